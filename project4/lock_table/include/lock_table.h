@@ -51,9 +51,13 @@ struct hash_record_t
 {
     size_t operator()(const record_key_t& k) const
     {
-        std::size_t h1 = std::hash<std::string>()(std::to_string(k.first));
-        std::size_t h2 = std::hash<std::string>()(std::to_string(k.second));
-        return h1 ^ (h2 << 1);
+        uint64_t h;
+
+        // Mix table id and key (splitmix64 finalizer)
+        h = (uint64_t)k.first * 0x9E3779B97F4A7C15ULL ^ (uint64_t)k.second;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
     }
 };
 
@@ -0,0 +1,94 @@
+#include "index.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+
+/// Commit throughput benchmark (each transaction updates its own record and commits)
+// usage: commit_bench [trx_per_thread] > /dev/null (transaction logs go to stdout, results to stderr)
+
+namespace
+{
+    const std::string BENCH_FILE_PATH = "DATA1";   // updates are logged only for DATA<n> tables
+    const std::string BENCH_LOG_PATH = "CommitBench.log";
+    const std::string BENCH_LOGMSG_PATH = "CommitBenchMsg.txt";
+    const int THREAD_COUNTS[] = {1, 2, 4, 8, 16, 32};
+
+    int64_t table_id;
+    int trx_per_thread = 200;
+
+    struct worker_arg_t
+    {
+        int64_t key;
+        int failures;
+    };
+
+    void* commit_worker(void* arg)
+    {
+        worker_arg_t* worker = (worker_arg_t*)arg;
+        char value[VALUE_MIN_SIZE+1];
+        uint16_t old_val_size;
+        int trx_id;
+
+        // Update the record of the thread and commit
+        for (int op = 0; op < trx_per_thread; op++) {
+            memset(value, 'a' + op % 26, VALUE_MIN_SIZE);
+            value[VALUE_MIN_SIZE] = '\0';
+            trx_id = trx_begin();
+            if (db_update(table_id, worker->key, value, VALUE_MIN_SIZE, &old_val_size, trx_id) || trx_commit(trx_id) != trx_id) {
+                worker->failures++;
+            }
+        }
+
+        return NULL;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    char value[VALUE_MIN_SIZE+1];
+    pthread_t threads[32];
+    worker_arg_t workers[32];
+
+    if (argc > 1) trx_per_thread = atoi(argv[1]);
+
+    // Build the table (a record per thread)
+    remove(BENCH_FILE_PATH.c_str());
+    remove(BENCH_LOG_PATH.c_str());
+    if (init_db(1000, 0, 0, const_cast<char*>(BENCH_LOG_PATH.c_str()), const_cast<char*>(BENCH_LOGMSG_PATH.c_str()))) {
+        fprintf(stderr, "[ERROR] init_db failed\n");
+        return 1;
+    }
+    table_id = open_table(const_cast<char*>(BENCH_FILE_PATH.c_str()));
+    memset(value, 'a', VALUE_MIN_SIZE);
+    value[VALUE_MIN_SIZE] = '\0';
+    for (int64_t key = 1; key <= 32; key++) {
+        db_insert(table_id, key, value, VALUE_MIN_SIZE);
+    }
+
+    // Measure the commit throughput for each number of threads
+    fprintf(stderr, "%8s %12s %18s\n", "threads", "elapsed(s)", "throughput(trx/s)");
+    for (int num_threads : THREAD_COUNTS) {
+        auto begin = std::chrono::steady_clock::now();
+        for (int idx = 0; idx < num_threads; idx++) {
+            workers[idx] = {idx + 1, 0};
+            pthread_create(&threads[idx], NULL, commit_worker, &workers[idx]);
+        }
+        for (int idx = 0; idx < num_threads; idx++) {
+            pthread_join(threads[idx], NULL);
+            if (workers[idx].failures) fprintf(stderr, "[ERROR] thread %d failed %d transactions\n", idx, workers[idx].failures);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        fprintf(stderr, "%8d %12.3f %18.0f\n", num_threads, elapsed, (double)num_threads * trx_per_thread / elapsed);
+    }
+
+    shutdown_db();
+    remove(BENCH_FILE_PATH.c_str());
+    remove(BENCH_LOG_PATH.c_str());
+    remove(BENCH_LOGMSG_PATH.c_str());
+
+    return 0;
+}
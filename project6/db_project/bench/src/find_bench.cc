@@ -0,0 +1,130 @@
+#include "index.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+/// Read-only db_find scaling and batch find benchmark
+// usage: find_bench [num_keys] [num_buf] [ops_per_thread]
+
+namespace
+{
+    const std::string BENCH_FILE_PATH = "FindBench.db";
+    const int THREAD_COUNTS[] = {1, 2, 4, 8, 16, 32};
+    const int BATCH_SIZES[] = {10, 100, 1000};
+
+    int64_t table_id;
+    int64_t num_keys = 100000;
+    int num_buf = 10000;
+    int ops_per_thread = 200000;
+
+    struct worker_arg_t
+    {
+        int seed;
+        int failures;
+    };
+
+    void* find_worker(void* arg)
+    {
+        worker_arg_t* worker = (worker_arg_t*)arg;
+        std::mt19937_64 gen(worker->seed);
+        std::uniform_int_distribution<int64_t> dis(1, num_keys);
+        char ret_val[VALUE_MAX_SIZE+1];
+        uint16_t val_size;
+
+        // Find random keys
+        for (int op = 0; op < ops_per_thread; op++) {
+            if (db_find(table_id, dis(gen), ret_val, &val_size)) worker->failures++;
+        }
+
+        return NULL;
+    }
+
+    // Find ops_per_thread random keys in batches, one by one or with db_find_batch
+    double measure_batch(int batch_size, bool batched)
+    {
+        std::mt19937_64 gen(batch_size);
+        std::uniform_int_distribution<int64_t> dis(1, num_keys);
+        std::vector<int64_t> keys(batch_size);
+        std::vector<std::string> buffers(batch_size, std::string(VALUE_MAX_SIZE+1, '\0'));
+        std::vector<char*> ret_vals(batch_size);
+        std::vector<uint16_t> val_sizes(batch_size);
+
+        for (int idx = 0; idx < batch_size; idx++) ret_vals[idx] = &buffers[idx][0];
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int op = 0; op < ops_per_thread; op += batch_size) {
+            for (int idx = 0; idx < batch_size; idx++) keys[idx] = dis(gen);
+            if (batched) {
+                db_find_batch(table_id, keys.data(), batch_size, ret_vals.data(), val_sizes.data());
+                continue;
+            }
+            for (int idx = 0; idx < batch_size; idx++) {
+                db_find(table_id, keys[idx], ret_vals[idx], &val_sizes[idx]);
+            }
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    char value[VALUE_MAX_SIZE+1];
+    pthread_t threads[32];
+    worker_arg_t workers[32];
+
+    if (argc > 1) num_keys = atoll(argv[1]);
+    if (argc > 2) num_buf = atoi(argv[2]);
+    if (argc > 3) ops_per_thread = atoi(argv[3]);
+
+    // Build the table
+    remove(BENCH_FILE_PATH.c_str());
+    if (init_db(num_buf, 0, 0, NULL, NULL)) {
+        printf("[ERROR] init_db failed\n");
+        return 1;
+    }
+    table_id = open_table(const_cast<char*>(BENCH_FILE_PATH.c_str()));
+    memset(value, 'a', VALUE_MIN_SIZE);
+    value[VALUE_MIN_SIZE] = '\0';
+    for (int64_t key = 1; key <= num_keys; key++) {
+        db_insert(table_id, key, value, VALUE_MIN_SIZE);
+    }
+
+    // Measure the throughput for each number of threads
+    printf("%8s %12s %16s %10s\n", "threads", "elapsed(s)", "throughput(op/s)", "speedup");
+    double base = 0;
+    for (int num_threads : THREAD_COUNTS) {
+        auto begin = std::chrono::steady_clock::now();
+        for (int idx = 0; idx < num_threads; idx++) {
+            workers[idx] = {idx + 1, 0};
+            pthread_create(&threads[idx], NULL, find_worker, &workers[idx]);
+        }
+        for (int idx = 0; idx < num_threads; idx++) {
+            pthread_join(threads[idx], NULL);
+            if (workers[idx].failures) printf("[ERROR] thread %d failed %d finds\n", idx, workers[idx].failures);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        double throughput = (double)num_threads * ops_per_thread / elapsed;
+        if (base == 0) base = throughput;
+        printf("%8d %12.3f %16.0f %9.2fx\n", num_threads, elapsed, throughput, throughput / base);
+    }
+
+    // Compare single finds with batch finds of the same keys
+    printf("\n%8s %14s %14s %10s\n", "batch", "db_find(s)", "batch(s)", "speedup");
+    for (int batch_size : BATCH_SIZES) {
+        double single = measure_batch(batch_size, false);
+        double batched = measure_batch(batch_size, true);
+        printf("%8d %14.3f %14.3f %9.2fx\n", batch_size, single, batched, single / batched);
+    }
+
+    shutdown_db();
+    remove(BENCH_FILE_PATH.c_str());
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "index.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/// Lock contention benchmark (transfer threads move money between random accounts while a scan thread checks the sum)
+// (the transfers lock the accounts they read for the update, and the scans read a snapshot without locks)
+// usage: lock_bench [num_accounts] [transfer_per_thread] > /dev/null (transaction logs go to stdout, results to stderr)
+
+namespace
+{
+    const std::string BENCH_FILE_PATH = "DATA1";   // updates are logged only for DATA<n> tables
+    const std::string BENCH_LOG_PATH = "LockBench.log";
+    const std::string BENCH_LOGMSG_PATH = "LockBenchMsg.txt";
+    const int THREAD_COUNTS[] = {1, 2, 4, 8, 16};
+    const int SCAN_THREAD_NUMBER = 1;
+    const int64_t INITIAL_MONEY = 100000;
+    const int64_t MAX_MONEY_TRANSFERRED = 100;
+
+    int64_t table_id;
+    int64_t num_accounts = 4096;
+    int transfer_per_thread = 2000;
+    std::atomic<bool> transfer_done;
+
+    struct worker_arg_t
+    {
+        unsigned int seed;
+        int commits;
+        int aborts;
+    };
+
+    // Read the money of the account to update it
+    int read_money(int64_t key, int64_t* money, int trx_id)
+    {
+        char value[VALUE_MAX_SIZE+1];
+        uint16_t val_size;
+
+        if (db_find_locking(table_id, key, value, &val_size, trx_id, LOCK_MODE_EXCLUSIVE)) return 1;
+        value[val_size] = '\0';
+        *money = atoll(value);
+        return 0;
+    }
+
+    // Write the money of the account
+    int write_money(int64_t key, int64_t money, int trx_id)
+    {
+        char value[VALUE_MIN_SIZE+1];
+        uint16_t old_val_size;
+
+        snprintf(value, sizeof(value), "%0*ld", (int)VALUE_MIN_SIZE, (long)money);
+        return db_update(table_id, key, value, VALUE_MIN_SIZE, &old_val_size, trx_id);
+    }
+
+    // Finish the transaction that failed (it is already rolled back if it was chosen as a deadlock victim)
+    void abort_failed(int trx_id)
+    {
+        if (TRX::trx_manager.is_active_trx(trx_id)) trx_abort(trx_id);
+    }
+
+    void* transfer_worker(void* arg)
+    {
+        worker_arg_t* worker = (worker_arg_t*)arg;
+        int64_t source, destination, money, transferred;
+        int trx_id;
+
+        for (int op = 0; op < transfer_per_thread; op++) {
+            // Decide the accounts (in ascending order to avoid deadlocks)
+            source = rand_r(&worker->seed) % num_accounts + 1;
+            destination = rand_r(&worker->seed) % num_accounts + 1;
+            if (source >= destination) continue;
+            transferred = rand_r(&worker->seed) % MAX_MONEY_TRANSFERRED;
+
+            // Withdraw and deposit in a transaction
+            trx_id = trx_begin();
+            if (read_money(source, &money, trx_id) || write_money(source, money - transferred, trx_id)
+                || read_money(destination, &money, trx_id) || write_money(destination, money + transferred, trx_id)) {
+                abort_failed(trx_id);
+                worker->aborts++;
+                continue;
+            }
+            if (trx_commit(trx_id) == trx_id) worker->commits++;
+            else worker->aborts++;
+        }
+
+        return NULL;
+    }
+
+    void* scan_worker(void* arg)
+    {
+        worker_arg_t* worker = (worker_arg_t*)arg;
+        int64_t sum_money;
+        int trx_id;
+
+        while (!transfer_done) {
+            // Summate all the accounts in the snapshot of a transaction
+            sum_money = 0;
+            trx_id = trx_begin();
+            if (db_scan(table_id, 1, num_accounts, [&](int64_t, const char* val, uint16_t size) {
+                sum_money += atoll(std::string(val, size).c_str());
+                return true;
+            }, trx_id)) {
+                abort_failed(trx_id);
+                worker->aborts++;
+                continue;
+            }
+            trx_commit(trx_id);
+
+            // Check consistency
+            if (sum_money != num_accounts * INITIAL_MONEY) {
+                fprintf(stderr, "[ERROR] inconsistent sum %ld (expected %ld)\n", (long)sum_money, (long)(num_accounts * INITIAL_MONEY));
+            }
+            worker->commits++;
+        }
+
+        return NULL;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    char value[VALUE_MIN_SIZE+1];
+    pthread_t threads[16], scan_threads[SCAN_THREAD_NUMBER];
+    worker_arg_t workers[16], scanners[SCAN_THREAD_NUMBER];
+    int commits, aborts;
+
+    if (argc > 1) num_accounts = atoll(argv[1]);
+    if (argc > 2) transfer_per_thread = atoi(argv[2]);
+
+    // Build the table (every account has the initial money)
+    remove(BENCH_FILE_PATH.c_str());
+    remove(BENCH_LOG_PATH.c_str());
+    if (init_db(1000, 0, 0, const_cast<char*>(BENCH_LOG_PATH.c_str()), const_cast<char*>(BENCH_LOGMSG_PATH.c_str()))) {
+        fprintf(stderr, "[ERROR] init_db failed\n");
+        return 1;
+    }
+    table_id = open_table(const_cast<char*>(BENCH_FILE_PATH.c_str()));
+    snprintf(value, sizeof(value), "%0*ld", (int)VALUE_MIN_SIZE, (long)INITIAL_MONEY);
+    for (int64_t key = 1; key <= num_accounts; key++) {
+        db_insert(table_id, key, value, VALUE_MIN_SIZE);
+    }
+
+    // Measure the transfer throughput for each number of threads while the scan threads run
+    fprintf(stderr, "%8s %12s %22s %8s %8s\n", "threads", "elapsed(s)", "throughput(commit/s)", "aborts", "scans");
+    for (int num_threads : THREAD_COUNTS) {
+        transfer_done = false;
+        for (int idx = 0; idx < SCAN_THREAD_NUMBER; idx++) {
+            scanners[idx] = {0, 0, 0};
+            pthread_create(&scan_threads[idx], NULL, scan_worker, &scanners[idx]);
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int idx = 0; idx < num_threads; idx++) {
+            workers[idx] = {(unsigned int)idx + 1, 0, 0};
+            pthread_create(&threads[idx], NULL, transfer_worker, &workers[idx]);
+        }
+        commits = aborts = 0;
+        for (int idx = 0; idx < num_threads; idx++) {
+            pthread_join(threads[idx], NULL);
+            commits += workers[idx].commits;
+            aborts += workers[idx].aborts;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        transfer_done = true;
+        for (int idx = 0; idx < SCAN_THREAD_NUMBER; idx++) pthread_join(scan_threads[idx], NULL);
+        fprintf(stderr, "%8d %12.3f %22.0f %8d %8d\n", num_threads, elapsed, commits / elapsed, aborts, scanners[0].commits);
+    }
+
+    // Lock objects are recycled, so the heap allocations stay far below the locks taken
+    LOCK_POOL::stats_t stats = LOCK_POOL::get_stats();
+    fprintf(stderr, "lock objects: %lu taken, %lu returned, %lu slab allocations\n",
+            (unsigned long)stats.num_allocs, (unsigned long)stats.num_frees, (unsigned long)stats.num_slabs);
+
+    shutdown_db();
+    remove(BENCH_FILE_PATH.c_str());
+    remove(BENCH_LOG_PATH.c_str());
+    remove(BENCH_LOGMSG_PATH.c_str());
+
+    return 0;
+}
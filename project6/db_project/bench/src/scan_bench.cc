@@ -0,0 +1,70 @@
+#include "index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+
+/// Full-table scan benchmark with and without read-ahead
+// usage: scan_bench [num_keys] [num_buf] [repeat]
+
+namespace
+{
+    const std::string BENCH_FILE_PATH = "ScanBench.db";
+    const int READ_AHEADS[] = {0, 4, 8, 16, 32};
+}
+
+int main(int argc, char** argv)
+{
+    int64_t table_id, num_keys = 1000000;
+    int num_buf = 1000, repeat = 3;
+    char value[VALUE_MAX_SIZE+1];
+    long num_records;
+
+    if (argc > 1) num_keys = atoll(argv[1]);
+    if (argc > 2) num_buf = atoi(argv[2]);
+    if (argc > 3) repeat = atoi(argv[3]);
+
+    // Build the table
+    remove(BENCH_FILE_PATH.c_str());
+    if (init_db(num_buf, 0, 0, NULL, NULL)) {
+        printf("[ERROR] init_db failed\n");
+        return 1;
+    }
+    table_id = open_table(const_cast<char*>(BENCH_FILE_PATH.c_str()));
+    memset(value, 'a', VALUE_MAX_SIZE);
+    value[VALUE_MAX_SIZE] = '\0';
+    for (int64_t key = 1; key <= num_keys; key++) {
+        db_insert(table_id, key, value, VALUE_MAX_SIZE);
+    }
+    shutdown_db();
+
+    // Scan the whole table from a cold buffer for each read-ahead depth
+    printf("%10s %12s %18s\n", "read-ahead", "elapsed(s)", "throughput(rec/s)");
+    for (int read_ahead : READ_AHEADS) {
+        double elapsed = 0;
+        for (int round = 0; round < repeat; round++) {
+            init_db(num_buf, 0, 0, NULL, NULL);
+            table_id = open_table(const_cast<char*>(BENCH_FILE_PATH.c_str()));
+
+            num_records = 0;
+            auto begin = std::chrono::steady_clock::now();
+            BPT::scan(table_id, BPT::get_root_page(table_id), 1, num_keys, [&](int64_t, const char*, uint16_t) {
+                num_records++;
+                return true;
+            }, read_ahead);
+            elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            if (num_records != num_keys) printf("[ERROR] scanned %ld of %ld records\n", num_records, (long)num_keys);
+            shutdown_db();
+        }
+
+        elapsed /= repeat;
+        printf("%10d %12.3f %18.0f\n", read_ahead, elapsed, num_keys / elapsed);
+    }
+
+    remove(BENCH_FILE_PATH.c_str());
+
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -18,20 +19,52 @@
 #include <iostream>
 #include <deque>
 #include <algorithm>
+#include <functional>
+#include <vector>
+#include <tuple>
+
+
+/// Constants
+constexpr int SCAN_READ_AHEAD = 8;      // number of leaves to read ahead in range scan
+constexpr double BULK_LOAD_FILL_FACTOR = 0.9;   // fill factor of bulk-loaded pages
+constexpr int BULK_LOAD_EXTENT = 64;            // number of contiguous pages allocated at once for bulk-loaded leaves
+
+
+/// Types
+// Range scan callback (called with the leaf latched shared, returns false to stop the scan)
+using scan_func_t = std::function<bool(int64_t key, const char* value, uint16_t size)>;
+
+// Batch find callback (called with the position of each found key in the batch)
+using find_batch_func_t = std::function<void(int index, const char* value, uint16_t size)>;
+
+// Bulk load input stream (sets the next record in ascending key order, returns false at the end)
+using bulk_load_func_t = std::function<bool(int64_t& key, std::string& value)>;
+
+// Image of a change in a leaf page to be logged (a record image is the slot followed by the value, padded to the larger one)
+// (redo only for a compaction of the values, which changes no record and is never undone)
+struct leaf_image_t
+{
+    uint16_t offset;
+    uint8_t kind;               // IMAGE::RAW or IMAGE::RECORD
+    std::string old_img;
+    std::string new_img;
+    bool redo_only;
+};
 
 
 /// B+Tree FUNCTION PROTOTYPES
 namespace BPT
 {   
     // Checker
-    bool is_invalid_node_page(NodePage& node);
+    bool is_valid_node_page(NodePage& node);
+    bool is_valid_node_page(const page_t& page);
     bool is_correct_internal_index(int index, NodePage& node, pagenum_t page_number);
 
     // Node page IO (buffer IO)
     NodePage load_node_page(int64_t table_id, pagenum_t page_number, int& pin_id, bool pin = false, bool pinned = false);
     void save_node_page(int64_t table_id, pagenum_t page_number, NodePage& node, int pin_id, bool unpin = true);
     void unpin_node_page(int pin_id);
-    pagenum_t make_node_page(int64_t table_id, bool is_leaf = true);
+    pagenum_t make_node_page(int64_t table_id, bool is_leaf = true, pagenum_t hint = 0);
     void free_node_page(int64_t table_id, pagenum_t page_number, int pin_id);
 
     // Getter and setter (buffer IO)
@@ -50,6 +83,52 @@ namespace BPT
     pagenum_t find_leaf(int64_t table_id, pagenum_t root, int64_t key);
     int find(int64_t table_id, pagenum_t root, int64_t key, std::string& value, pagenum_t key_page = 0);
 
+    // Range scan cursor (keeps the current leaf pinned shared and follows the right siblings)
+    class Cursor
+    {
+    private:
+        int64_t table_id;
+        pagenum_t root;
+        int64_t end_key;
+        int read_ahead, leaves_to_prefetch;
+        pagenum_t leaf;
+        int index;
+        int64_t saved_key;
+        bool released;
+        PageHandle page;
+
+        void seek(int64_t key);
+        void enter_leaf();
+        void skip_to_record();
+
+    public:
+        // Constructors
+        Cursor();
+        Cursor(int64_t table_id, pagenum_t root, int64_t begin_key, int64_t end_key, int read_ahead = SCAN_READ_AHEAD);
+
+        // Iteration
+        bool is_valid() const;
+        void next();
+
+        // Current record
+        int64_t key() const;
+        const char* value() const;
+        uint16_t size() const;
+        int trx_id() const;
+        int record_id() const;
+        pagenum_t page_number() const;
+
+        // Unpin the leaf keeping the position, and pin it again
+        void release();
+        void restore();
+    };
+
+    // Range scan
+    int scan(int64_t table_id, pagenum_t root, int64_t begin_key, int64_t end_key, const scan_func_t& callback, int read_ahead = SCAN_READ_AHEAD);
+
+    // Batch find
+    int find_batch(int64_t table_id, pagenum_t root, const int64_t* keys, int num_keys, const find_batch_func_t& callback);
+
     // Insertion
     template <typename T>
     int insert_node_key(std::deque<T>& dest, T& keypair);
@@ -78,7 +157,12 @@ namespace BPT
     void destroy_tree(int64_t table_id, pagenum_t root);
 
     // Update
-    int update(int64_t table_id, pagenum_t leaf, int64_t key, Record& record_old, std::string value_new, int trx_id, int pin_id);
+    int update_record(page_t* frame, int index, const char* value, uint16_t size, int trx_id, std::vector<leaf_image_t>& images);
+    int undo_image(page_t* frame, uint16_t offset, uint8_t kind, const std::string& old_img, std::vector<leaf_image_t>& images);
+    int update(int64_t table_id, pagenum_t leaf, int64_t key, Record& record_old, std::string value_new, int trx_id, int pin_id, std::vector<leaf_image_t>& images);
+
+    // Bulk load
+    int bulk_load(int64_t table_id, const bulk_load_func_t& next_record, double fill_factor = BULK_LOAD_FILL_FACTOR);
 }
 
 
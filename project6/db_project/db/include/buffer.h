@@ -5,18 +5,29 @@
 #include "page.h"
 #include "file.h"
 #include "debug_util.h"
+#include "replacement.h"
+#include "log.h"
 
 #include <pthread.h>
 #include <assert.h>
+#include <atomic>
+#include <memory>
+#include <deque>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <tuple>
 #include <algorithm>
 
 
-/// Type
-using link_pair = std::pair<int ,int>;
+/// Constants
+constexpr int BUFFER_SHARD_COUNT = 64;          // number of page table shards
+constexpr int DIRTY_HIGH_WATER_PERCENT = 50;    // dirty frames (% of buffer) to clean eagerly above
+constexpr int CLEANER_INTERVAL_MS = 10;         // interval of the page cleaner
+constexpr int CLEANER_TRICKLE_PERCENT = 10;     // cold frames (% of buffer) to clean every interval
+constexpr int PREFETCH_THREAD_COUNT = 2;        // number of read-ahead I/O threads
+constexpr int PREFETCH_QUEUE_SIZE = 64;         // max pending read-ahead requests
 
 
 /// Buffer manager
@@ -27,65 +38,150 @@ private:
     struct buffer_t
     {
         // Metadata
-        int frame_id;       // point to frame, linked lru, eviction priority
-        int64_t table_id;
+        int frame_id;       // point to frame
+        int64_t table_id;   // -1 if no page is assigned to the frame
         pagenum_t pg_num;
-        bool is_dirty;
+        std::atomic<bool> is_dirty;
+        std::atomic<int64_t> rec_lsn;   // lsn of the first record that may have dirtied the frame (-1 if clean)
+        std::atomic<int64_t> page_lsn;  // lsn of the last record applied to the frame (the log must be durable up to it before writing)
+
+        // Pin count (a frame is evictable only if it is zero)
+        std::atomic<int> pin_count;
 
-        // Page latch
-        pthread_mutex_t page_latch;
+        // Page latch (shared for read-only access)
+        pthread_rwlock_t page_latch;
 
         // Constructors
         buffer_t();
-        buffer_t(int index, int64_t table_id, pagenum_t pg_num, bool pin = false, bool dirty = false);
     };
 
-    // Fields
-    int num_buf, num_used;
-    int oldest[3], latest[3];
+    // Page table shard (maps pages to buffer indexes)
+    struct shard_t
+    {
+        pthread_mutex_t shard_latch;
+        std::unordered_map<page_key_t, int, hash_page_key_t> index_map;
+    };
 
-    // Buffer indexes, Control blocks, Frames, LRU linked list
-    std::map<std::pair<int64_t, pagenum_t>, int> index_map;      // map
+    // Fields
+    int num_buf;
+    std::atomic<int> num_used;
+
+    // Replacement policy (orders frames for eviction)
+    std::unique_ptr<ReplacementPolicy> policy;
+
+    // Page cleaner (writes dirty frames at the cold end in background)
+    std::atomic<int> num_dirty;
+    int dirty_high_water;
+    bool cleaner_running;
+    pthread_t cleaner_thread;
+    pthread_mutex_t cleaner_latch;
+    pthread_cond_t cleaner_cond;
+
+    // Read-ahead (I/O threads load chains of leaves into free or clean frames)
+    struct prefetch_t
+    {
+        int64_t table_id;
+        pagenum_t pg_num;
+        int depth;
+    };
+    bool prefetch_running;
+    std::deque<prefetch_t> prefetch_queue;
+    std::vector<pthread_t> prefetch_threads;
+    pthread_mutex_t prefetch_latch;
+    pthread_cond_t prefetch_cond;
+
+    // Page table shards, Control blocks, Frames
+    std::vector<shard_t> shards;                                 // fixed
     std::vector<buffer_t> pool;                                  // fixed and aligned
     std::vector<page_t> frames;                                  // fixed and aligned
-    std::vector<link_pair> lru, eviction_priority;               // fixed and aligned
-
-    // Buffer manager latch
-    pthread_mutex_t buffer_latch;
-    pthread_mutex_t list_latch;
 
     // Latch Manager
-    int page_latch_acquire(int index);
+    int page_latch_acquire(int index, bool shared = false);
     int page_latch_release(int index);
 
     // Disk accessor
     void flush_page(int index);
-    void load_page(int index, int table_id, int pg_num);
+    void mark_dirty(int index, int64_t rec_lsn = -1);
+    void load_page(int index, int64_t table_id, pagenum_t pg_num);
+
+    // Page table accessors
+    shard_t& get_shard(int64_t table_id, pagenum_t pg_num);
+    int lookup_index(int64_t table_id, pagenum_t pg_num);
+    void unmap_index(int index);
 
     // Buffer index allocators
-    void update_list(std::vector<link_pair>& list, int index, int pin = 2);
-    void update_index(int index, bool pin = false);
-    int get_new_index(bool pin = false);
-    int get_victim_index();
+    int get_new_index();
+    bool claim_index(int index, bool clean_only = false);
+    int get_victim_index(bool clean_only = false);
+    void release_index(int index);
 
     // Buffer page index mappers
-    int assign_index(int64_t table_id, pagenum_t pg_num, bool load = true);
+    bool map_index(int index, int64_t table_id, pagenum_t pg_num);
+    int assign_index(int64_t table_id, pagenum_t pg_num, bool load = true, bool shared = false);
+
+    // Page cleaner
+    static void* cleaner_main(void* arg);
+    void start_cleaner();
+    void stop_cleaner();
+    void wake_cleaner();
+    void clean_frames(int count);
+
+    // Read-ahead
+    static void* prefetch_main(void* arg);
+    void start_prefetchers();
+    void stop_prefetchers();
+    pagenum_t prefetch_index(int64_t table_id, pagenum_t pg_num);
 
 public:
     // Constructor
     BufferManager();
 
     // Initializers
-    int init(int num_buf);
+    int init(int num_buf, int policy = REPLACEMENT::CLOCK, int dirty_high_water_percent = DIRTY_HIGH_WATER_PERCENT);
     void clear();
     void flush_all_pages();
 
     // Member functions (Page access manager)
-    page_t get_page(int64_t table_id, pagenum_t pg_num, int& index);
+    page_t get_page(int64_t table_id, pagenum_t pg_num, int& index, bool shared = false);
     page_t get_page_by_idx(int index);
+    page_t* get_frame(int index);
+    void set_dirty(int index, int64_t rec_lsn = -1);
+    void set_page_lsn(int index, int64_t page_lsn);
     void set_dirty_page(int index, const page_t& pg_img, bool unpin = true);
-    int pin_page(int64_t table_id, pagenum_t pg_num);
+    int pin_page(int64_t table_id, pagenum_t pg_num, bool load = false, bool shared = false);
     void unpin_page(int index);
+    int get_num_dirty() const;
+    void get_dirty_pages(std::vector<dpt_entry_t>& dirty_pages);
+    void flush_dirty_pages(int64_t rec_lsn_bound);
+    void prefetch(int64_t table_id, pagenum_t pg_num, int depth);
+};
+
+/// Pinned page handle (RAII guard over a buffer frame)
+class PageHandle
+{
+private:
+    // Fields
+    int pin_id;
+    page_t* frame;
+
+public:
+    // Constructors and destructor
+    PageHandle();
+    PageHandle(int64_t table_id, pagenum_t pg_num, bool load = true, bool shared = false);
+    PageHandle(PageHandle&& other);
+    PageHandle(const PageHandle& copy) = delete;
+    ~PageHandle();
+
+    // Operators
+    PageHandle& operator=(PageHandle&& other);
+    PageHandle& operator=(const PageHandle& copy) = delete;
+
+    // Member functions
+    const page_t* read() const;
+    page_t* write();
+    int get_pin_id() const;
+    bool is_pinned() const;
+    void release();
 };
 
 /// Buffer Manager APIs
@@ -95,17 +191,30 @@ namespace BUF
     extern BufferManager buffer;
 
     /// Buffer initializers
-    int init_buffer(int num_buf);
+    int init_buffer(int num_buf, int policy = REPLACEMENT::CLOCK, int dirty_high_water_percent = DIRTY_HIGH_WATER_PERCENT);
     int clear_buffer();
     
     /// Page controllers
     page_t read_page(int64_t table_id, pagenum_t pg_num, int& pin_id, bool pin = false, bool pinned = false);
     void write_page(int pin_id, const page_t& pg_img, bool unpin = true);
-    int pin_page(int64_t table_id, pagenum_t pg_num);
+    int pin_page(int64_t table_id, pagenum_t pg_num, bool load = false);
     void unpin_page(int pin_id);
 
+    /// In-place page accessors (no page image copy)
+    PageHandle fix_page(int64_t table_id, pagenum_t pg_num, bool load = true, bool shared = false);
+    page_t* get_frame(int pin_id);
+    void mark_dirty(int pin_id, int64_t rec_lsn = -1);
+    void stamp_page(int pin_id, int64_t page_lsn);
+
+    /// Checkpoint helpers (dirty page table, and writing the pages dirty since before the bound)
+    void get_dirty_pages(std::vector<dpt_entry_t>& dirty_pages);
+    void flush_dirty_pages(int64_t rec_lsn_bound);
+    /// Read-ahead (loads the page and the next leaves along the right siblings in background)
+    void prefetch(int64_t table_id, pagenum_t pg_num, int depth);
+
     /// Table controllers (processing with header page in buffer)
-    pagenum_t alloc_page(int64_t table_id);
+    pagenum_t alloc_page(int64_t table_id, pagenum_t hint = 0);
+    pagenum_t alloc_pages(int64_t table_id, int count);
     void free_page(int64_t table_id, pagenum_t pg_num, int pin_id);
     bool is_valid_page(int64_t table_id, pagenum_t pg_num);
 }
@@ -1,5 +1,5 @@
-#ifndef DB_LOG_H__
-#define DB_LOG_H__
+#ifndef DB_DEBUG_UTIL_H__
+#define DB_DEBUG_UTIL_H__
 
 
 /// Includes
@@ -43,4 +43,4 @@ namespace DebugUtil
 }
 
 
-#endif // DB_LOG_H
+#endif // DB_DEBUG_UTIL_H__
@@ -14,10 +14,10 @@ extern TableManager opened_tables;
 // Open existing database file or create one if it doesn't exist
 int64_t file_open_table_file(const char* pathname);
 
-// Allocate an on-disk page from the free page list
+// Allocate an on-disk page (lowest free page in the allocation pages)
 pagenum_t file_alloc_page(int64_t table_id);
 
-// Free an on-disk page to the free page list
+// Free an on-disk page (clear its bit in the allocation page)
 void file_free_page(int64_t table_id, pagenum_t pagenum);
 
 // Read an on-disk page into the in-memory page structure(dest)
@@ -7,9 +7,11 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <string>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 
 /// Table manager for opened tables
@@ -23,6 +25,7 @@ public:
     int64_t push(int fd, const std::string pathname);
     int pop();
     int getFileDesc(int64_t table_id);
+    bool isDataTable(int64_t table_id);
     int numOfTables();
 };
 
@@ -36,11 +39,11 @@ namespace FileUtil
     // Write a block to disk file
     void write_block(int fd, const void* buffer, size_t block_size, off_t offset = 0);
 
-    // Initialize the database file (default size: 10MiB - A header page and 2559 free pages)
+    // Initialize the database file (default size: 10MiB - A header page, an allocation page and 2558 free pages)
     void init_table_file(int fd, pagenum_t num_of_pages = INITIAL_DB_FILE_SIZE / PAGE_SIZE);
 
-    // Double the space of the database file
-    void extend_table_file(int fd);
+    // Extend the database file to the given number of pages (header page is updated by the caller)
+    void extend_table_file(int fd, pagenum_t old_num_of_pages, pagenum_t new_num_of_pages);
 
     // Return that file size is invalid value
     bool is_valid_table_file(int fd);
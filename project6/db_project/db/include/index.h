@@ -7,6 +7,7 @@
 #include "buffer.h"
 #include "bpt.h"
 #include "trx.h"
+#include "log.h"
 
 
 /// Index Manager APIs
@@ -22,17 +23,43 @@ int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size);
 // Find the matching record and delete it if found
 int db_delete(int64_t table_id, int64_t key);
 
+// Call back the records having keys in [begin_key, end_key] in key order (callback returns false to stop)
+int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key, const scan_func_t& callback);
+
+// Find the records of many keys at once (val_sizes[i] is 0 if keys[i] is not found)
+int db_find_batch(int64_t table_id, const int64_t* keys, int num_keys, char** ret_vals, uint16_t* val_sizes);
+
+// Open a cursor on the first record having key in [begin_key, end_key] (invalid if there is none)
+BPT::Cursor db_open_cursor(int64_t table_id, int64_t begin_key, int64_t end_key);
+
+// Build the table from records in ascending key order (the table must be empty)
+int db_bulk_load(int64_t table_id, const bulk_load_func_t& next_record, double fill_factor = BULK_LOAD_FILL_FACTOR);
+
 // Initialize database management system
-int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path);
+// (buffer_policy is one of REPLACEMENT::*, the page cleaner keeps dirty frames under dirty_high_water_percent of the buffer)
+// (the tables 'DATA<table_id>' are recovered from the log, flag is one of LOG::PHASE_* to stop the pass after log_num records)
+// (checkpoints are taken often enough to keep the redo of a later recovery around max_recovery_time_ms)
+int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path,
+            int buffer_policy = REPLACEMENT::CLOCK, int dirty_high_water_percent = DIRTY_HIGH_WATER_PERCENT,
+            int max_recovery_time_ms = MAX_RECOVERY_TIME_MS);
 
 // Shutdown database management system
 int shutdown_db();
 
 
 /// Index Manager APIs with Transaction Control
-// Read a value in the table with a matching key for the transaction having trx_id
+// Read a value in the table with a matching key as of the read view of the transaction having trx_id (no lock is taken)
 int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size, int trx_id);
 
+// Read the latest value with a matching key taking a record lock of lock_mode (LOCK_MODE_EXCLUSIVE to update it next)
+int db_find_locking(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size, int trx_id, int lock_mode = LOCK_MODE_SHARED);
+
+// Scan the records in [begin_key, end_key] as of the read view of the transaction (no lock is taken)
+int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key, const scan_func_t& callback, int trx_id);
+
+// Scan the latest records in [begin_key, end_key] taking a record lock of lock_mode on each record for the transaction
+int db_scan_locking(int64_t table_id, int64_t begin_key, int64_t end_key, const scan_func_t& callback, int trx_id, int lock_mode = LOCK_MODE_SHARED);
+
 // Find the matching key and modify the values
 int db_update(int64_t table_id, int64_t key, char* values, uint16_t val_size, uint16_t* old_val_size, int trx_id);
 
@@ -9,9 +9,51 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sched.h>
+#include <atomic>
 #include <vector>
+#include <map>
+#include <queue>
+#include <string>
+
+/// Constants
+constexpr size_t LOG_BUFFER_SIZE = 1024 * 1024;     // 1 MiB ring of serialized log records
+constexpr int LOG_FLUSH_INTERVAL_MS = 100;          // period of the log flusher when nobody is waiting (commits and page writes request what they need)
+constexpr int RECOVERY_MAX_REDO_THREADS = 16;       // upper bound of the redo workers (one per core)
+constexpr int64_t LOG_FILE_HEADER_SIZE = 4096;      // master record before the first log record (lsn = file offset)
+constexpr int CHECKPOINT_INTERVAL_MS = 100;         // period of the checkpointer to check the log growth
+constexpr int MAX_RECOVERY_TIME_MS = 1000;          // default bound of the redo time after a crash
+constexpr int64_t REDO_BYTES_PER_MS = 16 * 1024;    // estimated redo speed until a recovery measures it
 
 /// Types
+using log_page_key_t = std::pair<int64_t, pagenum_t>;
+
+// Master record at the head of the log file
+struct log_file_header_t
+{
+    int64_t checkpoint_lsn;     // lsn of the last complete checkpoint (-1 if none)
+    int64_t start_lsn;          // the log before is not needed by the recovery anymore
+    int next_trx_id;            // transaction ids below are used (kept at each checkpoint, since the log with them may be truncated)
+};
+
+// Entry of the active transaction table in a checkpoint
+struct att_entry_t
+{
+    int trx_id;
+    int64_t first_lsn, last_lsn;
+};
+
+// Entry of the dirty page table in a checkpoint
+struct dpt_entry_t
+{
+    int64_t table_id;
+    pagenum_t page_num;
+    int64_t rec_lsn;            // lsn of the first record that may have dirtied the page
+};
+
+
 struct LogRecord
 {
     // Fields for BEGIN, COMMIT, ROLLBACK
@@ -24,34 +66,86 @@ struct LogRecord
     int64_t table_id;
     pagenum_t page_num;
     uint16_t offset, length;
+    uint8_t image_kind;         // IMAGE::RAW or IMAGE::RECORD
     std::string old_img, new_img;
 
     // + Fields for COMPENSATE
     int64_t next_undo_lsn;
 
+    // Fields for END_CHECKPOINT
+    std::vector<att_entry_t> active_trxs;
+    std::vector<dpt_entry_t> dirty_pages;
+
     // Constructor
     LogRecord();
     LogRecord(int trx_id);
-
-    // Member functions
-    char* to_bytes();
+    LogRecord(const char* bytes);
 };
 
 /// Log Manager
+// Records are serialized into a ring buffer (byte of lsn at lsn % LOG_BUFFER_SIZE),
+// and a flusher thread writes and syncs everything appended so far in a single I/O (group commit).
+// Appenders reserve their space with an atomic add and serialize without the latch,
+// then publish in lsn order so that the flusher only sees completely written records.
+// Recovery follows ARIES: analysis finds the losers, redo repeats the history on pages whose page_lsn is behind
+// (partitioned by page across worker threads), and undo rolls the losers back writing compensation records.
+// Fuzzy checkpoints record the active transactions and dirty pages without stopping the workers,
+// and the log before the oldest lsn needed by a recovery is punched out of the file.
 class LogManager
 {
 private:
     // Fields
     FILE *log_message_file;
     int log_fd;
-    int64_t lsn_to_flush, lsn_to_assgin;
-    std::deque<LogRecord> log_buffer;
+    char* log_buffer;
+    std::atomic<int64_t> lsn_to_assgin;     // end of the reserved space
+    std::atomic<int64_t> lsn_to_write;      // end of the published records
+    std::atomic<int64_t> lsn_to_flush;      // end of the durable records
+    std::atomic<int64_t> lsn_requested;     // end of the records that someone waits for
+    std::atomic<bool> is_running;
     pthread_mutex_t log_buffer_latch;
+    pthread_cond_t flush_cond, flushed_cond;
+    pthread_t flusher;
+    int last_trx_id;                        // largest transaction id found by the recovery (in the master record or the log)
+
+    // Checkpointer (bounds the log to redo by max_recovery_time_ms)
+    log_file_header_t master;
+    int64_t redo_lsn;                       // redo of a recovery would start here
+    int64_t truncated_lsn;                  // the log before is punched out of the file
+    int64_t redo_bytes_per_ms;
+    int max_recovery_time_ms;
+    bool is_recovered;                      // false while the losers of a stopped recovery remain in the log
+    bool checkpointer_running;
+    pthread_t checkpointer;
+    pthread_mutex_t checkpoint_latch;
+    pthread_cond_t checkpointer_cond;
 
     // Member functions (private)
     int64_t assign_lsn(size_t size);
     size_t get_log_size(int type, size_t img_length = 0);
-    int64_t get_prev_lsn(int trx_id);
+    size_t get_checkpoint_size(size_t num_trxs, size_t num_pages);
+    int64_t write_bytes(int64_t lsn, const void* bytes, size_t size);
+    int64_t write_header(int64_t lsn, size_t size, int64_t prev_lsn, int trx_id, int type);
+    void publish(int64_t lsn, int64_t end);
+    void wait_flushed(int64_t lsn);
+
+    // Log flusher
+    static void* flusher_main(void* arg);
+    void flush_batch();
+
+    // Checkpointer
+    static void* checkpointer_main(void* arg);
+    int64_t log_checkpoint(const std::vector<att_entry_t>& active_trxs, const std::vector<dpt_entry_t>& dirty_pages);
+    void write_master();
+    void truncate(int64_t lsn);
+
+    // Recovery
+    int64_t read_log(std::vector<LogRecord>& records);
+    void analysis(const std::vector<LogRecord>& records, std::map<int, int64_t>& losers, std::map<log_page_key_t, int64_t>& dirty_pages);
+    bool redo(const std::vector<LogRecord>& records, const std::map<log_page_key_t, int64_t>& dirty_pages, int log_num);
+    bool undo(const std::vector<LogRecord>& records, std::map<int, int64_t>& losers, int log_num);
+    bool redo_record(const LogRecord& record);
+    static void* redo_worker_main(void* arg);
 
 public:
     // Constructor
@@ -59,8 +153,15 @@ public:
 
     // Member functions
     void init(const char* log_path, const char* logmsg_path);
-    int recovery(int flag = 0);
-    int64_t log(int type, int trx_id, int64_t table_id = 0, pagenum_t page_num = 0, uint16_t offset = 0, uint16_t length = 0, std::string old_img = "", std::string new_img = "", int64_t next_undo_lsn = 0);
+    void shutdown();
+    int recovery(int flag = 0, int log_num = 0);
+    int get_last_trx_id();
+    void start_checkpointer(int max_recovery_time_ms);
+    void stop_checkpointer();
+    int64_t checkpoint();
+    int64_t get_next_lsn();
+    int64_t log(int type, int trx_id, int64_t prev_lsn, int64_t table_id = 0, pagenum_t page_num = 0, uint16_t offset = 0, uint16_t length = 0, const char* old_img = NULL, const char* new_img = NULL, int64_t next_undo_lsn = 0, uint8_t image_kind = IMAGE::RAW);
+    int64_t flush(int64_t lsn);
     int64_t force();
 };
 
@@ -73,6 +174,8 @@ namespace LOG
     constexpr int COMMIT = 2;
     constexpr int ROLLBACK = 3;
     constexpr int COMPENSATE = 4;
+    constexpr int BEGIN_CHECKPOINT = 5;
+    constexpr int END_CHECKPOINT = 6;
 
     // Phases
     constexpr int PHASE_ANALYSIS = 0;
@@ -84,8 +187,19 @@ namespace LOG
 
     // API Forwarding
     void init(const char* log_path, const char* logmsg_path);
-    int recovery(int flag = PHASE_ANALYSIS);
-    int log(int type, int trx_id, int64_t table_id = 0, pagenum_t page_num = 0, uint16_t offset = 0, uint16_t length = 0, std::string old_img = "", std::string new_img = "", int64_t next_undo_lsn = 0);
+    void shutdown();
+    // Recover the tables from the log (PHASE_REDO or PHASE_UNDO stops the pass after log_num records, as a crash)
+    int recovery(int flag = PHASE_ANALYSIS, int log_num = 0);
+    int get_last_trx_id();
+
+    // Take fuzzy checkpoints in background, so that the redo after a crash takes about max_recovery_time_ms at most
+    void start_checkpointer(int max_recovery_time_ms = MAX_RECOVERY_TIME_MS);
+    void stop_checkpointer();
+    int64_t checkpoint();
+
+    int64_t get_next_lsn();
+    int64_t log(int type, int trx_id, int64_t prev_lsn, int64_t table_id = 0, pagenum_t page_num = 0, uint16_t offset = 0, uint16_t length = 0, const char* old_img = NULL, const char* new_img = NULL, int64_t next_undo_lsn = 0, uint8_t image_kind = IMAGE::RAW);
+    int64_t flush(int64_t lsn);
     int64_t force();
 }
 
@@ -17,13 +17,14 @@ constexpr size_t INITIAL_DB_FILE_SIZE = 10 * 1024 * 1024;                 // 10
 constexpr size_t PAGE_SIZE = 4 * 1024;                                    // 4096 B
 constexpr size_t HEADER_SIZE = 128;                                       // 128 B
 constexpr size_t BODY_SIZE = PAGE_SIZE - HEADER_SIZE;                     // 3968 B
-constexpr size_t SLOT_SIZE = 16;                                          // 12 B
+constexpr size_t SLOT_SIZE = 16;                                          // 16 B
 constexpr size_t EDGE_SIZE = 16;                                          // 16 B
 constexpr size_t VALUE_MAX_SIZE = 108;                                    // 112 B
 constexpr size_t VALUE_MIN_SIZE = 46;                                     // 50 B
 constexpr size_t RECORD_THRESHOLD = 2500;                                 // 2500 B
 constexpr int EDGE_MAX_COUNT = BODY_SIZE/EDGE_SIZE;                       // 248
 constexpr int RECORD_MAX_COUNT = BODY_SIZE/(SLOT_SIZE+VALUE_MIN_SIZE);    // 64
+constexpr int PAGES_PER_GROUP = PAGE_SIZE * 8;                            // 32768 pages (128 MiB) per allocation page
 
 /// Flags
 namespace FLAG
@@ -34,6 +35,13 @@ namespace FLAG
   constexpr int ABORTED = 2;      // Aborted (Failure to acquire lock)
 }
 
+/// Kinds of the images in the log records
+namespace IMAGE
+{
+  constexpr uint8_t RAW = 0;      // Bytes written at the offset as they are
+  constexpr uint8_t RECORD = 1;   // Slot of a record followed by its value (padded to the larger one)
+}
+
 
 /// Type definition
 using pagenum_t = uint64_t;
@@ -61,7 +69,7 @@ struct page_t
 struct HeaderPage
 {
   // field
-  pagenum_t next_free_page_number;      // common for header and free page
+  pagenum_t next_free_page_number;      // lowest page number that may be free (allocation hint)
   pagenum_t num_of_pages;               // reserved in free page
   pagenum_t root_page_number;           // reserved in free page
   char reserved[PAGE_SIZE - 24];        // reserved
@@ -171,6 +179,112 @@ struct NodePage
 };
 
 
+// Non-owning view over the raw bytes of a node page (header and key array)
+// Only used in B Plus Tree
+struct NodeView
+{
+  // fields
+  const page_t* src;           // page bytes to read
+  page_t* dest;                // page bytes to write (NULL for read-only view)
+
+  // constructors
+  NodeView(const page_t* page);
+  NodeView(page_t* page);
+
+  // member functions (header)
+  pagenum_t parent_page_number() const;
+  bool is_leaf() const;
+  uint32_t number_of_keys() const;
+  int64_t page_lsn() const;
+  uint64_t amount_of_free_space() const;
+  pagenum_t right_sibling_page_number() const;
+  pagenum_t first_child_page_number() const;
+  void set_parent_page_number(pagenum_t parent_page_number);
+  void set_right_sibling_page_number(pagenum_t right_sibling_page_number);
+  void set_first_child_page_number(pagenum_t first_child_page_number);
+  void set_number_of_keys(uint32_t number_of_keys);
+  void set_page_lsn(int64_t page_lsn);
+  void set_amount_of_free_space(uint64_t amount_of_free_space);
+
+  // member functions (body, slot and edge begin with the key)
+  int64_t key(int index) const;
+  int find_index(int64_t key) const;
+};
+
+// Non-owning view over the slotted body of a leaf page
+// (values lie anywhere between the slots and the end of the page, the free space counts the holes between them too)
+struct LeafView : public NodeView
+{
+  // constructors
+  LeafView(const page_t* page);
+  LeafView(page_t* page);
+
+  // member functions
+  uint16_t size(int index) const;
+  uint16_t offset(int index) const;
+  int trx_id(int index) const;
+  const char* value(int index) const;
+  int find_record(int64_t key) const;
+  void set_value(int index, const char* value, uint16_t size);
+  void set_trx_id(int index, int trx_id);
+  bool append(int64_t key, const char* value, uint16_t size);
+
+  // member functions (free space management)
+  uint16_t heap_top() const;
+  uint64_t contiguous_free_space() const;
+  bool needs_compaction(int index, uint16_t size) const;
+  uint16_t compact(int last = -1);
+  bool insert(int index, int64_t key, const char* value, uint16_t size);
+  void remove(int index);
+  bool resize(int index, const char* value, uint16_t size);
+
+  // member functions (log images)
+  void apply_image(uint16_t offset, const char* image, uint16_t length, uint8_t kind);
+
+  // member functions (slot)
+  void set_slot(int index, int64_t key, uint16_t size, uint16_t offset, int trx_id);
+  void set_size(int index, uint16_t size);
+  void set_offset(int index, uint16_t offset);
+};
+
+// Non-owning view over the edge array of an internal page
+struct InternalView : public NodeView
+{
+  // constructors
+  InternalView(const page_t* page);
+  InternalView(page_t* page);
+
+  // member functions
+  pagenum_t child(int index) const;
+  pagenum_t find_child(int64_t key) const;
+  void set_key(int index, int64_t key);
+  bool append(int64_t key, pagenum_t page_number);
+};
+
+// Non-owning view over the bitmap of an allocation page (a bit per page of its group, set if allocated)
+// Group g covers pages [g * PAGES_PER_GROUP, (g+1) * PAGES_PER_GROUP) and its allocation page is the second one
+struct AllocationView
+{
+  // fields
+  const page_t* src;           // page bytes to read
+  page_t* dest;                // page bytes to write (NULL for read-only view)
+
+  // constructors
+  AllocationView(const page_t* page);
+  AllocationView(page_t* page);
+
+  // member functions
+  bool is_allocated(int index) const;
+  int find_free(int begin, int end, int count = 1) const;
+  void set_allocated(int index, int count, bool allocated);
+  void init(pagenum_t group);
+
+  // page number mapping
+  static pagenum_t group_of(pagenum_t page_number);
+  static pagenum_t allocation_page_number(pagenum_t group);
+};
+
+
 /// Operators
 bool operator==(const KeyPair& keyPair, const int64_t key);
 bool operator==(const int64_t key, const KeyPair& keyPair);
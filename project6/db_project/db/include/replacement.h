@@ -0,0 +1,140 @@
+#ifndef DB_REPLACEMENT_H_
+#define DB_REPLACEMENT_H_
+
+/// Includes
+#include "page.h"
+
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+
+/// Replacement policies
+namespace REPLACEMENT
+{
+  constexpr int CLOCK = 0;        // reference bit per frame, no reordering on hits (default)
+  constexpr int LRU = 1;          // exact LRU list
+  constexpr int TWO_Q = 2;        // 2Q (scan resistant)
+}
+
+
+/// Type
+using page_key_t = std::pair<int64_t, pagenum_t>;
+
+// Hash of (table id, page number)
+struct hash_page_key_t
+{
+    size_t operator()(const page_key_t& key) const;
+};
+
+// Claims the frame as the victim if it is not pinned (returns true if claimed)
+using claim_func_t = std::function<bool(int)>;
+
+
+/// Replacement policy interface
+// The buffer manager reports which page each frame holds, the policy only orders frames.
+class ReplacementPolicy
+{
+public:
+    virtual ~ReplacementPolicy() {}
+
+    // Initializer
+    virtual void init(int num_buf) = 0;
+
+    // Page events
+    virtual void access(int index) = 0;                                           // hit
+    virtual void admit(int index, int64_t table_id, pagenum_t pg_num) = 0;        // page is assigned to frame
+    virtual void evict(int index, int64_t table_id, pagenum_t pg_num) = 0;        // page is removed from frame
+    virtual void release(int index) = 0;                                          // frame is left without page
+
+    // Victim selector (-1 if every frame is pinned)
+    virtual int victim(const claim_func_t& claim) = 0;
+
+    // Frames to be the next victims, in eviction order (at most count, best effort)
+    virtual void cold_frames(std::vector<int>& frames, int count) = 0;
+};
+
+// CLOCK: hits only set the reference bit (no latch)
+class ClockPolicy : public ReplacementPolicy
+{
+private:
+    int num_buf;
+    std::atomic<uint64_t> clock_hand;
+    std::vector<std::atomic<bool>> referenced;
+
+public:
+    ClockPolicy();
+
+    void init(int num_buf) override;
+    void access(int index) override;
+    void admit(int index, int64_t table_id, pagenum_t pg_num) override;
+    void evict(int index, int64_t table_id, pagenum_t pg_num) override;
+    void release(int index) override;
+    int victim(const claim_func_t& claim) override;
+    void cold_frames(std::vector<int>& frames, int count) override;
+};
+
+// LRU: frames are ordered from the least recently used (front) under the policy latch
+class LRUPolicy : public ReplacementPolicy
+{
+private:
+    std::list<int> lru;
+    std::vector<std::list<int>::iterator> position;
+    std::vector<bool> linked;
+    pthread_mutex_t policy_latch;
+
+    void unlink(int index);
+
+public:
+    LRUPolicy();
+    ~LRUPolicy();
+
+    void init(int num_buf) override;
+    void access(int index) override;
+    void admit(int index, int64_t table_id, pagenum_t pg_num) override;
+    void evict(int index, int64_t table_id, pagenum_t pg_num) override;
+    void release(int index) override;
+    int victim(const claim_func_t& claim) override;
+    void cold_frames(std::vector<int>& frames, int count) override;
+};
+
+// 2Q: new pages enter FIFO a1in, pages re-referenced after leaving a1in enter LRU am.
+// A scan only cycles through a1in, so the hot set in am survives it.
+class TwoQPolicy : public ReplacementPolicy
+{
+private:
+    // Queue of each frame
+    enum queue_t { NONE, A1IN, AM };
+
+    int kin, kout;                                  // max size of a1in, a1out
+    std::list<int> a1in, am;                        // frames (front is the next victim)
+    std::list<page_key_t> a1out;                    // ghost pages evicted from a1in
+    std::unordered_map<page_key_t, std::list<page_key_t>::iterator, hash_page_key_t> a1out_map;
+    std::vector<std::list<int>::iterator> position;
+    std::vector<queue_t> queue;
+    pthread_mutex_t policy_latch;
+
+    void unlink(int index);
+    void remember(int64_t table_id, pagenum_t pg_num);
+    int victim_from(std::list<int>& list, const claim_func_t& claim);
+
+public:
+    TwoQPolicy();
+    ~TwoQPolicy();
+
+    void init(int num_buf) override;
+    void access(int index) override;
+    void admit(int index, int64_t table_id, pagenum_t pg_num) override;
+    void evict(int index, int64_t table_id, pagenum_t pg_num) override;
+    void release(int index) override;
+    int victim(const claim_func_t& claim) override;
+    void cold_frames(std::vector<int>& frames, int count) override;
+};
+
+// Create the replacement policy (NULL if the policy is unknown)
+ReplacementPolicy* make_replacement_policy(int policy);
+
+#endif  // DB_REPLACEMENT_H_
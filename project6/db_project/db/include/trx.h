@@ -3,10 +3,12 @@
 
 /// Includes
 #include "trx_type.h"
+#include "log.h"
 
 #include <stdint.h>
 #include <pthread.h>
 #include <iostream>
+#include <functional>
 
 
 /// Transaction Manager
@@ -14,43 +16,88 @@ class TransactionManager
 {
 public:
     // Fields
-    // Transaction table
+    // Transaction table (transactions begin and finish without a latch, the latch serializes the read views and the purge limit)
     pthread_mutex_t trx_manager_latch;
     trx_table_t trx_table;
-    int next_trx_id;
-
-    // Lock table
-    pthread_mutex_t lock_manager_latch;
-    lock_table_t lock_table;
-
-    // Transaction functions (protected by trx manager latch)
+    std::atomic<int> next_trx_id;
+    std::atomic<uint64_t> num_removed;              // transactions taken out of the table (a read view retries if it changes)
+    trx_worker_t workers[TRX_MAX_WORKERS];
+
+    // Lock table (record locks by page in latched buckets, and table locks above them)
+    lock_bucket_t lock_buckets[LOCK_BUCKET_COUNT];
+    pthread_mutex_t table_lock_latch;
+    table_lock_table_t table_locks;
+
+    // Undo history (undo arenas of the finished transactions a read view may still follow, purged once every read view sees them)
+    pthread_mutex_t history_latch;
+    std::unordered_map<int, undo_arena_t*> history;
+    std::atomic<int> num_read_views;                // active transactions having a read view (no history is kept without them)
+    std::atomic<int> num_finishing;                 // transactions moving their undo arenas out of the table (a read missing one waits for them)
+    std::atomic<int> num_finished;
+
+    // Deadlock detector (runs every DEADLOCK_DETECT_INTERVAL_MS unless lock waits time out instead)
+    std::atomic<int> lock_wait_timeout_ms;
+    bool detector_running;
+    pthread_t detector;
+    pthread_mutex_t detector_latch;
+    pthread_cond_t detector_cond;
+
+    // Transaction functions (wait-free, except that a full table slot makes the allocation retry)
     bool is_active_trx(int trx_id);
     trx_t* get_trx(int trx_id);
-    int remove_trx(int trx_id);
-    bool is_deadlock(int trx_id);
-
-    // Lock functions (private)
-    bool is_empty_entry(page_key_t page);
-    lock_t* create_lock(page_key_t page, int record_id, int trx_id, int lock_mode);
-    lock_t* compress_lock(page_key_t page, int record_id, int trx_id, int lock_mode);
+    trx_t* remove_trx(int trx_id);
+    trx_worker_t* get_worker();
+    void wait_beginning(int low_limit_id);
+
+    // Deadlock functions (the waits-for graph is the current waits of the transactions)
+    static void* detector_main(void* arg);
+    int detect_deadlocks();
+    int wait_lock(trx_t* trx_obj, pthread_mutex_t* latch, pthread_cond_t* cond, const std::function<bool()>& is_granted);
+
+    // Undo history functions
+    int get_purge_limit();
+    bool find_undo(int trx_id, int64_t table_id, int64_t key, std::string& value, int& old_trx_id);
+    void keep_undo(trx_t* trx_obj);
+    void finish_undo(trx_t* trx_obj);
+
+    // Lock functions (private, the bucket latch of the page must be held)
+    lock_bucket_t* get_bucket(page_key_t page);
+    bool is_empty_entry(lock_bucket_t* bucket, page_key_t page);
+    lock_t* create_lock(lock_bucket_t* bucket, page_key_t page, int record_id, int trx_id, int lock_mode);
+    lock_t* compress_lock(lock_bucket_t* bucket, page_key_t page, int record_id, int trx_id, int lock_mode);
     int remove_lock(lock_t* lock_obj);
     int broadcast_lock(lock_t* lock_obj);
+    int acquire_table_lock(int64_t table_id, int trx_id, int lock_mode, bool no_wait = false);
+    int acquire_record_lock(int64_t table_id, pagenum_t page_id, int record_id, int trx_id, int old_trx_id, int lock_mode);
+    int release_lock(lock_t* lock_obj);
+    int release_table_locks(int trx_id, trx_t* trx_obj);
+    void escalate_lock(int64_t table_id, int trx_id);
 
 public:
-    // Constructor
+    // Constructor and destructor
     TransactionManager();
+    ~TransactionManager();
 
     // Initializers
-    int init();
+    int init(int lock_table_size = LOCK_TABLE_SIZE);
+    void start_detector();
+    void stop_detector();
+    void set_lock_wait_timeout(int lock_wait_timeout_ms);
 
     // Member functions
     int alloc_trx();
-    int release_all_locks(int trx_id);
+    int release_all_locks(int trx_id, trx_t* trx_obj);
     int abort_trx(int trx_id);
-    int add_undo_log(int trx_id, undo_log_t log);
+    int add_undo_log(int trx_id, undo_log_t log, const std::string& old_value);
+
+    // Consistent read functions (following the undo logs of the transactions)
+    const read_view_t* open_read_view(int trx_id);
+    int read_version(const read_view_t* read_view, int64_t table_id, int64_t key, std::string& value, int trx_id);
+    int purge_versions();
     
-    // Functions protected by lock manager latch
-    int acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int trx_id, int old_trx_id, int lock_mode);
+    // Functions protected by the bucket latches (and the table lock latch)
+    int acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int record_id, int trx_id, int old_trx_id, int lock_mode);
+    int acquire_table(int64_t table_id, int trx_id, int lock_mode);
     int commit_trx(int trx_id);
 };
 
@@ -61,14 +108,47 @@ namespace TRX
     // Global transaction manager
     extern TransactionManager trx_manager;
 
-    // Initialize transaction manager
-    int init_trx_manager();
+    // Initialize transaction manager (with a lock table of lock_table_size pages)
+    int init_trx_manager(int lock_table_size = LOCK_TABLE_SIZE);
+
+    // Stop the deadlock detector
+    void shutdown_trx_manager();
+
+    // Get the read view of the transaction (taken at its first consistent read, NULL if the transaction is not active)
+    const read_view_t* open_read_view(int trx_id);
+
+    // Turn the value written by trx_id into the version the read view sees (following the undo logs of the writers)
+    int read_version(const read_view_t* read_view, int64_t table_id, int64_t key, std::string& value, int trx_id);
+
+    // Remove the undo logs no read view follows anymore (returns the number of transactions whose logs are removed)
+    int purge_versions();
+
+    // Abort lock waits longer than lock_wait_timeout_ms instead of detecting deadlocks (0 to detect them again)
+    void set_lock_wait_timeout(int lock_wait_timeout_ms);
+
+    // Get the id the next transaction takes (kept in the master record of the log at each checkpoint)
+    int get_next_trx_id();
+
+    // Allocate transaction ids after the given one (e.g. the last one in the log)
+    void skip_trx_ids(int trx_id);
 
     // Acquire lock
-    int acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int trx_id, int old_trx_id, int lock_mode);
+    int acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int record_id, int trx_id, int old_trx_id, int lock_mode);
+
+    // Lock the whole table (LOCK_MODE_SHARED or LOCK_MODE_EXCLUSIVE, so that the records need no lock of their own)
+    int lock_table(int64_t table_id, int trx_id, int lock_mode);
+
+    // Get the lsn of the last log record of the transaction
+    int64_t get_last_lsn(int trx_id);
+
+    // Append a log record of the transaction (linked to its last record, -1 for an update of a table other than 'DATA<n>')
+    int64_t write_log(int trx_id, int type, int64_t table_id = 0, pagenum_t page_id = 0, uint16_t offset = 0, uint16_t length = 0, const char* old_img = NULL, const char* new_img = NULL, int64_t next_undo_lsn = -1, uint8_t image_kind = IMAGE::RAW);
+
+    // Collect the transactions having log records for a checkpoint
+    void get_active_trxs(std::vector<att_entry_t>& active_trxs);
 
-    // Add undo log
-    int save_log(int trx_id, int64_t table_id, pagenum_t page_id, int64_t key, std::string old_value, int old_trx_id);
+    // Add undo log of the update of the record in the page (also followed by the consistent reads)
+    int save_log(int trx_id, int64_t table_id, pagenum_t page_id, int64_t key, int record_id, const std::string& old_value, int old_trx_id, int64_t undo_next_lsn = -1);
 }
 
 // Allocate transaction
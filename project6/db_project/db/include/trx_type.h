@@ -5,8 +5,11 @@
 // Includes
 #include "page.h"
 #include "bpt.h"
+#include "log.h"
+#include "replacement.h"
 
 #include <stdint.h>
+#include <limits.h>
 #include <pthread.h>
 
 #include <iostream>
@@ -18,42 +21,108 @@
 #include <stack>
 #include <iterator>
 #include <tuple>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <functional>
 
 
 /// Constants
+constexpr int LOCK_MODE_NONE = -1;
 constexpr int LOCK_MODE_SHARED = 0;
 constexpr int LOCK_MODE_EXCLUSIVE = 1;
+constexpr int LOCK_MODE_INTENTION_SHARED = 2;               // table level only
+constexpr int LOCK_MODE_INTENTION_EXCLUSIVE = 3;            // table level only
+constexpr int LOCK_MODE_SHARED_INTENTION_EXCLUSIVE = 4;     // table level only (S + IX)
+constexpr int LOCK_ESCALATION_THRESHOLD = 512;              // record locks of a transaction on a table to escalate above
+constexpr int LOCK_BUCKET_COUNT = 64;                       // partitions of the lock table (each with its own latch)
+constexpr int LOCK_TABLE_SIZE = 4096;                       // lock table entries (pages) allocated at init over all buckets
+constexpr int LOCK_POOL_SLAB_SIZE = 256;                    // lock objects allocated (and moved between the pool and a thread) at once
+constexpr int LOCK_POOL_CACHE_SIZE = 1024;                  // free lock objects a thread keeps before returning a slab of them
+constexpr int DEADLOCK_DETECT_INTERVAL_MS = 10;             // period of the deadlock detector
+constexpr int LOCK_WAIT_TIMEOUT_MS = 0;                     // lock waits abort after this instead of deadlock detection (0 to detect)
+constexpr int PURGE_INTERVAL = 64;                          // finished transactions between purges of the undo history
+constexpr int TRX_TABLE_SIZE = 4096;                        // active transactions at most (slots indexed by trx_id modulo it)
+constexpr int EPOCH_MAX_THREADS = 256;                      // threads looking up transactions at once
+constexpr int EPOCH_RECLAIM_BATCH = 64;                     // retired transactions to collect before reclaiming them
+constexpr int TRX_MAX_WORKERS = 256;                        // threads beginning transactions at once
+constexpr int TRX_ID_TAKING = INT_MAX;                      // a worker is taking an id (not yet known to a read view)
+constexpr int UNDO_POOL_CACHE_SIZE = 4;                     // free undo arenas a thread keeps
+constexpr size_t UNDO_ARENA_KEEP_SIZE = 1 << 20;            // bytes of old values an arena keeps across transactions
 
 
 /// Types
 struct undo_log_t;
+struct undo_arena_t;
 struct trx_t;
 struct lock_t;
 struct lock_table_entry_t;
-struct hash_page_t;
+struct table_lock_t;
+struct lock_table_t;
+struct lock_bucket_t;
+struct read_view_t;
+struct trx_table_t;
+struct trx_worker_t;
 using page_key_t = std::pair<int64_t, pagenum_t>;
-using lock_table_t = std::unordered_map<page_key_t, lock_table_entry_t, hash_page_t>;
-using trx_table_t = std::unordered_map<int, trx_t>;
+using table_lock_table_t = std::unordered_map<int64_t, table_lock_t>;
 
 
 /// Structures
+// Physical undo of an update (the old value written back to the record in the frame, and logged as the compensation)
 struct undo_log_t
 {
 private:
     // Fields
     int64_t table_id;
     pagenum_t page_id;
+    uint16_t length;
+    size_t image_offset;        // old image in the values of the arena
     int64_t key;
-    std::string old_value;
+    int record_id;              // slot of the record at the update (searched again if the page moved it)
     int old_trx_id;
+    int64_t undo_next_lsn;      // prev_lsn of the update record (next_undo_lsn of its compensation)
 
 public:
     // Constructors
     undo_log_t();
-    undo_log_t(int64_t table_id, pagenum_t page_id, int64_t key, std::string old_value, int old_trx_id);
+    undo_log_t(int64_t table_id, pagenum_t page_id, int64_t key, int record_id, int old_trx_id, int64_t undo_next_lsn = -1);
 
     // Member functions
-    int rollback();
+    int rollback(int trx_id, int64_t& last_lsn, const std::string& values);
+
+    friend struct undo_arena_t;
+};
+
+// Undo logs of a transaction in update order (the old images are appended to one buffer, and both are kept for the next transaction)
+// (the consistent reads of the others follow them back from the records the transaction wrote)
+struct undo_arena_t
+{
+public:
+    // Fields
+    std::vector<undo_log_t> logs;
+    std::string values;
+
+    // Member functions
+    void add(undo_log_t log, const std::string& old_image);
+    bool find(int64_t table_id, int64_t key, std::string& value, int& old_trx_id) const;
+    void clear();
+};
+
+// Snapshot of the transactions whose updates a transaction reads (taken at its first consistent read)
+struct read_view_t
+{
+public:
+    // Fields
+    int creator_trx_id;
+    int up_limit_id;                    // transactions before it had finished
+    int low_limit_id;                   // transactions from it had not begun
+    std::vector<int> active_ids;        // transactions in between still active (sorted)
+
+    // Constructor
+    read_view_t();
+
+    // Member functions
+    bool is_visible(int trx_id) const;
 };
 
 struct trx_t
@@ -61,30 +130,53 @@ struct trx_t
 private:
     // Fields (private)
     int trx_id;
-    std::stack<undo_log_t> undo_logs;
-    pthread_mutex_t waiting_list_latch;
-    int64_t last_lsn;
+    undo_arena_t* undo_arena;           // taken from the UNDO_POOL at the first update (NULL before)
+    pthread_mutex_t undo_latch;         // protects the undo arena against the consistent reads of the others
+    bool undo_taken;                    // the undo arena is taken to the undo history
+    pthread_mutex_t waiting_list_latch;  // protects the waiting list and the current wait
+    pthread_mutex_t* wait_latch;        // latch and condition of the current wait (NULL if not waiting)
+    pthread_cond_t* wait_cond;
+    int wait_seq;                       // number of the current (or last) wait
+    bool deadlock_victim;               // chosen to break a deadlock in the current wait
+    pthread_mutex_t lock_list_latch;    // protects the lock list (other transactions append implicit locks to it)
+    bool releasing;                     // the locks are being released, so no lock may be appended
+    int64_t first_lsn, last_lsn;
 
 public:
     // Fields (public)
-    std::set<int> waiting_list;
+    std::set<int> waiting_list;         // transactions the current wait is for (waits-for edges)
     lock_t *first, *last;
+    std::unordered_map<int64_t, int> table_locks;          // table_id -> mode held on the table
+    std::unordered_map<int64_t, int> num_record_locks;     // table_id -> record locks taken since the last escalation attempt
+    read_view_t read_view;
+    bool has_read_view;
 
     // Constructor and destructor
     trx_t();
     trx_t(int trx_id);
+    ~trx_t();
 
     // Member functions
+    int get_trx_id();
+
     int append_lock(lock_t* lock_obj);
+    lock_t* detach_locks();
+    std::vector<lock_t*> detach_acquired_locks(int64_t table_id);
 
-    bool in_waiting_list(int trx_id);
     void add_waiting_list(int trx_id);
-    void pop_waiting_list(int trx_id);
-    std::stack<int> get_waiting_stack();
-
-    void add_undo_log(undo_log_t undo_log);
+    void begin_wait(pthread_mutex_t* latch, pthread_cond_t* cond);
+    void end_wait();
+    bool is_deadlock_victim();
+    bool get_wait(std::vector<int>& waiting_for, int& wait_seq);
+    bool set_deadlock_victim(int wait_seq, pthread_mutex_t*& latch, pthread_cond_t*& cond);
+
+    void add_undo_log(undo_log_t undo_log, const std::string& old_value);
+    bool find_undo(int64_t table_id, int64_t key, std::string& value, int& old_trx_id, bool& taken);
     int rollback();
+    undo_arena_t* take_undo_arena();
+    void release_undo_arena();
 
+    int64_t get_first_lsn();
     int64_t get_last_lsn();
     void set_last_lsn(int64_t last_lsn);
 
@@ -102,14 +194,15 @@ public:
     std::bitset<RECORD_MAX_COUNT> bitmap;
     pthread_cond_t cond;
 
+    page_key_t page;                    // kept apart from the sentinel, which moves when the lock table is rebuilt
     lock_table_entry_t *sentinel;
     lock_t *prev, *next, *next_trx_lock;
 
     // Constructor and destructor
     lock_t();
-    lock_t(lock_table_entry_t* sentinel, int64_t record_id, int trx_id, int lock_mode = LOCK_MODE_SHARED);
 
     // Member functions
+    void init(lock_table_entry_t* sentinel, int record_id, int trx_id, int lock_mode = LOCK_MODE_SHARED);
     int is_contained(int record_id, int trx_id = 0, int lock_mode = LOCK_MODE_SHARED);
     bool is_compressable(int trx_id, int lock_mode);
     int is_conflict(int record_id, int trx_id, int lock_mode);
@@ -118,7 +211,6 @@ public:
     void add_record(int record_id);
     void set_acquired();
 
-    void wait(pthread_mutex_t* lock_manager_latch);
     void signal();
 
     page_key_t get_page_key();
@@ -144,19 +236,146 @@ public:
     lock_t* compress_lock(int record_id, int trx_id, int lock_mode);
     int remove_lock(lock_t* lock);
     bool is_empty();
+    bool is_blocked(lock_t* lock, lock_t* ignored = NULL);
     int broadcast_lock(lock_t* lock);
 
     friend struct lock_t;
+    friend struct lock_table_t;
+};
+
+// Table lock (granted modes and the requests waiting in arrival order)
+struct table_lock_t
+{
+public:
+    // Fields
+    std::unordered_map<int, int> granted;                   // trx_id -> mode
+    std::deque<std::pair<int, int>> waiting;                // (trx_id, mode)
+    pthread_cond_t cond;
+
+    // Constructor
+    table_lock_t();
+
+    // Member functions
+    bool is_grantable(int trx_id, int lock_mode, bool upgrade);
+    std::vector<int> get_conflicts(int trx_id, int lock_mode);
+    void remove_waiting(int trx_id);
+};
+
+// Transaction table in fixed slots (lookups are wait-free, a slot is taken by a compare and swap and emptied by its owner)
+// (a transaction found is used under an EPOCH guard, unless the caller is the thread running the transaction)
+struct trx_table_t
+{
+private:
+    // Fields
+    std::atomic<trx_t*> slots[TRX_TABLE_SIZE];
+
+public:
+    // Constructor and destructor
+    trx_table_t();
+    ~trx_table_t();
+
+    // Member functions
+    trx_t* find(int trx_id);
+    bool insert(trx_t* trx_obj);
+    trx_t* erase(int trx_id);
+    void for_each(const std::function<void(trx_t*)>& func);
+    void clear();
 };
 
-struct hash_page_t
+// Context of a thread beginning transactions (a read view waits for the transaction it is putting in the table)
+struct trx_worker_t
+{
+public:
+    // Fields
+    std::atomic<bool> used{false};
+    std::atomic<int> beginning{0};      // id being put in the table (TRX_ID_TAKING while it is taken, 0 if none)
+};
+
+// Epoch-based reclamation of the transactions removed from the table
+// (a removed transaction is deleted once no guard taken before its removal is left)
+namespace EPOCH
+{
+    // Pins the current epoch while transactions found in the table are used (guards of a thread may nest)
+    struct guard_t
+    {
+        guard_t();
+        ~guard_t();
+    };
+
+    void retire(trx_t* trx_obj);
+    int reclaim();
+}
+
+// Lock object pool (lock objects and their condition variables are recycled instead of deallocated)
+namespace LOCK_POOL
+{
+    struct stats_t
+    {
+        uint64_t num_allocs;        // lock objects taken
+        uint64_t num_frees;         // lock objects returned
+        uint64_t num_slabs;         // heap allocations (of LOCK_POOL_SLAB_SIZE lock objects)
+    };
+
+    lock_t* alloc();
+    void free(lock_t* lock);
+    stats_t get_stats();
+}
+
+// Undo arena pool (the arena of a finished transaction is reused by the next one of its thread)
+namespace UNDO_POOL
 {
-    size_t operator()(const page_key_t& k) const
+    struct stats_t
     {
-        std::size_t h1 = std::hash<std::string>()(std::to_string(k.first));
-        std::size_t h2 = std::hash<std::string>()(std::to_string(k.second));
-        return h1 ^ (h2 << 1);
-    }
+        uint64_t num_allocs;        // undo arenas taken
+        uint64_t num_news;          // heap allocations
+    };
+
+    undo_arena_t* alloc();
+    void free(undo_arena_t* arena);
+    stats_t get_stats();
+}
+
+// Table lock modes (compatibility matrix and the weakest mode covering both)
+namespace LOCK_MODE
+{
+    bool is_compatible(int held, int requested);
+    int join(int held, int requested);
+    bool covers(int held, int requested);
+}
+
+// Lock table entries of a bucket in open addressing (linear probing on the page key hash, sized at init)
+// (an entry without locks is reused for another page, and the slots only grow if most of them hold locks)
+struct lock_table_t
+{
+private:
+    // Fields
+    std::vector<lock_table_entry_t> slots;      // page_id 0 (header page, never locked) marks a slot never used
+    size_t mask;
+    size_t num_used;
+
+    // Member functions (private)
+    void rebuild();
+
+public:
+    // Constructor
+    lock_table_t();
+
+    // Member functions
+    void init(size_t capacity);
+    lock_table_entry_t* find(page_key_t page);
+    lock_table_entry_t* get(page_key_t page);
+};
+
+// Partition of the lock table (the latch protects its entries and the locks in them)
+struct lock_bucket_t
+{
+public:
+    // Fields
+    pthread_mutex_t latch;
+    lock_table_t entries;
+
+    // Constructor
+    lock_bucket_t();
 };
 
 
@@ -16,11 +16,9 @@ namespace BPT
                 DebugUtil::PrintPage(node);
                 return false;
             }
-            // Check the amount of free space
-            uint64_t amount_of_free_space = PAGE_SIZE - (
-                HEADER_SIZE + node.header.number_of_keys * SLOT_SIZE + 
-                (node.header.number_of_keys > 0 ? PAGE_SIZE - node.slots.back().offset : 0)
-            );
+            // Check the amount of free space (the holes between the values count too)
+            uint64_t amount_of_free_space = BODY_SIZE - node.header.number_of_keys * SLOT_SIZE;
+            for (Record& record : node.slots) amount_of_free_space -= record.size;
             if (node.header.amount_of_free_space != amount_of_free_space) {
                 std::cout << "[is_valid_node_page] the amount of free space is invalid ";
                 std::cout << "( expected: " << amount_of_free_space << " B";
@@ -40,6 +38,51 @@ namespace BPT
         return true;
     }
 
+    // Check the raw node page in place (without decoding the node)
+    bool is_valid_node_page(const page_t& page)
+    {
+        NodeView node(&page);
+        uint32_t number_of_keys = node.number_of_keys();
+
+        if (node.is_leaf()) {
+            // Check the number of keys
+            if (number_of_keys * SLOT_SIZE > BODY_SIZE) {
+                std::cout << "[is_valid_node_page] the number of keys is invalid" << std::endl;
+                DebugUtil::PrintPage(NodePage(page));
+                return false;
+            }
+            // Check the values are between the slots and the end of the page
+            LeafView leaf(&page);
+            for (int idx = 0; idx < (int)number_of_keys; idx++) {
+                if (leaf.offset(idx) < HEADER_SIZE + number_of_keys * SLOT_SIZE || leaf.offset(idx) + leaf.size(idx) > PAGE_SIZE) {
+                    std::cout << "[is_valid_node_page] the value of a record is out of the body" << std::endl;
+                    DebugUtil::PrintPage(NodePage(page));
+                    return false;
+                }
+            }
+
+            // Check the amount of free space (the holes between the values count too)
+            uint64_t amount_of_free_space = BODY_SIZE - number_of_keys * SLOT_SIZE;
+            for (int idx = 0; idx < (int)number_of_keys; idx++) amount_of_free_space -= leaf.size(idx);
+            if (node.amount_of_free_space() != amount_of_free_space) {
+                std::cout << "[is_valid_node_page] the amount of free space is invalid ";
+                std::cout << "( expected: " << amount_of_free_space << " B";
+                std::cout << ", real: " << node.amount_of_free_space() << " B )" << std::endl;
+                DebugUtil::PrintPage(NodePage(page));
+                return false;
+            }
+        } else {
+            // Check the number of keys
+            if (number_of_keys > EDGE_MAX_COUNT) {
+                std::cout << "[is_valid_node_page] the number of keys is invalid" << std::endl;
+                DebugUtil::PrintPage(NodePage(page));
+                return false;
+            }
+        }
+
+        return true;
+    }
+
     bool is_correct_internal_index(int index, NodePage& node, pagenum_t page_number)
     {
         // Check the node is internal
@@ -64,7 +107,7 @@ namespace BPT
             DebugUtil::PrintMarker(__func__, "( page_number: " + std::to_string(page_number) + " )");
         }
 
-        NodePage node_to_return;
+        page_t page;
 
         // Check the page is header page
         if (page_number == 0) {
@@ -72,16 +115,17 @@ namespace BPT
             exit(1);
         }
 
-        // Read given page as Node Page
-        node_to_return = NodePage(BUF::read_page(table_id, page_number, pin_id, pin, pinned));
-        if (DebugUtil::DEBUG_MODE) DebugUtil::PrintPage(node_to_return);
-
-        // Check the page is valid page
-        if (!is_valid_node_page(node_to_return)) {
+        // Read given page and check it is valid before decoding it
+        page = BUF::read_page(table_id, page_number, pin_id, pin, pinned);
+        if (!is_valid_node_page(page)) {
             std::cout << "[load_node_page] invalid page " << std::endl;
             std::cout << "( table_id: " << table_id << ", page_number: " << page_number << " )" << std::endl;
             exit(1);
         }
+
+        // Decode given page as Node Page
+        NodePage node_to_return(page);
+        if (DebugUtil::DEBUG_MODE) DebugUtil::PrintPage(node_to_return);
         return node_to_return;
     }
 
@@ -114,15 +158,15 @@ namespace BPT
         BUF::unpin_page(pin_id);
     }
 
-    pagenum_t make_node_page(int64_t table_id, bool is_leaf)
+    pagenum_t make_node_page(int64_t table_id, bool is_leaf, pagenum_t hint)
     {
         if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__);
 
         pagenum_t new_page_number;
         NodePage new_node;
 
-        // allocate new page
-        new_page_number = BUF::alloc_page(table_id);
+        // allocate new page (next to the hint page if possible)
+        new_page_number = BUF::alloc_page(table_id, hint);
 
         // create new node page and initialize the node page in buffer
         new_node = NodePage(is_leaf);
@@ -145,13 +189,12 @@ namespace BPT
     // get root page number, if root page doesn't exist, create it
     pagenum_t get_root_page(int64_t table_id)
     {
-        int pin_id;
         pagenum_t root;
-        HeaderPage header;
+        PageHandle page;
 
-        // Read header page and return root page number
-        header = HeaderPage(BUF::read_page(table_id, 0, pin_id));
-        root = header.root_page_number;
+        // Read root page number from the header page in place
+        page = BUF::fix_page(table_id, 0, true, true);
+        memcpy(&root, page.read()->data + offsetof(HeaderPage, root_page_number), sizeof(pagenum_t));
 
         return root;
     }
@@ -171,28 +214,27 @@ namespace BPT
     // set parent page number of child page
     void set_parent_page(int64_t table_id, pagenum_t child, pagenum_t parent)
     {
-        int pin_id;
-        NodePage child_node;
+        PageHandle page;
 
-        // update parent page number of child page
-        child_node = load_node_page(table_id, child, pin_id, true);
-        child_node.header.parent_page_number = parent;
-        save_node_page(table_id, child, child_node, pin_id);
+        // update parent page number of child page in place
+        if (child == 0) {
+            std::cout << "[set_parent_page] tried to write header page as node page" << std::endl;
+            exit(1);
+        }
+        page = BUF::fix_page(table_id, child);
+        NodeView(page.write()).set_parent_page_number(parent);
     }
 
     // set parent page number of child pages of parent page (must have been updated child data in parent)
     void set_parent_pages(int64_t table_id, pagenum_t parent, int start_point) 
     {
-        int pin_id;
-        pagenum_t child;
-        NodePage parent_node, child_node;
+        PageHandle page;
 
-        // update parent of child node pages
-        parent_node = load_node_page(table_id, parent, pin_id);
-        for (int idx = start_point; idx < (int)parent_node.header.number_of_keys; idx++) {
-            if (idx == -1) child = parent_node.header.first_child_page_number;
-            else child = parent_node.edges[idx].page_number;
-            set_parent_page(table_id, child, parent);
+        // update parent of child node pages (the parent stays pinned while walking its edges)
+        page = BUF::fix_page(table_id, parent, true, true);
+        InternalView parent_view(page.read());
+        for (int idx = start_point; idx < (int)parent_view.number_of_keys(); idx++) {
+            set_parent_page(table_id, parent_view.child(idx), parent);
         }
     }
 
@@ -200,20 +242,30 @@ namespace BPT
     /// Correction functions
 
     // Correct metadata of node page (header, offset)
+    // (the values of the leaf slots from start_point are placed below the values before it, or all of them are packed if short)
     void correct_node(NodePage& node, int start_point)
     {
-        uint16_t offset;
+        size_t used = 0, needed = 0, slot_end;
+        uint16_t offset = PAGE_SIZE;
 
         if (node.header.is_leaf) {
             // Case: node is leaf
-            // set initial offset value
-            if (start_point == 0) offset = PAGE_SIZE;
-            else offset = node.slots[start_point-1].offset;
+            // set initial offset value (below the lowest value kept)
+            slot_end = HEADER_SIZE + SLOT_SIZE * node.slots.size();
+            for (int idx = 0; idx < (int)node.slots.size(); idx++) {
+                if (idx < start_point) offset = std::min(offset, node.slots[idx].offset);
+                else needed += node.slots[idx].size;
+                used += node.slots[idx].size;
+            }
+            if (start_point > 0 && offset < slot_end + needed) {
+                start_point = 0;
+                offset = PAGE_SIZE;
+            }
 
             // calculate and set each offset value of a leaf slots using each size value
             for (int idx = start_point; idx < node.slots.size(); idx++) {
                 offset -= node.slots[idx].size;
-                if (offset < HEADER_SIZE) {
+                if (offset < slot_end) {
                     std::cout << "[update_leaf_offset] out of page space" << std::endl;
                     exit(1);
                 }
@@ -221,9 +273,8 @@ namespace BPT
             }
 
             // update header data
-            offset = node.slots.empty() ? PAGE_SIZE : node.slots.back().offset;
             node.header.number_of_keys = node.slots.size();
-            node.header.amount_of_free_space = PAGE_SIZE - (HEADER_SIZE + SLOT_SIZE * node.slots.size() + (PAGE_SIZE - offset));
+            node.header.amount_of_free_space = BODY_SIZE - (SLOT_SIZE * node.slots.size() + used);
         } else {
             // Case: node is internal
             // update header data
@@ -249,57 +300,52 @@ namespace BPT
     // Traces the path from the root to a leaf, searching
     pagenum_t find_leaf(int64_t table_id, pagenum_t root, int64_t key)
     {
-        int pin_id;
-        int idx;
         pagenum_t leaf;
-        NodePage node;
+        PageHandle page;
 
-        // load the given root page
+        // pin the given root page
         if (root == 0) return 0;
-        node = load_node_page(table_id, root, pin_id);
+        page = BUF::fix_page(table_id, root, true, true);
 
-        // find the leaf page
+        // find the leaf page (pin the child before unpinning the parent)
         leaf = root;
-        while (!node.header.is_leaf) {
-            // find the candidate index having the key
-            idx = find_key_index(node.edges, key);
-
-            // load the page of the index found
-            if (idx == -1) leaf = node.header.first_child_page_number;
-            else leaf = node.edges[idx].page_number;
-            node = load_node_page(table_id, leaf, pin_id);
+        while (!NodeView(page.read()).is_leaf()) {
+            // find the child page having the key
+            leaf = InternalView(page.read()).find_child(key);
+            if (leaf == 0) {
+                std::cout << "[find_leaf] tried to read header page as node page" << std::endl;
+                exit(1);
+            }
+            page = BUF::fix_page(table_id, leaf, true, true);
         }
 
         return leaf;
     }
 
-    // find the record index having given key
+    // find the record index having given key (the leaf page stays pinned)
     std::pair<int, int> find_record(int64_t table_id, pagenum_t leaf, int64_t key, int& pin_id)
     {
         int idx;
-        NodePage leaf_node;
 
-        // Load the given leaf page
+        // Pin the given leaf page
         if (leaf == 0) return {-1,-1};
-        leaf_node = load_node_page(table_id, leaf, pin_id, true);
+        pin_id = BUF::pin_page(table_id, leaf, true);
+        LeafView leaf_view(BUF::get_frame(pin_id));
 
-        // Find the key in the leaf node
-        idx = find_key_index(leaf_node.slots, key);
-        if (idx < 0 || idx >= leaf_node.header.number_of_keys || leaf_node.slots[idx].key != key) {
-            return {-1,-1};
-        }
+        // Find the key in the leaf page
+        idx = leaf_view.find_record(key);
+        if (idx < 0) return {-1,-1};
 
-        // Return the pair of leaf page number and record index
-        return {leaf_node.slots[idx].trx_id, idx};
+        // Return the pair of transaction id and record index
+        return {leaf_view.trx_id(idx), idx};
     }
 
     // Finds and returns the record to which a key refers
     int find(int64_t table_id, pagenum_t root, int64_t key, std::string& value, pagenum_t key_page)
     {
-        int pin_id;
         int idx;
         pagenum_t leaf;
-        NodePage leaf_node;
+        PageHandle page;
 
         // Initialize the return value to empty string
         value = "";
@@ -307,16 +353,223 @@ namespace BPT
         // Find the leaf node having the key
         leaf = key_page > 0 ? key_page : find_leaf(table_id, root, key);
         if (leaf == 0) return FLAG::FAILURE;
-        leaf_node = load_node_page(table_id, leaf, pin_id);
+        page = BUF::fix_page(table_id, leaf, true, true);
+        LeafView leaf_view(page.read());
 
-        // Find the key in the leaf node
-        idx = find_key_index(leaf_node.slots, key);
-        if (idx < 0 || idx >= leaf_node.header.number_of_keys || leaf_node.slots[idx].key != key) {
-            return FLAG::FAILURE;
+        // Find the key in the leaf page
+        idx = leaf_view.find_record(key);
+        if (idx < 0) return FLAG::FAILURE;
+
+        // Return the value of the key (copied straight from the frame)
+        value.assign(leaf_view.value(idx), strnlen(leaf_view.value(idx), leaf_view.size(idx)));
+        return FLAG::SUCCESS;
+    }
+
+
+    /// Batch find
+
+    // Find the keys at sorted positions [begin, end) of the batch in the subtree of the page
+    static void find_batch_subtree(int64_t table_id, pagenum_t page_number, const int64_t* keys, const std::vector<int>& order,
+                                   int begin, int end, const find_batch_func_t& callback)
+    {
+        int idx;
+        pagenum_t child;
+        std::vector<std::tuple<pagenum_t, int, int>> groups;
+        PageHandle page = BUF::fix_page(table_id, page_number, true, true);
+
+        // Leaf: look up every key of the range in the pinned page
+        if (NodeView(page.read()).is_leaf()) {
+            LeafView leaf_view(page.read());
+            for (int i = begin; i < end; i++) {
+                idx = leaf_view.find_record(keys[order[i]]);
+                if (idx < 0) continue;
+                callback(order[i], leaf_view.value(idx), strnlen(leaf_view.value(idx), leaf_view.size(idx)));
+            }
+            return;
+        }
+
+        // Internal: split the range into runs of keys going to the same child
+        InternalView internal_view(page.read());
+        for (int i = begin; i < end; i++) {
+            child = internal_view.find_child(keys[order[i]]);
+            if (child == 0) {
+                std::cout << "[find_batch] tried to read header page as node page" << std::endl;
+                exit(1);
+            }
+            if (!groups.empty() && std::get<0>(groups.back()) == child) std::get<2>(groups.back()) = i + 1;
+            else groups.emplace_back(child, i, i + 1);
+        }
+
+        // Descend into each child once (the node is unpinned before its children are latched)
+        page.release();
+        for (auto& group : groups) {
+            find_batch_subtree(table_id, std::get<0>(group), keys, order, std::get<1>(group), std::get<2>(group), callback);
+        }
+    }
+
+    // Find the keys of the batch with one descent per distinct leaf, calling back each found record
+    int find_batch(int64_t table_id, pagenum_t root, const int64_t* keys, int num_keys, const find_batch_func_t& callback)
+    {
+        std::vector<int> order(num_keys);
+
+        if (root == 0 || num_keys <= 0) return FLAG::FAILURE;
+
+        // Sort the positions of the keys by key
+        for (int i = 0; i < num_keys; i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [keys](int a, int b) { return keys[a] < keys[b]; });
+
+        find_batch_subtree(table_id, root, keys, order, 0, num_keys, callback);
+        return FLAG::SUCCESS;
+    }
+
+
+    /// Range scan
+
+    // Cursor positioned nowhere
+    Cursor::Cursor()
+        : table_id(0), root(0), end_key(0), read_ahead(0), leaves_to_prefetch(0),
+          leaf(0), index(0), saved_key(0), released(false)
+    {}
+
+    // Cursor positioned on the first record having key not less than begin_key
+    // (the next read_ahead leaves are loaded in background, read_ahead 0 disables it)
+    Cursor::Cursor(int64_t table_id, pagenum_t root, int64_t begin_key, int64_t end_key, int read_ahead)
+        : table_id(table_id), root(root), end_key(end_key), read_ahead(read_ahead), leaves_to_prefetch(0),
+          leaf(0), index(0), saved_key(0), released(false)
+    {
+        if (root == 0 || begin_key > end_key) return;
+        this->seek(begin_key);
+    }
+
+    // Descend from the root to the first record having key not less than given key
+    void Cursor::seek(int64_t key)
+    {
+        this->released = false;
+        this->leaf = find_leaf(this->table_id, this->root, key);
+        if (this->leaf == 0) {
+            this->page.release();
+            return;
+        }
+        this->page = BUF::fix_page(this->table_id, this->leaf, true, true);
+        this->enter_leaf();
+
+        // Find the first key not less than the key
+        LeafView leaf_view(this->page.read());
+        this->index = leaf_view.find_index(key);
+        if (this->index < 0 || leaf_view.key(this->index) < key) this->index++;
+        this->skip_to_record();
+    }
+
+    // Request the next leaves once half of the read-ahead window is consumed
+    void Cursor::enter_leaf()
+    {
+        if (this->read_ahead > 0 && this->leaves_to_prefetch-- <= 0) {
+            BUF::prefetch(this->table_id, LeafView(this->page.read()).right_sibling_page_number(), this->read_ahead);
+            this->leaves_to_prefetch = this->read_ahead / 2;
+        }
+    }
+
+    // Move along the right siblings until the index points to a record
+    void Cursor::skip_to_record()
+    {
+        pagenum_t right_sibling;
+
+        while (this->page.is_pinned() && this->index >= (int)LeafView(this->page.read()).number_of_keys()) {
+            // Pin the sibling before unpinning this leaf
+            right_sibling = LeafView(this->page.read()).right_sibling_page_number();
+            if (right_sibling == 0) {
+                this->page.release();
+                return;
+            }
+            this->leaf = right_sibling;
+            this->page = BUF::fix_page(this->table_id, this->leaf, true, true);
+            this->index = 0;
+            this->enter_leaf();
+        }
+    }
+
+    bool Cursor::is_valid() const
+    {
+        return this->page.is_pinned() && this->key() <= this->end_key;
+    }
+
+    void Cursor::next()
+    {
+        if (!this->page.is_pinned()) return;
+        this->index++;
+        this->skip_to_record();
+    }
+
+    int64_t Cursor::key() const
+    {
+        return LeafView(this->page.read()).key(this->index);
+    }
+
+    const char* Cursor::value() const
+    {
+        return LeafView(this->page.read()).value(this->index);
+    }
+
+    uint16_t Cursor::size() const
+    {
+        return LeafView(this->page.read()).size(this->index);
+    }
+
+    int Cursor::trx_id() const
+    {
+        return LeafView(this->page.read()).trx_id(this->index);
+    }
+
+    int Cursor::record_id() const
+    {
+        return this->index;
+    }
+
+    pagenum_t Cursor::page_number() const
+    {
+        return this->leaf;
+    }
+
+    // Unpin the leaf (e.g. while waiting for a record lock)
+    void Cursor::release()
+    {
+        if (!this->page.is_pinned()) return;
+        this->saved_key = this->key();
+        this->released = true;
+        this->page.release();
+    }
+
+    // Pin the leaf again and find the saved key
+    // If the record has moved or been deleted, position on the next record from the root
+    void Cursor::restore()
+    {
+        int index;
+
+        if (!this->released) return;
+        this->released = false;
+
+        this->page = BUF::fix_page(this->table_id, this->leaf, true, true);
+        LeafView leaf_view(this->page.read());
+        index = leaf_view.is_leaf() ? leaf_view.find_record(this->saved_key) : -1;
+        if (index < 0) {
+            this->page.release();
+            this->seek(this->saved_key);
+            return;
+        }
+        this->index = index;
+    }
+
+    // Calls back records of keys in [begin_key, end_key] in key order along the leaf chain
+    int scan(int64_t table_id, pagenum_t root, int64_t begin_key, int64_t end_key, const scan_func_t& callback, int read_ahead)
+    {
+        // Check the range and the tree
+        if (begin_key > end_key || root == 0) return FLAG::FAILURE;
+
+        // Call back the records in the range
+        for (Cursor cursor(table_id, root, begin_key, end_key, read_ahead); cursor.is_valid(); cursor.next()) {
+            if (!callback(cursor.key(), cursor.value(), cursor.size())) break;
         }
 
-        // Return the value of the key
-        value = leaf_node.slots[idx].value;
         return FLAG::SUCCESS;
     }
 
@@ -382,33 +635,23 @@ namespace BPT
         return FLAG::SUCCESS;
     }
 
+    // Inserts a new key into a leaf node in place (the other values stay unless the contiguous free space is short)
     int insert_into_leaf(int64_t table_id, pagenum_t leaf, int64_t key, std::string value)
     {
-        int pin_id;
         int index;
-        NodePage leaf_node;
-        Record record;
-
-        // load leaf node to be inserted
-        leaf_node = load_node_page(table_id, leaf, pin_id, true);
-        if (!leaf_node.header.is_leaf) {
-            unpin_node_page(pin_id);
-            return FLAG::FAILURE;
-        }
+        PageHandle page;
 
-        // make new record and insert the record
-        record = Record(key, value);
-        index = insert_node_key(leaf_node.slots, record);
-        if (index < 0) {
-            unpin_node_page(pin_id);
-            return FLAG::FAILURE;
-        }
+        // Pin the leaf node to be inserted
+        page = BUF::fix_page(table_id, leaf);
+        LeafView leaf_view(page.read());
+        if (!leaf_view.is_leaf()) return FLAG::FAILURE;
 
-        // update offsets of records and page header
-        correct_node(leaf_node, index);
+        // Find the insertion point (ignore duplicates)
+        index = leaf_view.find_index(key);
+        if (index >= 0 && leaf_view.key(index) == key) return FLAG::FAILURE;
 
-        // set the node
-        save_node_page(table_id, leaf, leaf_node, pin_id);
+        // Insert the record into the free space of the page
+        if (!LeafView(page.write()).insert(index + 1, key, value.c_str(), value.size())) return FLAG::FAILURE;
         return FLAG::SUCCESS;
     }
 
@@ -433,8 +676,8 @@ namespace BPT
         record = Record(key, value);
         index = insert_node_key(leaf_node.slots, record);
 
-        // create new leaf node page
-        new_leaf = make_node_page(table_id);
+        // create new leaf node page (physically next to the leaf if possible)
+        new_leaf = make_node_page(table_id, true, leaf);
         new_leaf_node = load_node_page(table_id, new_leaf, pin_id_n, true);
 
         // split array of slots
@@ -520,8 +763,8 @@ namespace BPT
             return FLAG::FAILURE;
         }
 
-        // create new internal node page
-        new_internal = make_node_page(table_id, false);
+        // create new internal node page (physically next to the internal node if possible)
+        new_internal = make_node_page(table_id, false, internal);
         new_internal_node = load_node_page(table_id, new_internal, pin_id_n, true);
 
         // split array of edges
@@ -664,18 +907,24 @@ namespace BPT
         int index;
         NodePage key_node;
 
+        // delete the record of a leaf in place (its value is left as a hole)
+        {
+            PageHandle page = BUF::fix_page(table_id, key_page);
+            LeafView leaf_view(page.read());
+            if (leaf_view.is_leaf()) {
+                index = leaf_view.find_record(key);
+                if (index < 0) return FLAG::FAILURE;
+                LeafView(page.write()).remove(index);
+                return FLAG::SUCCESS;
+            }
+        }
+
         // load key node page to be inserted
         key_node = load_node_page(table_id, key_page, pin_id, true);
 
-        // find key index and delete the record or edge
-        if (key_node.header.is_leaf) {
-            index = delete_node_key(key_node.slots, key);
-            if (index < 0) return FLAG::FAILURE;
-            correct_node(key_node, index);
-        } else {
-            index = delete_node_key(key_node.edges, key);
-            correct_node(key_node);
-        }
+        // find key index and delete the edge
+        index = delete_node_key(key_node.edges, key);
+        correct_node(key_node);
 
         // set the node
         save_node_page(table_id, key_page, key_node, pin_id);
@@ -967,44 +1216,255 @@ namespace BPT
 
     /// Update
 
-    // Master update function
-    int update(int64_t table_id, pagenum_t leaf, int64_t key, Record& record_old, std::string value_new, int trx_id, int pin_id)
+    // Copy the record image of the record at index (the slot followed by the value, padded to length)
+    static std::string record_image(const page_t* frame, int index, uint16_t length)
+    {
+        LeafView leaf_view(frame);
+        std::string image(frame->data + HEADER_SIZE + index * SLOT_SIZE, SLOT_SIZE);
+
+        image.append(leaf_view.value(index), leaf_view.size(index));
+        image.resize(length, '\0');
+        return image;
+    }
+
+    // Change the value of the record at index in the frame, and append the images to log in order
+    // (a larger value compacts the values first if the contiguous free space is short, but never splits the leaf)
+    int update_record(page_t* frame, int index, const char* value, uint16_t size, int trx_id, std::vector<leaf_image_t>& images)
+    {
+        LeafView leaf_view(frame);
+        uint16_t old_size, length;
+        leaf_image_t image;
+
+        // Check the size of the value and the free space of the leaf
+        if (size < VALUE_MIN_SIZE || size > VALUE_MAX_SIZE) return FLAG::FAILURE;
+        if (index < 0 || index >= (int)leaf_view.number_of_keys()) return FLAG::FAILURE;
+        old_size = leaf_view.size(index);
+        if (size > old_size && leaf_view.amount_of_free_space() < (uint64_t)(size - old_size)) return FLAG::FAILURE;
+
+        // Compact the values with the record at the heap top (the image of the whole body)
+        if (leaf_view.needs_compaction(index, size)) {
+            image = {(uint16_t)HEADER_SIZE, IMAGE::RAW, std::string(frame->data + HEADER_SIZE, BODY_SIZE), "", true};
+            leaf_view.compact(index);
+            image.new_img.assign(frame->data + HEADER_SIZE, BODY_SIZE);
+            images.push_back(image);
+        }
+
+        // Change the value and the transaction id of the record
+        length = SLOT_SIZE + std::max(old_size, size);
+        image = {(uint16_t)(HEADER_SIZE + index * SLOT_SIZE), IMAGE::RECORD, record_image(frame, index, length), "", false};
+        leaf_view.resize(index, value, size);
+        leaf_view.set_trx_id(index, trx_id);
+        image.new_img = record_image(frame, index, length);
+        images.push_back(image);
+
+        return FLAG::SUCCESS;
+    }
+
+    // Write the old image of a log record back to the frame, and append the images to log as compensations
+    // (a record image is written back to the record having its key, wherever the page moved it)
+    int undo_image(page_t* frame, uint16_t offset, uint8_t kind, const std::string& old_img, std::vector<leaf_image_t>& images)
+    {
+        LeafView leaf_view(frame);
+        int64_t key;
+        uint16_t size;
+        int idx, old_trx_id;
+
+        // Write the image as it is if it is not a record image
+        if (kind != IMAGE::RECORD) {
+            images.push_back({offset, IMAGE::RAW, std::string(frame->data + offset, old_img.size()), old_img, false});
+            memcpy(frame->data + offset, old_img.data(), old_img.size());
+            return FLAG::SUCCESS;
+        }
+
+        // Read the old slot (key, size, offset, trx_id) and find the record
+        memcpy(&key, old_img.data(), sizeof(int64_t));
+        memcpy(&size, old_img.data() + sizeof(int64_t), sizeof(uint16_t));
+        memcpy(&old_trx_id, old_img.data() + sizeof(int64_t) + sizeof(uint16_t) * 2, sizeof(int));
+        idx = leaf_view.find_record(key);
+        if (idx < 0 || size > old_img.size() - SLOT_SIZE) return FLAG::FAILURE;
+
+        // Put the old value and the transaction id back
+        return update_record(frame, idx, old_img.data() + SLOT_SIZE, size, old_trx_id, images);
+    }
+
+    // Master update function (the leaf page must be pinned by pin_id)
+    int update(int64_t table_id, pagenum_t leaf, int64_t key, Record& record_old, std::string value_new, int trx_id, int pin_id, std::vector<leaf_image_t>& images)
     {
         
         printf("[INFO][%s][trx_id: %d] Begin (table_id: %d, leaf: %d, key: %d, value_new: %s)\n", __func__, trx_id, table_id, leaf, key, value_new.c_str());
 
         int idx;
-        NodePage leaf_node;
+        page_t* page;
 
-        // Find the leaf node having the key
+        // Get the frame of the pinned leaf page
         if (leaf == 0) return FLAG::FAILURE;
-        leaf_node = load_node_page(table_id, leaf, pin_id, true, true);
+        page = BUF::get_frame(pin_id);
+        if (page == NULL) return FLAG::FAILURE;
+        LeafView leaf_view(page);
 
-        // Find the key in the leaf node
-        idx = find_key_index(leaf_node.slots, key);
-        if (idx < 0 || idx >= leaf_node.header.number_of_keys || leaf_node.slots[idx].key != key) {
-            // save_node_page(table_id, leaf, leaf_node, pin_id, true);
-            return FLAG::FAILURE;
-        }
+        // Find the key in the leaf page
+        idx = leaf_view.find_record(key);
+        if (idx < 0) return FLAG::FAILURE;
 
         // Get the old value
-        record_old = leaf_node.slots[idx];
-        if (record_old.value.size() != value_new.size()) {
-            // save_node_page(table_id, leaf, leaf_node, pin_id, true);
-            return FLAG::FAILURE;
-        }
+        record_old = Record(page, idx);
 
         
         printf("[INFO][%s][trx_id: %d] Old record (table_id: %d, leaf: %d, key: %d, value: %s, trx_id: %d)\n", __func__, trx_id, table_id, leaf, key, record_old.value.c_str(), record_old.trx_id);
 
-        // Update the value of the record
-        leaf_node.slots[idx].value = value_new;
-        leaf_node.slots[idx].trx_id = trx_id;
+        // Update the value and transaction id of the record in the frame (its size may change)
+        if (update_record(page, idx, value_new.c_str(), value_new.size(), trx_id, images)) return FLAG::FAILURE;
+        BUF::mark_dirty(pin_id);
 
         
-        printf("[INFO][%s][trx_id: %d] Assign (table_id: %d, leaf: %d, key: %d, value_new: %s)\n", __func__, leaf_node.slots[idx].trx_id, table_id, leaf, key, leaf_node.slots[idx].value.c_str());
+        printf("[INFO][%s][trx_id: %d] Assign (table_id: %d, leaf: %d, key: %d, value_new: %s)\n", __func__, trx_id, table_id, leaf, key, value_new.c_str());
+
+        return FLAG::SUCCESS;
+    }
+
+    /// Bulk load
+
+    // Node being filled at a level of the bulk-loaded tree
+    struct bulk_node_t
+    {
+        pagenum_t page_number;
+        pagenum_t parent_page_number;
+        page_t image;
+    };
+
+    // Allocate a page for the bulk-loaded tree (remembered to be freed on failure)
+    static pagenum_t bulk_alloc_page(int64_t table_id, std::vector<pagenum_t>& allocated)
+    {
+        allocated.push_back(BUF::alloc_page(table_id));
+        return allocated.back();
+    }
+
+    // Allocate a leaf from the current extent, so that the leaf chain is physically contiguous
+    static pagenum_t bulk_alloc_leaf(int64_t table_id, std::pair<pagenum_t, pagenum_t>& extent, std::vector<pagenum_t>& allocated)
+    {
+        pagenum_t first;
 
-        save_node_page(table_id, leaf, leaf_node, pin_id, false);
+        // Allocate a new extent if the current one is used up
+        if (extent.first == extent.second) {
+            first = BUF::alloc_pages(table_id, BULK_LOAD_EXTENT);
+            for (pagenum_t page_number = first; page_number < first + BULK_LOAD_EXTENT; page_number++) {
+                allocated.push_back(page_number);
+            }
+            extent = {first, first + BULK_LOAD_EXTENT};
+        }
+        return extent.first++;
+    }
+
+    // Write the closed node to the buffer
+    static void bulk_write_node(int64_t table_id, bulk_node_t& node)
+    {
+        NodeView(&node.image).set_parent_page_number(node.parent_page_number);
+        BUF::write_page(BUF::pin_page(table_id, node.page_number), node.image);
+    }
+
+    // Append the child having given first key to the open node of the level, and return the parent of the child
+    // (a parent is allocated before its children are closed, so children are written only once)
+    static pagenum_t bulk_append_child(int64_t table_id, std::vector<bulk_node_t>& levels, int level, int64_t key, pagenum_t child,
+                                       int max_keys, std::vector<pagenum_t>& allocated)
+    {
+        bulk_node_t node;
+
+        // Case 1: the top node gets a new parent (new root level)
+        if (level == (int)levels.size()) {
+            node.page_number = bulk_alloc_page(table_id, allocated);
+            node.parent_page_number = 0;
+            node.image = NodePage(false);
+            InternalView(&node.image).set_first_child_page_number(levels[level-1].page_number);
+            InternalView(&node.image).append(key, child);
+            levels[level-1].parent_page_number = node.page_number;
+            levels.push_back(node);
+            return node.page_number;
+        }
+
+        // Case 2: the open node has room for the child
+        InternalView view(&levels[level].image);
+        if ((int)view.number_of_keys() < max_keys) {
+            view.append(key, child);
+            return levels[level].page_number;
+        }
+
+        // Case 3: the open node is full, the child is the first child of a new node
+        node.page_number = bulk_alloc_page(table_id, allocated);
+        node.image = NodePage(false);
+        InternalView(&node.image).set_first_child_page_number(child);
+        node.parent_page_number = bulk_append_child(table_id, levels, level + 1, key, node.page_number, max_keys, allocated);
+        bulk_write_node(table_id, levels[level]);
+        levels[level] = node;
+        return node.page_number;
+    }
+
+    // Build the tree bottom-up from records in ascending key order (the table must be empty)
+    // Leaves are filled up to fill_factor of the page body, internal nodes up to fill_factor of the edges
+    int bulk_load(int64_t table_id, const bulk_load_func_t& next_record, double fill_factor)
+    {
+        int max_keys;
+        size_t max_bytes, used_bytes;
+        int64_t key, prev_key = 0;
+        std::string value;
+        std::vector<bulk_node_t> levels;
+        std::vector<pagenum_t> allocated;
+        std::pair<pagenum_t, pagenum_t> extent = {0, 0};
+        bulk_node_t leaf;
+
+        // Check the arguments and the table is empty
+        if (fill_factor <= 0 || fill_factor > 1) return FLAG::FAILURE;
+        if (get_root_page(table_id) != 0) return FLAG::FAILURE;
+        max_bytes = fill_factor * BODY_SIZE;
+        max_keys = std::max(1, (int)(fill_factor * EDGE_MAX_COUNT));
+
+        while (next_record(key, value)) {
+            // Check the record (valid size, ascending key order)
+            if (value.size() < VALUE_MIN_SIZE || value.size() > VALUE_MAX_SIZE || (!levels.empty() && key <= prev_key)) {
+                std::cout << "[bulk_load] invalid or unsorted record ( key: " << key << " )" << std::endl;
+
+                // Free the pages of the partial tree (the table stays empty)
+                for (auto it = allocated.rbegin(); it != allocated.rend(); it++) {
+                    BUF::free_page(table_id, *it, BUF::pin_page(table_id, *it));
+                }
+                return FLAG::FAILURE;
+            }
+            prev_key = key;
+
+            // Open a new leaf if the record goes over the fill factor
+            if (levels.empty()) {
+                leaf.page_number = bulk_alloc_leaf(table_id, extent, allocated);
+                leaf.parent_page_number = 0;
+                leaf.image = NodePage(true);
+                levels.push_back(leaf);
+            } else {
+                used_bytes = BODY_SIZE - LeafView(&levels[0].image).amount_of_free_space();
+                if (used_bytes + SLOT_SIZE + value.size() > max_bytes) {
+                    leaf.page_number = bulk_alloc_leaf(table_id, extent, allocated);
+                    leaf.image = NodePage(true);
+                    leaf.parent_page_number = bulk_append_child(table_id, levels, 1, key, leaf.page_number, max_keys, allocated);
+                    NodeView(&levels[0].image).set_right_sibling_page_number(leaf.page_number);
+                    bulk_write_node(table_id, levels[0]);
+                    levels[0] = leaf;
+                }
+            }
+
+            // Append the record to the open leaf
+            LeafView(&levels[0].image).append(key, value.c_str(), value.size());
+        }
+
+        // Free the unused pages of the last extent
+        for (; extent.first < extent.second; extent.first++) {
+            BUF::free_page(table_id, extent.first, BUF::pin_page(table_id, extent.first));
+        }
+
+        // Nothing to load
+        if (levels.empty()) return FLAG::SUCCESS;
+
+        // Close the open nodes bottom-up and set the top node as root
+        for (bulk_node_t& node : levels) {
+            bulk_write_node(table_id, node);
+        }
+        set_root_page(table_id, levels.back().page_number);
 
         return FLAG::SUCCESS;
     }
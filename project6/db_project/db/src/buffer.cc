@@ -3,59 +3,68 @@
 
 /// Buffer Manager
 BufferManager::BufferManager()
-    : num_buf(0), num_used(0)
-{}
+    : num_buf(0), num_used(0), num_dirty(0), dirty_high_water(0), cleaner_running(false), prefetch_running(false)
+{
+    // initialize page cleaner and read-ahead latches
+    pthread_mutex_init(&this->cleaner_latch, NULL);
+    pthread_cond_init(&this->cleaner_cond, NULL);
+    pthread_mutex_init(&this->prefetch_latch, NULL);
+    pthread_cond_init(&this->prefetch_cond, NULL);
+}
 
 
 /// Buffer structure
 BufferManager::buffer_t::buffer_t()
-    : frame_id(), table_id(0), pg_num(0), is_dirty(false)
+    : frame_id(), table_id(-1), pg_num(0), is_dirty(false), rec_lsn(-1), page_lsn(-1), pin_count(1)
 {
-    // initialize mutex
-    pthread_mutex_init(&page_latch, NULL);
+    // initialize latch
+    pthread_rwlock_init(&page_latch, NULL);
 }
 
-BufferManager::buffer_t::buffer_t(int index, int64_t table_id, pagenum_t pg_num, bool pin, bool dirty)
-    : frame_id(index), table_id(table_id), pg_num(pg_num), is_dirty(dirty)
-{
-    // initialize mutex
-    pthread_mutex_init(&page_latch, NULL);
-}  
-
 
 /// Member functions
 // Initializer API
-int BufferManager::init(int num_buf)
+int BufferManager::init(int num_buf, int policy, int dirty_high_water_percent)
 {
     int flag;
 
-    // Check whether the number of buffer is valid
+    // Check whether the arguments are valid
     if (num_buf < 0) return 1;
+    if (dirty_high_water_percent < 0 || dirty_high_water_percent > 100) return 1;
 
-    // Initialize buffer manager latch
-    flag = pthread_mutex_init(&this->buffer_latch, NULL);
-    if (flag != 0) return 1;
+    // Stop the background threads of the previous buffer
+    this->stop_prefetchers();
+    this->stop_cleaner();
 
-    // Initialize list latch
-    flag = pthread_mutex_init(&this->list_latch, NULL);
-    if (flag != 0) return 1;
+    // Initialize replacement policy
+    this->policy.reset(make_replacement_policy(policy));
+    if (this->policy == nullptr) return 1;
+    this->policy->init(num_buf);
 
     // Initialize field data
     this->num_buf = num_buf;
     this->num_used = 0;
-    std::fill(this->oldest,this->oldest+3,-1);
-    std::fill(this->latest,this->latest+3,-1);
+    this->num_dirty = 0;
+    this->dirty_high_water = num_buf * dirty_high_water_percent / 100;
 
-    this->index_map.clear();
-    this->pool.reserve(this->num_buf);
-    this->frames.reserve(this->num_buf);
-    this->lru.resize(this->num_buf, {-1,-1});
-    this->eviction_priority.resize(this->num_buf, {-1,-1});
+    // Initialize page table shards
+    this->shards = std::vector<shard_t>(BUFFER_SHARD_COUNT);
+    for (int shard = 0; shard < BUFFER_SHARD_COUNT; shard++) {
+        flag = pthread_mutex_init(&this->shards[shard].shard_latch, NULL);
+        if (flag != 0) return 1;
+    }
 
+    // Initialize control blocks and frames (unused frames stay pinned until allocated)
+    this->pool = std::vector<buffer_t>(this->num_buf);
+    this->frames = std::vector<page_t>(this->num_buf);
     for (int index = 0; index < this->num_buf; index++) {
         this->pool[index].frame_id = index;
-        flag = pthread_mutex_init(&this->pool[index].page_latch, NULL);
-        if (flag != 0) return 1;
+    }
+
+    // Start the page cleaner and the read-ahead I/O threads
+    if (this->num_buf > 0) {
+        this->start_cleaner();
+        this->start_prefetchers();
     }
 
     return 0;
@@ -63,76 +72,99 @@ int BufferManager::init(int num_buf)
 
 void BufferManager::clear()
 {
-    // Clear all data
-    this->num_buf = 0;
-    this->num_used = 0;
-    std::fill(this->oldest,this->oldest+3,-1);
-    std::fill(this->latest,this->latest+3,-1);
+    // Stop the background threads
+    this->stop_prefetchers();
+    this->stop_cleaner();
 
+    // Destroy page latches
     for (int index = 0; index < this->num_buf; index++) {
-        pthread_mutex_destroy(&this->pool[index].page_latch);
+        pthread_rwlock_destroy(&this->pool[index].page_latch);
+    }
+
+    // Destroy page table shard latches
+    for (int shard = 0; shard < (int)this->shards.size(); shard++) {
+        pthread_mutex_destroy(&this->shards[shard].shard_latch);
     }
 
-    this->index_map.clear();
+    // Clear all data
+    this->num_buf = 0;
+    this->num_used = 0;
+    this->num_dirty = 0;
+    this->policy.reset();
+
+    this->shards.clear();
     this->pool.clear();
     this->frames.clear();
-    this->lru.clear();
-    this->eviction_priority.clear();
-
-    // Destroy buffer manager latch
-    pthread_mutex_destroy(&this->buffer_latch);
-    pthread_mutex_destroy(&this->list_latch);
 }
 
 void BufferManager::flush_all_pages()
 {
-    std::cout << "[flush_all_pages]" << std::endl;
-
-    // Acquire buffer manager latch
-    pthread_mutex_lock(&this->buffer_latch);
+    if (DebugUtil::DEBUG_MODE) std::cout << "[flush_all_pages]" << std::endl;
 
-    // Flush buffer data
-    for (int index = 0; index < num_buf; index++) {
-        pthread_mutex_lock(&this->pool[index].page_latch);
+    // Flush buffer data (pin each frame so that it is not evicted while flushing)
+    for (int index = 0; index < this->num_used; index++) {
+        this->page_latch_acquire(index);
         this->flush_page(index);
-        pthread_mutex_unlock(&this->pool[index].page_latch);
+        this->page_latch_release(index);
     }
-
-    // Release buffer manager latch
-    pthread_mutex_unlock(&this->buffer_latch);
 }
 
 
 /// Disk Accessor
-// flush the page from buffer to disk
+// flush the page from buffer to disk (Require page latch)
 void BufferManager::flush_page(int index)
 {
     // Check whether index is valid
     if (index < 0 || index >= this->num_used) return;
+    if (this->pool[index].table_id < 0) return;
 
-    // Page is dirty, write to disk
+    // Page is dirty, write to disk after the log of its changes (write-ahead logging)
     if (this->pool[index].is_dirty) {
+        if (this->pool[index].page_lsn >= 0) LOG::flush(this->pool[index].page_lsn);
         file_write_page(this->pool[index].table_id, this->pool[index].pg_num, &this->frames[index]);
-        std::cout << "[FLUSH PAGE] ( table id : " << this->pool[index].table_id;
-        std::cout << ", page number: " << this->pool[index].pg_num << " )" << std::endl;
+        this->pool[index].is_dirty = false;
+        this->pool[index].rec_lsn = -1;
+        this->num_dirty--;
+        if (DebugUtil::DEBUG_MODE) {
+            std::cout << "[FLUSH PAGE] ( table id : " << this->pool[index].table_id;
+            std::cout << ", page number: " << this->pool[index].pg_num << " )" << std::endl;
+        }
     }
 }
 
-// load the page from disk to buffer
-void BufferManager::load_page(int index, int table_id, int pg_num)
+// mark the frame as dirty since rec_lsn, or since the next log record if it is negative (Require exclusive page latch)
+void BufferManager::mark_dirty(int index, int64_t rec_lsn)
+{
+    if (this->pool[index].is_dirty) {
+        if (rec_lsn >= 0 && rec_lsn < this->pool[index].rec_lsn) this->pool[index].rec_lsn = rec_lsn;
+        return;
+    }
+
+    // Set rec_lsn before the frame looks dirty to the checkpoint
+    this->pool[index].rec_lsn = rec_lsn >= 0 ? rec_lsn : LOG::get_next_lsn();
+    this->pool[index].is_dirty = true;
+
+    // Wake the page cleaner above the high water mark
+    if (++this->num_dirty > this->dirty_high_water) this->wake_cleaner();
+}
+
+// load the page from disk to buffer (Require page latch)
+void BufferManager::load_page(int index, int64_t table_id, pagenum_t pg_num)
 {
     // Check whether index is valid
     if (index < 0 || index >= this->num_used) return;
 
     // Load page from disk
     file_read_page(table_id, pg_num, &this->frames[index]);
-    std::cout << "[FETCH PAGE] ( table id : " << table_id << ", page number: " << pg_num << " )" << std::endl;
+    if (DebugUtil::DEBUG_MODE) {
+        std::cout << "[FETCH PAGE] ( table id : " << table_id << ", page number: " << pg_num << " )" << std::endl;
+    }
 }
 
 
 // Latch Manager
-// Acquire page latch (Require buffer manager latch)
-int BufferManager::page_latch_acquire(int index)
+// Pin the frame and acquire page latch
+int BufferManager::page_latch_acquire(int index, bool shared)
 {
     int flag;
 
@@ -144,31 +176,26 @@ int BufferManager::page_latch_acquire(int index)
     // Check whether index is valid
     if (index < 0 || index >= this->num_used) return 1;
 
-    // Acquire page latch
-    flag = pthread_mutex_lock(&this->pool[index].page_latch);
-
-    
-    #if DEBUG_MODE
-    printf("[DEBUG][%s] Acquire the page latch (index: %d)\n", __func__, index);
-    #endif
+    // Pin the frame
+    this->pool[index].pin_count++;
 
+    // Acquire page latch
+    if (shared) flag = pthread_rwlock_rdlock(&this->pool[index].page_latch);
+    else flag = pthread_rwlock_wrlock(&this->pool[index].page_latch);
     if (flag != 0) {
-        
-        // pthread_mutex_unlock(&this->buffer_latch);
+        this->pool[index].pin_count--;
         return 1;
     }
 
-    // Pin the page
-    this->update_index(index, true);
-
     
-    // // Release buffer manager latch
-    // pthread_mutex_unlock(&this->buffer_latch);
+    #if DEBUG_MODE
+    printf("[DEBUG][%s] Acquire the page latch (index: %d)\n", __func__, index);
+    #endif
 
     return 0;
 }
 
-// Release page latch
+// Release page latch and unpin the frame
 int BufferManager::page_latch_release(int index)
 {
     int flag;
@@ -181,26 +208,13 @@ int BufferManager::page_latch_release(int index)
     // Check whether index is valid
     if (index < 0 || index >= this->num_used) return 1;
 
-    // // Acquire buffer manager latch
-    // flag = pthread_mutex_lock(&this->buffer_latch);
-    // if (flag != 0) return 1;
-
-    
-    // printf("[DEBUG][%s] Acquire the buffer latch (index: %d)\n", __func__, index);
-
-    // Unpin the page
-    this->update_index(index, false);
-
-    // // Release buffer manager latch
-    // pthread_mutex_unlock(&this->buffer_latch);
-
-    
-    // printf("[DEBUG][%s] Release the buffer latch (index: %d)\n", __func__, index);
-
     // Release page latch
-    flag = pthread_mutex_unlock(&this->pool[index].page_latch);
+    flag = pthread_rwlock_unlock(&this->pool[index].page_latch);
     if (flag != 0) return 1;
 
+    // Unpin the frame
+    this->pool[index].pin_count--;
+
     
     #if DEBUG_MODE
     printf("[DEBUG][%s] Release the page latch (index: %d)\n", __func__, index);
@@ -210,189 +224,207 @@ int BufferManager::page_latch_release(int index)
 }
 
 
-/// Index Allocators
-void BufferManager::update_list(std::vector<link_pair>& list, int index, int pin)
+/// Page table accessors
+// Get the page table shard of the page
+BufferManager::shard_t& BufferManager::get_shard(int64_t table_id, pagenum_t pg_num)
 {
-    bool old_pin;
-    int prev, next;
+    // Use the upper bits so that the shard and the bucket in the shard are independent
+    return this->shards[(hash_page_key_t()({table_id, pg_num}) >> 32) % BUFFER_SHARD_COUNT];
+}
 
-    // Check if there is nothing to update
-    if (index == this->latest[pin]) return;
-    
-    // Update neighbor index
-    std::tie(prev, next) = list[index];
-    if (prev >= 0) list[prev].second = next;
-    if (next >= 0) list[next].first = prev;
+// Find the index of the page and pin it (-1 if the page is not in buffer)
+int BufferManager::lookup_index(int64_t table_id, pagenum_t pg_num)
+{
+    int index;
+    shard_t& shard = this->get_shard(table_id, pg_num);
 
-    // Update oldest, latest index
-    if (pin > 1) {
-        if (index == this->oldest[pin]) this->oldest[pin] = next;
-    } else if (index < this->num_used) {
-        if (index == this->oldest[!pin]) this->oldest[!pin] = next;
-        if (index == this->latest[!pin]) this->latest[!pin] = prev;
+    // Pin the frame under the shard latch so that it can't be claimed as a victim
+    pthread_mutex_lock(&shard.shard_latch);
+    auto it = shard.index_map.find({table_id, pg_num});
+    if (it == shard.index_map.end()) {
+        index = -1;
+    } else {
+        index = it->second;
+        this->pool[index].pin_count++;
     }
+    pthread_mutex_unlock(&shard.shard_latch);
 
-    // Update this index
-    list[index] = {this->latest[pin], -1};
-    if (this->latest[pin] >= 0) list[this->latest[pin]].second = index;
-    this->latest[pin] = index;
-    if (this->oldest[pin] == -1) this->oldest[pin] = index;
+    return index;
 }
 
-// Set page to recent access
-void BufferManager::update_index(int index, bool pin)
+// Remove the page of the frame from the page table (Require page latch)
+void BufferManager::unmap_index(int index)
 {
-    int flag;
-
-    // Acquire list latch
-    flag = pthread_mutex_lock(&this->list_latch);
-    if (flag != 0) return;
-
-    // Check whether index is valid
-    if (index >= this->num_used || index < 0) return;
-
-    // Update linked lists
-    this->update_list(this->lru, index);
-    this->update_list(this->eviction_priority, index, pin);
-
-    // Release list latch
-    pthread_mutex_unlock(&this->list_latch);
+    int64_t table_id = this->pool[index].table_id;
+    pagenum_t pg_num = this->pool[index].pg_num;
+
+    // Check the frame has a page
+    if (table_id < 0) return;
+    this->policy->evict(index, table_id, pg_num);
+
+    // Erase the mapping if it still points to this frame
+    shard_t& shard = this->get_shard(table_id, pg_num);
+    pthread_mutex_lock(&shard.shard_latch);
+    auto it = shard.index_map.find({table_id, pg_num});
+    if (it != shard.index_map.end() && it->second == index) shard.index_map.erase(it);
+    pthread_mutex_unlock(&shard.shard_latch);
+
+    // Clear page information (the page has been flushed)
+    this->pool[index].table_id = -1;
+    this->pool[index].pg_num = 0;
 }
 
-// Allocate new index of buffer for a page
-int BufferManager::get_new_index(bool pin)
+
+/// Index Allocators
+// Allocate new index of buffer for a page (pinned and latched)
+int BufferManager::get_new_index()
 {
-    int new_index, flag;
+    int new_index;
 
-    // Acquire list latch
-    flag = pthread_mutex_lock(&this->list_latch);
-    if (flag != 0) return -1;
-    
-    // New index is the number of used pages
+    // Claim the next unused frame (unused frames are already pinned)
     new_index = this->num_used;
+    while (new_index < this->num_buf) {
+        if (this->num_used.compare_exchange_weak(new_index, new_index + 1)) {
+            pthread_rwlock_wrlock(&this->pool[new_index].page_latch);
+            return new_index;
+        }
+    }
 
-    // Check if buffer is full
-    if (this->num_used >= this->num_buf) return -1;
+    return -1;
+}
 
-    // Update linked lists
-    this->update_list(this->lru, new_index);
-    this->update_list(this->eviction_priority, new_index, pin);
+// Claim the frame as the victim if it is not pinned (the pin count goes 0 -> 1 only once)
+bool BufferManager::claim_index(int index, bool clean_only)
+{
+    int expected = 0;
 
-    // Increas the number of used buffer frame
-    this->num_used++;
+    if (!this->pool[index].pin_count.compare_exchange_strong(expected, 1)) return false;
 
-    // Release list latch
-    pthread_mutex_unlock(&this->list_latch);
+    // Give back dirty frame if only clean one is wanted (an unpinned frame can't get dirty)
+    if (clean_only && this->pool[index].is_dirty) {
+        this->pool[index].pin_count--;
+        return false;
+    }
 
-    return new_index;
+    return true;
 }
 
-// Find index of the victim page
-int BufferManager::get_victim_index()
+// Find index of the victim page and claim it (pinned and latched)
+int BufferManager::get_victim_index(bool clean_only)
 {
-    int victim, flag;
-
-    // Acquire list latch
-    flag = pthread_mutex_lock(&this->list_latch);
-    if (flag != 0) return -1;
+    int victim;
 
-    // Find the index oldest and unpinned (If it doesn't exist, it is -1)
-    victim = this->oldest[0];
+    // Ask the replacement policy for an unpinned frame, clean one first
+    victim = this->policy->victim([this](int index) { return this->claim_index(index, true); });
+    if (victim < 0 && clean_only) return -1;
+    if (victim < 0) {
+        victim = this->policy->victim([this](int index) { return this->claim_index(index); });
+        if (victim < 0) return -1;
 
-    // Release list latch
-    pthread_mutex_unlock(&this->list_latch);
+        // Foreground miss pays for a write: let the page cleaner catch up
+        this->wake_cleaner();
+    }
 
+    pthread_rwlock_wrlock(&this->pool[victim].page_latch);
     return victim;
 }
 
+// Give back the claimed frame without any page
+void BufferManager::release_index(int index)
+{
+    pthread_rwlock_unlock(&this->pool[index].page_latch);
+    this->pool[index].pin_count--;
+}
+
 /// Buffer page index mapper
-// Acquire page latch and get page index
-int BufferManager::assign_index(int64_t table_id, pagenum_t pg_num, bool load)
+// Evict the page of the claimed frame and map given page to it (Require exclusive page latch)
+// If another thread has loaded the page meanwhile, give back the frame and return false
+bool BufferManager::map_index(int index, int64_t table_id, pagenum_t pg_num)
 {
-    int flag, index;
+    // Evict page (the page on disk needs no log to be flushed)
+    this->flush_page(index);
+    this->unmap_index(index);
+    this->pool[index].page_lsn = -1;
+
+    // Map the page to the frame unless another thread has loaded it meanwhile
+    shard_t& shard = this->get_shard(table_id, pg_num);
+    pthread_mutex_lock(&shard.shard_latch);
+    if (shard.index_map.find({table_id, pg_num}) != shard.index_map.end()) {
+        pthread_mutex_unlock(&shard.shard_latch);
+        this->policy->release(index);
+        this->release_index(index);
+        return false;
+    }
+    shard.index_map[{table_id, pg_num}] = index;
+    this->pool[index].table_id = table_id;
+    this->pool[index].pg_num = pg_num;
+    pthread_mutex_unlock(&shard.shard_latch);
 
-    
-    #if DEBUG_MODE
-    printf("[DEBUG][%s] Begin (table id: %ld, page number: %d)\n", __func__, table_id, pg_num);
-    #endif
+    return true;
+}
 
-    // Acquire buffer manager latch
-    flag = pthread_mutex_lock(&this->buffer_latch);
-    if (flag != 0) return -1;
+// Pin the page, acquire page latch and get page index
+int BufferManager::assign_index(int64_t table_id, pagenum_t pg_num, bool load, bool shared)
+{
+    int index;
 
     
     #if DEBUG_MODE
-    printf("[DEBUG][%s] Acquire the buffer latch (table id: %ld, page number: %d)\n", __func__, table_id, pg_num);
+    printf("[DEBUG][%s] Begin (table id: %ld, page number: %d)\n", __func__, table_id, pg_num);
     #endif
 
-    if (this->index_map.find({table_id, pg_num}) != this->index_map.end()) {
+    while (true) {
         // Case 1: Page is already in buffer (HIT)
-        index = this->index_map[{table_id, pg_num}];
-        if (this->page_latch_acquire(index)) {
-            // Release buffer manager latch
-            pthread_mutex_unlock(&this->buffer_latch);
-            return -1;
-        }
-    } else if (this->num_buf > this->num_used) {
-        // Case 2: Page is not in buffer and buffer is not full (COLD MISS)
-        index = this->get_new_index(true);
-        if (this->page_latch_acquire(index)) {
-            // Release buffer manager latch
-            pthread_mutex_unlock(&this->buffer_latch);
-            return -1;
+        index = this->lookup_index(table_id, pg_num);
+        if (index >= 0) {
+            if (shared) pthread_rwlock_rdlock(&this->pool[index].page_latch);
+            else pthread_rwlock_wrlock(&this->pool[index].page_latch);
+
+            // Check the frame was not evicted before the page latch was acquired
+            if (this->pool[index].table_id == table_id && this->pool[index].pg_num == pg_num) {
+                this->policy->access(index);
+                return index;
+            }
+            this->release_index(index);
+            continue;
         }
 
-        // Load page from disk
-        if (load) load_page(index, table_id, pg_num);
-        this->index_map[{table_id, pg_num}] = index;
-    } else {
+        // Case 2: Page is not in buffer and buffer is not full (COLD MISS)
         // Case 3: Page is not in buffer and buffer is full (MISS)
-        index = this->get_victim_index();
+        index = this->get_new_index();
+        if (index < 0) index = this->get_victim_index();
         if (index < 0) {
             // Case 4: Buffer is full and no victim page
-            pthread_mutex_unlock(&this->buffer_latch);
             std::cout << "[ERROR] Buffer is full and no victim page" << std::endl;
             exit(1);
         }
-        if (this->page_latch_acquire(index)) {
-            // Release buffer manager latch
-            pthread_mutex_unlock(&this->buffer_latch);
-            return -1;
-        }
-
-        // Evict page
-        flush_page(index);
-        this->index_map.erase({this->pool[index].table_id, this->pool[index].pg_num});
 
-        // Load page from disk
-        if (load) load_page(index, table_id, pg_num);
-        this->index_map[{table_id, pg_num}] = index;
-    }
-    
-    // Update page information
-    this->pool[index].table_id = table_id;
-    this->pool[index].pg_num = pg_num;
+        // Evict page and map the page to the frame
+        if (!this->map_index(index, table_id, pg_num)) continue;
 
-    // Release buffer manager latch
-    pthread_mutex_unlock(&this->buffer_latch);
+        // Load page from disk (hitters wait on the page latch until it is loaded)
+        if (load) this->load_page(index, table_id, pg_num);
+        this->policy->admit(index, table_id, pg_num);
 
-    
-    #if DEBUG_MODE
-    printf("[DEBUG][%s] Release the buffer latch (table id: %ld, page number: %d)\n", __func__, table_id, pg_num);
-    #endif
+        // Reacquire the page latch as shared (the pin keeps the page in the frame)
+        if (shared) {
+            pthread_rwlock_unlock(&this->pool[index].page_latch);
+            pthread_rwlock_rdlock(&this->pool[index].page_latch);
+        }
 
-    return index;
+        return index;
+    }
 }
 
 
 /// Buffer page accessors
 // Read page image from buffer and acquire page latch
-page_t BufferManager::get_page(int64_t table_id, pagenum_t pg_num, int& index)
+page_t BufferManager::get_page(int64_t table_id, pagenum_t pg_num, int& index, bool shared)
 {
     if (DebugUtil::DEBUG_MODE) std::cout << "[get_page] ( table_id: " << table_id << ", pg_num: " << pg_num << " )" << std::endl;
 
     // Get page index (Acquire page latch)
-    index = this->assign_index(table_id, pg_num);
+    index = this->assign_index(table_id, pg_num, true, shared);
     if (index < 0) {
         std::cout << "[BufferManager::get_page] Page latch is not acquired." << std::endl;
         exit(1);
@@ -417,7 +449,7 @@ void BufferManager::set_dirty_page(int index, const page_t& pg_img, bool unpin)
 
     // Put page image into buffer
     this->frames[index] = pg_img;
-    this->pool[index].is_dirty = true;
+    this->mark_dirty(index);
 
     // Release page latch
     if (!unpin) return;
@@ -428,15 +460,44 @@ void BufferManager::set_dirty_page(int index, const page_t& pg_img, bool unpin)
     }
 }
 
+// Get the frame of the page when ALREADY acquired page latch
+page_t* BufferManager::get_frame(int index)
+{
+    // Check if the index is valid
+    if (index < 0 || index >= this->num_used) return NULL;
+
+    return &this->frames[index];
+}
+
+// Mark the frame as dirty when ALREADY acquired page latch
+void BufferManager::set_dirty(int index, int64_t rec_lsn)
+{
+    // Check if the index is valid
+    if (index < 0 || index >= this->num_used) return;
+
+    this->mark_dirty(index, rec_lsn);
+}
+
+// Stamp the frame with the lsn of the record applied to it when ALREADY acquired exclusive page latch
+// (the node header keeps it for redo, the control block for write-ahead logging)
+void BufferManager::set_page_lsn(int index, int64_t page_lsn)
+{
+    // Check if the index is valid
+    if (index < 0 || index >= this->num_used) return;
+
+    NodeView(&this->frames[index]).set_page_lsn(page_lsn);
+    if (page_lsn > this->pool[index].page_lsn) this->pool[index].page_lsn = page_lsn;
+}
+
 // Acquire page latch as pin
-int BufferManager::pin_page(int64_t table_id, pagenum_t pg_num)
+int BufferManager::pin_page(int64_t table_id, pagenum_t pg_num, bool load, bool shared)
 {
     if (DebugUtil::DEBUG_MODE) std::cout << "[pin_page] ( table_id: " << table_id << ", pg_num: " << pg_num << " )" << std::endl;
 
     int index;
 
     // Get page index (Acquire page latch)
-    index = this->assign_index(table_id, pg_num, false);
+    index = this->assign_index(table_id, pg_num, load, shared);
     if (index < 0) {
         std::cout << "[BufferManager::get_page] Page latch is not acquired." << std::endl;
         exit(1);
@@ -465,6 +526,315 @@ void BufferManager::unpin_page(int index)
     }
 }
 
+// Get the number of dirty frames
+int BufferManager::get_num_dirty() const
+{
+    return this->num_dirty;
+}
+
+// Collect the dirty frames with their rec_lsn for a checkpoint (pages may get dirty while collecting)
+void BufferManager::get_dirty_pages(std::vector<dpt_entry_t>& dirty_pages)
+{
+    for (int index = 0; index < this->num_used; index++) {
+        if (!this->pool[index].is_dirty) continue;
+
+        // Pin the frame so that its page stays while reading it
+        this->pool[index].pin_count++;
+        pthread_rwlock_rdlock(&this->pool[index].page_latch);
+        if (this->pool[index].is_dirty && this->pool[index].table_id >= 0) {
+            dirty_pages.push_back({this->pool[index].table_id, this->pool[index].pg_num, this->pool[index].rec_lsn});
+        }
+        pthread_rwlock_unlock(&this->pool[index].page_latch);
+        this->pool[index].pin_count--;
+    }
+}
+
+// Write the frames dirty since before rec_lsn_bound, so that a checkpoint can move the redo start forward
+void BufferManager::flush_dirty_pages(int64_t rec_lsn_bound)
+{
+    for (int index = 0; index < this->num_used; index++) {
+        if (!this->pool[index].is_dirty || this->pool[index].rec_lsn >= rec_lsn_bound) continue;
+
+        // Pin the frame so that it is not evicted (exclusive latch, as the cleaner writes under shared latch)
+        this->pool[index].pin_count++;
+        pthread_rwlock_wrlock(&this->pool[index].page_latch);
+
+        this->flush_page(index);
+
+        pthread_rwlock_unlock(&this->pool[index].page_latch);
+        this->pool[index].pin_count--;
+    }
+}
+
+
+/// Page cleaner
+void* BufferManager::cleaner_main(void* arg)
+{
+    BufferManager* buffer = (BufferManager*)arg;
+    struct timespec deadline;
+    int num_dirty;
+
+    pthread_mutex_lock(&buffer->cleaner_latch);
+    while (buffer->cleaner_running) {
+        // Sleep for an interval unless woken up above the high water mark
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += CLEANER_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&buffer->cleaner_cond, &buffer->cleaner_latch, &deadline);
+        if (!buffer->cleaner_running) break;
+        pthread_mutex_unlock(&buffer->cleaner_latch);
+
+        // Clean the whole buffer from the cold end above the high water mark, trickle otherwise
+        num_dirty = buffer->num_dirty;
+        if (num_dirty > buffer->dirty_high_water) buffer->clean_frames(buffer->num_buf);
+        else if (num_dirty > 0) buffer->clean_frames(std::max(1, buffer->num_buf * CLEANER_TRICKLE_PERCENT / 100));
+
+        pthread_mutex_lock(&buffer->cleaner_latch);
+    }
+    pthread_mutex_unlock(&buffer->cleaner_latch);
+
+    return NULL;
+}
+
+void BufferManager::start_cleaner()
+{
+    this->cleaner_running = true;
+    if (pthread_create(&this->cleaner_thread, NULL, BufferManager::cleaner_main, this) != 0) {
+        std::cout << "[BufferManager::start_cleaner] Failed to create page cleaner." << std::endl;
+        this->cleaner_running = false;
+    }
+}
+
+void BufferManager::stop_cleaner()
+{
+    // Check the page cleaner is running
+    pthread_mutex_lock(&this->cleaner_latch);
+    if (!this->cleaner_running) {
+        pthread_mutex_unlock(&this->cleaner_latch);
+        return;
+    }
+    this->cleaner_running = false;
+    pthread_cond_signal(&this->cleaner_cond);
+    pthread_mutex_unlock(&this->cleaner_latch);
+
+    pthread_join(this->cleaner_thread, NULL);
+}
+
+void BufferManager::wake_cleaner()
+{
+    pthread_cond_signal(&this->cleaner_cond);
+}
+
+// Write dirty frames among the count coldest ones (never waits for a page latch)
+void BufferManager::clean_frames(int count)
+{
+    std::vector<int> frames;
+
+    this->policy->cold_frames(frames, count);
+    for (int index : frames) {
+        if (!this->pool[index].is_dirty) continue;
+
+        // Pin the frame so that it is not evicted, and skip it if it is latched
+        this->pool[index].pin_count++;
+        if (pthread_rwlock_tryrdlock(&this->pool[index].page_latch) != 0) {
+            this->pool[index].pin_count--;
+            continue;
+        }
+
+        // Only the cleaner writes under shared latch (writers need exclusive latch)
+        this->flush_page(index);
+
+        pthread_rwlock_unlock(&this->pool[index].page_latch);
+        this->pool[index].pin_count--;
+    }
+}
+
+
+/// Read-ahead
+// Load the page into a free or clean frame and return its right sibling (0 if it is not a leaf)
+// Never evicts a dirty frame and never waits for a page latch held by others
+pagenum_t BufferManager::prefetch_index(int64_t table_id, pagenum_t pg_num)
+{
+    int index;
+    pagenum_t right_sibling = 0;
+
+    // Page is already in buffer: only read its right sibling
+    index = this->lookup_index(table_id, pg_num);
+    if (index >= 0) {
+        if (pthread_rwlock_tryrdlock(&this->pool[index].page_latch) != 0) {
+            this->pool[index].pin_count--;
+            return 0;
+        }
+        if (this->pool[index].table_id == table_id && this->pool[index].pg_num == pg_num) {
+            NodeView node(&this->frames[index]);
+            if (node.is_leaf()) right_sibling = node.right_sibling_page_number();
+        }
+        this->release_index(index);
+        return right_sibling;
+    }
+
+    // Page is not in buffer: load it into a free or clean frame
+    index = this->get_new_index();
+    if (index < 0) index = this->get_victim_index(true);
+    if (index < 0) return 0;
+    if (!this->map_index(index, table_id, pg_num)) return 0;
+
+    this->load_page(index, table_id, pg_num);
+    this->policy->admit(index, table_id, pg_num);
+    NodeView node(&this->frames[index]);
+    if (node.is_leaf()) right_sibling = node.right_sibling_page_number();
+    this->release_index(index);
+
+    return right_sibling;
+}
+
+void* BufferManager::prefetch_main(void* arg)
+{
+    BufferManager* buffer = (BufferManager*)arg;
+    prefetch_t request;
+
+    pthread_mutex_lock(&buffer->prefetch_latch);
+    while (true) {
+        // Wait for a request
+        while (buffer->prefetch_running && buffer->prefetch_queue.empty()) {
+            pthread_cond_wait(&buffer->prefetch_cond, &buffer->prefetch_latch);
+        }
+        if (!buffer->prefetch_running) break;
+        request = buffer->prefetch_queue.front();
+        buffer->prefetch_queue.pop_front();
+        pthread_mutex_unlock(&buffer->prefetch_latch);
+
+        // Load the chain of leaves along the right siblings
+        for (int depth = 0; depth < request.depth && request.pg_num != 0; depth++) {
+            request.pg_num = buffer->prefetch_index(request.table_id, request.pg_num);
+        }
+
+        pthread_mutex_lock(&buffer->prefetch_latch);
+    }
+    pthread_mutex_unlock(&buffer->prefetch_latch);
+
+    return NULL;
+}
+
+void BufferManager::start_prefetchers()
+{
+    pthread_t thread;
+
+    this->prefetch_running = true;
+    for (int idx = 0; idx < PREFETCH_THREAD_COUNT; idx++) {
+        if (pthread_create(&thread, NULL, BufferManager::prefetch_main, this) != 0) {
+            std::cout << "[BufferManager::start_prefetchers] Failed to create I/O thread." << std::endl;
+            break;
+        }
+        this->prefetch_threads.push_back(thread);
+    }
+}
+
+void BufferManager::stop_prefetchers()
+{
+    // Drop pending requests and wake I/O threads
+    pthread_mutex_lock(&this->prefetch_latch);
+    this->prefetch_running = false;
+    this->prefetch_queue.clear();
+    pthread_cond_broadcast(&this->prefetch_cond);
+    pthread_mutex_unlock(&this->prefetch_latch);
+
+    for (pthread_t thread : this->prefetch_threads) {
+        pthread_join(thread, NULL);
+    }
+    this->prefetch_threads.clear();
+}
+
+// Request to load the page and the next (depth - 1) leaves along the right siblings
+void BufferManager::prefetch(int64_t table_id, pagenum_t pg_num, int depth)
+{
+    if (pg_num == 0 || depth <= 0) return;
+
+    // Drop the request if the queue is full (read-ahead is only a hint)
+    pthread_mutex_lock(&this->prefetch_latch);
+    if (this->prefetch_running && (int)this->prefetch_queue.size() < PREFETCH_QUEUE_SIZE) {
+        this->prefetch_queue.push_back({table_id, pg_num, depth});
+        pthread_cond_signal(&this->prefetch_cond);
+    }
+    pthread_mutex_unlock(&this->prefetch_latch);
+}
+
+
+/// Pinned page handle
+PageHandle::PageHandle()
+    : pin_id(-1), frame(NULL)
+{}
+
+PageHandle::PageHandle(int64_t table_id, pagenum_t pg_num, bool load, bool shared)
+    : pin_id(-1), frame(NULL)
+{
+    // Pin the page and point to its frame
+    this->pin_id = BUF::buffer.pin_page(table_id, pg_num, load, shared);
+    this->frame = BUF::buffer.get_frame(this->pin_id);
+}
+
+PageHandle::PageHandle(PageHandle&& other)
+    : pin_id(other.pin_id), frame(other.frame)
+{
+    // Take over the pin
+    other.pin_id = -1;
+    other.frame = NULL;
+}
+
+PageHandle::~PageHandle()
+{
+    this->release();
+}
+
+PageHandle& PageHandle::operator=(PageHandle&& other)
+{
+    if (this == &other) return *this;
+
+    // Release the current pin and take over the other pin
+    this->release();
+    this->pin_id = other.pin_id;
+    this->frame = other.frame;
+    other.pin_id = -1;
+    other.frame = NULL;
+
+    return *this;
+}
+
+// Read view of the pinned frame
+const page_t* PageHandle::read() const
+{
+    return this->frame;
+}
+
+// Write view of the pinned frame (the frame is marked as dirty)
+page_t* PageHandle::write()
+{
+    BUF::buffer.set_dirty(this->pin_id);
+    return this->frame;
+}
+
+int PageHandle::get_pin_id() const
+{
+    return this->pin_id;
+}
+
+bool PageHandle::is_pinned() const
+{
+    return this->pin_id >= 0;
+}
+
+// Unpin the page before the handle goes out of scope
+void PageHandle::release()
+{
+    if (this->pin_id < 0) return;
+
+    BUF::buffer.unpin_page(this->pin_id);
+    this->pin_id = -1;
+    this->frame = NULL;
+}
+
+
 /// Buffer Manager APIs
 namespace BUF
 {
@@ -472,9 +842,9 @@ namespace BUF
     BufferManager buffer;
 
     /// Buffer initializers
-    int init_buffer(int num_buf)
+    int init_buffer(int num_buf, int policy, int dirty_high_water_percent)
     {
-        return buffer.init(num_buf);
+        return buffer.init(num_buf, policy, dirty_high_water_percent);
     }
 
     int clear_buffer()
@@ -496,8 +866,8 @@ namespace BUF
             return pg_img;
         }
 
-        // Read page image
-        pg_img = buffer.get_page(table_id, pg_num, pin_id);
+        // Read page image (shared page latch if it is unpinned right away)
+        pg_img = buffer.get_page(table_id, pg_num, pin_id, !pin);
         if (!pin) {
             buffer.unpin_page(pin_id);
             pin_id = -1;
@@ -512,10 +882,10 @@ namespace BUF
         buffer.set_dirty_page(pin_id, pg_img, unpin);
     }
 
-    int pin_page(int64_t table_id, pagenum_t pg_num)
+    int pin_page(int64_t table_id, pagenum_t pg_num, bool load)
     {
-        // Pin the page (not read)
-        return buffer.pin_page(table_id, pg_num);
+        // Pin the page (read from disk only if load is true)
+        return buffer.pin_page(table_id, pg_num, load);
     }
 
     void unpin_page(int pin_id)
@@ -524,76 +894,146 @@ namespace BUF
         buffer.unpin_page(pin_id);
     }
 
-    /// Table controllers (processing with header page in buffer)
-    pagenum_t alloc_page(int64_t table_id)
+    /// In-place page accessors
+    PageHandle fix_page(int64_t table_id, pagenum_t pg_num, bool load, bool shared)
     {
-        std::cout << "[alloc_page]" << std::endl;
+        // Pin the page and return the handle to its frame
+        return PageHandle(table_id, pg_num, load, shared);
+    }
 
-        int pin_id_h, pin_id_f;
-        pagenum_t pg_num_to_alloc, num_pages;
-        HeaderPage header_page, free_page;
+    page_t* get_frame(int pin_id)
+    {
+        return buffer.get_frame(pin_id);
+    }
 
-        // Get header page data
-        header_page = HeaderPage(buffer.get_page(table_id, 0, pin_id_h));
-        pg_num_to_alloc = header_page.next_free_page_number;
-        num_pages = header_page.num_of_pages;
-
-        // Extend file size 
-        if (!pg_num_to_alloc) {
-            // Update header page
-            header_page.next_free_page_number = num_pages;
-            header_page.num_of_pages = num_pages * 2;
+    void mark_dirty(int pin_id, int64_t rec_lsn)
+    {
+        buffer.set_dirty(pin_id, rec_lsn);
+    }
+
+    void stamp_page(int pin_id, int64_t page_lsn)
+    {
+        buffer.set_page_lsn(pin_id, page_lsn);
+    }
+
+    /// Checkpoint helpers
+    void get_dirty_pages(std::vector<dpt_entry_t>& dirty_pages)
+    {
+        buffer.get_dirty_pages(dirty_pages);
+    }
+
+    void flush_dirty_pages(int64_t rec_lsn_bound)
+    {
+        buffer.flush_dirty_pages(rec_lsn_bound);
+    }
+
+    /// Read-ahead
+    void prefetch(int64_t table_id, pagenum_t pg_num, int depth)
+    {
+        buffer.prefetch(table_id, pg_num, depth);
+    }
 
-            // Append free pages
-            for (pagenum_t pg_num = num_pages; pg_num < num_pages * 2; pg_num++) {
-                free_page.next_free_page_number = (pg_num + 1) % (num_pages * 2);
-                buffer.set_dirty_page(buffer.pin_page(table_id, pg_num), free_page);
+    /// Table controllers (processing with header page in buffer)
+    // Allocate count pages in a row searching from the hint (or the lowest free page), extending the file if needed
+    static pagenum_t alloc_run(int64_t table_id, int count, pagenum_t hint)
+    {
+        PageHandle header_handle, allocation_handle;
+        HeaderPage header_page;
+        pagenum_t start, first_group, allocation_page_number, num_pages, pg_num_to_alloc;
+        int index, begin, end;
+
+        // Get header page (its latch serializes the allocations of the table)
+        header_handle = fix_page(table_id, 0);
+        header_page = HeaderPage(*header_handle.read());
+        start = std::max(hint, header_page.next_free_page_number);
+        pg_num_to_alloc = 0;
+
+        while (!pg_num_to_alloc) {
+            // Search the bitmaps from the group of the start page
+            num_pages = header_page.num_of_pages;
+            first_group = AllocationView::group_of(start);
+            for (pagenum_t group = first_group; group <= AllocationView::group_of(num_pages - 1); group++) {
+                allocation_page_number = AllocationView::allocation_page_number(group);
+                if (allocation_page_number >= num_pages) break;
+
+                // Find free pages in a row in the group and mark them allocated
+                allocation_handle = fix_page(table_id, allocation_page_number);
+                begin = group == first_group ? start % PAGES_PER_GROUP : 0;
+                end = std::min<pagenum_t>(PAGES_PER_GROUP, num_pages - group * PAGES_PER_GROUP);
+                index = AllocationView(allocation_handle.read()).find_free(begin, end, count);
+                if (index < 0) continue;
+                AllocationView(allocation_handle.write()).set_allocated(index, count, true);
+                pg_num_to_alloc = group * PAGES_PER_GROUP + index;
+                break;
+            }
+            if (pg_num_to_alloc) break;
+
+            // Search again from the lowest free page if the hint was over it
+            if (start > header_page.next_free_page_number) {
+                start = header_page.next_free_page_number;
+                continue;
             }
 
-            // Get new first free page number again
-            pg_num_to_alloc = num_pages;
+            // Extend file size (space is reserved without writing the new pages)
+            FileUtil::extend_table_file(opened_tables.getFileDesc(table_id), num_pages, num_pages * 2);
+            header_page.num_of_pages = num_pages * 2;
+            start = num_pages;
         }
 
-        // Get first free page
-        free_page = HeaderPage(buffer.get_page(table_id, pg_num_to_alloc, pin_id_f));
+        // Raise the hint when the lowest free pages are allocated
+        if (pg_num_to_alloc == header_page.next_free_page_number) {
+            header_page.next_free_page_number = pg_num_to_alloc + count;
+        }
+        *header_handle.write() = header_page;
 
-        // Update free page numbers
-        header_page.next_free_page_number = free_page.next_free_page_number;
-        free_page.next_free_page_number = pg_num_to_alloc;
+        return pg_num_to_alloc;
+    }
 
-        // Apply updated pages
-        buffer.set_dirty_page(pin_id_h, header_page);
-        buffer.set_dirty_page(pin_id_f, free_page);
+    pagenum_t alloc_page(int64_t table_id, pagenum_t hint)
+    {
+        if (DebugUtil::DEBUG_MODE) std::cout << "[alloc_page]" << std::endl;
 
-        return pg_num_to_alloc;
+        // Allocate the first free page from the hint
+        return alloc_run(table_id, 1, hint);
+    }
+
+    pagenum_t alloc_pages(int64_t table_id, int count)
+    {
+        if (DebugUtil::DEBUG_MODE) std::cout << "[alloc_pages] ( count: " << count << " )" << std::endl;
+
+        // A run can't go over the allocation page of the next group
+        if (count < 1 || count > PAGES_PER_GROUP - 2) return 0;
+        return alloc_run(table_id, count, 0);
     }
 
     void free_page(int64_t table_id, pagenum_t pg_num, int pin_id)
     {
-        std::cout << "[free_page]" << std::endl;
+        if (DebugUtil::DEBUG_MODE) std::cout << "[free_page]" << std::endl;
 
-        int pin_id_h;
-        HeaderPage header_page, free_page;
+        PageHandle header_handle, allocation_handle;
+        HeaderPage header_page;
 
         // Get header page data
-        header_page = HeaderPage(buffer.get_page(table_id, 0, pin_id_h));
+        header_handle = fix_page(table_id, 0);
+        header_page = HeaderPage(*header_handle.read());
 
-        // Update free page numbers
-        free_page.next_free_page_number = header_page.next_free_page_number;
-        header_page.next_free_page_number = pg_num;
+        // Mark the page free and lower the hint
+        allocation_handle = fix_page(table_id, AllocationView::allocation_page_number(AllocationView::group_of(pg_num)));
+        AllocationView(allocation_handle.write()).set_allocated(pg_num % PAGES_PER_GROUP, 1, false);
+        header_page.next_free_page_number = std::min(header_page.next_free_page_number, pg_num);
+        *header_handle.write() = header_page;
 
-        // Apply updated pages
-        buffer.set_dirty_page(pin_id_h, header_page);
-        buffer.set_dirty_page(pin_id, free_page);
+        // Clear the freed page
+        buffer.set_dirty_page(pin_id, page_t());
     }
 
     bool is_valid_page(int64_t table_id, pagenum_t pg_num)
     {
-        int pin_id_h;
         HeaderPage header_page;
 
-        // Get header page data
-        header_page = HeaderPage(buffer.get_page(table_id, 0, pin_id_h));
+        // Get header page data (shared, released at the end of scope)
+        PageHandle header_handle = fix_page(table_id, 0, true, true);
+        header_page = HeaderPage(*header_handle.read());
 
         // Return the page is exist in the table
         return pg_num < header_page.num_of_pages && pg_num >= 0;
@@ -29,15 +29,22 @@ int64_t file_open_table_file(const char* pathname)
 
     // Append opened table to opened_tables, dynamically assign and return the table_id
     table_id = opened_tables.push(fd, pathname);
+
+    // Close the file again if the table is already opened, or another table has its id
+    if (table_id < 0 || opened_tables.getFileDesc(table_id) != fd) close(fd);
+    if (table_id < 0) {
+        std::cout << "[file_open_table_file] Another table has the id of " << pathname << std::endl;
+    }
     return table_id;
 }
 
-// Allocate an on-disk page from the free page list
+// Allocate the first free on-disk page found in the allocation pages
 pagenum_t file_alloc_page(int64_t table_id)
 {
-    HeaderPage header_buffer, page_buffer;
-    pagenum_t page_number_to_alloc, new_next_free_page_number;
-    int fd;
+    HeaderPage header_buffer;
+    page_t allocation_buffer;
+    pagenum_t page_number_to_alloc, allocation_page_number, first_group, num_of_pages;
+    int fd, index, begin, end;
 
     // Get file descriptor of the table file
     fd = opened_tables.getFileDesc(table_id);
@@ -49,21 +56,40 @@ pagenum_t file_alloc_page(int64_t table_id)
 
     // Read header page
     FileUtil::read_block(fd, &header_buffer, PAGE_SIZE);
-    page_number_to_alloc = header_buffer.next_free_page_number;
+    page_number_to_alloc = 0;
+
+    while (!page_number_to_alloc) {
+        // Search the bitmaps from the group of the lowest possibly free page
+        num_of_pages = header_buffer.num_of_pages;
+        first_group = AllocationView::group_of(header_buffer.next_free_page_number);
+        for (pagenum_t group = first_group; group <= AllocationView::group_of(num_of_pages - 1); group++) {
+            allocation_page_number = AllocationView::allocation_page_number(group);
+            if (allocation_page_number >= num_of_pages) break;
+
+            // Find a free page in the group
+            FileUtil::read_block(fd, &allocation_buffer, PAGE_SIZE, PAGE_SIZE * allocation_page_number);
+            begin = group == first_group ? header_buffer.next_free_page_number % PAGES_PER_GROUP : 0;
+            end = std::min<pagenum_t>(PAGES_PER_GROUP, num_of_pages - group * PAGES_PER_GROUP);
+            index = AllocationView(&allocation_buffer).find_free(begin, end);
+            if (index < 0) continue;
+
+            // Mark the page allocated
+            AllocationView(&allocation_buffer).set_allocated(index, 1, true);
+            FileUtil::write_block(fd, &allocation_buffer, PAGE_SIZE, PAGE_SIZE * allocation_page_number);
+            page_number_to_alloc = group * PAGES_PER_GROUP + index;
+            break;
+        }
 
-    // Extend file size
-    if (!page_number_to_alloc) {
-        FileUtil::extend_table_file(fd);
-        FileUtil::read_block(fd, &header_buffer, PAGE_SIZE);
-        page_number_to_alloc = header_buffer.next_free_page_number;
+        // Extend file size (every page was allocated, so the new space is the lowest free one)
+        if (!page_number_to_alloc) {
+            FileUtil::extend_table_file(fd, num_of_pages, num_of_pages * 2);
+            header_buffer.num_of_pages = num_of_pages * 2;
+            header_buffer.next_free_page_number = num_of_pages;
+        }
     }
 
-    // Read first free page
-    FileUtil::read_block(fd, &page_buffer, PAGE_SIZE, PAGE_SIZE * page_number_to_alloc);
-    new_next_free_page_number = page_buffer.next_free_page_number;
-
-    // Update header page
-    header_buffer.next_free_page_number = new_next_free_page_number;
+    // Update header page (pages below the allocated one are all allocated)
+    header_buffer.next_free_page_number = page_number_to_alloc + 1;
     FileUtil::write_block(fd, &header_buffer, PAGE_SIZE);
 
     // Return and log page number to allocate
@@ -72,11 +98,12 @@ pagenum_t file_alloc_page(int64_t table_id)
     return page_number_to_alloc;
 }
 
-// Free an on-disk page to the free page list
+// Free an on-disk page by clearing its bit in the allocation page
 void file_free_page(int64_t table_id, pagenum_t pagenum)
 {
-    HeaderPage page_buffer;
-    pagenum_t old_next_free_page_number;
+    HeaderPage header_buffer;
+    page_t allocation_buffer;
+    pagenum_t allocation_page_number;
     int fd;
 
     // Get file descriptor of the table file
@@ -87,18 +114,16 @@ void file_free_page(int64_t table_id, pagenum_t pagenum)
         return;
     }
 
-    // Read header page
-    FileUtil::read_block(fd, &page_buffer, PAGE_SIZE);
-    old_next_free_page_number = page_buffer.next_free_page_number;
-
-    // Update header page
-    page_buffer.next_free_page_number = pagenum;
-    FileUtil::write_block(fd, &page_buffer, PAGE_SIZE);
+    // Mark the page free
+    allocation_page_number = AllocationView::allocation_page_number(AllocationView::group_of(pagenum));
+    FileUtil::read_block(fd, &allocation_buffer, PAGE_SIZE, PAGE_SIZE * allocation_page_number);
+    AllocationView(&allocation_buffer).set_allocated(pagenum % PAGES_PER_GROUP, 1, false);
+    FileUtil::write_block(fd, &allocation_buffer, PAGE_SIZE, PAGE_SIZE * allocation_page_number);
 
-    // Update new free page (initialize reserved space)
-    page_buffer = HeaderPage();
-    page_buffer.next_free_page_number = old_next_free_page_number;
-    FileUtil::write_block(fd, &page_buffer, PAGE_SIZE, PAGE_SIZE * pagenum);
+    // Update header page (lower the allocation hint)
+    FileUtil::read_block(fd, &header_buffer, PAGE_SIZE);
+    header_buffer.next_free_page_number = std::min(header_buffer.next_free_page_number, pagenum);
+    FileUtil::write_block(fd, &header_buffer, PAGE_SIZE);
 
     // Log page number freed
     std::cout << "[file_free_page] Freeing page success ";
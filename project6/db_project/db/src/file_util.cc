@@ -1,19 +1,36 @@
 #include "file_util.h"
 
 /// Table manager for opened tables
-// push a table file info to table list
+// get the table id n of 'DATA<n>' (-1 if the name is not exactly 'DATA' followed by n, so that n leads back to the name)
+static int64_t data_table_id(const std::string& pathname)
+{
+    int64_t num;
+
+    if (pathname.size() <= 4 || pathname.size() > 4 + 18 || pathname.substr(0, 4) != "DATA") return -1;
+    if (!std::all_of(pathname.begin() + 4, pathname.end(), ::isdigit)) return -1;
+    num = std::stoll(pathname.substr(4));
+    if (pathname != "DATA" + std::to_string(num)) return -1;
+    return num;
+}
+
+// push a table file info to table list (-1 if another table has the id of 'DATA<n>')
 int64_t TableManager::push(int fd, const std::string pathname)
 {
     int64_t table_id;
-    int num;
+    int64_t num;
+
+    // Check the name is 'DATA<n>' (table id of 'DATA<n>' is always n, so that the log can refer to it)
+    num = data_table_id(pathname);
+    if (num >= 0) {
+        if (num >= this->tables.size()) {
+            this->tables.resize(num + 1, {-1, ""});
+        }
 
-    // Check the prefix is 'DATA'
-    if (pathname.substr(0, 4) == "DATA") {
-        num = std::stoi(pathname.substr(4, pathname.size() - 4));
-        if (num > this->tables.size()) {
-            this->tables.resize(num);
+        // the table is already opened, or the id is taken by another table (opened before under another name)
+        if (this->tables[num].first >= 0) {
+            return this->tables[num].second == pathname ? num : -1;
         }
-        this->tables[num - 1] = {fd, pathname};
+        this->tables[num] = {fd, pathname};
         return num;
     }
 
@@ -36,9 +53,14 @@ int TableManager::pop()
     // if table list is empty, return -1
     if (this->tables.size() == 0) return -1;
 
-    // pop and return the last table of the list
+    // pop the last table of the list
     int fd = this->tables.back().first;
     this->tables.pop_back();
+
+    // drop the empty slots left before 'DATA<n>' tables and return the file descriptor
+    while (this->tables.size() > 0 && this->tables.back().first < 0) {
+        this->tables.pop_back();
+    }
     return fd;
 }
 
@@ -53,6 +75,13 @@ int TableManager::getFileDesc(int64_t table_id)
     return fd;
 }
 
+// check given table is 'DATA<table_id>' (only such tables are logged, since recovery opens them by the id)
+bool TableManager::isDataTable(int64_t table_id)
+{
+    if (table_id >= this->tables.size() || table_id < 0) return false;
+    return this->tables[table_id].first >= 0 && data_table_id(this->tables[table_id].second) == table_id;
+}
+
 // return the number of tables in table list
 int TableManager::numOfTables()
 {
@@ -99,51 +128,43 @@ namespace FileUtil
         // }
     }
 
-    // Initialize the table file (initial size: 10MiB - A header page and 2559 free pages)
+    // Initialize the table file (initial size: 10MiB - A header page, an allocation page and 2558 free pages)
     void init_table_file(int fd, pagenum_t num_of_pages)
     {
         HeaderPage page_buffer;
 
-        // Initialize header page
+        // Allocate the space of the file and the allocation pages
+        extend_table_file(fd, 0, num_of_pages);
+
+        // Initialize header page (pages after the first allocation page are free)
         page_buffer.num_of_pages = num_of_pages;
-        page_buffer.next_free_page_number = 1;
+        page_buffer.next_free_page_number = AllocationView::allocation_page_number(0) + 1;
         page_buffer.root_page_number = 0;
         write_block(fd, &page_buffer, PAGE_SIZE);
-
-        // Initialize free pages
-        page_buffer.num_of_pages = 0;
-        for (int page_number = 1; page_number < num_of_pages; page_number++) {
-            page_buffer.next_free_page_number = (page_number + 1) % num_of_pages;
-            write_block(fd, &page_buffer, PAGE_SIZE, PAGE_SIZE * page_number);
-        }
     }
 
-    // Double the space of the table file
-    void extend_table_file(int fd)
+    // Extend the table file (space is reserved at once, and only the new allocation pages are written)
+    void extend_table_file(int fd, pagenum_t old_num_of_pages, pagenum_t new_num_of_pages)
     {
-        HeaderPage page_buffer;
-        pagenum_t old_next_free_page_number;
-        pagenum_t old_num_of_pages, new_num_of_pages;
+        page_t page_buffer;
+        pagenum_t allocation_page_number;
+        int flag;
 
-        // Read header page
-        read_block(fd, &page_buffer, PAGE_SIZE);
-        old_next_free_page_number = page_buffer.next_free_page_number;
-        old_num_of_pages = page_buffer.num_of_pages;
-        new_num_of_pages = old_num_of_pages * 2;
-
-        // Update header page
-        page_buffer.next_free_page_number = old_num_of_pages;
-        page_buffer.num_of_pages = new_num_of_pages;
-        write_block(fd, &page_buffer, PAGE_SIZE);
+        // Reserve the space (zero-filled) without writing each page
+        flag = posix_fallocate(fd, PAGE_SIZE * old_num_of_pages, PAGE_SIZE * (new_num_of_pages - old_num_of_pages));
+        if (flag != 0) flag = ftruncate(fd, PAGE_SIZE * new_num_of_pages);
+        if (flag != 0) {
+            std::cout << "[extend_table_file] File extension failed" << std::endl;
+            exit(1);
+        }
 
-        // Append free pages
-        page_buffer.num_of_pages = 0;
-        for (int page_number = old_num_of_pages; page_number < new_num_of_pages - 1; page_number++) {
-            page_buffer.next_free_page_number = page_number + 1;
-            write_block(fd, &page_buffer, PAGE_SIZE, PAGE_SIZE * page_number);
+        // Initialize the allocation pages of the new groups
+        for (pagenum_t group = AllocationView::group_of(old_num_of_pages); group <= AllocationView::group_of(new_num_of_pages - 1); group++) {
+            allocation_page_number = AllocationView::allocation_page_number(group);
+            if (allocation_page_number < old_num_of_pages || allocation_page_number >= new_num_of_pages) continue;
+            AllocationView(&page_buffer).init(group);
+            write_block(fd, &page_buffer, PAGE_SIZE, PAGE_SIZE * allocation_page_number);
         }
-        page_buffer.next_free_page_number = old_next_free_page_number;
-        write_block(fd, &page_buffer, PAGE_SIZE, PAGE_SIZE * (new_num_of_pages - 1));
     }
 
     // Return that file size is invalid value
@@ -18,7 +18,7 @@ int64_t open_table(char* pathname)
 // Insert input 'key/value' (record) with its size to data file at the right place
 int db_insert(int64_t table_id, int64_t key, char* value, uint16_t val_size)
 {
-    DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", key: " + std::to_string(key) + ", value: \"" + std::string(value) + "\" )");
+    if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", key: " + std::to_string(key) + ", value: \"" + std::string(value) + "\" )");
 
     pagenum_t root_page_number;
     std::string value_str;
@@ -48,7 +48,7 @@ int db_insert(int64_t table_id, int64_t key, char* value, uint16_t val_size)
 // Find the record containing input 'key'
 int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size)
 {
-    DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", key: " + std::to_string(key) + " )");
+    if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", key: " + std::to_string(key) + " )");
 
     pagenum_t root_page_number;
     std::string value;
@@ -76,7 +76,7 @@ int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size)
 // Find the matching record and delete it if found
 int db_delete(int64_t table_id, int64_t key)
 {
-    DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", key: " + std::to_string(key) + " )");
+    if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", key: " + std::to_string(key) + " )");
 
     pagenum_t root_page_number;
     int flag;
@@ -92,8 +92,64 @@ int db_delete(int64_t table_id, int64_t key)
     return FLAG::SUCCESS;
 }
 
+// Call back the records having keys in the range in key order
+int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key, const scan_func_t& callback)
+{
+    if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", begin_key: " + std::to_string(begin_key) + ", end_key: " + std::to_string(end_key) + " )");
+
+    pagenum_t root_page_number;
+
+    // Get root page number
+    root_page_number = BPT::get_root_page(table_id);
+    if (root_page_number == 0) return FLAG::FAILURE;
+
+    // Scan the records along the leaf chain
+    return BPT::scan(table_id, root_page_number, begin_key, end_key, callback);
+}
+
+// Find the records of many keys sharing the descents
+int db_find_batch(int64_t table_id, const int64_t* keys, int num_keys, char** ret_vals, uint16_t* val_sizes)
+{
+    if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", num_keys: " + std::to_string(num_keys) + " )");
+
+    pagenum_t root_page_number;
+
+    // Check if pointers to return are valid
+    if (keys == NULL || ret_vals == NULL || val_sizes == NULL) return FLAG::FAILURE;
+    std::fill(val_sizes, val_sizes + num_keys, 0);
+
+    // Get root page number
+    root_page_number = BPT::get_root_page(table_id);
+    if (root_page_number == 0) return FLAG::FAILURE;
+
+    // Assign the found values and sizes
+    return BPT::find_batch(table_id, root_page_number, keys, num_keys, [&](int index, const char* value, uint16_t size) {
+        memcpy(ret_vals[index], value, size);
+        ret_vals[index][size] = 0;
+        val_sizes[index] = size;
+    });
+}
+
+// Open a cursor on the first record in the range
+BPT::Cursor db_open_cursor(int64_t table_id, int64_t begin_key, int64_t end_key)
+{
+    if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + ", begin_key: " + std::to_string(begin_key) + ", end_key: " + std::to_string(end_key) + " )");
+
+    return BPT::Cursor(table_id, BPT::get_root_page(table_id), begin_key, end_key);
+}
+
+// Build the table bottom-up from sorted records
+int db_bulk_load(int64_t table_id, const bulk_load_func_t& next_record, double fill_factor)
+{
+    if (DebugUtil::DEBUG_MODE) DebugUtil::PrintMarker(__func__,"( table_id: " + std::to_string(table_id) + " )");
+
+    // Load the records into the empty table
+    return BPT::bulk_load(table_id, next_record, fill_factor);
+}
+
 // Initialize database management system
-int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path)
+int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path,
+            int buffer_policy, int dirty_high_water_percent, int max_recovery_time_ms)
 {
     DebugUtil::PrintMarker(__func__);
 
@@ -104,9 +160,22 @@ int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_pat
     if (ret_code) return FLAG::FAILURE;
 
     // Buffer manager initialization
-    ret_code = BUF::init_buffer(num_buf);
+    ret_code = BUF::init_buffer(num_buf, buffer_policy, dirty_high_water_percent);
     if (ret_code) return FLAG::FAILURE;
 
+    // Log manager initialization (starts the log flusher) and recovery of the tables in the log
+    if (log_path != NULL && logmsg_path != NULL) {
+        LOG::init(log_path, logmsg_path);
+        ret_code = LOG::recovery(flag, log_num);
+        if (ret_code) return FLAG::FAILURE;
+
+        // Never reuse the transaction ids in the log (or in the log truncated before, kept in the master record)
+        TRX::skip_trx_ids(LOG::get_last_trx_id());
+
+        // Take checkpoints in background to keep the recovery time bounded
+        LOG::start_checkpointer(max_recovery_time_ms);
+    }
+
     return FLAG::SUCCESS;
 }
 
@@ -115,21 +184,64 @@ int shutdown_db()
 {
     DebugUtil::PrintMarker(__func__);
 
-    // Flush buffer data and close all opened table files
+    // Stop the background threads, flush buffer data (each page after its log), checkpoint the clean state (the log before it is given back), and close all opened table files
+    TRX::shutdown_trx_manager();
+    LOG::stop_checkpointer();
     BUF::clear_buffer();
+    LOG::checkpoint();
     file_close_table_files();
+    LOG::shutdown();
 
     return FLAG::SUCCESS;
 }
 
 
 /// Index Manager APIs with Transaction Control
-// Read a value in the table with a matching key for the transaction having trx_id
+// Read a value in the table with a matching key as of the read view of the transaction having trx_id
 int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size, int trx_id)
 {
     printf("[INFO][%s][trx_id: %d] ( table_id: %d, key: %d )\n", __func__, trx_id, table_id, key);
 
-    lock_t* lock;
+    const read_view_t* read_view;
+    pagenum_t root_page;
+    std::string value;
+    int flag, writer_trx_id;
+
+    // Check if pointer to return is valid
+    if (ret_val == NULL || val_size == NULL) return FLAG::FAILURE;
+
+    // Get the read view of the transaction
+    read_view = TRX::open_read_view(trx_id);
+    if (read_view == NULL) return FLAG::FATAL;
+
+    // Get root page number
+    root_page = BPT::get_root_page(table_id);
+    if (root_page == 0) return FLAG::FAILURE;
+
+    // Find the record (no leaf to read ahead) and take its value with the transaction that wrote it
+    BPT::Cursor cursor(table_id, root_page, key, key, 0);
+    if (!cursor.is_valid()) return FLAG::FAILURE;
+    value.assign(cursor.value(), cursor.size());
+    writer_trx_id = cursor.trx_id();
+    cursor.release();
+
+    // Go back to the version the read view sees
+    flag = TRX::read_version(read_view, table_id, key, value, writer_trx_id);
+    if (flag) return flag;
+
+    // Assign the found value and size
+    memset(ret_val, 0, value.size()+1);
+    std::copy(value.begin(), value.begin()+value.size(), ret_val);
+    *val_size = value.size();
+
+    return FLAG::SUCCESS;
+}
+
+// Read the latest value with a matching key taking a record lock of lock_mode for the transaction
+int db_find_locking(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size, int trx_id, int lock_mode)
+{
+    printf("[INFO][%s][trx_id: %d] ( table_id: %d, key: %d, lock_mode: %d )\n", __func__, trx_id, table_id, key, lock_mode);
+
     pagenum_t root_page, key_page;
     std::string value;
     int flag, record_id, old_trx_id, pin_id;
@@ -153,7 +265,7 @@ int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size, in
     }
 
     // Acquire lock
-    flag = TRX::acquire_lock(table_id, key_page, key, trx_id, old_trx_id, LOCK_MODE_SHARED);
+    flag = TRX::acquire_lock(table_id, key_page, key, record_id, trx_id, old_trx_id, lock_mode);
     if (flag) return flag;
 
     // Find the record corresponding to key
@@ -168,6 +280,75 @@ int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size, in
     return FLAG::SUCCESS;
 }
 
+// Scan the records in the range as of the read view of the transaction
+int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key, const scan_func_t& callback, int trx_id)
+{
+    printf("[INFO][%s][trx_id: %d] ( table_id: %ld, begin_key: %ld, end_key: %ld )\n", __func__, trx_id, table_id, begin_key, end_key);
+
+    const read_view_t* read_view;
+    pagenum_t root_page;
+    std::string value;
+    int flag;
+
+    // Get the read view of the transaction
+    read_view = TRX::open_read_view(trx_id);
+    if (read_view == NULL) return FLAG::FATAL;
+
+    // Get root page number
+    root_page = BPT::get_root_page(table_id);
+    if (root_page == 0 || begin_key > end_key) return FLAG::FAILURE;
+
+    for (BPT::Cursor cursor(table_id, root_page, begin_key, end_key); cursor.is_valid(); cursor.next()) {
+        // Go back to the version the read view sees (while the leaf is pinned)
+        value.assign(cursor.value(), cursor.size());
+        flag = TRX::read_version(read_view, table_id, cursor.key(), value, cursor.trx_id());
+        if (flag) return flag;
+
+        // Call back the record
+        if (!callback(cursor.key(), value.data(), value.size())) break;
+    }
+
+    return FLAG::SUCCESS;
+}
+
+// Scan the records in the range with a record lock of lock_mode on each record
+int db_scan_locking(int64_t table_id, int64_t begin_key, int64_t end_key, const scan_func_t& callback, int trx_id, int lock_mode)
+{
+    printf("[INFO][%s][trx_id: %d] ( table_id: %ld, begin_key: %ld, end_key: %ld, lock_mode: %d )\n", __func__, trx_id, table_id, begin_key, end_key, lock_mode);
+
+    pagenum_t root_page, key_page;
+    int64_t key;
+    int flag, record_id, old_trx_id;
+
+    // Get root page number
+    root_page = BPT::get_root_page(table_id);
+    if (root_page == 0 || begin_key > end_key) return FLAG::FAILURE;
+
+    BPT::Cursor cursor(table_id, root_page, begin_key, end_key);
+    while (cursor.is_valid()) {
+        // Release the leaf while acquiring the record lock (as db_find_locking does)
+        key = cursor.key();
+        key_page = cursor.page_number();
+        record_id = cursor.record_id();
+        old_trx_id = cursor.trx_id();
+        cursor.release();
+
+        flag = TRX::acquire_lock(table_id, key_page, key, record_id, trx_id, old_trx_id, lock_mode);
+        if (flag) return flag;
+
+        // Pin the leaf again (lock the next record instead if the record is gone)
+        cursor.restore();
+        if (!cursor.is_valid()) break;
+        if (cursor.key() != key) continue;
+
+        // Call back the locked record
+        if (!callback(cursor.key(), cursor.value(), cursor.size())) break;
+        cursor.next();
+    }
+
+    return FLAG::SUCCESS;
+}
+
 // Find the matching key and modify the values
 int db_update(int64_t table_id, int64_t key, char* values, uint16_t val_size, uint16_t* old_val_size, int trx_id)
 {
@@ -177,10 +358,13 @@ int db_update(int64_t table_id, int64_t key, char* values, uint16_t val_size, ui
     std::string value_old, value_new;
     Record record_old;
     char value_char[VALUE_MAX_SIZE+1];
+    std::vector<leaf_image_t> images;
     int flag, record_id, old_trx_id, pin_id;
+    int64_t lsn, prev_lsn;
 
-    // Check if pointer to return is valid
+    // Check if pointer to return is valid and the size of the value
     if (values == NULL || old_val_size == NULL) return FLAG::FAILURE;
+    if (val_size < VALUE_MIN_SIZE || val_size > VALUE_MAX_SIZE) return FLAG::FAILURE;
 
     // Convert char* to std::string
     memset(&value_char, 0, val_size+1);
@@ -195,26 +379,39 @@ int db_update(int64_t table_id, int64_t key, char* values, uint16_t val_size, ui
     key_page = BPT::find_leaf(table_id, root_page, key);
     if (key_page == 0) return FLAG::FAILURE;
 
-    // Check if the record exists and acquire page latch (as pin)
+    // Check if the record exists and acquire page latch and release (as pin)
     std::tie(old_trx_id, record_id) = BPT::find_record(table_id, key_page, key, pin_id);
+    BPT::unpin_node_page(pin_id);
     if (old_trx_id < 0 && record_id < 0) {
-        BPT::unpin_node_page(pin_id);
         return FLAG::FAILURE;
     }
 
-    // Acquire lock
-    flag = TRX::acquire_lock(table_id, key_page, key, trx_id, old_trx_id, LOCK_MODE_EXCLUSIVE);
+    // Acquire lock (never wait for a record lock while holding the page latch)
+    flag = TRX::acquire_lock(table_id, key_page, key, record_id, trx_id, old_trx_id, LOCK_MODE_EXCLUSIVE);
     if (flag) return flag;
 
-    // Update the record corresponding to key (NOT unpin for logging)
-    flag = BPT::update(table_id, key_page, key, record_old, value_new, trx_id, pin_id);
+    // Update the record corresponding to key in the frame (NOT unpin for logging)
+    pin_id = BUF::pin_page(table_id, key_page, true);
+    flag = BPT::update(table_id, key_page, key, record_old, value_new, trx_id, pin_id, images);
     if (flag) {
         BPT::unpin_node_page(pin_id);
         return FLAG::FAILURE;
     }
 
-    // Save log and unpin
-    flag = TRX::save_log(trx_id, table_id, key_page, key, record_old.value, record_old.trx_id);
+    // Write the redo/undo log records while the page is still latched, and stamp the page with the last
+    // (a compaction before the update is redo only, so it is logged as a compensation skipped by the undo)
+    prev_lsn = TRX::get_last_lsn(trx_id);
+    lsn = -1;
+    for (leaf_image_t& image : images) {
+        lsn = TRX::write_log(
+            trx_id, image.redo_only ? LOG::COMPENSATE : LOG::UPDATE, table_id, key_page, image.offset, image.old_img.size(),
+            image.old_img.data(), image.new_img.data(), image.redo_only ? TRX::get_last_lsn(trx_id) : -1, image.kind
+        );
+    }
+    if (lsn >= 0) BUF::stamp_page(pin_id, lsn);
+
+    // Save log (its compensation continues from the record before) and unpin
+    flag = TRX::save_log(trx_id, table_id, key_page, key, record_id, record_old.value, record_old.trx_id, prev_lsn);
     BPT::unpin_node_page(pin_id);
     if (flag) return FLAG::FAILURE;
 
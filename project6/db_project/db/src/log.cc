@@ -1,75 +1,124 @@
 #include "log.h"
+#include "buffer.h"
+#include "file.h"
+#include "trx.h"
 
 /// Log Record
 LogRecord::LogRecord()
     : log_size(0), lsn(-1), prev_lsn(-1), trx_id(0), log_type(0),
-      table_id(0), page_num(0), offset(0), length(0)
+      table_id(0), page_num(0), offset(0), length(0), image_kind(IMAGE::RAW), next_undo_lsn(-1)
 {}
 
 LogRecord::LogRecord(int trx_id)
     : log_size(0), lsn(-1), prev_lsn(-1), trx_id(trx_id), log_type(0),
-      table_id(0), page_num(0), offset(0), length(0)
+      table_id(0), page_num(0), offset(0), length(0), image_kind(IMAGE::RAW), next_undo_lsn(-1)
 {}
 
-char* LogRecord::to_bytes()
-{
-    int offset = 0;
-    char* bytes = new char[this->log_size+1];
-    memset(bytes, 0, this->log_size+1);
-
-    memcpy(bytes, &this->log_size, sizeof(this->log_size));
-    offset += sizeof(this->log_size);
-    memcpy(bytes + offset, &this->lsn, sizeof(this->lsn));
-    offset += sizeof(this->lsn);
-    memcpy(bytes + offset, &this->prev_lsn, sizeof(this->prev_lsn));
-    offset += sizeof(this->prev_lsn);
-    memcpy(bytes + offset, &this->trx_id, sizeof(this->trx_id));
-    offset += sizeof(this->trx_id);
-    memcpy(bytes + offset, &this->log_type, sizeof(this->log_type));
-    offset += sizeof(this->log_type);
-
-    if (this->log_type >= LOG::UPDATE) {
-        memcpy(bytes + offset, &this->table_id, sizeof(this->table_id));
-        offset += sizeof(this->table_id);
-        memcpy(bytes + offset, &this->page_num, sizeof(this->page_num));
-        offset += sizeof(this->page_num);
-        memcpy(bytes + offset, &this->offset, sizeof(this->offset));
-        offset += sizeof(this->offset);
-        memcpy(bytes + offset, &this->length, sizeof(this->length));
-        offset += sizeof(this->length);
-        memcpy(bytes + offset, this->old_img.c_str(), this->old_img.length());
-        offset += this->old_img.length();
-        memcpy(bytes + offset, this->new_img.c_str(), this->new_img.length());
-        offset += this->new_img.length();
+// Parse a record serialized by LogManager::log
+LogRecord::LogRecord(const char* bytes)
+    : LogRecord()
+{
+    size_t pos = 0;
+
+    memcpy(&this->log_size, bytes + pos, sizeof(size_t));
+    pos += sizeof(size_t);
+    memcpy(&this->lsn, bytes + pos, sizeof(int64_t));
+    pos += sizeof(int64_t);
+    memcpy(&this->prev_lsn, bytes + pos, sizeof(int64_t));
+    pos += sizeof(int64_t);
+    memcpy(&this->trx_id, bytes + pos, sizeof(int));
+    pos += sizeof(int);
+    memcpy(&this->log_type, bytes + pos, sizeof(int));
+    pos += sizeof(int);
+
+    if (this->log_type == LOG::UPDATE || this->log_type == LOG::COMPENSATE) {
+        memcpy(&this->table_id, bytes + pos, sizeof(int64_t));
+        pos += sizeof(int64_t);
+        memcpy(&this->page_num, bytes + pos, sizeof(pagenum_t));
+        pos += sizeof(pagenum_t);
+        memcpy(&this->offset, bytes + pos, sizeof(uint16_t));
+        pos += sizeof(uint16_t);
+        memcpy(&this->length, bytes + pos, sizeof(uint16_t));
+        pos += sizeof(uint16_t);
+        memcpy(&this->image_kind, bytes + pos, sizeof(uint8_t));
+        pos += sizeof(uint8_t);
+        this->old_img.assign(bytes + pos, this->length);
+        pos += this->length;
+        this->new_img.assign(bytes + pos, this->length);
+        pos += this->length;
     }
 
     if (this->log_type == LOG::COMPENSATE) {
-        memcpy(bytes + offset, &this->next_undo_lsn, sizeof(this->next_undo_lsn));
-        offset += sizeof(this->next_undo_lsn);
+        memcpy(&this->next_undo_lsn, bytes + pos, sizeof(int64_t));
     }
 
-    return bytes;
+    if (this->log_type == LOG::END_CHECKPOINT) {
+        int num_trxs, num_pages;
+
+        memcpy(&num_trxs, bytes + pos, sizeof(int));
+        pos += sizeof(int);
+        memcpy(&num_pages, bytes + pos, sizeof(int));
+        pos += sizeof(int);
+
+        this->active_trxs.resize(num_trxs);
+        for (att_entry_t& entry : this->active_trxs) {
+            memcpy(&entry.trx_id, bytes + pos, sizeof(int));
+            pos += sizeof(int);
+            memcpy(&entry.first_lsn, bytes + pos, sizeof(int64_t));
+            pos += sizeof(int64_t);
+            memcpy(&entry.last_lsn, bytes + pos, sizeof(int64_t));
+            pos += sizeof(int64_t);
+        }
+
+        this->dirty_pages.resize(num_pages);
+        for (dpt_entry_t& entry : this->dirty_pages) {
+            memcpy(&entry.table_id, bytes + pos, sizeof(int64_t));
+            pos += sizeof(int64_t);
+            memcpy(&entry.page_num, bytes + pos, sizeof(pagenum_t));
+            pos += sizeof(pagenum_t);
+            memcpy(&entry.rec_lsn, bytes + pos, sizeof(int64_t));
+            pos += sizeof(int64_t);
+        }
+    }
 }
 
 /// Log Manager
 LogManager::LogManager()
-    : log_message_file(NULL)
-{}
+    : log_message_file(NULL), log_fd(-1), log_buffer(NULL),
+      lsn_to_assgin(0), lsn_to_write(0), lsn_to_flush(0), lsn_requested(0), is_running(false), last_trx_id(0),
+      redo_lsn(0), truncated_lsn(0), redo_bytes_per_ms(REDO_BYTES_PER_MS), max_recovery_time_ms(MAX_RECOVERY_TIME_MS),
+      is_recovered(true), checkpointer_running(false)
+{
+    pthread_mutex_init(&this->log_buffer_latch, NULL);
+    pthread_cond_init(&this->flush_cond, NULL);
+    pthread_cond_init(&this->flushed_cond, NULL);
+    pthread_mutex_init(&this->checkpoint_latch, NULL);
+    pthread_cond_init(&this->checkpointer_cond, NULL);
+}
 
+// Reserve the space of a record and return its lsn
 int64_t LogManager::assign_lsn(size_t size)
 {
-    int64_t lsn = this->lsn_to_assgin;
-    this->lsn_to_assgin += size;
+    int64_t lsn = this->lsn_to_assgin.fetch_add(size);
+
+    // Wait for the flusher if the space still holds records not written yet
+    if (lsn + (int64_t)size - this->lsn_to_flush > (int64_t)LOG_BUFFER_SIZE) {
+        pthread_mutex_lock(&this->log_buffer_latch);
+        while (lsn + (int64_t)size - this->lsn_to_flush > (int64_t)LOG_BUFFER_SIZE) {
+            this->wait_flushed(this->lsn_to_flush);
+        }
+        pthread_mutex_unlock(&this->log_buffer_latch);
+    }
     return lsn;
 }
 
 size_t LogManager::get_log_size(int type, size_t img_length)
 {
     size_t default_size = sizeof(size_t) + sizeof(int64_t)*2 + sizeof(int)*2;
-    size_t detail_size = sizeof(int64_t) + sizeof(pagenum_t) + sizeof(uint16_t)*2 + img_length*2;
+    size_t detail_size = sizeof(int64_t) + sizeof(pagenum_t) + sizeof(uint16_t)*2 + sizeof(uint8_t) + img_length*2;
 
     // Return size of log record by type
-    if (type == LOG::BEGIN || type == LOG::COMMIT || type == LOG::ROLLBACK) {
+    if (type == LOG::BEGIN || type == LOG::COMMIT || type == LOG::ROLLBACK || type == LOG::BEGIN_CHECKPOINT) {
         return default_size;
     } else if (type == LOG::UPDATE) {
         return default_size + detail_size;
@@ -80,111 +129,789 @@ size_t LogManager::get_log_size(int type, size_t img_length)
     }
 }
 
-int64_t LogManager::get_prev_lsn(int trx_id)
+size_t LogManager::get_checkpoint_size(size_t num_trxs, size_t num_pages)
 {
-    // Find previous lsn of transaction
-    for (int i = this->log_buffer.size() - 1; i >= 0; i--) {
-        if (this->log_buffer[i].trx_id == trx_id) {
-            return this->log_buffer[i].lsn;
+    size_t att_entry_size = sizeof(int) + sizeof(int64_t)*2;
+    size_t dpt_entry_size = sizeof(int64_t) + sizeof(pagenum_t) + sizeof(int64_t);
+
+    // Return size of END_CHECKPOINT record with the tables
+    return this->get_log_size(LOG::BEGIN_CHECKPOINT) + sizeof(int)*2 + num_trxs * att_entry_size + num_pages * dpt_entry_size;
+}
+
+// Copy bytes into the ring at lsn (wrapping around the end) and return the lsn after them
+int64_t LogManager::write_bytes(int64_t lsn, const void* bytes, size_t size)
+{
+    size_t offset = lsn % LOG_BUFFER_SIZE;
+    size_t first = std::min(size, LOG_BUFFER_SIZE - offset);
+
+    memcpy(this->log_buffer + offset, bytes, first);
+    memcpy(this->log_buffer, (const char*)bytes + first, size - first);
+    return lsn + size;
+}
+
+// Serialize the fields common to every record at lsn and return the lsn after them
+int64_t LogManager::write_header(int64_t lsn, size_t size, int64_t prev_lsn, int trx_id, int type)
+{
+    int64_t pos;
+
+    pos = this->write_bytes(lsn, &size, sizeof(size_t));
+    pos = this->write_bytes(pos, &lsn, sizeof(int64_t));
+    pos = this->write_bytes(pos, &prev_lsn, sizeof(int64_t));
+    pos = this->write_bytes(pos, &trx_id, sizeof(int));
+    pos = this->write_bytes(pos, &type, sizeof(int));
+    return pos;
+}
+
+// Publish the record in [lsn, end) after every record reserved before it
+void LogManager::publish(int64_t lsn, int64_t end)
+{
+    // Wait for the records before (they are being copied by other appenders)
+    while (this->lsn_to_write.load(std::memory_order_acquire) != lsn) {
+        sched_yield();
+    }
+    this->lsn_to_write.store(end, std::memory_order_release);
+
+    // Wake up the flusher if someone waits for the record
+    // (under the latch, so that the flusher either sees the record before it sleeps or gets the signal)
+    if (this->lsn_requested.load() > lsn) {
+        pthread_mutex_lock(&this->log_buffer_latch);
+        pthread_cond_signal(&this->flush_cond);
+        pthread_mutex_unlock(&this->log_buffer_latch);
+    }
+}
+
+// Wait until the record at lsn is durable (log buffer latch must be held)
+void LogManager::wait_flushed(int64_t lsn)
+{
+    while (this->lsn_to_flush <= lsn) {
+        // Request the flusher to write up to the lsn and join the batch
+        if (this->lsn_requested < lsn + 1) this->lsn_requested = lsn + 1;
+        pthread_cond_signal(&this->flush_cond);
+        pthread_cond_wait(&this->flushed_cond, &this->log_buffer_latch);
+    }
+}
+
+void* LogManager::flusher_main(void* arg)
+{
+    LogManager* log_manager = (LogManager*)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&log_manager->log_buffer_latch);
+    while (log_manager->is_running || log_manager->lsn_to_flush < log_manager->lsn_to_assgin) {
+        // Sleep until a waiter requests published records or the flush interval passes
+        // (also at shutdown while a reserved record is not published yet, its publisher wakes the flusher)
+        if (log_manager->lsn_to_write == log_manager->lsn_to_flush ||
+            (log_manager->is_running && log_manager->lsn_requested <= log_manager->lsn_to_flush)) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&log_manager->flush_cond, &log_manager->log_buffer_latch, &deadline);
+        }
+
+        // Write every record published so far as a batch
+        if (log_manager->lsn_to_flush < log_manager->lsn_to_write) {
+            log_manager->flush_batch();
         }
     }
+    pthread_mutex_unlock(&log_manager->log_buffer_latch);
+
+    return NULL;
+}
+
+// Write and sync the records in [lsn_to_flush, lsn_to_write) (log buffer latch must be held)
+void LogManager::flush_batch()
+{
+    struct iovec iov[2];
+    int64_t begin, end;
+    size_t offset, size;
+    int num_iov;
+    ssize_t written;
+
+    // Take the batch (only the flusher moves lsn_to_flush, so the bytes stay in the ring)
+    begin = this->lsn_to_flush;
+    end = this->lsn_to_write.load(std::memory_order_acquire);
+    offset = begin % LOG_BUFFER_SIZE;
+    size = end - begin;
+
+    // Describe the batch as one or two regions of the ring
+    iov[0].iov_base = this->log_buffer + offset;
+    iov[0].iov_len = std::min(size, LOG_BUFFER_SIZE - offset);
+    iov[1].iov_base = this->log_buffer;
+    iov[1].iov_len = size - iov[0].iov_len;
+    num_iov = iov[1].iov_len ? 2 : 1;
+
+    // Write and sync the batch without the latch, so that appenders keep going
+    pthread_mutex_unlock(&this->log_buffer_latch);
+    written = pwritev(this->log_fd, iov, num_iov, begin);
+    if (written != (ssize_t)size || fdatasync(this->log_fd) != 0) {
+        std::cout << "[LogManager::flush_batch] Failed to write the log file" << std::endl;
+        exit(1);
+    }
+    pthread_mutex_lock(&this->log_buffer_latch);
 
-    // Return 0 if not found
-    return 0;
+    // Wake up the waiters of the batch and the appenders waiting for space
+    this->lsn_to_flush = end;
+    pthread_cond_broadcast(&this->flushed_cond);
 }
 
 void LogManager::init(const char* log_path, const char* logmsg_path)
 {
-    int fd;
-    const int flags = O_RDWR | O_CREAT | O_SYNC;
+    int flag;
+    int64_t lsn;
+    const int flags = O_RDWR | O_CREAT;
     const mode_t permission = 0777;
 
     // Open log files
     this->log_message_file = fopen(logmsg_path, "w");
     this->log_fd = open(log_path, flags, permission);
-    
-    // Initialize log buffer
-    this->lsn_to_flush = 0;
-    this->lsn_to_assgin = 0;
-    this->log_buffer.clear();
-    pthread_mutex_init(&this->log_buffer_latch, NULL);
 
     // Check whether the log file is validly opened
     if (this->log_fd < 0 || this->log_message_file == NULL) {
         std::cout << "[LogManager::init] Failed to open a log files" << std::endl;
         exit(1);
     }
+
+    // Read the master record, or write it to a new log file
+    lsn = lseek(this->log_fd, 0, SEEK_END);
+    if (lsn < LOG_FILE_HEADER_SIZE) {
+        lsn = LOG_FILE_HEADER_SIZE;
+        this->master.checkpoint_lsn = -1;
+        this->master.start_lsn = lsn;
+        this->master.next_trx_id = 1;
+        if (ftruncate(this->log_fd, lsn) != 0) {
+            std::cout << "[LogManager::init] Failed to initialize the log file" << std::endl;
+            exit(1);
+        }
+        this->write_master();
+    } else if (pread(this->log_fd, &this->master, sizeof(log_file_header_t), 0) != sizeof(log_file_header_t)) {
+        std::cout << "[LogManager::init] Failed to read the master record" << std::endl;
+        exit(1);
+    }
+    this->redo_lsn = this->master.start_lsn;
+    this->truncated_lsn = LOG_FILE_HEADER_SIZE;
+    this->last_trx_id = std::max(this->master.next_trx_id - 1, 0);
+    this->is_recovered = true;
+
+    // Initialize log buffer (new records are appended after the existing log)
+    this->lsn_to_assgin = this->lsn_to_write = this->lsn_to_flush = this->lsn_requested = lsn;
+    this->log_buffer = new char[LOG_BUFFER_SIZE];
+
+    // Start the log flusher
+    this->is_running = true;
+    flag = pthread_create(&this->flusher, NULL, flusher_main, this);
+    if (flag != 0) {
+        std::cout << "[LogManager::init] Failed to create the log flusher" << std::endl;
+        exit(1);
+    }
 }
 
-int LogManager::recovery(int flag)
+void LogManager::shutdown()
 {
-
-    return 0;
+    // Stop the checkpointer first (it appends records)
+    this->stop_checkpointer();
+
+    // Stop the log flusher after it writes the remaining records
+    pthread_mutex_lock(&this->log_buffer_latch);
+    if (!this->is_running) {
+        pthread_mutex_unlock(&this->log_buffer_latch);
+        return;
+    }
+    this->is_running = false;
+    this->lsn_requested = this->lsn_to_assgin.load();
+    pthread_cond_signal(&this->flush_cond);
+    pthread_mutex_unlock(&this->log_buffer_latch);
+    pthread_join(this->flusher, NULL);
+
+    // Close log files
+    close(this->log_fd);
+    fclose(this->log_message_file);
+    this->log_fd = -1;
+    this->log_message_file = NULL;
+    delete[] this->log_buffer;
+    this->log_buffer = NULL;
 }
 
-int64_t LogManager::log(int type, int trx_id, int64_t table_id, pagenum_t page_num, uint16_t offset, uint16_t length, std::string old_img, std::string new_img, int64_t next_undo_lsn)
+// Append a log record and return its lsn (the caller keeps the last lsn of the transaction as prev_lsn)
+int64_t LogManager::log(int type, int trx_id, int64_t prev_lsn, int64_t table_id, pagenum_t page_num, uint16_t offset, uint16_t length, const char* old_img, const char* new_img, int64_t next_undo_lsn, uint8_t image_kind)
 {
-    int flag;
-    LogRecord log_record;
     size_t size;
+    int64_t lsn, pos;
 
-    // Acquire the log buffer latch
-    flag = pthread_mutex_lock(&this->log_buffer_latch);
-    if (flag != 0) return -1;
+    // Check whether the log manager is running
+    if (!this->is_running) return -1;
 
-    // Set new log record
+    // Reserve the space of the record
     size = this->get_log_size(type, length);
-    log_record.lsn = this->assign_lsn(size);
-    log_record.prev_lsn = this->get_prev_lsn(trx_id);
-    log_record.trx_id = trx_id;
-    log_record.log_type = type;
-
-    if (type >= LOG::UPDATE) {
-        log_record.table_id = table_id;
-        log_record.page_num = page_num;
-        log_record.offset = offset;
-        log_record.length = length;
-        log_record.old_img = old_img;
-        log_record.new_img = new_img;
-    } 
+    lsn = this->assign_lsn(size);
+
+    // Serialize the record directly into the reserved space
+    pos = this->write_header(lsn, size, prev_lsn, trx_id, type);
+
+    if (type == LOG::UPDATE || type == LOG::COMPENSATE) {
+        pos = this->write_bytes(pos, &table_id, sizeof(int64_t));
+        pos = this->write_bytes(pos, &page_num, sizeof(pagenum_t));
+        pos = this->write_bytes(pos, &offset, sizeof(uint16_t));
+        pos = this->write_bytes(pos, &length, sizeof(uint16_t));
+        pos = this->write_bytes(pos, &image_kind, sizeof(uint8_t));
+        pos = this->write_bytes(pos, old_img, length);
+        pos = this->write_bytes(pos, new_img, length);
+    }
 
     if (type == LOG::COMPENSATE) {
-        log_record.next_undo_lsn = next_undo_lsn;
+        pos = this->write_bytes(pos, &next_undo_lsn, sizeof(int64_t));
     }
 
-    // Append log record to log buffer
-    this->log_buffer.push_back(log_record);
+    // Publish the record to the flusher
+    this->publish(lsn, pos);
+    return lsn;
+}
+
+// Wait until the record at lsn is durable and return the flushed lsn (end of the durable log)
+int64_t LogManager::flush(int64_t lsn)
+{
+    int64_t lsn_flushed;
+
+    // The record is durable already (page writes mostly end here)
+    lsn_flushed = this->lsn_to_flush;
+    if (lsn < lsn_flushed) return lsn_flushed;
 
-    // Release the log buffer latch
+    pthread_mutex_lock(&this->log_buffer_latch);
+    if (this->is_running) {
+        this->wait_flushed(std::min(lsn, this->lsn_to_assgin - 1));
+    }
+    lsn_flushed = this->lsn_to_flush;
     pthread_mutex_unlock(&this->log_buffer_latch);
-    return log_record.lsn;
+
+    return lsn_flushed;
 }
 
+// Wait until every record appended so far is durable
 int64_t LogManager::force()
 {
-    int flag;
+    return this->flush(this->lsn_to_assgin - 1);
+}
+
+
+/// Checkpointer
+void* LogManager::checkpointer_main(void* arg)
+{
+    LogManager* log_manager = (LogManager*)arg;
+    struct timespec deadline;
+    int64_t budget;
+
+    pthread_mutex_lock(&log_manager->checkpoint_latch);
+    while (log_manager->checkpointer_running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += CHECKPOINT_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&log_manager->checkpointer_cond, &log_manager->checkpoint_latch, &deadline);
+        if (!log_manager->checkpointer_running) break;
+
+        // Take a checkpoint when the log to redo reaches half of the recovery time
+        budget = (int64_t)log_manager->max_recovery_time_ms * log_manager->redo_bytes_per_ms;
+        if (log_manager->get_next_lsn() - log_manager->redo_lsn > budget / 2) {
+            pthread_mutex_unlock(&log_manager->checkpoint_latch);
+            log_manager->checkpoint();
+            pthread_mutex_lock(&log_manager->checkpoint_latch);
+        }
+    }
+    pthread_mutex_unlock(&log_manager->checkpoint_latch);
+
+    return NULL;
+}
+
+// Append END_CHECKPOINT record with the active transaction table and the dirty page table
+int64_t LogManager::log_checkpoint(const std::vector<att_entry_t>& active_trxs, const std::vector<dpt_entry_t>& dirty_pages)
+{
     size_t size;
-    char* bytes;
+    int64_t lsn, pos;
+    int num_trxs = active_trxs.size(), num_pages = dirty_pages.size();
+
+    // Check whether the log manager is running
+    if (!this->is_running) return -1;
+
+    // Reserve the space of the record
+    size = this->get_checkpoint_size(num_trxs, num_pages);
+    lsn = this->assign_lsn(size);
+
+    // Serialize the tables
+    pos = this->write_header(lsn, size, -1, 0, LOG::END_CHECKPOINT);
+    pos = this->write_bytes(pos, &num_trxs, sizeof(int));
+    pos = this->write_bytes(pos, &num_pages, sizeof(int));
+    for (const att_entry_t& entry : active_trxs) {
+        pos = this->write_bytes(pos, &entry.trx_id, sizeof(int));
+        pos = this->write_bytes(pos, &entry.first_lsn, sizeof(int64_t));
+        pos = this->write_bytes(pos, &entry.last_lsn, sizeof(int64_t));
+    }
+    for (const dpt_entry_t& entry : dirty_pages) {
+        pos = this->write_bytes(pos, &entry.table_id, sizeof(int64_t));
+        pos = this->write_bytes(pos, &entry.page_num, sizeof(pagenum_t));
+        pos = this->write_bytes(pos, &entry.rec_lsn, sizeof(int64_t));
+    }
 
-    // Acquire the log buffer latch
-    flag = pthread_mutex_lock(&this->log_buffer_latch);
-    if (flag != 0) return -1;
+    // Publish the record to the flusher
+    this->publish(lsn, pos);
+    return lsn;
+}
 
-    // Flush log buffer to log file
-    while (this->lsn_to_flush < this->lsn_to_assgin) {
-        size = this->get_log_size(this->log_buffer[0].log_type, this->log_buffer[0].length);
-        bytes = this->log_buffer[0].to_bytes();
-        pwrite(this->log_fd, bytes, size, this->lsn_to_flush);
-        this->lsn_to_flush += size;
-        this->log_buffer.pop_front();
-        delete[] bytes;
+// Write and sync the master record
+void LogManager::write_master()
+{
+    if (pwrite(this->log_fd, &this->master, sizeof(log_file_header_t), 0) != sizeof(log_file_header_t) || fdatasync(this->log_fd) != 0) {
+        std::cout << "[LogManager::write_master] Failed to write the master record" << std::endl;
+        exit(1);
     }
+}
 
-    // Release the log buffer latch
-    pthread_mutex_unlock(&this->log_buffer_latch);
-    return this->lsn_to_flush;
+// Give back the disk space of the log before lsn in whole blocks (the file keeps its size, so that lsn stays the offset)
+void LogManager::truncate(int64_t lsn)
+{
+    int64_t end = lsn / LOG_FILE_HEADER_SIZE * LOG_FILE_HEADER_SIZE;
+
+    if (end <= this->truncated_lsn) return;
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // The space stays in use if the file system cannot punch a hole
+    fallocate(this->log_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, this->truncated_lsn, end - this->truncated_lsn);
+#endif
+    this->truncated_lsn = end;
+}
+
+void LogManager::start_checkpointer(int max_recovery_time_ms)
+{
+    int flag;
+
+    pthread_mutex_lock(&this->checkpoint_latch);
+    this->max_recovery_time_ms = max_recovery_time_ms;
+    if (this->checkpointer_running || !this->is_running) {
+        pthread_mutex_unlock(&this->checkpoint_latch);
+        return;
+    }
+    this->checkpointer_running = true;
+    pthread_mutex_unlock(&this->checkpoint_latch);
+
+    flag = pthread_create(&this->checkpointer, NULL, checkpointer_main, this);
+    if (flag != 0) {
+        std::cout << "[LogManager::start_checkpointer] Failed to create the checkpointer" << std::endl;
+        exit(1);
+    }
+}
+
+void LogManager::stop_checkpointer()
+{
+    pthread_mutex_lock(&this->checkpoint_latch);
+    if (!this->checkpointer_running) {
+        pthread_mutex_unlock(&this->checkpoint_latch);
+        return;
+    }
+    this->checkpointer_running = false;
+    pthread_cond_signal(&this->checkpointer_cond);
+    pthread_mutex_unlock(&this->checkpoint_latch);
+    pthread_join(this->checkpointer, NULL);
 }
 
+// Take a fuzzy checkpoint and return its lsn (workers keep going while the tables are collected)
+int64_t LogManager::checkpoint()
+{
+    std::vector<att_entry_t> active_trxs;
+    std::vector<dpt_entry_t> dirty_pages;
+    int64_t begin_lsn, end_lsn, redo_lsn, start_lsn, budget;
+
+    // Check whether the log manager is running (the log of a stopped recovery is kept for the next one)
+    if (!this->is_running || !this->is_recovered) return -1;
+    pthread_mutex_lock(&this->checkpoint_latch);
+
+    // Write the pages dirty for too long, so that the redo from the checkpoint fits in the recovery time
+    budget = (int64_t)this->max_recovery_time_ms * this->redo_bytes_per_ms;
+    BUF::flush_dirty_pages(this->get_next_lsn() - budget / 2);
+
+    // Collect the tables after the begin record (changes during the collection are in the log after it)
+    begin_lsn = this->log(LOG::BEGIN_CHECKPOINT, 0, -1);
+    TRX::get_active_trxs(active_trxs);
+    BUF::get_dirty_pages(dirty_pages);
+
+    // Write every dirty page if the tables do not fit in the log buffer
+    if (this->get_checkpoint_size(active_trxs.size(), dirty_pages.size()) > LOG_BUFFER_SIZE / 2) {
+        BUF::flush_dirty_pages(INT64_MAX);
+        dirty_pages.clear();
+        BUF::get_dirty_pages(dirty_pages);
+    }
+    if (this->get_checkpoint_size(active_trxs.size(), dirty_pages.size()) > LOG_BUFFER_SIZE / 2) {
+        pthread_mutex_unlock(&this->checkpoint_latch);
+        return -1;
+    }
+
+    end_lsn = this->log_checkpoint(active_trxs, dirty_pages);
+    this->flush(end_lsn);
+
+    // Redo starts at the oldest dirty page, and undo may go back to the first record of an active transaction
+    redo_lsn = begin_lsn;
+    for (const dpt_entry_t& entry : dirty_pages) redo_lsn = std::min(redo_lsn, entry.rec_lsn);
+    redo_lsn = std::max(redo_lsn, LOG_FILE_HEADER_SIZE);
+    start_lsn = redo_lsn;
+    for (const att_entry_t& entry : active_trxs) start_lsn = std::min(start_lsn, entry.first_lsn);
+    start_lsn = std::max(start_lsn, LOG_FILE_HEADER_SIZE);
+
+    // Point the master record to the checkpoint, and give back the log before the start
+    // (with the next transaction id, since the ids stamped on the records may be only in the log given back, or in the recovered one)
+    this->master.checkpoint_lsn = begin_lsn;
+    this->master.start_lsn = start_lsn;
+    this->master.next_trx_id = std::max(TRX::get_next_trx_id(), this->last_trx_id + 1);
+    this->write_master();
+    this->redo_lsn = redo_lsn;
+    this->truncate(start_lsn);
+
+    pthread_mutex_unlock(&this->checkpoint_latch);
+    return begin_lsn;
+}
+
+
+/// Recovery
+// Partition of the records redone by a worker thread (records of a page always go to the same worker)
+struct redo_partition_t
+{
+    LogManager* log_manager;
+    const std::vector<LogRecord>* records;
+    std::vector<size_t> indices;
+    std::vector<char> applied;          // whether the record at each index is applied (traced in lsn order after the workers)
+    pthread_t worker;
+};
+
+// Open the table of a log record by its 'DATA<table_id>' file, unless it is opened already or gone
+static bool open_recovery_table(int64_t table_id)
+{
+    std::string pathname = "DATA" + std::to_string(table_id);
+
+    if (opened_tables.isDataTable(table_id)) return true;
+    if (access(pathname.c_str(), F_OK) != 0) return false;
+    return file_open_table_file(pathname.c_str()) == table_id;
+}
+
+// Check whether the image of the record fits in an existing page of an opened table
+static bool is_recoverable(const LogRecord& record)
+{
+    if (!opened_tables.isDataTable(record.table_id)) return false;
+    if (record.offset < HEADER_SIZE || record.offset + record.length > PAGE_SIZE) return false;
+    return BUF::is_valid_page(record.table_id, record.page_num);
+}
+
+// Read every complete record of the log needed by the recovery and return the end of them
+int64_t LogManager::read_log(std::vector<LogRecord>& records)
+{
+    std::vector<char> bytes;
+    int64_t begin, end, lsn;
+    size_t log_size, expected_size;
+
+    // Read the log from the start of the master record
+    begin = this->master.start_lsn;
+    end = this->lsn_to_flush;
+    bytes.resize(end - begin);
+    if (end > begin && pread(this->log_fd, bytes.data(), end - begin, begin) != end - begin) {
+        std::cout << "[LogManager::read_log] Failed to read the log file" << std::endl;
+        exit(1);
+    }
+
+    // Parse the records until the end of the log or a torn record
+    lsn = begin;
+    while (lsn + (int64_t)sizeof(size_t) <= end) {
+        memcpy(&log_size, bytes.data() + (lsn - begin), sizeof(size_t));
+        if (log_size < this->get_log_size(LOG::BEGIN) || lsn + (int64_t)log_size > end) break;
+
+        LogRecord record(bytes.data() + (lsn - begin));
+        if (record.log_type == LOG::END_CHECKPOINT) {
+            expected_size = this->get_checkpoint_size(record.active_trxs.size(), record.dirty_pages.size());
+        } else {
+            expected_size = this->get_log_size(record.log_type, record.length);
+        }
+        if (record.lsn != lsn || record.log_size != expected_size) break;
+        records.push_back(record);
+        lsn += log_size;
+    }
+    return lsn;
+}
+
+// Find the losers (transactions without COMMIT or ROLLBACK) with their last lsn and the dirty pages with their rec_lsn
+// (the log kept holds every record of the transactions active at the last checkpoint, and its dirty page table covers the pages before it)
+void LogManager::analysis(const std::vector<LogRecord>& records, std::map<int, int64_t>& losers, std::map<log_page_key_t, int64_t>& dirty_pages)
+{
+    std::map<int, bool> winners;
+
+    fprintf(this->log_message_file, "[ANALYSIS] Analysis pass start\n");
+
+    for (const LogRecord& record : records) {
+        this->last_trx_id = std::max(this->last_trx_id, record.trx_id);
+
+        if (record.log_type == LOG::BEGIN_CHECKPOINT) {
+            continue;
+        } else if (record.log_type == LOG::END_CHECKPOINT) {
+            // Merge the tables of the last checkpoint (the records after its begin are newer)
+            if (record.lsn < this->master.checkpoint_lsn) continue;
+            for (const att_entry_t& entry : record.active_trxs) {
+                this->last_trx_id = std::max(this->last_trx_id, entry.trx_id);
+                if (winners.count(entry.trx_id) == 0 && losers[entry.trx_id] < entry.last_lsn) {
+                    losers[entry.trx_id] = entry.last_lsn;
+                }
+            }
+            for (const dpt_entry_t& entry : record.dirty_pages) {
+                auto it = dirty_pages.emplace(log_page_key_t(entry.table_id, entry.page_num), entry.rec_lsn).first;
+                it->second = std::min(it->second, entry.rec_lsn);
+                open_recovery_table(entry.table_id);
+            }
+            continue;
+        }
+
+        // Track the last record of each transaction until it ends
+        if (record.log_type == LOG::COMMIT || record.log_type == LOG::ROLLBACK) {
+            losers.erase(record.trx_id);
+            winners[record.trx_id] = true;
+        } else {
+            losers[record.trx_id] = record.lsn;
+        }
+
+        // Track the first record dirtying each page after the checkpoint, and open the table to be recovered
+        if (record.log_type == LOG::UPDATE || record.log_type == LOG::COMPENSATE) {
+            if (record.lsn >= this->master.checkpoint_lsn) {
+                dirty_pages.emplace(log_page_key_t(record.table_id, record.page_num), record.lsn);
+            }
+            open_recovery_table(record.table_id);
+        }
+    }
+
+    fprintf(this->log_message_file, "[ANALYSIS] Analysis success. Winner:");
+    for (auto& winner : winners) fprintf(this->log_message_file, " %d", winner.first);
+    fprintf(this->log_message_file, ", Loser:");
+    for (auto& loser : losers) fprintf(this->log_message_file, " %d", loser.first);
+    fprintf(this->log_message_file, "\n");
+}
+
+// Redo the record on its page if the page has not seen it yet (page_lsn makes redo idempotent)
+bool LogManager::redo_record(const LogRecord& record)
+{
+    PageHandle page;
+    page_t* frame;
+
+    // Skip the records of the tables or pages not existing anymore
+    if (!is_recoverable(record)) return false;
+
+    // Compare the lsn with the page
+    page = BUF::fix_page(record.table_id, record.page_num);
+    if (NodeView(page.read()).page_lsn() >= record.lsn) return false;
+
+    // Apply the new image and stamp the page (the frame is dirty since the record)
+    BUF::mark_dirty(page.get_pin_id(), record.lsn);
+    frame = page.write();
+    LeafView(frame).apply_image(record.offset, record.new_img.data(), record.length, record.image_kind);
+    BUF::stamp_page(page.get_pin_id(), record.lsn);
+    return true;
+}
+
+void* LogManager::redo_worker_main(void* arg)
+{
+    redo_partition_t* partition = (redo_partition_t*)arg;
+    LogManager* log_manager = partition->log_manager;
+
+    // Redo the records of the partition in lsn order
+    partition->applied.resize(partition->indices.size());
+    for (size_t idx = 0; idx < partition->indices.size(); idx++) {
+        partition->applied[idx] = log_manager->redo_record((*partition->records)[partition->indices[idx]]);
+    }
+    return NULL;
+}
+
+// Repeat the history of the first log_num records (every record if log_num is negative) and return whether all are redone
+bool LogManager::redo(const std::vector<LogRecord>& records, const std::map<log_page_key_t, int64_t>& dirty_pages, int log_num)
+{
+    std::vector<redo_partition_t> partitions;
+    std::map<log_page_key_t, int64_t>::const_iterator dirty_page;
+    std::vector<char> applied;
+    struct timespec begin_time, end_time;
+    size_t num_records, index;
+    int64_t elapsed_ms;
+    int num_workers;
+    const char* type_names[] = {"BEGIN", "UPDATE", "COMMIT", "ROLLBACK", "COMPENSATE", "BEGIN CHECKPOINT", "END CHECKPOINT"};
+
+    fprintf(this->log_message_file, "[REDO] Redo pass start\n");
+    clock_gettime(CLOCK_MONOTONIC, &begin_time);
+
+    // One redo worker per core
+    num_workers = std::min(std::max((int)sysconf(_SC_NPROCESSORS_ONLN), 1), RECOVERY_MAX_REDO_THREADS);
+    partitions.resize(num_workers);
+
+    // Partition the page records by (table_id, page_num), so that the records of a page stay in lsn order
+    num_records = log_num < 0 ? records.size() : std::min(records.size(), (size_t)log_num);
+    this->redo_lsn = this->lsn_to_flush;
+    for (index = 0; index < num_records; index++) {
+        const LogRecord& record = records[index];
+        if (record.log_type != LOG::UPDATE && record.log_type != LOG::COMPENSATE) continue;
+
+        // Skip the pages written after the record (not dirty, or dirtied later)
+        dirty_page = dirty_pages.find(log_page_key_t(record.table_id, record.page_num));
+        if (dirty_page == dirty_pages.end() || record.lsn < dirty_page->second) continue;
+        this->redo_lsn = std::min(this->redo_lsn, record.lsn);
+
+        uint64_t hash = std::hash<uint64_t>()((uint64_t)record.table_id * 0x9E3779B97F4A7C15ULL ^ record.page_num);
+        partitions[hash % num_workers].indices.push_back(index);
+    }
+
+    // Redo the partitions in parallel
+    for (redo_partition_t& partition : partitions) {
+        partition.log_manager = this;
+        partition.records = &records;
+        if (pthread_create(&partition.worker, NULL, redo_worker_main, &partition) != 0) {
+            std::cout << "[LogManager::redo] Failed to create a redo worker" << std::endl;
+            exit(1);
+        }
+    }
+    for (redo_partition_t& partition : partitions) {
+        pthread_join(partition.worker, NULL);
+    }
+
+    // Trace the records in lsn order (the workers only record whether they applied each one)
+    applied.assign(num_records, false);
+    for (redo_partition_t& partition : partitions) {
+        for (size_t idx = 0; idx < partition.indices.size(); idx++) applied[partition.indices[idx]] = partition.applied[idx];
+    }
+    for (index = 0; index < num_records; index++) {
+        const LogRecord& record = records[index];
+
+        if (record.log_type != LOG::UPDATE && record.log_type != LOG::COMPENSATE) {
+            fprintf(this->log_message_file, "LSN %ld [%s] Transaction id %d\n", record.lsn, type_names[record.log_type], record.trx_id);
+        } else if (!applied[index]) {
+            fprintf(this->log_message_file, "LSN %ld [CONSIDER-REDO] Transaction id %d\n", record.lsn, record.trx_id);
+        } else if (record.log_type == LOG::UPDATE) {
+            fprintf(this->log_message_file, "LSN %ld [UPDATE] Transaction id %d redo apply\n", record.lsn, record.trx_id);
+        } else {
+            fprintf(this->log_message_file, "LSN %ld [CLR] next undo lsn %ld\n", record.lsn, record.next_undo_lsn);
+        }
+    }
+
+    // Measure the redo speed for the checkpointer (only over a meaningful amount of log)
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    elapsed_ms = (end_time.tv_sec - begin_time.tv_sec) * 1000 + (end_time.tv_nsec - begin_time.tv_nsec) / 1000000;
+    if (elapsed_ms > 0 && this->lsn_to_flush - this->redo_lsn >= (int64_t)LOG_BUFFER_SIZE) {
+        this->redo_bytes_per_ms = std::max((this->lsn_to_flush - this->redo_lsn) / elapsed_ms, (int64_t)1);
+    }
+
+    if (num_records < records.size()) return false;
+    fprintf(this->log_message_file, "[REDO] Redo pass end\n");
+    return true;
+}
+
+// Roll the losers back from their last records (at most log_num records if it is not negative) and return whether all are undone
+bool LogManager::undo(const std::vector<LogRecord>& records, std::map<int, int64_t>& losers, int log_num)
+{
+    std::priority_queue<std::pair<int64_t, int>> lsns_to_undo;
+    std::vector<LogRecord>::const_iterator it;
+    int64_t lsn, next_lsn;
+    int trx_id, num_undone;
+
+    fprintf(this->log_message_file, "[UNDO] Undo pass start\n");
+
+    // Undo the records of every loser in the reverse order of lsn
+    for (auto& loser : losers) lsns_to_undo.push({loser.second, loser.first});
+    for (num_undone = 0; !lsns_to_undo.empty(); num_undone++) {
+        if (log_num >= 0 && num_undone >= log_num) return false;
+
+        // Find the record to undo
+        std::tie(lsn, trx_id) = lsns_to_undo.top();
+        lsns_to_undo.pop();
+        it = std::lower_bound(records.begin(), records.end(), lsn, [](const LogRecord& record, int64_t lsn) {
+            return record.lsn < lsn;
+        });
+
+        if (it == records.end() || it->lsn != lsn) {
+            // The record is before the log kept (the BEGIN of a transaction active over a checkpoint)
+            next_lsn = -1;
+        } else if (it->log_type == LOG::UPDATE) {
+            // Restore the old image with compensation records (a compaction before it continues the undo from the last record)
+            const LogRecord& record = *it;
+            next_lsn = record.prev_lsn;
+            if (is_recoverable(record)) {
+                std::vector<leaf_image_t> images;
+                PageHandle page = BUF::fix_page(record.table_id, record.page_num);
+                page_t* frame = page.write();
+                BPT::undo_image(frame, record.offset, record.image_kind, record.old_img, images);
+                for (leaf_image_t& image : images) {
+                    losers[trx_id] = this->log(LOG::COMPENSATE, trx_id, losers[trx_id], record.table_id, record.page_num, image.offset,
+                                               image.old_img.size(), image.old_img.data(), image.new_img.data(), image.redo_only ? losers[trx_id] : next_lsn, image.kind);
+                }
+                lsn = losers[trx_id];
+                if (!images.empty()) BUF::stamp_page(page.get_pin_id(), lsn);
+            } else {
+                lsn = this->log(LOG::COMPENSATE, trx_id, losers[trx_id], record.table_id, record.page_num,
+                                record.offset, record.length, record.new_img.data(), record.old_img.data(), next_lsn, record.image_kind);
+            }
+            losers[trx_id] = lsn;
+            fprintf(this->log_message_file, "LSN %ld [UPDATE] Transaction id %d undo apply\n", record.lsn, trx_id);
+        } else if (it->log_type == LOG::COMPENSATE) {
+            // Skip the records already compensated
+            next_lsn = it->next_undo_lsn;
+            fprintf(this->log_message_file, "LSN %ld [CLR] next undo lsn %ld\n", it->lsn, next_lsn);
+        } else {
+            // The rollback reaches the beginning of the transaction
+            next_lsn = -1;
+        }
+
+        // Continue with the previous record, or end the rollback of the transaction
+        if (next_lsn >= 0) {
+            lsns_to_undo.push({next_lsn, trx_id});
+        } else {
+            this->log(LOG::ROLLBACK, trx_id, losers[trx_id]);
+            losers.erase(trx_id);
+        }
+    }
+
+    fprintf(this->log_message_file, "[UNDO] Undo pass end\n");
+    return true;
+}
+
+int LogManager::recovery(int flag, int log_num)
+{
+    std::vector<LogRecord> records;
+    std::map<int, int64_t> losers;
+    std::map<log_page_key_t, int64_t> dirty_pages;
+    int64_t end;
+
+    // Check whether the log manager is running
+    if (!this->is_running) return FLAG::FAILURE;
+
+    // Read the log, and cut a torn record at the end so that new records follow the last complete one
+    end = this->read_log(records);
+    if (end < this->lsn_to_flush) {
+        if (ftruncate(this->log_fd, end) != 0) {
+            std::cout << "[LogManager::recovery] Failed to truncate the log file" << std::endl;
+            exit(1);
+        }
+        this->lsn_to_assgin = this->lsn_to_write = this->lsn_to_flush = this->lsn_requested = end;
+    }
+
+    // Analysis, redo and undo passes (a crash is simulated by stopping the pass after log_num records)
+    this->is_recovered = false;
+    this->analysis(records, losers, dirty_pages);
+    if (!this->redo(records, dirty_pages, flag == LOG::PHASE_REDO ? log_num : -1)) {
+        fflush(this->log_message_file);
+        return FLAG::SUCCESS;
+    }
+    this->is_recovered = this->undo(records, losers, flag == LOG::PHASE_UNDO ? log_num : -1);
+
+    // Make the compensation records durable
+    this->force();
+    fflush(this->log_message_file);
+    return FLAG::SUCCESS;
+}
+
+// Return the largest transaction id found in the log by the recovery
+int LogManager::get_last_trx_id()
+{
+    return this->last_trx_id;
+}
+
+// Return the lsn of the next record (a lower bound of the records not appended yet)
+int64_t LogManager::get_next_lsn()
+{
+    return this->lsn_to_assgin;
+}
 
 /// APIs for Log manager
 namespace LOG
@@ -198,14 +925,49 @@ namespace LOG
         log_manager.init(log_path, logmsg_path);
     }
 
-    int recovery(int flag)
+    void shutdown()
+    {
+        log_manager.shutdown();
+    }
+
+    int recovery(int flag, int log_num)
+    {
+        return log_manager.recovery(flag, log_num);
+    }
+
+    int get_last_trx_id()
+    {
+        return log_manager.get_last_trx_id();
+    }
+
+    void start_checkpointer(int max_recovery_time_ms)
+    {
+        log_manager.start_checkpointer(max_recovery_time_ms);
+    }
+
+    void stop_checkpointer()
+    {
+        log_manager.stop_checkpointer();
+    }
+
+    int64_t checkpoint()
+    {
+        return log_manager.checkpoint();
+    }
+
+    int64_t get_next_lsn()
+    {
+        return log_manager.get_next_lsn();
+    }
+
+    int64_t log(int type, int trx_id, int64_t prev_lsn, int64_t table_id, pagenum_t page_num, uint16_t offset, uint16_t length, const char* old_img, const char* new_img, int64_t next_undo_lsn, uint8_t image_kind)
     {
-        return log_manager.recovery(flag);
+        return log_manager.log(type, trx_id, prev_lsn, table_id, page_num, offset, length, old_img, new_img, next_undo_lsn, image_kind);
     }
 
-    int log(int type, int trx_id, int64_t table_id, pagenum_t page_num, uint16_t offset, uint16_t length, std::string old_img, std::string new_img, int64_t next_undo_lsn)
+    int64_t flush(int64_t lsn)
     {
-        return log_manager.log(type, trx_id, table_id, page_num, offset, length, old_img, new_img, next_undo_lsn);
+        return log_manager.flush(lsn);
     }
 
     int64_t force()
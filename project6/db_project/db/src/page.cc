@@ -1,4 +1,5 @@
 #include "page.h"
+#include <stddef.h>
 
 /// page_t
 page_t::page_t()
@@ -123,11 +124,7 @@ Record::Record(const page_t* src, int index)
     slot_offset += sizeof(uint16_t);
     memcpy(&(this->trx_id),src->data+slot_offset,sizeof(int));
 
-    char* valueToCopy = new char[this->size+1];
-    memset(valueToCopy, 0, this->size+1);
-    memcpy(valueToCopy,src->data+this->offset,this->size);
-    this->value = std::string(valueToCopy);
-    delete[] valueToCopy;
+    this->value.assign(src->data+this->offset, strnlen(src->data+this->offset, this->size));
 }
 
 // member functions and operator
@@ -315,6 +312,472 @@ bool NodePage::operator==(const NodePage& other)
 }
 
 
+/// Non-owning view over node page bytes
+// constructors
+NodeView::NodeView(const page_t* page)
+    : src(page), dest(NULL)
+{}
+
+NodeView::NodeView(page_t* page)
+    : src(page), dest(page)
+{}
+
+// member functions (header)
+pagenum_t NodeView::parent_page_number() const
+{
+    pagenum_t parent_page_number;
+    memcpy(&parent_page_number, this->src->data + offsetof(NodePage::page_header_t, parent_page_number), sizeof(pagenum_t));
+    return parent_page_number;
+}
+
+bool NodeView::is_leaf() const
+{
+    uint32_t is_leaf;
+    memcpy(&is_leaf, this->src->data + offsetof(NodePage::page_header_t, is_leaf), sizeof(uint32_t));
+    return is_leaf != 0;
+}
+
+uint32_t NodeView::number_of_keys() const
+{
+    uint32_t number_of_keys;
+    memcpy(&number_of_keys, this->src->data + offsetof(NodePage::page_header_t, number_of_keys), sizeof(uint32_t));
+    return number_of_keys;
+}
+
+int64_t NodeView::page_lsn() const
+{
+    int64_t page_lsn;
+    memcpy(&page_lsn, this->src->data + offsetof(NodePage::page_header_t, page_lsn), sizeof(int64_t));
+    return page_lsn;
+}
+
+uint64_t NodeView::amount_of_free_space() const
+{
+    uint64_t amount_of_free_space;
+    memcpy(&amount_of_free_space, this->src->data + offsetof(NodePage::page_header_t, amount_of_free_space), sizeof(uint64_t));
+    return amount_of_free_space;
+}
+
+pagenum_t NodeView::right_sibling_page_number() const
+{
+    pagenum_t right_sibling_page_number;
+    memcpy(&right_sibling_page_number, this->src->data + offsetof(NodePage::page_header_t, right_sibling_page_number), sizeof(pagenum_t));
+    return right_sibling_page_number;
+}
+
+pagenum_t NodeView::first_child_page_number() const
+{
+    // first child shares the field with right sibling
+    return this->right_sibling_page_number();
+}
+
+void NodeView::set_parent_page_number(pagenum_t parent_page_number)
+{
+    memcpy(this->dest->data + offsetof(NodePage::page_header_t, parent_page_number), &parent_page_number, sizeof(pagenum_t));
+}
+
+void NodeView::set_right_sibling_page_number(pagenum_t right_sibling_page_number)
+{
+    memcpy(this->dest->data + offsetof(NodePage::page_header_t, right_sibling_page_number), &right_sibling_page_number, sizeof(pagenum_t));
+}
+
+void NodeView::set_first_child_page_number(pagenum_t first_child_page_number)
+{
+    // first child shares the field with right sibling
+    this->set_right_sibling_page_number(first_child_page_number);
+}
+
+void NodeView::set_number_of_keys(uint32_t number_of_keys)
+{
+    memcpy(this->dest->data + offsetof(NodePage::page_header_t, number_of_keys), &number_of_keys, sizeof(uint32_t));
+}
+
+void NodeView::set_page_lsn(int64_t page_lsn)
+{
+    memcpy(this->dest->data + offsetof(NodePage::page_header_t, page_lsn), &page_lsn, sizeof(int64_t));
+}
+
+void NodeView::set_amount_of_free_space(uint64_t amount_of_free_space)
+{
+    memcpy(this->dest->data + offsetof(NodePage::page_header_t, amount_of_free_space), &amount_of_free_space, sizeof(uint64_t));
+}
+
+// member functions (body)
+// key of the slot (leaf) or the edge (internal) at index (both begin with the key)
+int64_t NodeView::key(int index) const
+{
+    int64_t key;
+    size_t stride = this->is_leaf() ? SLOT_SIZE : EDGE_SIZE;
+    memcpy(&key, this->src->data + HEADER_SIZE + index * stride, sizeof(int64_t));
+    return key;
+}
+
+// find candidate index having given key (the last index whose key <= given key)
+int NodeView::find_index(int64_t key) const
+{
+    int low, high, mid;
+
+    // binary search for the upper bound of the key
+    low = 0;
+    high = this->number_of_keys();
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (this->key(mid) <= key) low = mid + 1;
+        else high = mid;
+    }
+
+    return low - 1;
+}
+
+
+/// Non-owning view over leaf page bytes
+// constructors
+LeafView::LeafView(const page_t* page)
+    : NodeView(page)
+{}
+
+LeafView::LeafView(page_t* page)
+    : NodeView(page)
+{}
+
+// member functions
+uint16_t LeafView::size(int index) const
+{
+    uint16_t size;
+    memcpy(&size, this->src->data + HEADER_SIZE + index * SLOT_SIZE + sizeof(int64_t), sizeof(uint16_t));
+    return size;
+}
+
+uint16_t LeafView::offset(int index) const
+{
+    uint16_t offset;
+    memcpy(&offset, this->src->data + HEADER_SIZE + index * SLOT_SIZE + sizeof(int64_t) + sizeof(uint16_t), sizeof(uint16_t));
+    return offset;
+}
+
+int LeafView::trx_id(int index) const
+{
+    int trx_id;
+    memcpy(&trx_id, this->src->data + HEADER_SIZE + index * SLOT_SIZE + sizeof(int64_t) + sizeof(uint16_t) * 2, sizeof(int));
+    return trx_id;
+}
+
+const char* LeafView::value(int index) const
+{
+    return this->src->data + this->offset(index);
+}
+
+// find the index of the record having exactly given key (-1 if not found)
+int LeafView::find_record(int64_t key) const
+{
+    int index = this->find_index(key);
+    if (index < 0 || this->key(index) != key) return -1;
+    return index;
+}
+
+void LeafView::set_value(int index, const char* value, uint16_t size)
+{
+    memcpy(this->dest->data + this->offset(index), value, size);
+}
+
+void LeafView::set_trx_id(int index, int trx_id)
+{
+    memcpy(this->dest->data + HEADER_SIZE + index * SLOT_SIZE + sizeof(int64_t) + sizeof(uint16_t) * 2, &trx_id, sizeof(int));
+}
+
+
+// append the record after the last slot (false if it doesn't fit in the free space)
+bool LeafView::append(int64_t key, const char* value, uint16_t size)
+{
+    uint32_t number_of_keys = this->number_of_keys();
+    uint16_t offset;
+
+    // Check the free space
+    if (this->amount_of_free_space() < SLOT_SIZE + size) return false;
+
+    // Values are packed from the end of the page in slot order
+    offset = this->heap_top() - size;
+    memcpy(this->dest->data + offset, value, size);
+    this->set_slot(number_of_keys, key, size, offset, 0);
+
+    // Update the header
+    this->set_number_of_keys(number_of_keys + 1);
+    this->set_amount_of_free_space(this->amount_of_free_space() - SLOT_SIZE - size);
+    return true;
+}
+
+
+// free space management
+// the lowest offset of the values (the end of the contiguous free space after the slots)
+uint16_t LeafView::heap_top() const
+{
+    uint16_t top = PAGE_SIZE;
+
+    for (int idx = 0; idx < (int)this->number_of_keys(); idx++) {
+        top = std::min(top, this->offset(idx));
+    }
+    return top;
+}
+
+uint64_t LeafView::contiguous_free_space() const
+{
+    return this->heap_top() - (HEADER_SIZE + this->number_of_keys() * SLOT_SIZE);
+}
+
+// check if the value of the record can change to the size only after compaction
+bool LeafView::needs_compaction(int index, uint16_t size) const
+{
+    uint16_t old_size = this->size(index);
+    uint64_t contiguous = this->contiguous_free_space();
+
+    if (size <= old_size) return false;
+    if (this->offset(index) == this->heap_top() && contiguous >= (uint64_t)(size - old_size)) return false;
+    return contiguous < size;
+}
+
+// pack the values from the end of the page in slot order, with the value of the record at last below the others
+// (the holes left by deletions and moved values become contiguous free space), and return the new heap top
+uint16_t LeafView::compact(int last)
+{
+    page_t copy(*this->src);
+    LeafView copy_view(&copy);
+    uint16_t offset = PAGE_SIZE;
+
+    // move a value from the copy below the ones packed
+    auto pack = [&](int index) {
+        offset -= copy_view.size(index);
+        memcpy(this->dest->data + offset, copy_view.value(index), copy_view.size(index));
+        this->set_offset(index, offset);
+    };
+
+    for (int idx = 0; idx < (int)this->number_of_keys(); idx++) {
+        if (idx != last) pack(idx);
+    }
+    if (last >= 0) pack(last);
+    return offset;
+}
+
+// insert the record at index, in the contiguous free space (compacted first if it is short)
+bool LeafView::insert(int index, int64_t key, const char* value, uint16_t size)
+{
+    uint32_t number_of_keys = this->number_of_keys();
+    int64_t contiguous;
+    uint16_t top;
+    char* slot;
+
+    // Check the free space
+    if (this->amount_of_free_space() < SLOT_SIZE + size) return false;
+    if (index < 0 || index > (int)number_of_keys) return false;
+
+    // Place the value below the others (the slot array grows by a slot too)
+    top = this->heap_top();
+    contiguous = (int64_t)top - (int64_t)(HEADER_SIZE + (number_of_keys + 1) * SLOT_SIZE);
+    if (contiguous < size) top = this->compact();
+    memcpy(this->dest->data + top - size, value, size);
+
+    // Shift the slots after index and write the slot
+    slot = this->dest->data + HEADER_SIZE + index * SLOT_SIZE;
+    memmove(slot + SLOT_SIZE, slot, (number_of_keys - index) * SLOT_SIZE);
+    this->set_slot(index, key, size, top - size, 0);
+
+    // Update the header
+    this->set_number_of_keys(number_of_keys + 1);
+    this->set_amount_of_free_space(this->amount_of_free_space() - SLOT_SIZE - size);
+    return true;
+}
+
+// remove the record at index (its value is left as a hole until the next compaction)
+void LeafView::remove(int index)
+{
+    uint32_t number_of_keys = this->number_of_keys();
+    uint16_t size = this->size(index);
+    char* slot;
+
+    // Shift the slots after index
+    slot = this->dest->data + HEADER_SIZE + index * SLOT_SIZE;
+    memmove(slot, slot + SLOT_SIZE, (number_of_keys - index - 1) * SLOT_SIZE);
+
+    // Update the header
+    this->set_number_of_keys(number_of_keys - 1);
+    this->set_amount_of_free_space(this->amount_of_free_space() + SLOT_SIZE + size);
+}
+
+// change the value of the record at index to another size (false if the free space is short)
+// (a smaller value stays in place, a larger one grows down from the heap top or moves below it)
+bool LeafView::resize(int index, const char* value, uint16_t size)
+{
+    uint16_t old_size = this->size(index), offset = this->offset(index);
+
+    // Check the free space
+    if (size > old_size && this->amount_of_free_space() < (uint64_t)(size - old_size)) return false;
+
+    // Find the place of the value
+    if (size > old_size) {
+        if (this->needs_compaction(index, size)) offset = this->compact(index);
+        if (offset == this->heap_top() && this->contiguous_free_space() >= (uint64_t)(size - old_size)) offset -= size - old_size;
+        else offset = this->heap_top() - size;
+    }
+
+    // Write the value and update the slot and the header
+    memcpy(this->dest->data + offset, value, size);
+    this->set_size(index, size);
+    this->set_offset(index, offset);
+    this->set_amount_of_free_space(this->amount_of_free_space() + old_size - size);
+    return true;
+}
+
+
+// log images
+// write the image of a log record at offset (a record image writes the value where its slot points, and moves the free space by its size)
+void LeafView::apply_image(uint16_t offset, const char* image, uint16_t length, uint8_t kind)
+{
+    int index;
+    uint16_t old_size, size;
+
+    if (kind != IMAGE::RECORD) {
+        memcpy(this->dest->data + offset, image, length);
+        return;
+    }
+
+    index = (offset - HEADER_SIZE) / SLOT_SIZE;
+    old_size = this->size(index);
+    memcpy(this->dest->data + offset, image, SLOT_SIZE);
+    size = this->size(index);
+    memcpy(this->dest->data + this->offset(index), image + SLOT_SIZE, size);
+    this->set_amount_of_free_space(this->amount_of_free_space() + old_size - size);
+}
+
+
+// slot
+void LeafView::set_slot(int index, int64_t key, uint16_t size, uint16_t offset, int trx_id)
+{
+    char* slot = this->dest->data + HEADER_SIZE + index * SLOT_SIZE;
+
+    memcpy(slot, &key, sizeof(int64_t));
+    memcpy(slot + sizeof(int64_t), &size, sizeof(uint16_t));
+    memcpy(slot + sizeof(int64_t) + sizeof(uint16_t), &offset, sizeof(uint16_t));
+    memcpy(slot + sizeof(int64_t) + sizeof(uint16_t) * 2, &trx_id, sizeof(int));
+}
+
+void LeafView::set_size(int index, uint16_t size)
+{
+    memcpy(this->dest->data + HEADER_SIZE + index * SLOT_SIZE + sizeof(int64_t), &size, sizeof(uint16_t));
+}
+
+void LeafView::set_offset(int index, uint16_t offset)
+{
+    memcpy(this->dest->data + HEADER_SIZE + index * SLOT_SIZE + sizeof(int64_t) + sizeof(uint16_t), &offset, sizeof(uint16_t));
+}
+
+
+/// Non-owning view over internal page bytes
+// constructors
+InternalView::InternalView(const page_t* page)
+    : NodeView(page)
+{}
+
+InternalView::InternalView(page_t* page)
+    : NodeView(page)
+{}
+
+// member functions
+pagenum_t InternalView::child(int index) const
+{
+    pagenum_t page_number;
+
+    // index -1 means the first child
+    if (index < 0) return this->first_child_page_number();
+    memcpy(&page_number, this->src->data + HEADER_SIZE + index * EDGE_SIZE + sizeof(int64_t), sizeof(pagenum_t));
+    return page_number;
+}
+
+pagenum_t InternalView::find_child(int64_t key) const
+{
+    return this->child(this->find_index(key));
+}
+
+void InternalView::set_key(int index, int64_t key)
+{
+    memcpy(this->dest->data + HEADER_SIZE + index * EDGE_SIZE, &key, sizeof(int64_t));
+}
+
+// append the edge after the last edge (false if the page is full)
+bool InternalView::append(int64_t key, pagenum_t page_number)
+{
+    uint32_t number_of_keys = this->number_of_keys();
+
+    if (number_of_keys >= EDGE_MAX_COUNT) return false;
+
+    memcpy(this->dest->data + HEADER_SIZE + number_of_keys * EDGE_SIZE, &key, sizeof(int64_t));
+    memcpy(this->dest->data + HEADER_SIZE + number_of_keys * EDGE_SIZE + sizeof(int64_t), &page_number, sizeof(pagenum_t));
+    this->set_number_of_keys(number_of_keys + 1);
+    return true;
+}
+
+
+/// Allocation page view
+AllocationView::AllocationView(const page_t* page)
+    : src(page), dest(NULL)
+{}
+
+AllocationView::AllocationView(page_t* page)
+    : src(page), dest(page)
+{}
+
+bool AllocationView::is_allocated(int index) const
+{
+    return (this->src->data[index / 8] >> (index % 8)) & 1;
+}
+
+// Return the first index of count free pages in a row within [begin, end), or -1 if there is none
+int AllocationView::find_free(int begin, int end, int count) const
+{
+    int run = 0;
+    uint64_t word;
+
+    for (int index = begin; index < end; index++) {
+        // Skip 64 allocated pages at once
+        if (index % 64 == 0 && index + 64 <= end) {
+            memcpy(&word, this->src->data + index / 8, sizeof(uint64_t));
+            if (word == ~0ULL) {
+                run = 0;
+                index += 63;
+                continue;
+            }
+        }
+        if (this->is_allocated(index)) run = 0;
+        else if (++run == count) return index - count + 1;
+    }
+    return -1;
+}
+
+void AllocationView::set_allocated(int index, int count, bool allocated)
+{
+    for (int bit = index; bit < index + count; bit++) {
+        if (allocated) this->dest->data[bit / 8] |= (char)(1 << (bit % 8));
+        else this->dest->data[bit / 8] &= (char)~(1 << (bit % 8));
+    }
+}
+
+// Initialize the bitmap of the group (only the header page and the allocation page itself are allocated)
+void AllocationView::init(pagenum_t group)
+{
+    memset(this->dest->data, 0, PAGE_SIZE);
+    this->set_allocated(allocation_page_number(group) % PAGES_PER_GROUP, 1, true);
+    if (group == 0) this->set_allocated(0, 1, true);
+}
+
+pagenum_t AllocationView::group_of(pagenum_t page_number)
+{
+    return page_number / PAGES_PER_GROUP;
+}
+
+pagenum_t AllocationView::allocation_page_number(pagenum_t group)
+{
+    return group * PAGES_PER_GROUP + 1;
+}
+
+
 /// operators
 bool operator==(const KeyPair& keyPair, const int64_t key)
 {
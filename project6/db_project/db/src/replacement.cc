@@ -0,0 +1,312 @@
+#include "replacement.h"
+
+
+/// Page key hash
+size_t hash_page_key_t::operator()(const page_key_t& key) const
+{
+    uint64_t hash;
+
+    // Mix table id and page number (splitmix64 finalizer)
+    hash = (uint64_t)key.first * 0x9E3779B97F4A7C15ULL ^ key.second;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    hash = hash ^ (hash >> 31);
+
+    return hash;
+}
+
+
+/// CLOCK
+ClockPolicy::ClockPolicy()
+    : num_buf(0), clock_hand(0)
+{}
+
+void ClockPolicy::init(int num_buf)
+{
+    this->num_buf = num_buf;
+    this->clock_hand = 0;
+    this->referenced = std::vector<std::atomic<bool>>(num_buf);
+    for (int index = 0; index < num_buf; index++) {
+        this->referenced[index] = false;
+    }
+}
+
+void ClockPolicy::access(int index)
+{
+    this->referenced[index].store(true);
+}
+
+void ClockPolicy::admit(int index, int64_t, pagenum_t)
+{
+    this->referenced[index].store(true);
+}
+
+void ClockPolicy::evict(int, int64_t, pagenum_t)
+{}
+
+void ClockPolicy::release(int index)
+{
+    this->referenced[index].store(false);
+}
+
+int ClockPolicy::victim(const claim_func_t& claim)
+{
+    int victim;
+
+    // Sweep the clock: give referenced frames a second chance, skip pinned frames
+    for (int sweep = 0; sweep < 3 * this->num_buf; sweep++) {
+        victim = this->clock_hand++ % this->num_buf;
+        if (this->referenced[victim].exchange(false)) continue;
+        if (claim(victim)) return victim;
+    }
+
+    return -1;
+}
+
+
+void ClockPolicy::cold_frames(std::vector<int>& frames, int count)
+{
+    uint64_t hand = this->clock_hand.load();
+
+    // Frames in the order the hand reaches them, unreferenced ones first
+    for (bool referenced : {false, true}) {
+        for (int step = 0; step < this->num_buf && (int)frames.size() < count; step++) {
+            int index = (hand + step) % this->num_buf;
+            if (this->referenced[index].load() == referenced) frames.push_back(index);
+        }
+    }
+}
+
+
+/// LRU
+LRUPolicy::LRUPolicy()
+{
+    pthread_mutex_init(&this->policy_latch, NULL);
+}
+
+LRUPolicy::~LRUPolicy()
+{
+    pthread_mutex_destroy(&this->policy_latch);
+}
+
+void LRUPolicy::init(int num_buf)
+{
+    this->lru.clear();
+    this->position.assign(num_buf, this->lru.end());
+    this->linked.assign(num_buf, false);
+}
+
+// Remove the frame from the list (Require policy latch)
+void LRUPolicy::unlink(int index)
+{
+    if (!this->linked[index]) return;
+    this->lru.erase(this->position[index]);
+    this->linked[index] = false;
+}
+
+void LRUPolicy::access(int index)
+{
+    // Move the frame to the most recently used end
+    pthread_mutex_lock(&this->policy_latch);
+    this->unlink(index);
+    this->position[index] = this->lru.insert(this->lru.end(), index);
+    this->linked[index] = true;
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+void LRUPolicy::admit(int index, int64_t, pagenum_t)
+{
+    this->access(index);
+}
+
+void LRUPolicy::evict(int, int64_t, pagenum_t)
+{}
+
+void LRUPolicy::release(int index)
+{
+    // Move the frame to the least recently used end
+    pthread_mutex_lock(&this->policy_latch);
+    this->unlink(index);
+    this->position[index] = this->lru.insert(this->lru.begin(), index);
+    this->linked[index] = true;
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+int LRUPolicy::victim(const claim_func_t& claim)
+{
+    int victim = -1;
+
+    // Find the least recently used and unpinned frame
+    pthread_mutex_lock(&this->policy_latch);
+    for (int index : this->lru) {
+        if (claim(index)) {
+            victim = index;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->policy_latch);
+
+    return victim;
+}
+
+
+void LRUPolicy::cold_frames(std::vector<int>& frames, int count)
+{
+    // Least recently used frames
+    pthread_mutex_lock(&this->policy_latch);
+    for (int index : this->lru) {
+        if ((int)frames.size() >= count) break;
+        frames.push_back(index);
+    }
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+
+/// 2Q
+TwoQPolicy::TwoQPolicy()
+    : kin(1), kout(1)
+{
+    pthread_mutex_init(&this->policy_latch, NULL);
+}
+
+TwoQPolicy::~TwoQPolicy()
+{
+    pthread_mutex_destroy(&this->policy_latch);
+}
+
+void TwoQPolicy::init(int num_buf)
+{
+    // a1in holds a quarter of the buffer, a1out remembers half of the buffer
+    this->kin = std::max(1, num_buf / 4);
+    this->kout = std::max(1, num_buf / 2);
+
+    this->a1in.clear();
+    this->am.clear();
+    this->a1out.clear();
+    this->a1out_map.clear();
+    this->position.assign(num_buf, this->am.end());
+    this->queue.assign(num_buf, NONE);
+}
+
+// Remove the frame from its queue (Require policy latch)
+void TwoQPolicy::unlink(int index)
+{
+    if (this->queue[index] == A1IN) this->a1in.erase(this->position[index]);
+    else if (this->queue[index] == AM) this->am.erase(this->position[index]);
+    this->queue[index] = NONE;
+}
+
+// Remember the page evicted from a1in (Require policy latch)
+void TwoQPolicy::remember(int64_t table_id, pagenum_t pg_num)
+{
+    if (this->a1out_map.count({table_id, pg_num})) return;
+
+    // Forget the oldest ghost page if a1out is full
+    if ((int)this->a1out.size() >= this->kout) {
+        this->a1out_map.erase(this->a1out.front());
+        this->a1out.pop_front();
+    }
+    this->a1out_map[{table_id, pg_num}] = this->a1out.insert(this->a1out.end(), {table_id, pg_num});
+}
+
+void TwoQPolicy::access(int index)
+{
+    // Pages in a1in are not promoted by correlated references
+    pthread_mutex_lock(&this->policy_latch);
+    if (this->queue[index] == AM) {
+        this->am.splice(this->am.end(), this->am, this->position[index]);
+    }
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+void TwoQPolicy::admit(int index, int64_t table_id, pagenum_t pg_num)
+{
+    pthread_mutex_lock(&this->policy_latch);
+    this->unlink(index);
+
+    auto it = this->a1out_map.find({table_id, pg_num});
+    if (it != this->a1out_map.end()) {
+        // Page is referenced again after it left a1in: it is hot
+        this->a1out.erase(it->second);
+        this->a1out_map.erase(it);
+        this->position[index] = this->am.insert(this->am.end(), index);
+        this->queue[index] = AM;
+    } else {
+        // Page is new
+        this->position[index] = this->a1in.insert(this->a1in.end(), index);
+        this->queue[index] = A1IN;
+    }
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+void TwoQPolicy::evict(int index, int64_t table_id, pagenum_t pg_num)
+{
+    pthread_mutex_lock(&this->policy_latch);
+    if (this->queue[index] == A1IN) this->remember(table_id, pg_num);
+    this->unlink(index);
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+void TwoQPolicy::release(int index)
+{
+    // Frame without page is the next victim
+    pthread_mutex_lock(&this->policy_latch);
+    this->unlink(index);
+    this->position[index] = this->a1in.insert(this->a1in.begin(), index);
+    this->queue[index] = A1IN;
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+// Find the first unpinned frame in the queue (Require policy latch)
+int TwoQPolicy::victim_from(std::list<int>& list, const claim_func_t& claim)
+{
+    for (int index : list) {
+        if (claim(index)) return index;
+    }
+    return -1;
+}
+
+int TwoQPolicy::victim(const claim_func_t& claim)
+{
+    int victim;
+
+    // Reclaim from a1in while it is over its share, otherwise from am
+    pthread_mutex_lock(&this->policy_latch);
+    if ((int)this->a1in.size() > this->kin || this->am.empty()) {
+        victim = this->victim_from(this->a1in, claim);
+        if (victim < 0) victim = this->victim_from(this->am, claim);
+    } else {
+        victim = this->victim_from(this->am, claim);
+        if (victim < 0) victim = this->victim_from(this->a1in, claim);
+    }
+    pthread_mutex_unlock(&this->policy_latch);
+
+    return victim;
+}
+
+
+void TwoQPolicy::cold_frames(std::vector<int>& frames, int count)
+{
+    // Same queue order as the victim selector
+    pthread_mutex_lock(&this->policy_latch);
+    bool a1in_first = (int)this->a1in.size() > this->kin || this->am.empty();
+    for (std::list<int>* list : {a1in_first ? &this->a1in : &this->am, a1in_first ? &this->am : &this->a1in}) {
+        for (int index : *list) {
+            if ((int)frames.size() >= count) break;
+            frames.push_back(index);
+        }
+    }
+    pthread_mutex_unlock(&this->policy_latch);
+}
+
+
+/// Factory
+ReplacementPolicy* make_replacement_policy(int policy)
+{
+    switch (policy) {
+        case REPLACEMENT::CLOCK: return new ClockPolicy();
+        case REPLACEMENT::LRU: return new LRUPolicy();
+        case REPLACEMENT::TWO_Q: return new TwoQPolicy();
+    }
+    return NULL;
+}
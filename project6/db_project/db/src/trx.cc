@@ -1,216 +1,515 @@
 #include "trx.h"
 
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+
+// Worker context of the thread (given back when the thread exits)
+struct worker_local_t
+{
+    trx_worker_t* worker = NULL;
+
+    ~worker_local_t()
+    {
+        if (this->worker != NULL) this->worker->used.store(false);
+    }
+};
+static thread_local worker_local_t worker_local;
+
 
 /// Transaction Manager
 // Constructor
 TransactionManager::TransactionManager() 
-    : next_trx_id(1)
-{}
+    : next_trx_id(1), num_removed(0), num_read_views(0), num_finishing(0), num_finished(0), lock_wait_timeout_ms(LOCK_WAIT_TIMEOUT_MS), detector_running(false)
+{
+    pthread_mutex_init(&this->detector_latch, NULL);
+    pthread_cond_init(&this->detector_cond, NULL);
+    pthread_mutex_init(&this->history_latch, NULL);
+}
+
+// Destructor (the detector must not outlive the transaction table)
+TransactionManager::~TransactionManager()
+{
+    this->stop_detector();
+}
 
 
 /// Transaction functions
-// Check if a transaction is active
+// Check if a transaction is active (wait-free)
 bool TransactionManager::is_active_trx(int trx_id)
 {
-    int flag;
+    EPOCH::guard_t guard;
 
-    // Acquire the trx manager latch
-    flag = pthread_mutex_lock(&this->trx_manager_latch);
-    if (flag != 0) return false;
+    return this->trx_table.find(trx_id) != NULL;
+}
+
+// Get the transaction object (wait-free, the object stays valid while its own thread runs it, or under an EPOCH guard)
+trx_t* TransactionManager::get_trx(int trx_id)
+{
+    EPOCH::guard_t guard;
+
+    return this->trx_table.find(trx_id);
+}
 
-    // Check if the transaction id is valid
-    if (trx_table.find(trx_id) == trx_table.end()) {
-        // Release the trx manager latch and return false
-        pthread_mutex_unlock(&this->trx_manager_latch);
-        return false;
+// Take a transaction out of the table (the caller retires its object, which is deleted once no lookup may use it)
+trx_t* TransactionManager::remove_trx(int trx_id) 
+{
+    // Count the removal before it, so that a read view missing the transaction sees the count change
+    this->num_removed.fetch_add(1, std::memory_order_seq_cst);
+    return this->trx_table.erase(trx_id);
+}
+
+// Get the worker context of the calling thread (taken at its first transaction, NULL if there are too many threads)
+trx_worker_t* TransactionManager::get_worker()
+{
+    bool expected;
+
+    if (worker_local.worker != NULL) return worker_local.worker;
+    for (trx_worker_t& worker : this->workers) {
+        expected = false;
+        if (worker.used.compare_exchange_strong(expected, true)) {
+            worker_local.worker = &worker;
+            return &worker;
+        }
     }
-    
-    // Release the trx manager latch and return true
-    pthread_mutex_unlock(&this->trx_manager_latch);
-    return true;
+    return NULL;
 }
 
-trx_t* TransactionManager::get_trx(int trx_id)
+// Wait for the workers putting a transaction with an id below the limit in the table (the id is taken before the slot)
+void TransactionManager::wait_beginning(int low_limit_id)
 {
-    int flag;
+    int beginning;
+
+    for (trx_worker_t& worker : this->workers) {
+        while (true) {
+            beginning = worker.beginning.load(std::memory_order_seq_cst);
+            if (beginning == 0 || (beginning != TRX_ID_TAKING && beginning >= low_limit_id)) break;
+            sched_yield();
+        }
+    }
+}
+
+
+/// Deadlock functions
+// Find a cycle in the waits-for graph (edges to transactions not waiting are ignored), empty if there is none
+static std::vector<int> find_cycle(const std::unordered_map<int, std::vector<int>>& graph)
+{
+    std::unordered_map<int, int> state;                     // 1: on the path, 2: done
+    std::vector<std::pair<int, size_t>> path;               // (trx_id, next edge to follow)
+    std::vector<int> cycle;
+
+    for (auto& node : graph) {
+        if (state[node.first] != 0) continue;
+        state[node.first] = 1;
+        path.push_back({node.first, 0});
+
+        // Depth first search from the transaction
+        while (!path.empty()) {
+            const std::vector<int>& edges = graph.at(path.back().first);
+            if (path.back().second == edges.size()) {
+                state[path.back().first] = 2;
+                path.pop_back();
+                continue;
+            }
+            int next_id = edges[path.back().second++];
+            if (graph.find(next_id) == graph.end() || state[next_id] == 2) continue;
+
+            // The transactions on the path from the next one form a cycle
+            if (state[next_id] == 1) {
+                size_t idx = 0;
+                while (path[idx].first != next_id) idx++;
+                for (; idx < path.size(); idx++) cycle.push_back(path[idx].first);
+                return cycle;
+            }
+            state[next_id] = 1;
+            path.push_back({next_id, 0});
+        }
+    }
+
+    return cycle;
+}
+
+// Detector thread (checks the waits-for graph every DEADLOCK_DETECT_INTERVAL_MS)
+void* TransactionManager::detector_main(void* arg)
+{
+    TransactionManager* trx_manager = (TransactionManager*)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&trx_manager->detector_latch);
+    while (trx_manager->detector_running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += DEADLOCK_DETECT_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&trx_manager->detector_cond, &trx_manager->detector_latch, &deadline);
+        if (!trx_manager->detector_running) break;
+
+        pthread_mutex_unlock(&trx_manager->detector_latch);
+        trx_manager->detect_deadlocks();
+        pthread_mutex_lock(&trx_manager->detector_latch);
+    }
+    pthread_mutex_unlock(&trx_manager->detector_latch);
+
+    return NULL;
+}
+
+// Break the deadlocks among the waiting transactions by aborting the youngest one of each cycle (returns the victims)
+int TransactionManager::detect_deadlocks()
+{
+    int wait_seq, victim;
     trx_t* trx_obj;
+    std::unordered_map<int, std::vector<int>> graph;
+    std::unordered_map<int, int> wait_seqs;
+    std::vector<int> cycle;
+    std::vector<std::pair<pthread_mutex_t*, pthread_cond_t*>> to_wake;
+    pthread_mutex_t* latch;
+    pthread_cond_t* cond;
+
+    // Take the current waits of the transactions (no transaction object is deleted under the guard)
+    EPOCH::guard_t guard;
+    this->trx_table.for_each([&](trx_t* trx) {
+        std::vector<int> waiting_for;
+        if (!trx->get_wait(waiting_for, wait_seq)) return;
+        graph[trx->get_trx_id()] = std::move(waiting_for);
+        wait_seqs[trx->get_trx_id()] = wait_seq;
+    });
+
+    // Choose the youngest transaction of each cycle (the victim only aborts if it is still in the same wait)
+    while (!(cycle = find_cycle(graph)).empty()) {
+        victim = *std::max_element(cycle.begin(), cycle.end());
+        graph.erase(victim);
+        trx_obj = this->trx_table.find(victim);
+        if (trx_obj != NULL && trx_obj->set_deadlock_victim(wait_seqs[victim], latch, cond)) {
+            printf("[INFO][%s][trx_id: %d] Deadlock victim\n", __func__, victim);
+            to_wake.push_back({latch, cond});
+        }
+    }
 
-    // Acquire the trx manager latch
-    flag = pthread_mutex_lock(&this->trx_manager_latch);
-    if (flag != 0) return NULL;
+    // Wake up the victims (under the latch of their waits, so that the wake up is not lost)
+    for (auto& wait : to_wake) {
+        pthread_mutex_lock(wait.first);
+        pthread_cond_broadcast(wait.second);
+        pthread_mutex_unlock(wait.first);
+    }
 
-    // Check if the transaction id is valid
-    if (trx_table.find(trx_id) == trx_table.end()) {
-        // Release the trx manager latch and return NULL
-        pthread_mutex_unlock(&this->trx_manager_latch);
-        return NULL;
+    return to_wake.size();
+}
+
+// Wait on the condition with the latch held until the lock is granted
+// Returns ABORTED if the transaction is chosen as a deadlock victim, or the lock wait timeout expires
+int TransactionManager::wait_lock(trx_t* trx_obj, pthread_mutex_t* latch, pthread_cond_t* cond, const std::function<bool()>& is_granted)
+{
+    int flag = FLAG::SUCCESS, timeout_ms;
+    struct timespec deadline;
+
+    // Compute the deadline of the wait if it times out
+    timeout_ms = this->lock_wait_timeout_ms;
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
     }
 
-    // Get the transaction object
-    trx_obj = &trx_table[trx_id];
+    // Publish the wait to the detector and wait
+    trx_obj->begin_wait(latch, cond);
+    while (!is_granted()) {
+        if (trx_obj->is_deadlock_victim()) {
+            flag = FLAG::ABORTED;
+            break;
+        }
+        if (timeout_ms <= 0) {
+            pthread_cond_wait(cond, latch);
+        } else if (pthread_cond_timedwait(cond, latch, &deadline) == ETIMEDOUT && !is_granted()) {
+            printf("[INFO][%s] Lock wait timeout (%d ms)\n", __func__, timeout_ms);
+            flag = FLAG::ABORTED;
+            break;
+        }
+    }
+    trx_obj->end_wait();
 
-    // Release the trx manager latch and return the trx
-    pthread_mutex_unlock(&this->trx_manager_latch);
-    return trx_obj;
+    return flag;
 }
 
-// Deallocate a transaction
-int TransactionManager::remove_trx(int trx_id) 
+void TransactionManager::start_detector()
 {
     int flag;
 
-    // Acquire the trx manager latch
-    flag = pthread_mutex_lock(&this->trx_manager_latch);
-    if (flag != 0) return 0;
+    pthread_mutex_lock(&this->detector_latch);
+    if (this->detector_running) {
+        pthread_mutex_unlock(&this->detector_latch);
+        return;
+    }
+    this->detector_running = true;
+    pthread_mutex_unlock(&this->detector_latch);
 
-    // Check if the transaction id is valid
-    if (this->trx_table.find(trx_id) == this->trx_table.end()) {
-        // Release the trx manager latch and return 0
-        pthread_mutex_unlock(&this->trx_manager_latch);
-        return 0;
+    flag = pthread_create(&this->detector, NULL, detector_main, this);
+    if (flag != 0) {
+        std::cout << "[TransactionManager::start_detector] Failed to create the deadlock detector" << std::endl;
+        exit(1);
     }
+}
 
-    // Deallocate the transaction
-    this->trx_table.erase(trx_id);
+void TransactionManager::stop_detector()
+{
+    pthread_mutex_lock(&this->detector_latch);
+    if (!this->detector_running) {
+        pthread_mutex_unlock(&this->detector_latch);
+        return;
+    }
+    this->detector_running = false;
+    pthread_cond_signal(&this->detector_cond);
+    pthread_mutex_unlock(&this->detector_latch);
+    pthread_join(this->detector, NULL);
+}
 
-    // Release the trx manager latch
-    pthread_mutex_unlock(&this->trx_manager_latch);
-    return trx_id;
+// Abort lock waits after the timeout instead of detecting deadlocks (0 to detect them)
+void TransactionManager::set_lock_wait_timeout(int lock_wait_timeout_ms)
+{
+    this->lock_wait_timeout_ms = lock_wait_timeout_ms;
+    if (lock_wait_timeout_ms > 0) this->stop_detector();
+    else this->start_detector();
 }
 
-// Detect deadlock
-bool TransactionManager::is_deadlock(int trx_id)
+
+/// Undo history functions
+// Get the transaction id below which every update is seen by all the read views, now and later (under the trx manager latch)
+int TransactionManager::get_purge_limit()
 {
-    int cur_id, next_id;
-    trx_t *trx_obj, *cur_obj;
-    std::stack<int> to_check, cur_stack;
+    int purge_limit = this->next_trx_id.load(std::memory_order_seq_cst);
+    EPOCH::guard_t guard;
+
+    // The transactions beginning below the limit are found in the table (a transaction finishing meanwhile needs no undo log)
+    this->wait_beginning(purge_limit);
+    this->trx_table.for_each([&](trx_t* trx) {
+        purge_limit = std::min(purge_limit, trx->get_trx_id());
+        if (trx->has_read_view) purge_limit = std::min(purge_limit, trx->read_view.up_limit_id);
+    });
+    return purge_limit;
+}
 
-    // Get the transaction object
+// Find the value of the record before the update of trx_id in its undo logs, and the transaction which wrote it
+// (a read view which does not see trx_id makes it keep them until the read view finishes, false if they are gone)
+bool TransactionManager::find_undo(int trx_id, int64_t table_id, int64_t key, std::string& value, int& old_trx_id)
+{
+    std::unordered_map<int, undo_arena_t*>::iterator history_entry;
+    trx_t* trx_obj;
+    bool found, taken, kept, finishing;
+
+    while (true) {
+        // An active transaction holds its undo logs
+        {
+            EPOCH::guard_t guard;
+            trx_obj = this->trx_table.find(trx_id);
+            if (trx_obj != NULL) {
+                found = trx_obj->find_undo(table_id, key, value, old_trx_id, taken);
+                if (found || !taken) return found;
+            }
+        }
+
+        // A finishing one takes them to the undo history (just after it leaves the table, if a read view began meanwhile)
+        // (counted before it leaves the table, so that the history is complete for it once no transaction is finishing)
+        finishing = this->num_finishing.load(std::memory_order_seq_cst) > 0;
+        pthread_mutex_lock(&this->history_latch);
+        history_entry = this->history.find(trx_id);
+        kept = history_entry != this->history.end();
+        found = kept && history_entry->second->find(table_id, key, value, old_trx_id);
+        pthread_mutex_unlock(&this->history_latch);
+        if (kept || !finishing) return found;
+        sched_yield();
+    }
+}
+
+// Take the undo arena of the finishing transaction to the undo history
+void TransactionManager::keep_undo(trx_t* trx_obj)
+{
+    undo_arena_t* arena = trx_obj->take_undo_arena();
+
+    if (arena == NULL) return;
+    pthread_mutex_lock(&this->history_latch);
+    this->history[trx_obj->get_trx_id()] = arena;
+    pthread_mutex_unlock(&this->history_latch);
+}
+
+// Give the undo arena of the finished transaction back to the pool, unless a read view (even one taken meanwhile) may follow it
+// (a read view counts itself before it reads the table, so either it sees the transaction finished or the transaction sees it)
+void TransactionManager::finish_undo(trx_t* trx_obj)
+{
+    if (trx_obj->has_read_view) this->num_read_views.fetch_sub(1, std::memory_order_seq_cst);
+    if (this->num_read_views.load(std::memory_order_seq_cst) > 0) this->keep_undo(trx_obj);
+    else trx_obj->release_undo_arena();
+}
+
+// Take the read view of the transaction at its first consistent read
+const read_view_t* TransactionManager::open_read_view(int trx_id)
+{
+    int flag;
+    uint64_t num_removed;
+    trx_t* trx_obj;
+    read_view_t* read_view;
+
+    // Get the transaction object (only its own thread reads for it)
     trx_obj = this->get_trx(trx_id);
-    if (trx_obj == NULL) return false;
+    if (trx_obj == NULL) return NULL;
+    read_view = &trx_obj->read_view;
+    if (trx_obj->has_read_view) return read_view;
 
-    // Get the waiting stack
-    to_check = trx_obj->get_waiting_stack();
+    // Acquire the trx manager latch (the purge limit is not taken while the view is)
+    flag = pthread_mutex_lock(&this->trx_manager_latch);
+    if (flag != 0) return NULL;
 
-    // Detect cycle in waiting-for graph
-    while (!to_check.empty()) {
-        // Get the current transaction id
-        cur_id = to_check.top();
-        to_check.pop();
+    // Count the view before reading the table, so that the transactions finishing after it keep their undo logs
+    this->num_read_views.fetch_add(1, std::memory_order_seq_cst);
+
+    // Collect the active transactions (the view is kept until the transaction finishes)
+    // (again if a transaction finished meanwhile, since one finishing after it may have been missed before it)
+    read_view->creator_trx_id = trx_id;
+    do {
+        num_removed = this->num_removed.load(std::memory_order_seq_cst);
+        read_view->low_limit_id = this->next_trx_id.load(std::memory_order_seq_cst);
+        read_view->active_ids.clear();
+
+        // The transactions beginning below the limit are found in the table
+        this->wait_beginning(read_view->low_limit_id);
+        EPOCH::guard_t guard;
+        this->trx_table.for_each([&](trx_t* trx) {
+            if (trx->get_trx_id() != trx_id && trx->get_trx_id() < read_view->low_limit_id) read_view->active_ids.push_back(trx->get_trx_id());
+        });
+    } while (this->num_removed.load(std::memory_order_seq_cst) != num_removed);
+    std::sort(read_view->active_ids.begin(), read_view->active_ids.end());
+    read_view->up_limit_id = read_view->active_ids.empty() ? read_view->low_limit_id : read_view->active_ids.front();
+    trx_obj->has_read_view = true;
 
-        // Get the current transaction object
-        cur_obj = this->get_trx(cur_id);
-        if (cur_obj == NULL) continue;
+    // Release the trx manager latch
+    pthread_mutex_unlock(&this->trx_manager_latch);
+    return read_view;
+}
 
-        // Get the waiting stack
-        cur_stack = cur_obj->get_waiting_stack();
-        
-        // Push other transactions to the stack
-        while (!cur_stack.empty()) {
-            // Get the next transaction id
-            next_id = cur_stack.top();
-            cur_stack.pop();
-
-            // Get the current transaction object
-            if (!this->is_active_trx(next_id)) {
-                cur_obj->pop_waiting_list(next_id);
-                continue;
-            }
+// Go back from the value written by trx_id through the undo logs of the writers to the version the read view sees
+int TransactionManager::read_version(const read_view_t* read_view, int64_t table_id, int64_t key, std::string& value, int trx_id)
+{
+    while (!read_view->is_visible(trx_id)) {
+        // Take the value before the update of the transaction (its undo logs are kept while the read view may follow them)
+        if (!this->find_undo(trx_id, table_id, key, value, trx_id)) {
+            printf("[ERROR][%s][trx_id: %d] Version not found (table_id: %ld, key: %ld)\n", __func__, read_view->creator_trx_id, table_id, key);
+            return FLAG::FAILURE;
+        }
+    }
+    return FLAG::SUCCESS;
+}
 
-            // Check already checked transaction
-            if (trx_obj->in_waiting_list(next_id)) continue;
+// Remove the undo logs of the finished transactions every read view sees
+int TransactionManager::purge_versions()
+{
+    std::vector<undo_arena_t*> purged;
+    int purge_limit;
 
-            // Check if the current transaction is waiting for the this transaction
-            if (next_id == trx_id) return true;
+    // Get the purge limit (a read view taken later has its limits above it)
+    if (pthread_mutex_lock(&this->trx_manager_latch) != 0) return 0;
+    purge_limit = this->get_purge_limit();
+    pthread_mutex_unlock(&this->trx_manager_latch);
 
-            // Push the next transaction id to the stack
-            trx_obj->add_waiting_list(next_id);
-            to_check.push(next_id);
+    // Take the undo arenas out of the history, and give them back to the pool without the latch
+    pthread_mutex_lock(&this->history_latch);
+    for (auto history_entry = this->history.begin(); history_entry != this->history.end();) {
+        if (history_entry->first < purge_limit) {
+            purged.push_back(history_entry->second);
+            history_entry = this->history.erase(history_entry);
+        } else {
+            history_entry++;
         }
     }
+    pthread_mutex_unlock(&this->history_latch);
+    for (undo_arena_t* arena : purged) UNDO_POOL::free(arena);
 
-    return false;
+    return purged.size();
 }
 
 
 /// Lock functions
+// Get the bucket of the lock table having the page
+lock_bucket_t* TransactionManager::get_bucket(page_key_t page)
+{
+    return &this->lock_buckets[(hash_page_key_t()(page) >> 32) % LOCK_BUCKET_COUNT];
+}
+
 // Check if a lock table entry is empty
-bool TransactionManager::is_empty_entry(page_key_t page)
+bool TransactionManager::is_empty_entry(lock_bucket_t* bucket, page_key_t page)
 {
-    lock_table_t::iterator it = lock_table.find(page);
+    lock_table_entry_t* entry = bucket->entries.find(page);
     
     // Check if the page is in the lock table
-    if (it == lock_table.end()) return true;
+    if (entry == NULL) return true;
 
     // Check if the lock table entry is empty
-    if (it->second.is_empty()) return true;
+    if (entry->is_empty()) return true;
 
     return false;
 }
 
-// Create a new lock object
-lock_t* TransactionManager::create_lock(page_key_t page, int record_id, int trx_id, int lock_mode)
+// Create a new lock object (NULL if the transaction has finished, or is releasing its locks)
+lock_t* TransactionManager::create_lock(lock_bucket_t* bucket, page_key_t page, int record_id, int trx_id, int lock_mode)
 {
     int flag, conflict;
     lock_t* lock_obj;
+    lock_table_entry_t* entry;
     trx_t* trx_obj;
 
-    // If the lock table entry is not exist, create a new lock table entry
-    if (this->lock_table.find(page) == this->lock_table.end()) {
-        this->lock_table[page] = lock_table_entry_t(page);
-    }
+    // Get the lock table entry (taking a slot for it if not exist)
+    entry = bucket->entries.get(page);
 
     // Allocate a new lock structure
-    lock_obj = this->lock_table[page].append_lock(record_id, trx_id, lock_mode);
+    lock_obj = entry->append_lock(record_id, trx_id, lock_mode);
     if (lock_obj == NULL) return NULL;
 
     printf("[INFO][%s][trx_id: %d] Allocate lock (MUST): %d, %d, %d, %d\n", __func__, trx_id, trx_id, page.second, record_id, lock_mode);
     printf("[INFO][%s][trx_id: %d] Allocate lock (REAL): %d, %d, %d, %d\n", __func__, trx_id, lock_obj->trx_id, page.second, lock_obj->record_id, lock_obj->lock_mode);
 
-    // Get the transaction object
-    trx_obj = this->get_trx(trx_id);
+    // Get the transaction object (the lock may be created for another transaction, whose object must not be deleted meanwhile)
+    EPOCH::guard_t guard;
+    trx_obj = this->trx_table.find(trx_id);
     if (trx_obj == NULL) {
-        this->lock_table[page].remove_lock(lock_obj);
+        entry->remove_lock(lock_obj);
         return NULL;
     }
 
-    // Append the lock to the transaction
-    flag = trx_obj->append_lock(lock_obj);
-    if (flag != 0) {
-        this->lock_table[page].remove_lock(lock_obj);
-        return NULL;
-    }
+    // If the new lock don't need to wait for any lock, set the lock as acquired
+    if (!entry->is_blocked(lock_obj)) lock_obj->set_acquired();
 
-    // Check if it acquires the lock immediately (Create wait-for graph)
-    for (lock_t* cur = lock_obj; cur != NULL; cur = cur->prev) {
+    // Otherwise it waits for the conflicting locks before it (edges of the waits-for graph)
+    for (lock_t* cur = lock_obj->prev; cur != NULL && !lock_obj->is_acquired(); cur = cur->prev) {
         
         printf("[INFO][%s][trx_id: %d] Current lock: %d, %d, %d, %d, %d\n", __func__, trx_id, cur->trx_id, page.second, cur->record_id, cur->lock_mode, cur->bitmap.test(cur->record_id));
         // Check if the new lock is conflict with the current lock
         conflict = cur->is_conflict(record_id, trx_id, lock_mode);
         printf("[INFO][%s][trx_id: %d] Conflict: %d\n", __func__, trx_id, conflict);
         if (conflict) trx_obj->add_waiting_list(cur->trx_id);
-        if (conflict > 1) break;
+    }
 
-        // If the new lock don't need to wait for any lock, set the lock as acquired
-        if (cur->prev == NULL) lock_obj->set_acquired();
+    // Append the lock to the transaction
+    flag = trx_obj->append_lock(lock_obj);
+    if (flag != 0) {
+        entry->remove_lock(lock_obj);
+        return NULL;
     }
 
     return lock_obj;
 }
 
 // Compress the lock
-lock_t* TransactionManager::compress_lock(page_key_t page, int record_id, int trx_id, int lock_mode)
+lock_t* TransactionManager::compress_lock(lock_bucket_t* bucket, page_key_t page, int record_id, int trx_id, int lock_mode)
 {
-    int flag;
     lock_t* lock_obj;
+    lock_table_entry_t* entry;
 
     // Check if the lock table entry exists
-    if (this->lock_table.find(page) == this->lock_table.end()) {
-        return NULL;
-    }
+    entry = bucket->entries.find(page);
+    if (entry == NULL) return NULL;
 
     // Check if the transaction has the lock
-    lock_obj = this->lock_table[page].compress_lock(record_id, trx_id, lock_mode);
+    lock_obj = entry->compress_lock(record_id, trx_id, lock_mode);
     if (lock_obj == NULL) return NULL;
 
     return lock_obj;
@@ -249,83 +548,112 @@ int TransactionManager::broadcast_lock(lock_t* lock_obj)
 }
 
 
+// Release a lock taken out of the lock list of its transaction (under the bucket latch of its page)
+int TransactionManager::release_lock(lock_t* lock_obj)
+{
+    int flag;
+    lock_bucket_t* bucket;
+
+    // Check if the lock is valid
+    if (lock_obj == NULL || lock_obj->sentinel == NULL) return FLAG::FAILURE;
+
+    // Acquire the bucket latch
+    bucket = this->get_bucket(lock_obj->get_page_key());
+    flag = pthread_mutex_lock(&bucket->latch);
+    if (flag != 0) return FLAG::FAILURE;
+
+    // Signal the locks waiting for this lock to be released, and deallocate it
+    flag = this->broadcast_lock(lock_obj);
+    if (flag == 0) flag = this->remove_lock(lock_obj);
+
+    // Release the bucket latch
+    pthread_mutex_unlock(&bucket->latch);
+    return flag;
+}
+
+
 /// Public functions
-// Initializer
-int TransactionManager::init()
+// Initializer (the lock table has slots for lock_table_size pages)
+int TransactionManager::init(int lock_table_size)
 {
     int flag;
 
     // Initialize the transaction table
+    this->stop_detector();
     this->trx_table.clear();
+    this->num_removed = 0;
     flag = pthread_mutex_init(&this->trx_manager_latch, NULL);
     if (flag != 0) return FLAG::FAILURE;
 
+    // Initialize the undo history
+    for (auto& history_entry : this->history) UNDO_POOL::free(history_entry.second);
+    this->history.clear();
+    this->num_read_views = 0;
+    this->num_finishing = 0;
+    this->num_finished = 0;
+
     // Initialize the lock table
-    this->lock_table.clear();
-    flag = pthread_mutex_init(&this->lock_manager_latch, NULL);
+    for (lock_bucket_t& bucket : this->lock_buckets) bucket.entries.init(lock_table_size / LOCK_BUCKET_COUNT);
+    this->table_locks.clear();
+    flag = pthread_mutex_init(&this->table_lock_latch, NULL);
     if (flag != 0) return FLAG::FAILURE;
 
+    // Start the deadlock detector (it reads the transaction table, so it is stopped while the table is reset)
+    if (this->lock_wait_timeout_ms <= 0) this->start_detector();
+
     return FLAG::SUCCESS;
 }
 
-// Allocate a new transaction id
+// Allocate a new transaction id (in the worker context of the thread, without a latch)
 int TransactionManager::alloc_trx() 
 {
-    int trx_id, flag;
+    int trx_id = 0, new_id;
+    trx_t* trx_obj;
+    trx_worker_t* worker;
 
-    
     printf("[INFO][%s] Begin\n", __func__);
 
-    // Acquire the trx manager latch
-    flag = pthread_mutex_lock(&this->trx_manager_latch);
-    if (flag != 0) return 0;
-
-    
-    printf("[INFO][%s] Acquire the trx manager latch\n", __func__);
+    // Get the worker context of the thread
+    worker = this->get_worker();
+    if (worker == NULL) {
+        printf("[ERROR][%s] Too many worker threads\n", __func__);
+        return 0;
+    }
 
-    // Allocate a new transaction id
-    trx_id = this->next_trx_id++;
-    trx_table[trx_id] = trx_t(trx_id);
-    
-    // Release the trx manager latch and return the new transaction id
-    pthread_mutex_unlock(&this->trx_manager_latch);
+    // Allocate a new transaction id (skipping the ids whose slot holds a long running transaction)
+    for (int tries = 0; tries < TRX_TABLE_SIZE && trx_id == 0; tries++) {
+        // Announce the id before taking it, so that a read view taken meanwhile waits for the transaction
+        worker->beginning.store(TRX_ID_TAKING, std::memory_order_seq_cst);
+        new_id = this->next_trx_id.fetch_add(1, std::memory_order_seq_cst);
+        worker->beginning.store(new_id, std::memory_order_seq_cst);
 
-    
-    printf("[INFO][%s] Release the trx manager latch\n", __func__);
+        trx_obj = new trx_t(new_id);
+        if (this->trx_table.insert(trx_obj)) trx_id = new_id;
+        else delete trx_obj;
+    }
+    worker->beginning.store(0, std::memory_order_seq_cst);
+    if (trx_id == 0) printf("[ERROR][%s] Transaction table is full\n", __func__);
 
     return trx_id;
 }
 
 // Release all locks of the transaction
-int TransactionManager::release_all_locks(int trx_id)
+int TransactionManager::release_all_locks(int trx_id, trx_t* trx_obj)
 {
     int flag;
-    trx_t* trx_obj;
+    lock_t *cur, *next;
 
     printf("[INFO][%s] Begin\n", __func__);
 
-    // Get the transaction object
-    trx_obj = this->get_trx(trx_id);
-    if (trx_obj == NULL) return FLAG::FAILURE;
-
-    // Release all locks of the transaction
-    for (lock_t* cur = trx_obj->first; cur != NULL; cur = trx_obj->first) {
-        // Signal the locks waiting for this lock to be released
-        flag = this->broadcast_lock(cur);
-        if (flag != 0) return FLAG::FAILURE;
-
-        // Link the next lock to first
-        trx_obj->first = cur->next_trx_lock;
-
-        // Deallocate the lock object
-        flag = this->remove_lock(cur);
+    // Release all locks of the transaction (each under the latch of its bucket)
+    for (cur = trx_obj->detach_locks(); cur != NULL; cur = next) {
+        next = cur->next_trx_lock;
+        flag = this->release_lock(cur);
         if (flag != 0) return FLAG::FAILURE;
     }
 
-    // Reset the last lock
-    trx_obj->last = NULL;
-
-    return FLAG::SUCCESS;
+    // Release the table locks
+    return this->release_table_locks(trx_id, trx_obj);
 }
 
 // Abort the transaction
@@ -344,19 +672,31 @@ int TransactionManager::abort_trx(int trx_id)
     flag = trx_obj->rollback();
     if (flag != 0) return FLAG::FAILURE;
 
-    // Release all the locks held by the transaction
-    flag = this->release_all_locks(trx_id);
+    // Log the end of the rollback
+    LOG::log(LOG::ROLLBACK, trx_id, trx_obj->get_last_lsn());
+
+    // Finish the transaction, and release all the locks held by it
+    // (its undo logs go to the undo history for the read views of the others, or its undo arena to the next transaction of the thread)
+    this->num_finishing.fetch_add(1, std::memory_order_seq_cst);
+    if (this->num_read_views.load(std::memory_order_seq_cst) > (trx_obj->has_read_view ? 1 : 0)) this->keep_undo(trx_obj);
+    if (this->remove_trx(trx_id) == NULL) {
+        this->num_finishing.fetch_sub(1, std::memory_order_seq_cst);
+        return FLAG::FAILURE;
+    }
+    this->finish_undo(trx_obj);
+    this->num_finishing.fetch_sub(1, std::memory_order_seq_cst);
+    flag = this->release_all_locks(trx_id, trx_obj);
+    EPOCH::retire(trx_obj);
     if (flag != 0) return FLAG::FAILURE;
 
-    // Deallocate the transaction object
-    flag = this->remove_trx(trx_id);
-    if (flag == 0) return FLAG::FAILURE;
+    // Purge the undo history from time to time
+    if (++this->num_finished % PURGE_INTERVAL == 0) this->purge_versions();
 
     return FLAG::SUCCESS;
 }
 
-// Add undo log
-int TransactionManager::add_undo_log(int trx_id, undo_log_t log)
+// Add undo log (the old image is copied into the undo arena of the transaction)
+int TransactionManager::add_undo_log(int trx_id, undo_log_t log, const std::string& old_value)
 {
     int flag;
     trx_t* trx_obj;
@@ -366,137 +706,275 @@ int TransactionManager::add_undo_log(int trx_id, undo_log_t log)
     if (trx_obj == NULL) return FLAG::FAILURE;
 
     // Add the undo log to the transaction
-    trx_obj->add_undo_log(log);
+    trx_obj->add_undo_log(log, old_value);
     return FLAG::SUCCESS;
 }
 
-// Acquire the lock (Protected by the lock_manager_latch)
-int TransactionManager::acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int trx_id, int old_trx_id, int lock_mode)
+// Acquire the lock (Protected by the bucket latch of the page, and the table lock latch for the intention lock)
+int TransactionManager::acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int record_id, int trx_id, int old_trx_id, int lock_mode)
 {
-    int flag, record_id;
-    lock_t* lock_obj;
-    page_key_t page;
+    int flag, table_mode;
+    trx_t* trx_obj;
 
     printf("[INFO][acquire_lock][trx_id: %d] Begin acquire lock %ld %ld %ld %d %d\n", trx_id, table_id, page_id, key, trx_id, lock_mode);
 
-    // Acquire the lock manager latch
-    flag = pthread_mutex_lock(&this->lock_manager_latch);
-    if (flag != 0) return FLAG::FATAL;
+    // Get the transaction object
+    trx_obj = this->get_trx(trx_id);
+    if (trx_obj == NULL) return FLAG::FATAL;
+
+    // The lock on the whole table covers the record (only this thread changes the table locks of the transaction)
+    table_mode = trx_obj->table_locks.count(table_id) ? trx_obj->table_locks[table_id] : LOCK_MODE_NONE;
+    if (LOCK_MODE::covers(table_mode, lock_mode)) {
+        printf("[INFO][%s][trx_id: %d] Covered by the table lock (table_id: %ld, lock_mode: %d)\n", __func__, trx_id, table_id, table_mode);
+        return FLAG::SUCCESS;
+    }
+
+    // Acquire the intention lock on the table before the record lock
+    flag = this->acquire_table_lock(table_id, trx_id, lock_mode == LOCK_MODE_EXCLUSIVE ? LOCK_MODE_INTENTION_EXCLUSIVE : LOCK_MODE_INTENTION_SHARED);
+    if (flag == FLAG::SUCCESS) flag = this->acquire_record_lock(table_id, page_id, record_id, trx_id, old_trx_id, lock_mode);
+
+    // Escalate to the table lock if the transaction holds too many record locks on the table
+    if (flag == FLAG::SUCCESS && ++trx_obj->num_record_locks[table_id] > LOCK_ESCALATION_THRESHOLD) {
+        this->escalate_lock(table_id, trx_id);
+    }
+
+    printf("[INFO][acquire_lock][trx_id: %d] End acquire lock %ld %ld %ld %d %d\n", trx_id, table_id, page_id, key, trx_id, lock_mode);
+
+    return flag;
+}
+
+// Acquire the record lock under the bucket latch of the page (the transaction is aborted on deadlock)
+int TransactionManager::acquire_record_lock(int64_t table_id, pagenum_t page_id, int record_id, int trx_id, int old_trx_id, int lock_mode)
+{
+    int flag;
+    trx_t* trx_obj;
+    lock_t* lock_obj;
+    lock_bucket_t* bucket;
+    page_key_t page;
 
-    printf("[INFO][acquire_lock][trx_id: %d] Acquire lock manager latch %ld %ld %ld %d %d\n", trx_id, table_id, page_id, key, trx_id, lock_mode);
+    // Get the transaction object
+    trx_obj = this->get_trx(trx_id);
+    if (trx_obj == NULL) return FLAG::FATAL;
 
-    // Get page and record information
+    // Get page information (record id is found by the caller with BPT::find_record)
     page = {table_id, page_id};
-    // std::tie(old_trx_id, record_id) = BPT::find_record(table_id, page_id, key);
-    // if (old_trx_id < 0 && record_id < 0) {
-    //     printf("[ERROR][%s][trx_id: %d] the record does not exist (table_id: %ld, page_id: %ld, key: %ld)\n", __func__, trx_id, table_id, page_id, key);
-    //     pthread_mutex_unlock(&this->lock_manager_latch);
-    //     return FLAG::FAILURE;
-    // }
+    bucket = this->get_bucket(page);
+
+    // Acquire the bucket latch
+    flag = pthread_mutex_lock(&bucket->latch);
+    if (flag != 0) return FLAG::FATAL;
 
     // Check implicit locking
-    if (this->is_empty_entry(page)) {
+    if (this->is_empty_entry(bucket, page)) {
         // Case 1: The lock is already implicitly acquired by another transaction
         if (old_trx_id != trx_id && this->is_active_trx(old_trx_id)) {
             printf("[INFO][%s][trx_id: %d] already implicitly acquired by another transaction %ld\n", __func__, trx_id, old_trx_id);
-            lock_obj = this->create_lock(page, record_id, old_trx_id, LOCK_MODE_EXCLUSIVE);
-            if (lock_obj == NULL) {
-                printf("[ERROR][%s][trx_id: %d] lock object is NULL of %d\n", __func__, trx_id, old_trx_id);
-                pthread_mutex_unlock(&this->lock_manager_latch);
-                return FLAG::FATAL;
-            }
+            lock_obj = this->create_lock(bucket, page, record_id, old_trx_id, LOCK_MODE_EXCLUSIVE);
+
+            // The transaction may have finished meanwhile, leaving the record unlocked
+            if (lock_obj == NULL) printf("[INFO][%s][trx_id: %d] transaction %d has finished\n", __func__, trx_id, old_trx_id);
         }
-        // Case 2: The lock is already implicitly acquired by the same transaction
-        else if (lock_mode == LOCK_MODE_EXCLUSIVE) {
+        // Case 2: The lock is already implicitly acquired by the same transaction (the record has its trx_id)
+        else if (old_trx_id == trx_id && lock_mode == LOCK_MODE_EXCLUSIVE) {
             printf("[INFO][%s][trx_id: %d] implicitly acquired by this transaction\n", __func__, trx_id);
             printf("[INFO][%s][trx_id: %d] Lock is acquired (page_id: %ld, record_id: %d, lock_mode: %d)\n", __func__, trx_id, page_id, record_id, lock_mode);
-            pthread_mutex_unlock(&this->lock_manager_latch);
+            pthread_mutex_unlock(&bucket->latch);
             return FLAG::SUCCESS;
         }
     }
 
     // Check if lock compression is possible
-    lock_obj = this->compress_lock(page, record_id, trx_id, lock_mode);
+    lock_obj = this->compress_lock(bucket, page, record_id, trx_id, lock_mode);
     if (lock_obj != NULL) {
         printf("[INFO][%s][trx_id: %d] Success to compress lock\n", __func__, trx_id);
         printf("[INFO][%s][trx_id: %d] Lock is acquired (page_id: %ld, record_id: %d, lock_mode: %d)\n", __func__, trx_id, page_id, record_id, lock_mode);
-        pthread_mutex_unlock(&this->lock_manager_latch);
+        pthread_mutex_unlock(&bucket->latch);
         return FLAG::SUCCESS;
     }
 
     // Allocate a new lock object
-    lock_obj = this->create_lock(page, record_id, trx_id, lock_mode);
+    lock_obj = this->create_lock(bucket, page, record_id, trx_id, lock_mode);
     if (lock_obj == NULL) {
         printf("[ERROR][%s][trx_id: %d]  lock object is NULL\n", __func__, trx_id);
-        pthread_mutex_unlock(&this->lock_manager_latch);
+        pthread_mutex_unlock(&bucket->latch);
         return FLAG::FATAL;
     }
 
-    // Deadlock detection
-    if (this->is_deadlock(trx_id)) {
-        printf("[INFO][%s][trx_id: %d] Deadlock detection Begin\n", __func__, trx_id);
-        flag = this->abort_trx(trx_id);
-        pthread_mutex_unlock(&this->lock_manager_latch);
-            
-        if (flag == FLAG::FATAL) printf("[ERROR][%s][trx_id: %d] Deadlock detection FATAL Error\n", __func__, trx_id);
-        return flag ? FLAG::FATAL : FLAG::ABORTED;
-    }
-
-    // Wait for the conflict locks to be released
-    // lock_obj->wait(&this->lock_manager_latch);
+    // Wait for the conflict locks to be released (the last one grants the lock)
     if (!lock_obj->is_acquired()) {
-        printf("[INFO][%s][trx_id: %d] Wait begin (page_id: %ld, record_id: %d, lock_mode: %d)\n", __func__, trx_id, page_id, record_id, lock_mode);
-        pthread_cond_wait(&lock_obj->cond, &this->lock_manager_latch);
-        printf("[INFO][%s][trx_id: %d] Wake (record_id: %d)\n", __func__, trx_id, record_id);
+        printf("[INFO][%s][trx_id: %d] Wait begin (record_id: %d)\n", __func__, trx_id, record_id);
+        flag = this->wait_lock(trx_obj, &bucket->latch, &lock_obj->cond, [lock_obj]() { return lock_obj->is_acquired(); });
+
+        // Abort on deadlock or timeout (the rollback latches the buckets of its locks again)
+        if (flag == FLAG::ABORTED) {
+            printf("[INFO][%s][trx_id: %d] Abort the lock wait\n", __func__, trx_id);
+            pthread_mutex_unlock(&bucket->latch);
+            flag = this->abort_trx(trx_id);
+
+            if (flag == FLAG::FATAL) printf("[ERROR][%s][trx_id: %d] Abort FATAL Error\n", __func__, trx_id);
+            return flag ? FLAG::FATAL : FLAG::ABORTED;
+        }
     }
     printf("[INFO][%s][trx_id: %d] Lock is acquired (page_id: %ld, record_id: %d, lock_mode: %d)\n", __func__, trx_id, page_id, record_id, lock_mode);
 
-    // Release the lock manager latch
-    pthread_mutex_unlock(&this->lock_manager_latch);
-    
-    printf("[INFO][acquire_lock][trx_id: %d] Release lock manager latch %ld %ld %ld %d %d\n", trx_id, table_id, page_id, key, trx_id, lock_mode);
-
+    // Release the bucket latch
+    pthread_mutex_unlock(&bucket->latch);
     return FLAG::SUCCESS;
 }
 
-// Commit the transaction (Protected by the lock_manager_latch)
-int TransactionManager::commit_trx(int trx_id)
+// Acquire the table lock, or upgrade the mode held to cover it (under the table lock latch)
+// Returns FAILURE without waiting if no_wait is set, and aborts the transaction on deadlock
+int TransactionManager::acquire_table_lock(int64_t table_id, int trx_id, int lock_mode, bool no_wait)
 {
-    int flag;
-    page_key_t page;
+    int flag, held_mode;
+    bool upgrade;
+    trx_t* trx_obj;
+    table_lock_t* table_lock;
 
-    printf("[INFO][commit_trx][trx_id: %d] Begin %ld\n", trx_id);
+    // Get the transaction object
+    trx_obj = this->get_trx(trx_id);
+    if (trx_obj == NULL) return FLAG::FATAL;
 
-    // Acquire the lock manager latch
-    flag = pthread_mutex_lock(&this->lock_manager_latch);
-    if (flag != 0) return 0;
+    // Check if the mode held already covers the lock mode (no latch is needed for the first access to the table only)
+    held_mode = trx_obj->table_locks.count(table_id) ? trx_obj->table_locks[table_id] : LOCK_MODE_NONE;
+    if (LOCK_MODE::covers(held_mode, lock_mode)) return FLAG::SUCCESS;
+    lock_mode = LOCK_MODE::join(held_mode, lock_mode);
+    upgrade = held_mode != LOCK_MODE_NONE;
 
-    printf("[INFO][commit_trx][trx_id: %d] Acquire lock manager latch\n", trx_id);
+    // Acquire the table lock latch
+    flag = pthread_mutex_lock(&this->table_lock_latch);
+    if (flag != 0) return FLAG::FATAL;
 
-    // Check if the transaction is valid
-    if (!this->is_active_trx(trx_id)) {
-        pthread_mutex_unlock(&this->lock_manager_latch);
-        return 0;
+    // Wait in arrival order unless it is granted now
+    table_lock = &this->table_locks[table_id];
+    if (!table_lock->is_grantable(trx_id, lock_mode, upgrade)) {
+        if (no_wait) {
+            pthread_mutex_unlock(&this->table_lock_latch);
+            return FLAG::FAILURE;
+        }
+        table_lock->waiting.push_back({trx_id, lock_mode});
+
+        // Wait for the holders of conflicting modes (edges of the waits-for graph)
+        for (int holder : table_lock->get_conflicts(trx_id, lock_mode)) trx_obj->add_waiting_list(holder);
+
+        printf("[INFO][%s][trx_id: %d] Wait begin (table_id: %ld, lock_mode: %d)\n", __func__, trx_id, table_id, lock_mode);
+        flag = this->wait_lock(trx_obj, &this->table_lock_latch, &table_lock->cond,
+                               [&]() { return table_lock->is_grantable(trx_id, lock_mode, upgrade); });
+        table_lock->remove_waiting(trx_id);
+
+        // Abort on deadlock or timeout
+        if (flag == FLAG::ABORTED) {
+            printf("[INFO][%s][trx_id: %d] Abort the lock wait\n", __func__, trx_id);
+            pthread_cond_broadcast(&table_lock->cond);
+            pthread_mutex_unlock(&this->table_lock_latch);
+            flag = this->abort_trx(trx_id);
+            return flag ? FLAG::FATAL : FLAG::ABORTED;
+        }
+
+        // The requests behind may be granted together
+        pthread_cond_broadcast(&table_lock->cond);
     }
 
-    // Release all the locks held by the transaction
-    flag = this->release_all_locks(trx_id);
-    if (flag != 0) {
-        pthread_mutex_unlock(&this->lock_manager_latch);
-        return 0;
+    // Grant the mode
+    table_lock->granted[trx_id] = lock_mode;
+    trx_obj->table_locks[table_id] = lock_mode;
+    printf("[INFO][%s][trx_id: %d] Table lock is acquired (table_id: %ld, lock_mode: %d)\n", __func__, trx_id, table_id, lock_mode);
+
+    // Release the table lock latch
+    pthread_mutex_unlock(&this->table_lock_latch);
+    return FLAG::SUCCESS;
+}
+
+// Release the table locks of the transaction (under the table lock latch)
+int TransactionManager::release_table_locks(int trx_id, trx_t* trx_obj)
+{
+    int flag = FLAG::SUCCESS;
+    table_lock_table_t::iterator it;
+
+    // Acquire the table lock latch
+    if (pthread_mutex_lock(&this->table_lock_latch) != 0) return FLAG::FAILURE;
+
+    for (auto& table : trx_obj->table_locks) {
+        it = this->table_locks.find(table.first);
+        if (it == this->table_locks.end()) {
+            flag = FLAG::FAILURE;
+            break;
+        }
+
+        // Wake up the requests waiting for the table
+        it->second.granted.erase(trx_id);
+        pthread_cond_broadcast(&it->second.cond);
     }
+    trx_obj->table_locks.clear();
+    trx_obj->num_record_locks.clear();
+
+    // Release the table lock latch
+    pthread_mutex_unlock(&this->table_lock_latch);
+    return flag;
+}
+
+// Replace the record locks of the transaction on the table with a table lock if it is granted without waiting
+// (S if the transaction only reads the table, X otherwise)
+void TransactionManager::escalate_lock(int64_t table_id, int trx_id)
+{
+    int flag, lock_mode;
+    trx_t* trx_obj;
+
+    // Get the transaction object
+    trx_obj = this->get_trx(trx_id);
+    if (trx_obj == NULL) return;
+
+    // Try the table lock (count the record locks again before the next attempt if it fails)
+    trx_obj->num_record_locks[table_id] = 0;
+    lock_mode = trx_obj->table_locks[table_id] == LOCK_MODE_INTENTION_SHARED ? LOCK_MODE_SHARED : LOCK_MODE_EXCLUSIVE;
+    flag = this->acquire_table_lock(table_id, trx_id, lock_mode, true);
+    if (flag != FLAG::SUCCESS) return;
+    printf("[INFO][%s][trx_id: %d] Escalate to the table lock (table_id: %ld, lock_mode: %d)\n", __func__, trx_id, table_id, lock_mode);
+
+    // Release the record locks on the table (nobody conflicting with the table lock can wait for them)
+    for (lock_t* lock_obj : trx_obj->detach_acquired_locks(table_id)) {
+        this->release_lock(lock_obj);
+    }
+}
+
+// Lock the whole table for the transaction (Protected by the table lock latch)
+int TransactionManager::acquire_table(int64_t table_id, int trx_id, int lock_mode)
+{
+    return this->acquire_table_lock(table_id, trx_id, lock_mode);
+}
+
+// Commit the transaction (each lock is released under the latch of its bucket)
+int TransactionManager::commit_trx(int trx_id)
+{
+    int flag;
+    trx_t* trx_obj;
+
+    printf("[INFO][commit_trx][trx_id: %d] Begin %ld\n", trx_id);
 
-    // Deallocate the transaction object
-    flag = this->remove_trx(trx_id);
-    if (flag == 0) {
-        pthread_mutex_unlock(&this->lock_manager_latch);
+    // Get the transaction object (only its own thread finishes it)
+    trx_obj = this->get_trx(trx_id);
+    if (trx_obj == NULL) return 0;
+
+    // Finish the transaction before its locks are released (a read view must not see an update read through them without it)
+    // (its undo logs go to the undo history before, so that the read views of the others find them either in the table or there)
+    this->num_finishing.fetch_add(1, std::memory_order_seq_cst);
+    if (this->num_read_views.load(std::memory_order_seq_cst) > (trx_obj->has_read_view ? 1 : 0)) this->keep_undo(trx_obj);
+    if (this->remove_trx(trx_id) == NULL) {
+        this->num_finishing.fetch_sub(1, std::memory_order_seq_cst);
         return 0;
     }
 
-    // Release the lock manager latch
-    pthread_mutex_unlock(&this->lock_manager_latch);
+    // Release all the locks held by the transaction, and retire its object (its undo arena goes to the next transaction of the thread without read views)
+    this->finish_undo(trx_obj);
+    this->num_finishing.fetch_sub(1, std::memory_order_seq_cst);
+    flag = this->release_all_locks(trx_id, trx_obj);
+    EPOCH::retire(trx_obj);
+    if (flag != 0) return 0;
 
-    printf("[INFO][commit_trx][trx_id: %d] Release lock manager latch\n", trx_id);
+    // Purge the undo history from time to time
+    if (++this->num_finished % PURGE_INTERVAL == 0) this->purge_versions();
+
+    printf("[INFO][commit_trx][trx_id: %d] Release locks\n", trx_id);
 
     return trx_id;
 }
@@ -509,18 +987,62 @@ namespace TRX
     TransactionManager trx_manager;
 
     // Initialize transaction manager
-    int init_trx_manager()
+    int init_trx_manager(int lock_table_size)
+    {
+        return trx_manager.init(lock_table_size);
+    }
+
+    // Stop the deadlock detector
+    void shutdown_trx_manager()
+    {
+        trx_manager.stop_detector();
+    }
+
+    // Abort lock waits longer than lock_wait_timeout_ms instead of detecting deadlocks
+    void set_lock_wait_timeout(int lock_wait_timeout_ms)
+    {
+        trx_manager.set_lock_wait_timeout(lock_wait_timeout_ms);
+    }
+
+    // Get the read view of the transaction
+    const read_view_t* open_read_view(int trx_id)
+    {
+        return trx_manager.open_read_view(trx_id);
+    }
+
+    // Get the version of the record the read view sees
+    int read_version(const read_view_t* read_view, int64_t table_id, int64_t key, std::string& value, int trx_id)
+    {
+        return trx_manager.read_version(read_view, table_id, key, value, trx_id);
+    }
+
+    // Remove the old versions no read view sees
+    int purge_versions()
+    {
+        return trx_manager.purge_versions();
+    }
+
+    // Get the id the next transaction takes
+    int get_next_trx_id()
     {
-        return trx_manager.init();
+        return trx_manager.next_trx_id.load();
+    }
+
+    // Allocate transaction ids after the given one
+    void skip_trx_ids(int trx_id)
+    {
+        int next_trx_id = trx_manager.next_trx_id.load();
+
+        while (next_trx_id <= trx_id && !trx_manager.next_trx_id.compare_exchange_weak(next_trx_id, trx_id + 1));
     }
 
     // Acquire lock
-    int acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int trx_id, int old_trx_id, int lock_mode) 
+    int acquire_lock(int64_t table_id, pagenum_t page_id, int64_t key, int record_id, int trx_id, int old_trx_id, int lock_mode) 
     {
         int flag;
 
         // Acquire the lock for the transaction
-        flag = trx_manager.acquire_lock(table_id, page_id, key, trx_id, old_trx_id, lock_mode);
+        flag = trx_manager.acquire_lock(table_id, page_id, key, record_id, trx_id, old_trx_id, lock_mode);
         if (flag == FLAG::ABORTED) printf("[INFO][acquire_lock][trx_id: %d] Abort transaction %d\n", trx_id, trx_id);
         else if (flag == FLAG::SUCCESS) printf("[INFO][acquire_lock][trx_id: %d] Acquire lock for transaction %d\n", trx_id, trx_id);
         else printf("[INFO][acquire_lock][trx_id: %d] Failed to acquire lock for transaction %d\n", trx_id, trx_id);
@@ -528,15 +1050,69 @@ namespace TRX
         return flag;
     }
 
+    // Get the lsn of the last log record of the transaction
+    int64_t get_last_lsn(int trx_id)
+    {
+        trx_t* trx_obj;
+
+        // Get the transaction object (only its own thread logs for it)
+        trx_obj = trx_manager.get_trx(trx_id);
+        if (trx_obj == NULL) return -1;
+        return trx_obj->get_last_lsn();
+    }
+
+    // Append a log record of the transaction (linked to its last record)
+    int64_t write_log(int trx_id, int type, int64_t table_id, pagenum_t page_id, uint16_t offset, uint16_t length, const char* old_img, const char* new_img, int64_t next_undo_lsn, uint8_t image_kind)
+    {
+        int64_t lsn;
+        trx_t* trx_obj;
+
+        // Get the transaction object (only its own thread logs for it)
+        trx_obj = trx_manager.get_trx(trx_id);
+        if (trx_obj == NULL) return -1;
+
+        // Log the updates only of the tables recovery opens again by the id (the others are rolled back from the undo logs only)
+        if ((type == LOG::UPDATE || type == LOG::COMPENSATE) && !opened_tables.isDataTable(table_id)) return -1;
+
+        // Append the log record and keep its lsn as the last one of the transaction
+        lsn = LOG::log(type, trx_id, trx_obj->get_last_lsn(), table_id, page_id, offset, length, old_img, new_img, next_undo_lsn, image_kind);
+        if (lsn >= 0) trx_obj->set_last_lsn(lsn);
+        return lsn;
+    }
+
+    // Collect the transactions having log records for a checkpoint
+    void get_active_trxs(std::vector<att_entry_t>& active_trxs)
+    {
+        EPOCH::guard_t guard;
+
+        trx_manager.trx_table.for_each([&](trx_t* trx) {
+            if (trx->get_first_lsn() < 0) return;
+            active_trxs.push_back({trx->get_trx_id(), trx->get_first_lsn(), trx->get_last_lsn()});
+        });
+    }
+
+    // Lock the whole table
+    int lock_table(int64_t table_id, int trx_id, int lock_mode)
+    {
+        int flag;
+
+        // Acquire the table lock for the transaction
+        flag = trx_manager.acquire_table(table_id, trx_id, lock_mode);
+        if (flag == FLAG::ABORTED) printf("[INFO][lock_table][trx_id: %d] Abort transaction %d\n", trx_id, trx_id);
+        else if (flag != FLAG::SUCCESS) printf("[INFO][lock_table][trx_id: %d] Failed to lock table %ld\n", trx_id, table_id);
+
+        return flag;
+    }
+
     // Add undo log
-    int save_log(int trx_id, int64_t table_id, pagenum_t page_id, int64_t key, std::string old_value, int old_trx_id)
+    int save_log(int trx_id, int64_t table_id, pagenum_t page_id, int64_t key, int record_id, const std::string& old_value, int old_trx_id, int64_t undo_next_lsn)
     {
         int flag;
         undo_log_t log;
 
         // Create and add the undo log
-        log = undo_log_t(table_id, page_id, key, old_value, old_trx_id);
-        flag = trx_manager.add_undo_log(trx_id, log);
+        log = undo_log_t(table_id, page_id, key, record_id, old_trx_id, undo_next_lsn);
+        flag = trx_manager.add_undo_log(trx_id, log, old_value);
         if (flag) printf("[INFO] Failed to add undo log for transaction %d\n", trx_id);
         return flag;
     }
@@ -553,8 +1129,14 @@ int trx_begin(void)
 
     // Allocate a transaction id
     trx_id = TRX::trx_manager.alloc_trx();
-    if (trx_id > 0) printf("[INFO][trx_begin][trx_id: %d] Allocate transaction %d\n", trx_id, trx_id);
-    else printf("[ERROR][trx_begin] Failed to allocate transaction\n");
+    if (trx_id <= 0) {
+        printf("[ERROR][trx_begin] Failed to allocate transaction\n");
+        return trx_id;
+    }
+    printf("[INFO][trx_begin][trx_id: %d] Allocate transaction %d\n", trx_id, trx_id);
+
+    // Log the beginning of the transaction
+    TRX::write_log(trx_id, LOG::BEGIN);
     return trx_id;
 }
 
@@ -562,6 +1144,11 @@ int trx_begin(void)
 int trx_commit(int trx_id)
 {
     int flag;
+    int64_t lsn;
+
+    // Wait until the commit log record is durable (batched with other commits by the log flusher)
+    lsn = TRX::write_log(trx_id, LOG::COMMIT);
+    if (lsn >= 0) LOG::flush(lsn);
 
     // Commit the transaction
     flag = TRX::trx_manager.commit_trx(trx_id);
@@ -577,7 +1164,7 @@ int trx_abort(int trx_id)
 
     // Abort the transaction
     flag = TRX::trx_manager.abort_trx(trx_id);
-    if (flag > 0) printf("[INFO][trx_abort][trx_id: %d] Abort transaction %d\n", trx_id, trx_id);
+    if (flag == FLAG::SUCCESS) printf("[INFO][trx_abort][trx_id: %d] Abort transaction %d\n", trx_id, trx_id);
     else printf("[ERROR][trx_abort][trx_id: %d]  Failed to abort transaction %d\n", trx_id, trx_id);
     return flag;
 }
\ No newline at end of file
@@ -4,71 +4,197 @@
 /// Structures
 // Undo log structure
 undo_log_t::undo_log_t()
-    : table_id(0), page_id(0), key(0), old_value(""), old_trx_id(0) 
+    : table_id(0), page_id(0), length(0), image_offset(0), key(0), record_id(-1), old_trx_id(0), undo_next_lsn(-1)
 {}
 
-undo_log_t::undo_log_t(int64_t table_id, pagenum_t page_id, int64_t key, std::string old_value, int old_trx_id)
-    : table_id(table_id), page_id(page_id), key(key), old_value(old_value), old_trx_id(old_trx_id)
+undo_log_t::undo_log_t(int64_t table_id, pagenum_t page_id, int64_t key, int record_id, int old_trx_id, int64_t undo_next_lsn)
+    : table_id(table_id), page_id(page_id), length(0), image_offset(0), key(key), record_id(record_id),
+    old_trx_id(old_trx_id), undo_next_lsn(undo_next_lsn)
 {}
 
-int undo_log_t::rollback()
+// Write the old value back and log it as compensation records following last_lsn (updated to the last record)
+int undo_log_t::rollback(int trx_id, int64_t& last_lsn, const std::string& values)
 {
-    int flag, pin_id;
-    Record record_rollback;
+    int idx;
+    int64_t lsn = -1;
+    page_t* frame;
+    PageHandle page;
+    std::vector<leaf_image_t> images;
+    const char* old_image = values.data() + this->image_offset;
+
+    // Pin the page having the record
+    page = BUF::fix_page(this->table_id, this->page_id);
+    frame = page.write();
+    if (frame == NULL) return FLAG::FAILURE;
+    LeafView leaf_view(frame);
+
+    // Find the record in its slot at the update (searched only if a change of the page moved it)
+    idx = this->record_id;
+    if (idx < 0 || idx >= (int)leaf_view.number_of_keys() || leaf_view.key(idx) != this->key) {
+        idx = leaf_view.find_record(this->key);
+        if (idx < 0) return FLAG::FAILURE;
+    }
 
-    // Reverse the operation
-    flag = BPT::update(
-        this->table_id, this->page_id, this->key,
-        record_rollback, this->old_value, this->old_trx_id, pin_id
-    );
-    return flag;
+    // Write the old value and the transaction id back (its size may differ from the current one)
+    if (BPT::update_record(frame, idx, old_image, this->length, this->old_trx_id, images)) return FLAG::FAILURE;
+
+    // Log the compensations while the page is latched (a compaction continues the undo from the last record)
+    // (none for a table whose updates are not logged, since recovery cannot open it by the id)
+    if (!opened_tables.isDataTable(this->table_id)) images.clear();
+    for (leaf_image_t& image : images) {
+        lsn = LOG::log(
+            LOG::COMPENSATE, trx_id, last_lsn, this->table_id, this->page_id, image.offset, image.old_img.size(),
+            image.old_img.data(), image.new_img.data(), image.redo_only ? last_lsn : this->undo_next_lsn, image.kind
+        );
+        if (lsn >= 0) last_lsn = lsn;
+    }
+
+    // Stamp the page with the last compensation
+    BUF::mark_dirty(page.get_pin_id());
+    if (lsn >= 0) BUF::stamp_page(page.get_pin_id(), lsn);
+    return FLAG::SUCCESS;
+}
+
+
+// Undo arena structure
+// Append the undo log and its old image
+void undo_arena_t::add(undo_log_t log, const std::string& old_image)
+{
+    log.image_offset = this->values.size();
+    log.length = old_image.size();
+    this->values.append(old_image);
+    this->logs.push_back(log);
+}
+
+// Find the value before the first update of the record in the arena, and the transaction which wrote it
+// (the later updates of the record have the transaction itself as the old one)
+bool undo_arena_t::find(int64_t table_id, int64_t key, std::string& value, int& old_trx_id) const
+{
+    for (const undo_log_t& log : this->logs) {
+        if (log.table_id != table_id || log.key != key) continue;
+        value.assign(this->values, log.image_offset, log.length);
+        old_trx_id = log.old_trx_id;
+        return true;
+    }
+    return false;
+}
+
+// Empty the arena for the next transaction (an unusually large buffer is given back to the heap)
+void undo_arena_t::clear()
+{
+    this->logs.clear();
+    if (this->values.capacity() > UNDO_ARENA_KEEP_SIZE) std::string().swap(this->values);
+    else this->values.clear();
+}
+
+
+// Read view structure
+read_view_t::read_view_t()
+    : creator_trx_id(0), up_limit_id(0), low_limit_id(0)
+{}
+
+// Check if the updates of the transaction are seen (its own, and the ones finished before the view)
+bool read_view_t::is_visible(int trx_id) const
+{
+    if (trx_id == this->creator_trx_id || trx_id < this->up_limit_id) return true;
+    if (trx_id >= this->low_limit_id) return false;
+    return !std::binary_search(this->active_ids.begin(), this->active_ids.end(), trx_id);
 }
 
 
 // Transaction structure
 trx_t::trx_t()
-    : trx_id(0), first(NULL), last(NULL)
+    : trx_id(0), undo_arena(NULL), undo_taken(false), wait_latch(NULL), wait_cond(NULL), wait_seq(0), deadlock_victim(false),
+    releasing(false), first_lsn(-1), last_lsn(-1), first(NULL), last(NULL), has_read_view(false)
 {
-    // Initialize the waiting for latch
+    // Initialize the waiting for latch, the lock list latch and the undo latch
     pthread_mutex_init(&this->waiting_list_latch, NULL);
+    pthread_mutex_init(&this->lock_list_latch, NULL);
+    pthread_mutex_init(&this->undo_latch, NULL);
 }
 
 trx_t::trx_t(int trx_id)
-    : trx_id(trx_id), first(NULL), last(NULL)
+    : trx_id(trx_id), undo_arena(NULL), undo_taken(false), wait_latch(NULL), wait_cond(NULL), wait_seq(0), deadlock_victim(false),
+    releasing(false), first_lsn(-1), last_lsn(-1), first(NULL), last(NULL), has_read_view(false)
 {
-    // Initialize the waiting for latch
+    // Initialize the waiting for latch, the lock list latch and the undo latch
     pthread_mutex_init(&this->waiting_list_latch, NULL);
+    pthread_mutex_init(&this->lock_list_latch, NULL);
+    pthread_mutex_init(&this->undo_latch, NULL);
+}
+
+// Destructor (an arena still held is deleted, since the thread deleting the transaction may not be its own)
+trx_t::~trx_t()
+{
+    delete this->undo_arena;
 }
 
 int trx_t::append_lock(lock_t* lock_obj)
 {
-    // Append the lock to the end of the list
-    if (this->first == NULL && this->last == NULL) {
+    int flag;
+
+    // Acquire the lock list latch
+    flag = pthread_mutex_lock(&this->lock_list_latch);
+    if (flag != 0) return FLAG::FAILURE;
+
+    // Append the lock to the end of the list (unless the locks are being released)
+    if (this->releasing) {
+        flag = FLAG::FAILURE;
+    } else if (this->first == NULL && this->last == NULL) {
         this->first = this->last = lock_obj;
+        flag = FLAG::SUCCESS;
     } else if (this->first != NULL && this->last != NULL) {
         this->last->next_trx_lock = lock_obj;
         this->last = lock_obj;
+        flag = FLAG::SUCCESS;
     } else {
-        return FLAG::FAILURE;
+        flag = FLAG::FAILURE;
     }
 
-    return FLAG::SUCCESS;
+    // Release the lock list latch
+    pthread_mutex_unlock(&this->lock_list_latch);
+    return flag;
 }
 
-bool trx_t::in_waiting_list(int trx_id)
+// Take the whole lock list to release it (no lock is appended afterwards)
+lock_t* trx_t::detach_locks()
 {
-    int flag;
+    lock_t* locks;
 
-    // Acquire the waiting list latch
-    flag = pthread_mutex_lock(&this->waiting_list_latch);
-    if (flag != 0) return false;
+    pthread_mutex_lock(&this->lock_list_latch);
+    this->releasing = true;
+    locks = this->first;
+    this->first = this->last = NULL;
+    pthread_mutex_unlock(&this->lock_list_latch);
 
-    // Check if this transaction is waiting for the given transaction
-    flag = this->waiting_list.find(trx_id) != this->waiting_list.end();
+    return locks;
+}
 
-    // Release the waiting list latch
-    pthread_mutex_unlock(&this->waiting_list_latch);
-    return flag;
+// Unlink the acquired locks on the table from the lock list
+std::vector<lock_t*> trx_t::detach_acquired_locks(int64_t table_id)
+{
+    lock_t *cur, *prev, *next;
+    std::vector<lock_t*> locks;
+
+    pthread_mutex_lock(&this->lock_list_latch);
+    prev = NULL;
+    for (cur = this->first; cur != NULL; cur = next) {
+        next = cur->next_trx_lock;
+        if (cur->get_page_key().first != table_id || !cur->is_acquired()) {
+            prev = cur;
+            continue;
+        }
+
+        // Unlink the lock from the transaction
+        if (prev == NULL) this->first = next;
+        else prev->next_trx_lock = next;
+        if (this->last == cur) this->last = prev;
+        cur->next_trx_lock = NULL;
+        locks.push_back(cur);
+    }
+    pthread_mutex_unlock(&this->lock_list_latch);
+
+    return locks;
 }
 
 void trx_t::add_waiting_list(int trx_id)
@@ -86,73 +212,148 @@ void trx_t::add_waiting_list(int trx_id)
     pthread_mutex_unlock(&this->waiting_list_latch);
 }
 
-void trx_t::pop_waiting_list(int trx_id)
+// Start waiting on the condition with the latch (the waiting list has the transactions waited for)
+void trx_t::begin_wait(pthread_mutex_t* latch, pthread_cond_t* cond)
 {
-    int flag;
+    pthread_mutex_lock(&this->waiting_list_latch);
+    this->wait_latch = latch;
+    this->wait_cond = cond;
+    this->wait_seq++;
+    this->deadlock_victim = false;
+    pthread_mutex_unlock(&this->waiting_list_latch);
+}
 
-    // Acquire the waiting list latch
-    flag = pthread_mutex_lock(&this->waiting_list_latch);
-    if (flag != 0) return;
+// Finish the wait (its waits-for edges are removed)
+void trx_t::end_wait()
+{
+    pthread_mutex_lock(&this->waiting_list_latch);
+    this->waiting_list.clear();
+    this->wait_latch = NULL;
+    this->wait_cond = NULL;
+    this->deadlock_victim = false;
+    pthread_mutex_unlock(&this->waiting_list_latch);
+}
 
-    // Remove the trx_id from the waiting set
-    if (this->waiting_list.find(trx_id) != this->waiting_list.end()) {
-        this->waiting_list.erase(trx_id);
-    }
+bool trx_t::is_deadlock_victim()
+{
+    bool victim;
 
-    // Release the waiting list latch
+    pthread_mutex_lock(&this->waiting_list_latch);
+    victim = this->deadlock_victim;
     pthread_mutex_unlock(&this->waiting_list_latch);
+    return victim;
 }
 
-std::stack<int> trx_t::get_waiting_stack()
+// Get the transactions waited for and the number of the wait (false if the transaction is not waiting)
+bool trx_t::get_wait(std::vector<int>& waiting_for, int& wait_seq)
 {
-    std::stack<int> waiting_stack;
-    int flag;
+    bool waiting;
 
-    // Acquire the waiting list latch
-    flag = pthread_mutex_lock(&this->waiting_list_latch);
-    if (flag != 0) return waiting_stack;
-
-    // Get the waiting stack
-    for (int trx_id : this->waiting_list) {
-        waiting_stack.push(trx_id);
+    pthread_mutex_lock(&this->waiting_list_latch);
+    waiting = this->wait_cond != NULL;
+    if (waiting) {
+        waiting_for.assign(this->waiting_list.begin(), this->waiting_list.end());
+        wait_seq = this->wait_seq;
     }
+    pthread_mutex_unlock(&this->waiting_list_latch);
+    return waiting;
+}
 
-    // Release the waiting list latch
+// Abort the wait if it is still the one numbered wait_seq (latch and cond are set to wake the transaction)
+bool trx_t::set_deadlock_victim(int wait_seq, pthread_mutex_t*& latch, pthread_cond_t*& cond)
+{
+    bool waiting;
+
+    pthread_mutex_lock(&this->waiting_list_latch);
+    waiting = this->wait_cond != NULL && this->wait_seq == wait_seq;
+    if (waiting) {
+        this->deadlock_victim = true;
+        latch = this->wait_latch;
+        cond = this->wait_cond;
+    }
     pthread_mutex_unlock(&this->waiting_list_latch);
-    return waiting_stack;
+    return waiting;
 }
 
-void trx_t::add_undo_log(undo_log_t log)
+void trx_t::add_undo_log(undo_log_t log, const std::string& old_value)
 {
-    // Add the undo log to the top of the stack
-    this->undo_logs.push(log);
+    // Take an arena at the first update, and append the undo log to it
+    pthread_mutex_lock(&this->undo_latch);
+    if (this->undo_arena == NULL) this->undo_arena = UNDO_POOL::alloc();
+    this->undo_arena->add(log, old_value);
+    pthread_mutex_unlock(&this->undo_latch);
+}
+
+// Find the value of the record before the transaction updated it (taken is set if the arena went to the undo history)
+bool trx_t::find_undo(int64_t table_id, int64_t key, std::string& value, int& old_trx_id, bool& taken)
+{
+    bool found;
+
+    pthread_mutex_lock(&this->undo_latch);
+    taken = this->undo_taken;
+    found = this->undo_arena != NULL && this->undo_arena->find(table_id, key, value, old_trx_id);
+    pthread_mutex_unlock(&this->undo_latch);
+    return found;
 }
 
+// Rollback the transaction (the latest update first, the undo logs are kept for the consistent reads of the others)
 int trx_t::rollback()
 {
     int flag;
-    undo_log_t log;
 
-    // Rollback the transaction
-    while (!this->undo_logs.empty()) {
-        // Pop the top undo log
-        log = this->undo_logs.top();
-        this->undo_logs.pop();
+    if (this->undo_arena == NULL) return FLAG::SUCCESS;
 
-        // Perform the rollback
-        flag = log.rollback();
+    std::vector<undo_log_t>& logs = this->undo_arena->logs;
+    for (auto log = logs.rbegin(); log != logs.rend(); log++) {
+        flag = log->rollback(this->trx_id, this->last_lsn, this->undo_arena->values);
         if (flag) return FLAG::FAILURE;
     }
     return FLAG::SUCCESS;
 }
 
+// Take the undo arena to the undo history (once the transaction is finished, it stays marked taken for the readers still holding it)
+undo_arena_t* trx_t::take_undo_arena()
+{
+    undo_arena_t* arena;
+
+    pthread_mutex_lock(&this->undo_latch);
+    arena = this->undo_arena;
+    this->undo_arena = NULL;
+    if (arena != NULL) this->undo_taken = true;
+    pthread_mutex_unlock(&this->undo_latch);
+    return arena;
+}
+
+// Give the undo arena back to the pool of the calling thread (once the transaction is finished)
+void trx_t::release_undo_arena()
+{
+    undo_arena_t* arena;
+
+    pthread_mutex_lock(&this->undo_latch);
+    arena = this->undo_arena;
+    this->undo_arena = NULL;
+    pthread_mutex_unlock(&this->undo_latch);
+    if (arena != NULL) UNDO_POOL::free(arena);
+}
+
+int trx_t::get_trx_id()
+{
+    return this->trx_id;
+}
+
 int64_t trx_t::get_last_lsn()
 {
     return this->last_lsn;
 }
 
+int64_t trx_t::get_first_lsn()
+{
+    return this->first_lsn;
+}
+
 void trx_t::set_last_lsn(int64_t last_lsn)
 {
+    if (this->first_lsn < 0) this->first_lsn = last_lsn;
     this->last_lsn = last_lsn;
 }
 
@@ -160,13 +361,14 @@ void trx_t::clear()
 {
     // Clear the transaction
     this->waiting_list.clear();
-    this->undo_logs = std::stack<undo_log_t>();
+    this->release_undo_arena();
+    this->has_read_view = false;
 }
 
 
 // Lock structure
 lock_t::lock_t()
-    : sentinel(NULL), prev(NULL), next(NULL), next_trx_lock(NULL),
+    : page(0, 0), sentinel(NULL), prev(NULL), next(NULL), next_trx_lock(NULL),
     record_id(0), trx_id(0), lock_mode(LOCK_MODE_SHARED), acquired(false)
 {
     // Initialize the condition variable
@@ -176,21 +378,26 @@ lock_t::lock_t()
     this->bitmap.reset();
 }
 
-lock_t::lock_t(lock_table_entry_t* sentinel, int64_t record_id, int trx_id, int lock_mode)
-    : sentinel(sentinel), prev(NULL), next(NULL), next_trx_lock(NULL),
-    record_id(record_id), trx_id(trx_id), lock_mode(lock_mode), acquired(false)
+// Set up a lock taken from the pool (the condition variable is kept across uses)
+void lock_t::init(lock_table_entry_t* sentinel, int record_id, int trx_id, int lock_mode)
 {
-    // Initialize the condition variable
-    pthread_cond_init(&this->cond, NULL);
-    
+    this->page = {sentinel->table_id, sentinel->page_id};
+    this->sentinel = sentinel;
+    this->prev = this->next = this->next_trx_lock = NULL;
+    this->record_id = record_id;
+    this->trx_id = trx_id;
+    this->lock_mode = lock_mode;
+    this->acquired = false;
+
     // Reset bitmap
     this->bitmap.reset();
 }
 
 int lock_t::is_contained(int record_id, int trx_id, int lock_mode)
 {
-    // If trx_id is not the same, return 0
+    // If trx_id is not the same, or the mode is weaker than lock_mode, return 0
     if (trx_id && this->trx_id != trx_id) return 0;
+    if (this->lock_mode < lock_mode) return 0;
 
     // If record_id is contain in this, return 2 (acquired)
     if (this->bitmap[record_id]) return 2;
@@ -239,15 +446,6 @@ void lock_t::set_acquired()
     this->bitmap.set(this->record_id, 1);
 }
 
-void lock_t::wait(pthread_mutex_t* lock_manager_latch)
-{
-    // Wait for the condition variable
-    if (!this->acquired) {
-        printf("[INFO][%s][trx_id: %d] Wait begin (record_id: %d)\n", __func__, this->trx_id, this->record_id);
-        pthread_cond_wait(&this->cond, lock_manager_latch);
-    }
-}
-
 void lock_t::signal()
 {
     // Signal the condition variable
@@ -258,7 +456,7 @@ void lock_t::signal()
 page_key_t lock_t::get_page_key()
 {
     // Return the page_key_t of this lock
-    return {this->sentinel->table_id, this->sentinel->page_id};
+    return this->page;
 }
 
 
@@ -277,7 +475,8 @@ lock_t* lock_table_entry_t::append_lock(int record_id, int trx_id, int lock_mode
     int flag;
 
     // Create a new lock
-    lock_t* lock = new lock_t(this, record_id, trx_id, lock_mode);
+    lock_t* lock = LOCK_POOL::alloc();
+    lock->init(this, record_id, trx_id, lock_mode);
 
     // Update the lock table entry
     if (this->head == NULL && this->tail == NULL) {
@@ -288,7 +487,7 @@ lock_t* lock_table_entry_t::append_lock(int record_id, int trx_id, int lock_mode
         this->tail->next = lock;
     } else {
         // This should never happen
-        delete lock;
+        LOCK_POOL::free(lock);
         return NULL;
     }
 
@@ -303,29 +502,24 @@ lock_t* lock_table_entry_t::append_lock(int record_id, int trx_id, int lock_mode
 // Try compress the lock
 lock_t* lock_table_entry_t::compress_lock(int record_id, int trx_id, int lock_mode)
 {
-    bool compressable = true;
-    int flag;
+    lock_t* compressable = NULL;
+
+    // Check if the transaction already holds the record in a mode covering lock_mode
+    for (lock_t* lock = this->head; lock != NULL; lock = lock->next) {
+        if (lock->is_acquired() && lock->is_contained(record_id, trx_id, lock_mode) == 2) return lock;
+    }
 
-    for (lock_t* lock = this->tail; lock != NULL; lock = lock->prev) {
-        // Cheack if the lock is already acquired
-        if (lock->is_contained(record_id, trx_id, lock_mode)) return lock;
+    for (lock_t* lock = this->head; lock != NULL; lock = lock->next) {
+        // Another transaction holds or waits for the record in a conflicting mode
+        if (lock->is_conflict(record_id, trx_id, lock_mode)) return NULL;
 
         // Check if the lock is compressable
-        if (compressable && lock->is_compressable(trx_id, lock_mode)) {
-            lock->add_record(record_id);
-            return lock;
-        }
-
-        // Check if the lock is conflict with the new lock
-        if (lock->is_conflict(record_id, trx_id, lock_mode)) {
-            // Case 1: The conflictable lock is already acquired
-            if (lock->is_acquired()) return NULL;
-            // Case 2: The conflictable lock is waiting
-            compressable = false;
-        }
+        if (compressable == NULL && lock->is_acquired() && lock->is_compressable(trx_id, lock_mode)) compressable = lock;
     }
 
-    return NULL;
+    // Add the record to the lock held by the transaction
+    if (compressable != NULL) compressable->add_record(record_id);
+    return compressable;
 }
 
 // Remove the head lock
@@ -337,17 +531,14 @@ int lock_table_entry_t::remove_lock(lock_t* lock)
     if (lock == NULL || lock->sentinel != this) return FLAG::FAILURE;
     if (this->head == NULL || this->tail == NULL) return FLAG::FAILURE;
 
-    // Destroy the condition variable
-    pthread_cond_destroy(&lock->cond);
-
     // Update the lock table entry
     if (this->head == lock) this->head = lock->next;
     if (this->tail == lock) this->tail = lock->prev;
     if (lock->next != NULL) lock->next->prev = lock->prev;
     if (lock->prev != NULL) lock->prev->next = lock->next;
 
-    // Destroy the lock
-    delete lock;
+    // Return the lock to the pool
+    LOCK_POOL::free(lock);
     return FLAG::SUCCESS;
 }
 
@@ -358,60 +549,523 @@ bool lock_table_entry_t::is_empty()
     return this->head == NULL && this->tail == NULL;
 }
 
-int lock_table_entry_t::broadcast_lock(lock_t* lock_obj)
+// Check if a lock before the lock conflicts with it (except the ignored one)
+bool lock_table_entry_t::is_blocked(lock_t* lock, lock_t* ignored)
 {
-    int conflict;
-    std::bitset<RECORD_MAX_COUNT> bitmap, xbitmap;
-
-    // Reset bitmaps
-    bitmap.reset();
-    xbitmap.reset();
+    for (lock_t* cur = lock->prev; cur != NULL; cur = cur->prev) {
+        if (cur != ignored && cur->is_conflict(lock->record_id, lock->trx_id, lock->lock_mode)) return true;
+    }
+    return false;
+}
 
+// Grant the waiting locks that the lock to be released is the last conflict of
+int lock_table_entry_t::broadcast_lock(lock_t* lock_obj)
+{
     // Check if the lock is valid
     if (lock_obj == NULL) return FLAG::FAILURE;
 
     printf("[INFO][%s][trx_id: %d] This lock: %d, %d, %d, %d\n", __func__, lock_obj->trx_id, lock_obj->trx_id, lock_obj->sentinel->page_id, lock_obj->record_id, lock_obj->lock_mode);
 
-    // Check lock mode
-    if (lock_obj->lock_mode == LOCK_MODE_EXCLUSIVE) {
-        // Case 1: Exclusive lock
-        for (lock_t* cur = lock_obj; cur != NULL; cur = cur->next) {
-            // Check if current lock is conflict with lock to be released
+    for (lock_t* cur = this->head; cur != NULL; cur = cur->next) {
+        if (cur == lock_obj || cur->is_acquired()) continue;
 
-            printf("[INFO][%s][trx_id: %d] Current lock: %d, %d, %d, %d\n", __func__, lock_obj->trx_id, cur->trx_id, cur->sentinel->page_id, cur->record_id, cur->lock_mode);
+        printf("[INFO][%s][trx_id: %d] Current lock: %d, %d, %d, %d\n", __func__, lock_obj->trx_id, cur->trx_id, cur->sentinel->page_id, cur->record_id, cur->lock_mode);
 
-            conflict = cur->is_conflict(lock_obj->record_id, lock_obj->trx_id, lock_obj->lock_mode);
+        // Wake up the waiting lock if nothing else conflicts with it
+        if (!this->is_blocked(cur, lock_obj)) {
+            cur->set_acquired();
+            cur->signal();
+        }
+    }
 
-            printf("[INFO][%s][trx_id: %d] Conflict: %d\n", __func__, lock_obj->trx_id, conflict);
-            
-            if (conflict == 1) {
-                if (xbitmap.test(cur->record_id) == 0) cur->signal();
-                bitmap.set(cur->record_id, 1);
-            }
-            
-            if (conflict == 2) {
-                if (bitmap.test(cur->record_id) == 0) cur->signal();
-                bitmap.set(cur->record_id, 1);
-                xbitmap.set(cur->record_id, 1);
+    return FLAG::SUCCESS;
+}
+
+
+/// Lock table structure
+lock_table_t::lock_table_t()
+    : mask(0), num_used(0)
+{}
+
+// Allocate the slots (rounded up to a power of two)
+void lock_table_t::init(size_t capacity)
+{
+    size_t size = 8;
+
+    while (size < capacity) size <<= 1;
+    this->slots.assign(size, lock_table_entry_t());
+    this->mask = size - 1;
+    this->num_used = 0;
+}
+
+// Find the entry of the page (NULL if there is none)
+lock_table_entry_t* lock_table_t::find(page_key_t page)
+{
+    lock_table_entry_t* slot;
+
+    for (size_t idx = hash_page_key_t()(page) & this->mask, probe = 0; probe <= this->mask; idx = (idx + 1) & this->mask, probe++) {
+        slot = &this->slots[idx];
+        if (slot->page_id == 0) return NULL;
+        if (slot->table_id == page.first && slot->page_id == page.second) return slot;
+    }
+    return NULL;
+}
+
+// Get the entry of the page, or take one for it
+lock_table_entry_t* lock_table_t::get(page_key_t page)
+{
+    size_t idx, probe;
+    lock_table_entry_t *slot = NULL, *reusable = NULL;
+
+    // Look for the page up to a slot never used (remembering the first entry without locks)
+    for (idx = hash_page_key_t()(page) & this->mask, probe = 0; probe <= this->mask; idx = (idx + 1) & this->mask, probe++) {
+        slot = &this->slots[idx];
+        if (slot->page_id == 0) break;
+        if (slot->table_id == page.first && slot->page_id == page.second) return slot;
+        if (reusable == NULL && slot->is_empty()) reusable = slot;
+    }
+
+    // Reuse the entry without locks, or take the slot never used while the table is at most 3/4 used
+    if (reusable != NULL) {
+        slot = reusable;
+    } else if (probe > this->mask || (this->num_used + 1) * 4 > this->slots.size() * 3) {
+        this->rebuild();
+        return this->get(page);
+    } else {
+        this->num_used++;
+    }
+
+    slot->table_id = page.first;
+    slot->page_id = page.second;
+    return slot;
+}
+
+// Move the entries having locks to new slots (twice more if they hold more than a half), and relink their locks
+void lock_table_t::rebuild()
+{
+    size_t idx, num_locked = 0;
+    std::vector<lock_table_entry_t> old_slots;
+
+    // Count the entries having locks
+    for (lock_table_entry_t& entry : this->slots) {
+        if (entry.page_id != 0 && !entry.is_empty()) num_locked++;
+    }
+
+    // Allocate new slots
+    old_slots.swap(this->slots);
+    this->init(num_locked * 2 > old_slots.size() ? old_slots.size() * 2 : old_slots.size());
+
+    for (lock_table_entry_t& entry : old_slots) {
+        if (entry.page_id == 0 || entry.is_empty()) continue;
+
+        // Move the entry to the first slot never used
+        idx = hash_page_key_t()({entry.table_id, entry.page_id}) & this->mask;
+        while (this->slots[idx].page_id != 0) idx = (idx + 1) & this->mask;
+        this->slots[idx] = entry;
+        this->num_used++;
+
+        // The locks point to the entry as their sentinel
+        for (lock_t* lock = entry.head; lock != NULL; lock = lock->next) lock->sentinel = &this->slots[idx];
+    }
+}
+
+
+/// Transaction table
+trx_table_t::trx_table_t()
+{
+    for (std::atomic<trx_t*>& slot : this->slots) slot.store(NULL, std::memory_order_relaxed);
+}
+
+trx_table_t::~trx_table_t()
+{
+    this->clear();
+}
+
+// Find the active transaction (wait-free)
+trx_t* trx_table_t::find(int trx_id)
+{
+    trx_t* trx_obj;
+
+    if (trx_id <= 0) return NULL;
+    trx_obj = this->slots[trx_id % TRX_TABLE_SIZE].load(std::memory_order_seq_cst);
+    if (trx_obj == NULL || trx_obj->get_trx_id() != trx_id) return NULL;
+    return trx_obj;
+}
+
+// Put the transaction in its slot (false if the slot holds another active transaction)
+bool trx_table_t::insert(trx_t* trx_obj)
+{
+    trx_t* expected = NULL;
+
+    return this->slots[trx_obj->get_trx_id() % TRX_TABLE_SIZE].compare_exchange_strong(expected, trx_obj, std::memory_order_seq_cst);
+}
+
+// Take the transaction out of its slot (by the thread running it, the caller retires it since lookups may still use it)
+trx_t* trx_table_t::erase(int trx_id)
+{
+    trx_t* trx_obj = this->find(trx_id);
+
+    // Only one of the callers removing it at once gets the transaction
+    if (trx_obj == NULL || !this->slots[trx_id % TRX_TABLE_SIZE].compare_exchange_strong(trx_obj, NULL, std::memory_order_seq_cst)) return NULL;
+    return trx_obj;
+}
+
+// Call the function on each active transaction
+void trx_table_t::for_each(const std::function<void(trx_t*)>& func)
+{
+    trx_t* trx_obj;
+
+    for (std::atomic<trx_t*>& slot : this->slots) {
+        trx_obj = slot.load(std::memory_order_seq_cst);
+        if (trx_obj != NULL) func(trx_obj);
+    }
+}
+
+// Delete all the transactions (nobody may look them up)
+void trx_table_t::clear()
+{
+    for (std::atomic<trx_t*>& slot : this->slots) delete slot.exchange(NULL);
+}
+
+
+/// Epoch-based reclamation
+namespace EPOCH
+{
+    constexpr uint64_t IDLE = UINT64_MAX;
+
+    // Epoch pinned by each thread (IDLE unless it holds a guard)
+    struct record_t
+    {
+        std::atomic<uint64_t> epoch{IDLE};
+        std::atomic<bool> used{false};
+    };
+    static record_t records[EPOCH_MAX_THREADS];
+    static std::atomic<uint64_t> global_epoch(0);
+
+    // Transactions removed at an epoch (deleted at exit if still retired)
+    struct retired_t
+    {
+        pthread_mutex_t latch = PTHREAD_MUTEX_INITIALIZER;
+        std::vector<std::pair<uint64_t, trx_t*>> trxs;
+
+        ~retired_t()
+        {
+            for (auto& retired : this->trxs) delete retired.second;
+        }
+    };
+    static retired_t retired;
+
+    // Record of the thread (given back when the thread exits)
+    struct local_t
+    {
+        int index = -1;
+        int depth = 0;
+
+        ~local_t()
+        {
+            if (this->index >= 0) records[this->index].used.store(false);
+        }
+    };
+    static thread_local local_t local;
+
+    static record_t& get_record()
+    {
+        bool expected;
+
+        if (local.index >= 0) return records[local.index];
+        for (int idx = 0; idx < EPOCH_MAX_THREADS; idx++) {
+            expected = false;
+            if (records[idx].used.compare_exchange_strong(expected, true)) {
+                local.index = idx;
+                return records[idx];
             }
         }
-    } else if (lock_obj->lock_mode == LOCK_MODE_SHARED) {
-        // Case 2: Shared lock
-        for (lock_t* cur = this->head; cur != NULL; cur = cur->next) {
+        std::cout << "[EPOCH::get_record] Too many threads" << std::endl;
+        exit(1);
+    }
 
-            printf("[INFO][%s][trx_id: %d] Current lock: %d, %d, %d, %d\n", __func__, lock_obj->trx_id, cur->trx_id, cur->sentinel->page_id, cur->record_id, cur->lock_mode);
+    // Publish the epoch before the table is read (a removal after it finds the guard)
+    guard_t::guard_t()
+    {
+        record_t& record = get_record();
 
-            // Check if current x lock is conflict with bitmap accumulated OR
-            if (cur->trx_id == lock_obj->trx_id) continue;
-            else if (cur->lock_mode == LOCK_MODE_SHARED && cur->is_acquired()) {
-                bitmap |= cur->bitmap;
-            }
-            else if (cur->lock_mode == LOCK_MODE_EXCLUSIVE && !cur->is_acquired()) {
-                if (bitmap.test(cur->record_id) == 0) cur->signal();
+        if (local.depth++ > 0) return;
+        record.epoch.store(global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    guard_t::~guard_t()
+    {
+        if (--local.depth > 0) return;
+        records[local.index].epoch.store(IDLE, std::memory_order_release);
+    }
+
+    // Delete the transaction later (it is already out of the table)
+    void retire(trx_t* trx_obj)
+    {
+        size_t num_retired;
+
+        pthread_mutex_lock(&retired.latch);
+        retired.trxs.push_back({global_epoch.fetch_add(1, std::memory_order_seq_cst), trx_obj});
+        num_retired = retired.trxs.size();
+        pthread_mutex_unlock(&retired.latch);
+
+        if (num_retired >= (size_t)EPOCH_RECLAIM_BATCH) reclaim();
+    }
+
+    // Delete the transactions retired before every guard left (returns the number deleted)
+    int reclaim()
+    {
+        uint64_t min_epoch = IDLE;
+        int num_reclaimed;
+
+        pthread_mutex_lock(&retired.latch);
+        for (record_t& record : records) min_epoch = std::min(min_epoch, record.epoch.load(std::memory_order_seq_cst));
+
+        // A guard pinning an epoch after the retirement cannot find the transaction
+        auto reclaimed = std::partition(retired.trxs.begin(), retired.trxs.end(), [min_epoch](const std::pair<uint64_t, trx_t*>& cur) {
+            return cur.first >= min_epoch;
+        });
+        for (auto it = reclaimed; it != retired.trxs.end(); it++) delete it->second;
+        num_reclaimed = retired.trxs.end() - reclaimed;
+        retired.trxs.erase(reclaimed, retired.trxs.end());
+        pthread_mutex_unlock(&retired.latch);
+
+        return num_reclaimed;
+    }
+}
+
+
+/// Lock object pool
+namespace LOCK_POOL
+{
+    // Shared free list (filled by slabs of lock objects, which are deallocated at exit only)
+    struct pool_t
+    {
+        pthread_mutex_t latch = PTHREAD_MUTEX_INITIALIZER;
+        std::vector<lock_t*> free_locks;
+        std::vector<lock_t*> slabs;
+
+        ~pool_t()
+        {
+            for (lock_t* slab : this->slabs) delete[] slab;
+        }
+    };
+    static pool_t pool;
+
+    // Counters
+    static std::atomic<uint64_t> num_allocs(0);
+    static std::atomic<uint64_t> num_frees(0);
+    static std::atomic<uint64_t> num_slabs(0);
+
+    // Free lock objects of the thread (returned to the shared free list when the thread exits)
+    struct cache_t
+    {
+        std::vector<lock_t*> locks;
+
+        ~cache_t()
+        {
+            pthread_mutex_lock(&pool.latch);
+            pool.free_locks.insert(pool.free_locks.end(), this->locks.begin(), this->locks.end());
+            pthread_mutex_unlock(&pool.latch);
+        }
+    };
+    static thread_local cache_t cache;
+
+    // Take a lock object (a slab of them is moved from the shared free list when the thread has none)
+    lock_t* alloc()
+    {
+        lock_t* lock;
+        size_t num_moved;
+
+        if (cache.locks.empty()) {
+            pthread_mutex_lock(&pool.latch);
+
+            // Allocate a slab if the shared free list is empty too
+            if (pool.free_locks.empty()) {
+                lock = new lock_t[LOCK_POOL_SLAB_SIZE];
+                pool.slabs.push_back(lock);
+                for (int idx = 0; idx < LOCK_POOL_SLAB_SIZE; idx++) pool.free_locks.push_back(&lock[idx]);
+                num_slabs.fetch_add(1, std::memory_order_relaxed);
             }
+
+            num_moved = std::min(pool.free_locks.size(), (size_t)LOCK_POOL_SLAB_SIZE);
+            cache.locks.insert(cache.locks.end(), pool.free_locks.end() - num_moved, pool.free_locks.end());
+            pool.free_locks.resize(pool.free_locks.size() - num_moved);
+
+            pthread_mutex_unlock(&pool.latch);
         }
+
+        lock = cache.locks.back();
+        cache.locks.pop_back();
+        num_allocs.fetch_add(1, std::memory_order_relaxed);
+        return lock;
     }
 
-    return FLAG::SUCCESS;
+    // Return a lock object (a slab of them goes back to the shared free list when the thread keeps too many)
+    void free(lock_t* lock)
+    {
+        cache.locks.push_back(lock);
+        num_frees.fetch_add(1, std::memory_order_relaxed);
+        if (cache.locks.size() <= (size_t)LOCK_POOL_CACHE_SIZE) return;
+
+        pthread_mutex_lock(&pool.latch);
+        pool.free_locks.insert(pool.free_locks.end(), cache.locks.end() - LOCK_POOL_SLAB_SIZE, cache.locks.end());
+        pthread_mutex_unlock(&pool.latch);
+        cache.locks.resize(cache.locks.size() - LOCK_POOL_SLAB_SIZE);
+    }
+
+    // Get the counters
+    stats_t get_stats()
+    {
+        return {num_allocs.load(), num_frees.load(), num_slabs.load()};
+    }
+}
+
+
+/// Undo arena pool
+namespace UNDO_POOL
+{
+    // Counters
+    static std::atomic<uint64_t> num_allocs(0);
+    static std::atomic<uint64_t> num_news(0);
+
+    // Free undo arenas of the thread (deleted when the thread exits)
+    struct cache_t
+    {
+        std::vector<undo_arena_t*> arenas;
+
+        ~cache_t()
+        {
+            for (undo_arena_t* arena : this->arenas) delete arena;
+        }
+    };
+    static thread_local cache_t cache;
+
+    // Take an undo arena (allocated only if the thread has none)
+    undo_arena_t* alloc()
+    {
+        undo_arena_t* arena;
+
+        num_allocs.fetch_add(1, std::memory_order_relaxed);
+        if (cache.arenas.empty()) {
+            num_news.fetch_add(1, std::memory_order_relaxed);
+            return new undo_arena_t();
+        }
+        arena = cache.arenas.back();
+        cache.arenas.pop_back();
+        return arena;
+    }
+
+    // Return an undo arena emptied (deleted if the thread keeps enough of them)
+    void free(undo_arena_t* arena)
+    {
+        if (cache.arenas.size() >= (size_t)UNDO_POOL_CACHE_SIZE) {
+            delete arena;
+            return;
+        }
+        arena->clear();
+        cache.arenas.push_back(arena);
+    }
+
+    // Get the counters
+    stats_t get_stats()
+    {
+        return {num_allocs.load(), num_news.load()};
+    }
+}
+
+
+/// Lock bucket structure
+lock_bucket_t::lock_bucket_t()
+{
+    // Initialize the bucket latch
+    pthread_mutex_init(&this->latch, NULL);
 }
 
+
+/// Table lock structure
+table_lock_t::table_lock_t()
+{
+    // Initialize the condition variable
+    pthread_cond_init(&this->cond, NULL);
+}
+
+// Check if the lock mode can be granted to the transaction now
+// (a new request also waits for the requests before it, an upgrade only for the granted modes)
+bool table_lock_t::is_grantable(int trx_id, int lock_mode, bool upgrade)
+{
+    // Check the modes granted to other transactions
+    for (auto& holder : this->granted) {
+        if (holder.first != trx_id && !LOCK_MODE::is_compatible(holder.second, lock_mode)) return false;
+    }
+    if (upgrade) return true;
+
+    // Check the requests waiting before
+    for (auto& request : this->waiting) {
+        if (request.first == trx_id) return true;
+        if (!LOCK_MODE::is_compatible(request.second, lock_mode)) return false;
+    }
+    return true;
+}
+
+// Get the transactions holding a mode conflicting with the lock mode
+std::vector<int> table_lock_t::get_conflicts(int trx_id, int lock_mode)
+{
+    std::vector<int> conflicts;
+
+    for (auto& holder : this->granted) {
+        if (holder.first != trx_id && !LOCK_MODE::is_compatible(holder.second, lock_mode)) conflicts.push_back(holder.first);
+    }
+    return conflicts;
+}
+
+// Remove the waiting request of the transaction
+void table_lock_t::remove_waiting(int trx_id)
+{
+    for (auto it = this->waiting.begin(); it != this->waiting.end(); it++) {
+        if (it->first == trx_id) {
+            this->waiting.erase(it);
+            return;
+        }
+    }
+}
+
+
+/// Table lock modes
+namespace LOCK_MODE
+{
+    // Compatibility matrix indexed by LOCK_MODE_* (S, X, IS, IX, SIX)
+    static const bool COMPATIBLE[5][5] = {
+        //        S      X      IS     IX     SIX
+        /* S   */ {true,  false, true,  false, false},
+        /* X   */ {false, false, false, false, false},
+        /* IS  */ {true,  false, true,  true,  true },
+        /* IX  */ {false, false, true,  true,  false},
+        /* SIX */ {false, false, true,  false, false},
+    };
+
+    bool is_compatible(int held, int requested)
+    {
+        if (held == LOCK_MODE_NONE || requested == LOCK_MODE_NONE) return true;
+        return COMPATIBLE[held][requested];
+    }
+
+    // Return the weakest mode covering both modes
+    int join(int held, int requested)
+    {
+        if (held == LOCK_MODE_NONE || held == requested) return requested;
+        if (requested == LOCK_MODE_NONE) return held;
+        if (held == LOCK_MODE_EXCLUSIVE || requested == LOCK_MODE_EXCLUSIVE) return LOCK_MODE_EXCLUSIVE;
+        if (held == LOCK_MODE_INTENTION_SHARED) return requested;
+        if (requested == LOCK_MODE_INTENTION_SHARED) return held;
+
+        // Any two of S, IX and SIX
+        return LOCK_MODE_SHARED_INTENTION_EXCLUSIVE;
+    }
+
+    bool covers(int held, int requested)
+    {
+        return held != LOCK_MODE_NONE && join(held, requested) == held;
+    }
+}
@@ -68,6 +68,37 @@ TEST(FileInitTest, CheckManyTables)
     }
 }
 
+TEST(FileInitTest, CheckDataTableIds)
+{
+    const vector<string> filepaths = {TestUtil::TEST_FILE_PATH, "DATA0", "DATA1", "DATA01"};
+    int64_t table_id;
+    int table_file;
+
+    for (const string& filepath : filepaths) remove(filepath.c_str());
+
+    // Other tables take the next id, and 'DATA<n>' takes n
+    table_id = file_open_table_file(TestUtil::TEST_FILE_PATH.c_str());
+    ASSERT_EQ(table_id, 0);
+    table_file = opened_tables.getFileDesc(table_id);
+    EXPECT_EQ(file_open_table_file("DATA1"), 1);
+    EXPECT_EQ(file_open_table_file("DATA01"), 2);
+
+    // 'DATA0' is refused since another table has its id, and 'DATA1' again gets the same file
+    EXPECT_EQ(file_open_table_file("DATA0"), -1);
+    EXPECT_EQ(opened_tables.getFileDesc(0), table_file);
+    table_file = opened_tables.getFileDesc(1);
+    EXPECT_EQ(file_open_table_file("DATA1"), 1);
+    EXPECT_EQ(opened_tables.getFileDesc(1), table_file);
+
+    // Only the table whose id leads back to its name is logged
+    EXPECT_FALSE(opened_tables.isDataTable(0));
+    EXPECT_TRUE(opened_tables.isDataTable(1));
+    EXPECT_FALSE(opened_tables.isDataTable(2));
+
+    file_close_table_files();
+    for (const string& filepath : filepaths) remove(filepath.c_str());
+}
+
 
 // 2. Page Management
 class PageManagementTest : public ::testing::Test {
@@ -131,6 +162,8 @@ TEST_F(PageManagementTest, CheckFileExtend)
     new_file_size = TestUtil::GetFileSize(table_id);
     EXPECT_EQ(new_num_of_pages, old_num_of_pages * 2);
     EXPECT_EQ(new_file_size, old_file_size * 2);
+    EXPECT_FALSE(TestUtil::IsFreedPage(table_id, old_num_of_pages));
+    EXPECT_TRUE(TestUtil::IsFreedPage(table_id, new_num_of_pages - 1));
 }
 
 
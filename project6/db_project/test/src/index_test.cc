@@ -2,6 +2,9 @@
 #include "bpt.h"
 #include "test_util.h"
 #include <gtest/gtest.h>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
 
 
 /// Types
@@ -617,14 +620,14 @@ TEST_F(DBTest, RandomKeyTest04)
 
 // One table re-load test
 // Init and shutdown DB Test with setting buffer size
-void InitTest(int buffer_size = -1)
+void InitTest(int buffer_size = -1, int buffer_policy = REPLACEMENT::CLOCK)
 {
     int num_records = NUM_KEY, trx_id;
     std::queue<TRecord> records;
     int64_t table_id;
 
     // Init DB
-    ASSERT_EQ(init_db(buffer_size == -1 ? 1 : buffer_size, 0, 100, "logfile.data", "logmsg.txt"),0);
+    ASSERT_EQ(init_db(buffer_size == -1 ? 1 : buffer_size, 0, 100, "logfile.data", "logmsg.txt", buffer_policy),0);
     remove(TestUtil::TEST_FILE_PATH.c_str());
     table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
     EXPECT_TRUE(TestUtil::IsValidOpenedFile(table_id));
@@ -646,7 +649,7 @@ void InitTest(int buffer_size = -1)
 
 
     // Init DB
-    ASSERT_EQ(init_db(buffer_size == -1 ? 1 : buffer_size, 0, 100, "logfile.data", "logmsg.txt"),0);
+    ASSERT_EQ(init_db(buffer_size == -1 ? 1 : buffer_size, 0, 100, "logfile.data", "logmsg.txt", buffer_policy),0);
     remove(TestUtil::TEST_FILE_PATH.c_str());
     TestUtil::LoadDB(DB_FILE_PATH);
     table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
@@ -721,6 +724,89 @@ TEST(BufferTest, InitShutdownDB)
     ASSERT_EQ(shutdown_db(),0);
 }
 
+TEST(BufferTest, PageHandleInPlace)
+{
+    int pin_id;
+    pagenum_t page_number;
+    page_t page_img;
+    int64_t table_id;
+
+    // Init DB
+    ASSERT_EQ(init_db(4, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    page_number = BUF::alloc_page(table_id);
+
+    // Write through the handle and release the pin at the end of scope
+    {
+        PageHandle page = BUF::fix_page(table_id, page_number);
+        ASSERT_TRUE(page.is_pinned());
+        memcpy(page.write()->data, TestUtil::SAMPLE_DATA.c_str(), TestUtil::SAMPLE_DATA.size());
+        EXPECT_EQ(page.read(), BUF::get_frame(page.get_pin_id()));
+    }
+
+    // The page image read by copy must have the bytes written in place
+    page_img = BUF::read_page(table_id, page_number, pin_id);
+    EXPECT_EQ(std::string(page_img.data, TestUtil::SAMPLE_DATA.size()), TestUtil::SAMPLE_DATA);
+
+    // Moved handle keeps the only pin
+    PageHandle first = BUF::fix_page(table_id, page_number);
+    PageHandle second = std::move(first);
+    EXPECT_FALSE(first.is_pinned());
+    EXPECT_TRUE(second.is_pinned());
+    second.release();
+    EXPECT_FALSE(second.is_pinned());
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+// Concurrent readers share the page table and evict frames of each other
+void* ConcurrentFind(void* arg)
+{
+    int64_t table_id = *(int64_t*)arg;
+    char ret_val[VALUE_MAX_SIZE+1];
+    uint16_t val_size;
+    long failures = 0;
+
+    for (int64_t key = 1; key <= 2000; key++) {
+        if (db_find(table_id, key, ret_val, &val_size)) failures++;
+        else if (std::string(ret_val, val_size) != std::string(VALUE_MIN_SIZE, 'a' + key % 26)) failures++;
+    }
+
+    return (void*)failures;
+}
+
+TEST(BufferTest, ConcurrentFind)
+{
+    const int NUM_THREADS = 8;
+    pthread_t threads[NUM_THREADS];
+    void* failures;
+    int64_t table_id;
+    std::string value;
+
+    // Init DB with a small buffer so that readers keep evicting pages
+    ASSERT_EQ(init_db(8, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 2000; key++) {
+        value = std::string(VALUE_MIN_SIZE, 'a' + key % 26);
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Find all keys from several threads
+    for (int idx = 0; idx < NUM_THREADS; idx++) {
+        pthread_create(&threads[idx], NULL, ConcurrentFind, &table_id);
+    }
+    for (int idx = 0; idx < NUM_THREADS; idx++) {
+        pthread_join(threads[idx], &failures);
+        EXPECT_EQ((long)failures, 0);
+    }
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
 // TEST(BufferTest, BufferBypass)
 // {
 //     InitTest(0);
@@ -776,6 +862,380 @@ TEST(BufferTest, BufferFixedSize_10000)
     InitTest(10000);
 }
 
+TEST(BufferTest, BufferPolicyLRU)
+{
+    InitTest(10, REPLACEMENT::LRU);
+}
+
+TEST(BufferTest, BufferPolicyTwoQ)
+{
+    InitTest(10, REPLACEMENT::TWO_Q);
+}
+
+TEST(BufferTest, PageCleaner)
+{
+    int64_t table_id;
+    std::string value;
+
+    // Init DB with a low high water mark (10 of 100 frames)
+    ASSERT_EQ(init_db(100, 0, 100, "logfile.data", "logmsg.txt", REPLACEMENT::CLOCK, 10),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 2000; key++) {
+        value = std::string(VALUE_MIN_SIZE, 'a' + key % 26);
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // The page cleaner writes the dirty frames in background
+    for (int wait = 0; wait < 100 && BUF::buffer.get_num_dirty() > 10; wait++) {
+        usleep(10000);
+    }
+    EXPECT_LE(BUF::buffer.get_num_dirty(), 10);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+// Range scan Test
+void ScanTest(int read_ahead)
+{
+    int64_t table_id, expected_key;
+    std::string value;
+
+    // Init DB with a small buffer so that the scan keeps loading leaves
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 4000; key++) {
+        value = std::string(VALUE_MIN_SIZE + key % 50, 'a' + key % 26);
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Scan a range in key order
+    expected_key = 500;
+    EXPECT_EQ(BPT::scan(table_id, BPT::get_root_page(table_id), 500, 3500, [&](int64_t key, const char* val, uint16_t size) {
+        EXPECT_EQ(key, expected_key);
+        EXPECT_EQ(std::string(val, size), std::string(VALUE_MIN_SIZE + key % 50, 'a' + key % 26));
+        expected_key++;
+        return true;
+    }, read_ahead), 0);
+    EXPECT_EQ(expected_key, 3501);
+
+    // Stop the scan from the callback
+    expected_key = 0;
+    EXPECT_EQ(BPT::scan(table_id, BPT::get_root_page(table_id), 0, 4000, [&](int64_t key, const char* val, uint16_t size) {
+        return ++expected_key < 10;
+    }, read_ahead), 0);
+    EXPECT_EQ(expected_key, 10);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(BufferTest, ScanWithoutReadAhead)
+{
+    ScanTest(0);
+}
+
+TEST(BufferTest, ScanWithReadAhead)
+{
+    ScanTest(SCAN_READ_AHEAD);
+}
+
+TEST(BufferTest, CursorAndTransactionalScan)
+{
+    int64_t table_id, expected_key;
+    int trx_id;
+    std::string value;
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 2; key <= 2000; key += 2) {
+        value = std::string(VALUE_MIN_SIZE, 'a' + key % 26);
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Cursor starts from the first key not less than the begin key and keeps its position over release
+    {
+        BPT::Cursor cursor = db_open_cursor(table_id, 101, 1000);
+        expected_key = 102;
+        for (; cursor.is_valid(); cursor.next()) {
+            EXPECT_EQ(cursor.key(), expected_key);
+            if (expected_key % 100 == 0) {
+                cursor.release();
+                cursor.restore();
+                EXPECT_EQ(cursor.key(), expected_key);
+            }
+            expected_key += 2;
+        }
+        EXPECT_EQ(expected_key, 1002);
+    }
+    EXPECT_FALSE(db_open_cursor(table_id, 2001, 3000).is_valid());
+
+    // Non-transactional and transactional scans see the same records
+    expected_key = 0;
+    EXPECT_EQ(db_scan(table_id, 1, 2000, [&](int64_t key, const char* val, uint16_t size) {
+        expected_key += key;
+        return true;
+    }), 0);
+    EXPECT_EQ(expected_key, 1001000);
+
+    trx_id = trx_begin();
+    ASSERT_GT(trx_id, 0);
+    expected_key = 0;
+    EXPECT_EQ(db_scan(table_id, 1, 2000, [&](int64_t key, const char* val, uint16_t size) {
+        EXPECT_EQ(std::string(val, size), std::string(VALUE_MIN_SIZE, 'a' + key % 26));
+        expected_key += key;
+        return true;
+    }, trx_id), 0);
+    EXPECT_EQ(expected_key, 1001000);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(BufferTest, AllocContiguousPages)
+{
+    int64_t table_id;
+    pagenum_t first, page_number, next_page_number;
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+
+    // Pages come from the lowest free ones and never overlap the allocation page
+    page_number = BUF::alloc_page(table_id);
+    EXPECT_EQ(page_number, AllocationView::allocation_page_number(0) + 1);
+    first = BUF::alloc_pages(table_id, 64);
+    EXPECT_EQ(first, page_number + 1);
+    EXPECT_EQ(BUF::alloc_pages(table_id, 0), 0);
+
+    // A freed page is reused first, and the hint gives the free page next to it
+    BUF::free_page(table_id, first + 10, BUF::pin_page(table_id, first + 10));
+    EXPECT_EQ(BUF::alloc_page(table_id, first + 5), first + 10);
+    EXPECT_EQ(BUF::alloc_page(table_id, first), first + 64);
+    BUF::free_page(table_id, first + 20, BUF::pin_page(table_id, first + 20));
+    EXPECT_EQ(BUF::alloc_page(table_id), first + 20);
+
+    // A run larger than the free space left extends the file
+    next_page_number = BUF::alloc_pages(table_id, INITIAL_DB_FILE_SIZE / PAGE_SIZE);
+    EXPECT_GE(next_page_number, INITIAL_DB_FILE_SIZE / PAGE_SIZE);
+    EXPECT_TRUE(BUF::is_valid_page(table_id, next_page_number + INITIAL_DB_FILE_SIZE / PAGE_SIZE - 1));
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(BufferTest, FindBatch)
+{
+    const int NUM_KEYS = 1000;
+    int64_t table_id;
+    std::string value;
+    std::vector<int64_t> keys;
+    std::vector<std::string> buffers(NUM_KEYS, std::string(VALUE_MAX_SIZE+1, '\0'));
+    std::vector<char*> ret_vals(NUM_KEYS);
+    std::vector<uint16_t> val_sizes(NUM_KEYS);
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int64_t> dis(-10, 4010);
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 0; key <= 4000; key += 2) {
+        value = std::string(VALUE_MIN_SIZE + key % 50, 'a' + key % 26);
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Unsorted keys with duplicates and missing keys
+    for (int idx = 0; idx < NUM_KEYS; idx++) {
+        keys.push_back(idx % 10 ? dis(gen) : keys.empty() ? 0 : keys.back());
+        ret_vals[idx] = &buffers[idx][0];
+    }
+    ASSERT_EQ(db_find_batch(table_id, keys.data(), NUM_KEYS, ret_vals.data(), val_sizes.data()), 0);
+
+    // Each result matches the single find of the key
+    for (int idx = 0; idx < NUM_KEYS; idx++) {
+        if (keys[idx] < 0 || keys[idx] > 4000 || keys[idx] % 2) {
+            EXPECT_EQ(val_sizes[idx], 0);
+            continue;
+        }
+        EXPECT_EQ(std::string(ret_vals[idx], val_sizes[idx]), std::string(VALUE_MIN_SIZE + keys[idx] % 50, 'a' + keys[idx] % 26));
+    }
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+// Bulk load Test
+TEST(BulkLoadTest, LoadFindScanAndModify)
+{
+    const int64_t NUM_RECORDS = 20000;
+    int64_t table_id, next_key = 0, key_sum = 0;
+    char ret_val[VALUE_MAX_SIZE];
+    uint16_t val_size;
+    std::string value;
+
+    // Values of varying sizes so that leaves hold different numbers of records
+    auto value_of = [](int64_t key) { return std::string(VALUE_MIN_SIZE + key % (VALUE_MAX_SIZE - VALUE_MIN_SIZE + 1), 'a' + key % 26); };
+
+    // Init DB
+    ASSERT_EQ(init_db(64, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+
+    // Load the even keys
+    EXPECT_EQ(db_bulk_load(table_id, [&](int64_t& key, std::string& val) {
+        if (next_key >= 2 * NUM_RECORDS) return false;
+        key = next_key;
+        val = value_of(key);
+        next_key += 2;
+        return true;
+    }), 0);
+
+    // Every key is found with its value, and the scan visits them in order
+    for (int64_t key = 0; key < 2 * NUM_RECORDS; key++) {
+        if (key % 2) {
+            EXPECT_NE(db_find(table_id, key, ret_val, &val_size), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, ret_val, &val_size), 0);
+        EXPECT_EQ(std::string(ret_val, val_size), value_of(key));
+    }
+    next_key = 0;
+    EXPECT_EQ(db_scan(table_id, 0, 2 * NUM_RECORDS, [&](int64_t key, const char* val, uint16_t size) {
+        EXPECT_EQ(key, next_key);
+        next_key += 2;
+        return true;
+    }), 0);
+    EXPECT_EQ(next_key, 2 * NUM_RECORDS);
+
+    // The loaded tree takes inserts and deletes
+    for (int64_t key = 1; key < 2 * NUM_RECORDS; key += 2) {
+        value = value_of(key);
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+    for (int64_t key = 0; key < 2 * NUM_RECORDS; key += 4) {
+        ASSERT_EQ(db_delete(table_id, key), 0);
+    }
+    EXPECT_EQ(db_scan(table_id, 0, 2 * NUM_RECORDS, [&](int64_t key, const char* val, uint16_t size) {
+        EXPECT_NE(key % 4, 0);
+        EXPECT_EQ(std::string(val, size), value_of(key));
+        key_sum += key;
+        return true;
+    }), 0);
+    EXPECT_EQ(key_sum, NUM_RECORDS * (2 * NUM_RECORDS - 1) - (NUM_RECORDS / 2) * (NUM_RECORDS - 2));
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(BulkLoadTest, RejectUnsortedInput)
+{
+    int64_t table_id, next_key = 0;
+    std::vector<int64_t> keys;
+    char ret_val[VALUE_MAX_SIZE];
+    uint16_t val_size;
+
+    // Init DB
+    ASSERT_EQ(init_db(64, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+
+    // A key out of order after several leaves fails the load and leaves the table empty
+    for (int64_t key = 0; key < 5000; key++) keys.push_back(key);
+    keys.push_back(100);
+    EXPECT_NE(db_bulk_load(table_id, [&](int64_t& key, std::string& val) {
+        if (next_key >= (int64_t)keys.size()) return false;
+        key = keys[next_key++];
+        val = std::string(VALUE_MIN_SIZE, 'a');
+        return true;
+    }), 0);
+    EXPECT_EQ(BPT::get_root_page(table_id), 0);
+    EXPECT_NE(db_find(table_id, 0, ret_val, &val_size), 0);
+
+    // A non-empty table cannot be loaded
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(std::string(VALUE_MIN_SIZE, 'a').c_str()), VALUE_MIN_SIZE), 0);
+    EXPECT_NE(db_bulk_load(table_id, [&](int64_t& key, std::string& val) { return false; }), 0);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+// Replacement policy Test
+void ScanPolicyTest(ReplacementPolicy& policy)
+{
+    const int NUM_BUF = 8, NUM_HOT = 4;
+    std::vector<int64_t> page_of(NUM_BUF, -1);
+    std::vector<bool> hot_evicted(NUM_HOT, false);
+    int victim;
+
+    // Claim any frame (nothing is pinned)
+    auto claim = [](int index) { return true; };
+
+    // Load hot pages, evict them once and load them again so that they are re-referenced
+    policy.init(NUM_BUF);
+    for (int index = 0; index < NUM_BUF; index++) {
+        policy.admit(index, 0, index);
+        page_of[index] = index;
+    }
+    for (pagenum_t pg_num = 0; pg_num < NUM_HOT; pg_num++) {
+        victim = policy.victim(claim);
+        ASSERT_GE(victim, 0);
+        policy.evict(victim, 0, page_of[victim]);
+        policy.admit(victim, 0, pg_num);
+        page_of[victim] = pg_num;
+        policy.access(victim);
+    }
+
+    // Scan many cold pages once and check whether the hot pages survive
+    for (pagenum_t pg_num = 100; pg_num < 200; pg_num++) {
+        victim = policy.victim(claim);
+        ASSERT_GE(victim, 0);
+        if (page_of[victim] < NUM_HOT) hot_evicted[page_of[victim]] = true;
+        policy.evict(victim, 0, page_of[victim]);
+        policy.admit(victim, 0, pg_num);
+        page_of[victim] = pg_num;
+    }
+
+    for (int pg_num = 0; pg_num < NUM_HOT; pg_num++) {
+        if (dynamic_cast<TwoQPolicy*>(&policy)) EXPECT_FALSE(hot_evicted[pg_num]);
+        else EXPECT_TRUE(hot_evicted[pg_num]);
+    }
+}
+
+TEST(ReplacementTest, ScanEvictsHotSetWithLRU)
+{
+    LRUPolicy policy;
+    ScanPolicyTest(policy);
+}
+
+TEST(ReplacementTest, ScanKeepsHotSetWithTwoQ)
+{
+    TwoQPolicy policy;
+    ScanPolicyTest(policy);
+}
+
+TEST(ReplacementTest, ClockSkipsPinnedFrames)
+{
+    ClockPolicy policy;
+    std::vector<bool> pinned = {true, false, true, true};
+
+    policy.init(pinned.size());
+    for (int index = 0; index < (int)pinned.size(); index++) {
+        policy.admit(index, 0, index);
+    }
+
+    // Only the unpinned frame can be the victim, and nothing once it is pinned
+    EXPECT_EQ(policy.victim([&](int index) { return !pinned[index]; }), 1);
+    pinned[1] = true;
+    EXPECT_EQ(policy.victim([&](int index) { return !pinned[index]; }), -1);
+}
+
 
 // File comparison test
 TEST(BufferTest, TableComparison)
@@ -863,3 +1323,500 @@ TEST(BufferTest, TableComparison)
         if (idx) EXPECT_TRUE(TestUtil::CompareFiles(table_files[0].second, table_files[idx].second));
     }
 }
+
+
+/// Lock test
+// Update key 2 in a new transaction on another thread, and set done after its commit
+static std::thread UpdateInOtherTrx(int64_t table_id, std::atomic<bool>& done)
+{
+    return std::thread([table_id, &done]() {
+        std::string value(VALUE_MIN_SIZE, 'z');
+        uint16_t old_val_size;
+        int trx_id = trx_begin();
+
+        EXPECT_EQ(db_update(table_id, 2, const_cast<char*>(value.c_str()), value.size(), &old_val_size, trx_id), 0);
+        EXPECT_EQ(trx_commit(trx_id), trx_id);
+        done = true;
+    });
+}
+
+TEST(LockTest, LockTableRebuild)
+{
+    const int NUM_PAGES = 100;
+    lock_table_t entries;
+    lock_table_entry_t* entry;
+    lock_t* locks[NUM_PAGES + 1];
+
+    // The slots grow while every page holds a lock, and the locks follow their entries
+    entries.init(8);
+    for (pagenum_t page_id = 1; page_id <= NUM_PAGES; page_id++) {
+        locks[page_id] = entries.get({1, page_id})->append_lock(0, 1, LOCK_MODE_SHARED);
+        ASSERT_NE(locks[page_id], (lock_t*)NULL);
+    }
+    for (pagenum_t page_id = 1; page_id <= NUM_PAGES; page_id++) {
+        entry = entries.find({1, page_id});
+        ASSERT_NE(entry, (lock_table_entry_t*)NULL);
+        EXPECT_EQ(locks[page_id]->sentinel, entry);
+        EXPECT_EQ(locks[page_id]->get_page_key(), page_key_t(1, page_id));
+    }
+    EXPECT_EQ(entries.find({2, 1}), (lock_table_entry_t*)NULL);
+
+    // The entries without locks are reused for other pages
+    for (pagenum_t page_id = 1; page_id <= NUM_PAGES; page_id++) {
+        EXPECT_EQ(locks[page_id]->sentinel->remove_lock(locks[page_id]), 0);
+    }
+    for (pagenum_t page_id = 1; page_id <= NUM_PAGES; page_id++) {
+        entry = entries.get({2, page_id});
+        EXPECT_TRUE(entry->is_empty());
+        EXPECT_EQ(entries.find({2, page_id}), entry);
+    }
+}
+
+TEST(LockTest, TrxTableReclaimsAfterGuards)
+{
+    trx_table_t table;
+    trx_t* trx_obj = new trx_t(1);
+    trx_t* other = new trx_t(1 + TRX_TABLE_SIZE);
+
+    // A slot holds one transaction, and lookups check the id
+    ASSERT_TRUE(table.insert(trx_obj));
+    EXPECT_FALSE(table.insert(other));
+    EXPECT_EQ(table.find(1), trx_obj);
+    EXPECT_EQ(table.find(1 + TRX_TABLE_SIZE), (trx_t*)NULL);
+    delete other;
+
+    // A removed transaction is deleted only after the guards that may have found it
+    EPOCH::reclaim();
+    {
+        EPOCH::guard_t guard;
+        EXPECT_EQ(table.erase(1), trx_obj);
+        EXPECT_EQ(table.find(1), (trx_t*)NULL);
+        EPOCH::retire(trx_obj);
+        EXPECT_EQ(EPOCH::reclaim(), 0);
+    }
+    EXPECT_EQ(EPOCH::reclaim(), 1);
+}
+
+TEST(LockTest, LockPoolRecycles)
+{
+    const int NUM_TRXS = 100;
+    int64_t table_id;
+    int trx_id;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size;
+    std::string value(VALUE_MIN_SIZE, 'a');
+    LOCK_POOL::stats_t before, after;
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 200; key++) {
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Every transaction locks records on a few pages, and its lock objects are reused by the next one
+    before = LOCK_POOL::get_stats();
+    for (int idx = 0; idx < NUM_TRXS; idx++) {
+        trx_id = trx_begin();
+        for (int64_t key = 1; key <= 200; key += 50) {
+            ASSERT_EQ(db_find_locking(table_id, key, ret_val, &val_size, trx_id), 0);
+        }
+        ASSERT_EQ(trx_commit(trx_id), trx_id);
+    }
+    after = LOCK_POOL::get_stats();
+
+    EXPECT_GE(after.num_allocs - before.num_allocs, (uint64_t)NUM_TRXS);
+    EXPECT_EQ(after.num_allocs - before.num_allocs, after.num_frees - before.num_frees);
+    EXPECT_LE(after.num_slabs - before.num_slabs, (uint64_t)1);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(LockTest, UndoArenaRecycles)
+{
+    const int NUM_TRXS = 100;
+    int64_t table_id;
+    int trx_id;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size, old_val_size;
+    std::string value(VALUE_MIN_SIZE, 'a'), first(VALUE_MIN_SIZE, 'b'), second(VALUE_MIN_SIZE, 'c');
+    UNDO_POOL::stats_t before, after;
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 10; key++) {
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Every transaction updates the records twice, and its undo arena is reused by the next one of the thread
+    before = UNDO_POOL::get_stats();
+    for (int idx = 0; idx < NUM_TRXS; idx++) {
+        trx_id = trx_begin();
+        ASSERT_GT(trx_id, 0);
+        for (int64_t key = 1; key <= 10; key++) {
+            ASSERT_EQ(db_update(table_id, key, const_cast<char*>(first.c_str()), first.size(), &old_val_size, trx_id), 0);
+            ASSERT_EQ(db_update(table_id, key, const_cast<char*>(second.c_str()), second.size(), &old_val_size, trx_id), 0);
+        }
+        if (idx % 2 == 0) ASSERT_EQ(trx_commit(trx_id), trx_id);
+        else ASSERT_EQ(trx_abort(trx_id), 0);
+
+        // Restore the records committed
+        if (idx % 2 == 0) {
+            trx_id = trx_begin();
+            for (int64_t key = 1; key <= 10; key++) {
+                ASSERT_EQ(db_update(table_id, key, const_cast<char*>(value.c_str()), value.size(), &old_val_size, trx_id), 0);
+            }
+            ASSERT_EQ(trx_commit(trx_id), trx_id);
+        }
+    }
+    after = UNDO_POOL::get_stats();
+
+    EXPECT_EQ(after.num_allocs - before.num_allocs, (uint64_t)(NUM_TRXS + NUM_TRXS / 2));
+    EXPECT_LE(after.num_news - before.num_news, (uint64_t)1);
+
+    // The rollbacks restored the values before the first updates (the undo logs are applied from the last one)
+    trx_id = trx_begin();
+    for (int64_t key = 1; key <= 10; key++) {
+        ASSERT_EQ(db_find(table_id, key, ret_val, &val_size, trx_id), 0);
+        EXPECT_EQ(std::string(ret_val, val_size), value);
+    }
+    ASSERT_EQ(trx_commit(trx_id), trx_id);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(LockTest, TableLockCoversRecords)
+{
+    int64_t table_id;
+    int reader, other;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size;
+    std::string value(VALUE_MIN_SIZE, 'a');
+    std::atomic<bool> done(false);
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 2, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    // The shared table lock covers the record, so no record lock is created
+    reader = trx_begin();
+    ASSERT_EQ(TRX::lock_table(table_id, reader, LOCK_MODE_SHARED), 0);
+    EXPECT_EQ(db_find_locking(table_id, 2, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(TRX::trx_manager.get_trx(reader)->first, (lock_t*)NULL);
+
+    // Other readers share the table (IS), while a writer (IX) waits for the reader
+    other = trx_begin();
+    EXPECT_EQ(db_find_locking(table_id, 2, ret_val, &val_size, other), 0);
+    EXPECT_EQ(trx_commit(other), other);
+
+    std::thread writer = UpdateInOtherTrx(table_id, done);
+    usleep(100 * 1000);
+    EXPECT_FALSE(done);
+    EXPECT_EQ(trx_commit(reader), reader);
+    writer.join();
+    EXPECT_TRUE(done);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(LockTest, WriterWaitsForRecordLock)
+{
+    int64_t table_id;
+    int reader;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size;
+    std::string value(VALUE_MIN_SIZE, 'a');
+    std::atomic<bool> done(false);
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 3; key++) {
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // The shared record lock of the reader blocks the writer of the record until the commit
+    reader = trx_begin();
+    EXPECT_EQ(db_find_locking(table_id, 2, ret_val, &val_size, reader), 0);
+
+    std::thread writer = UpdateInOtherTrx(table_id, done);
+    usleep(100 * 1000);
+    EXPECT_FALSE(done);
+
+    // The reader still reads the other records of the page
+    EXPECT_EQ(db_find_locking(table_id, 1, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(db_find_locking(table_id, 3, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(trx_commit(reader), reader);
+    writer.join();
+    EXPECT_TRUE(done);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(LockTest, EscalateScanToTableLock)
+{
+    const int64_t NUM_KEYS = 2 * LOCK_ESCALATION_THRESHOLD;
+    int64_t table_id, num_scanned = 0;
+    int reader, num_locks = 0;
+    std::string value(VALUE_MIN_SIZE, 'a');
+    std::atomic<bool> done(false);
+    trx_t* trx_obj;
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= NUM_KEYS; key++) {
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Scanning the whole table replaces the record locks with a shared table lock
+    reader = trx_begin();
+    EXPECT_EQ(db_scan_locking(table_id, 1, NUM_KEYS, [&](int64_t key, const char* val, uint16_t size) {
+        num_scanned++;
+        return true;
+    }, reader), 0);
+    EXPECT_EQ(num_scanned, NUM_KEYS);
+
+    trx_obj = TRX::trx_manager.get_trx(reader);
+    EXPECT_EQ(trx_obj->table_locks[table_id], LOCK_MODE_SHARED);
+    for (lock_t* lock = trx_obj->first; lock != NULL; lock = lock->next_trx_lock) num_locks++;
+    EXPECT_EQ(num_locks, 0);
+
+    // A writer waits for the escalated lock
+    std::thread writer = UpdateInOtherTrx(table_id, done);
+    usleep(100 * 1000);
+    EXPECT_FALSE(done);
+    EXPECT_EQ(trx_commit(reader), reader);
+    writer.join();
+    EXPECT_TRUE(done);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(LockTest, DeadlockAbortsYoungest)
+{
+    int64_t table_id;
+    int older, younger;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size, old_val_size;
+    std::string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'z');
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 3; key++) {
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // Each transaction reads a record the other one updates
+    older = trx_begin();
+    younger = trx_begin();
+    EXPECT_EQ(db_find_locking(table_id, 1, ret_val, &val_size, older), 0);
+    EXPECT_EQ(db_find_locking(table_id, 3, ret_val, &val_size, younger), 0);
+
+    std::thread writer([&]() {
+        EXPECT_EQ(db_update(table_id, 3, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, older), 0);
+    });
+    usleep(100 * 1000);
+
+    // The detector aborts the younger transaction, which lets the older one go on
+    EXPECT_NE(db_update(table_id, 1, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, younger), 0);
+    EXPECT_FALSE(TRX::trx_manager.is_active_trx(younger));
+    writer.join();
+    EXPECT_EQ(trx_commit(older), older);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(LockTest, LockWaitTimeout)
+{
+    int64_t table_id;
+    int reader, writer;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size, old_val_size;
+    std::string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'z');
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 3; key++) {
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // The writer gives up waiting for the reader after the timeout
+    TRX::set_lock_wait_timeout(50);
+    reader = trx_begin();
+    writer = trx_begin();
+    EXPECT_EQ(db_find_locking(table_id, 2, ret_val, &val_size, reader), 0);
+    EXPECT_NE(db_update(table_id, 2, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, writer), 0);
+    EXPECT_FALSE(TRX::trx_manager.is_active_trx(writer));
+    EXPECT_EQ(trx_commit(reader), reader);
+    TRX::set_lock_wait_timeout(0);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+
+/// MVCC test
+TEST(MvccTest, ReaderSeesSnapshot)
+{
+    int64_t table_id;
+    int reader, writer, later;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size, old_val_size;
+    std::string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'z'), last_value(VALUE_MIN_SIZE, 'y');
+    std::string scanned;
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    for (int64_t key = 1; key <= 3; key++) {
+        ASSERT_EQ(db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size()), 0);
+    }
+
+    // The reader takes its read view, and the writer updates the record without waiting for it
+    reader = trx_begin();
+    writer = trx_begin();
+    ASSERT_EQ(db_find(table_id, 2, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), value);
+    EXPECT_EQ(db_update(table_id, 2, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, writer), 0);
+    EXPECT_EQ(db_update(table_id, 2, const_cast<char*>(last_value.c_str()), last_value.size(), &old_val_size, writer), 0);
+
+    // The writer reads its own update, the reader its snapshot (also after the commit)
+    ASSERT_EQ(db_find(table_id, 2, ret_val, &val_size, writer), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), last_value);
+    ASSERT_EQ(db_find(table_id, 2, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), value);
+    EXPECT_EQ(trx_commit(writer), writer);
+    EXPECT_EQ(db_scan(table_id, 1, 3, [&](int64_t key, const char* val, uint16_t size) {
+        scanned += std::string(val, 1);
+        return true;
+    }, reader), 0);
+    EXPECT_EQ(scanned, "aaa");
+
+    // A transaction reading after the commit sees the last update
+    later = trx_begin();
+    ASSERT_EQ(db_find(table_id, 2, ret_val, &val_size, later), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), last_value);
+    EXPECT_EQ(trx_commit(later), later);
+
+    // The old version is kept while the reader may see it, and purged after
+    EXPECT_EQ(TRX::purge_versions(), 0);
+    EXPECT_EQ(trx_commit(reader), reader);
+    EXPECT_EQ(TRX::purge_versions(), 1);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(MvccTest, ReaderSkipsAbortedUpdate)
+{
+    int64_t table_id;
+    int reader, writer;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size, old_val_size;
+    std::string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'z');
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    // The update of an active transaction is not seen by a reader begun after it, before and after its rollback
+    writer = trx_begin();
+    EXPECT_EQ(db_update(table_id, 1, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, writer), 0);
+    reader = trx_begin();
+    ASSERT_EQ(db_find(table_id, 1, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), value);
+    EXPECT_EQ(trx_abort(writer), 0);
+    ASSERT_EQ(db_find(table_id, 1, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), value);
+    EXPECT_EQ(trx_commit(reader), reader);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(MvccTest, ReaderFollowsUndoChain)
+{
+    int64_t table_id;
+    int reader, writer;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    uint16_t val_size, old_val_size;
+    std::string value(VALUE_MIN_SIZE, 'a'), first(VALUE_MIN_SIZE, 'b'), second(VALUE_MAX_SIZE, 'c');
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    // Without read views, the undo logs of a finished transaction are not kept
+    writer = trx_begin();
+    EXPECT_EQ(db_update(table_id, 1, const_cast<char*>(first.c_str()), first.size(), &old_val_size, writer), 0);
+    EXPECT_EQ(trx_commit(writer), writer);
+    EXPECT_EQ(TRX::purge_versions(), 0);
+
+    // The reader goes back through the undo logs of two committed writers
+    reader = trx_begin();
+    ASSERT_EQ(db_find(table_id, 1, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), first);
+    for (const std::string& new_value : {second, value}) {
+        writer = trx_begin();
+        EXPECT_EQ(db_update(table_id, 1, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, writer), 0);
+        EXPECT_EQ(trx_commit(writer), writer);
+    }
+    ASSERT_EQ(db_find(table_id, 1, ret_val, &val_size, reader), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), first);
+
+    // The undo logs are purged once the reader finishes
+    EXPECT_EQ(TRX::purge_versions(), 0);
+    EXPECT_EQ(trx_commit(reader), reader);
+    EXPECT_EQ(TRX::purge_versions(), 2);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
+
+TEST(MvccTest, MissingWriterFailsRead)
+{
+    int64_t table_id;
+    int reader;
+    const read_view_t* read_view;
+    std::string value(VALUE_MIN_SIZE, 'a'), version;
+
+    // Init DB
+    ASSERT_EQ(init_db(16, 0, 100, "logfile.data", "logmsg.txt"),0);
+    remove(TestUtil::TEST_FILE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(TestUtil::TEST_FILE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    // A writer the read view does not see, found neither in the table nor in the undo history, fails the read instead of waiting
+    reader = trx_begin();
+    read_view = TRX::open_read_view(reader);
+    ASSERT_NE(read_view, nullptr);
+    version = value;
+    EXPECT_EQ(TRX::read_version(read_view, table_id, 1, version, reader + 100), FLAG::FAILURE);
+    EXPECT_EQ(trx_commit(reader), reader);
+
+    // Shutdown DB
+    EXPECT_EQ(shutdown_db(),0);
+}
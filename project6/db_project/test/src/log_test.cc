@@ -0,0 +1,668 @@
+#include "index.h"
+#include "log.h"
+#include "test_util.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <sys/wait.h>
+using namespace std;
+
+
+/// Helpers
+namespace
+{
+    const string LOG_FILE_PATH = "LogTest.data";
+    const string LOGMSG_FILE_PATH = "LogTestMsg.txt";
+
+    // Fixed part of a serialized log record
+    struct log_header_t
+    {
+        size_t log_size;
+        int64_t lsn, prev_lsn;
+        int trx_id;
+        int log_type;
+    };
+
+    // Read the master record at the head of the log file
+    log_file_header_t ReadMaster(const string& path)
+    {
+        log_file_header_t master = {-1, -1};
+        int fd = open(path.c_str(), O_RDONLY);
+
+        EXPECT_EQ(pread(fd, &master, sizeof(log_file_header_t), 0), sizeof(log_file_header_t));
+        close(fd);
+        return master;
+    }
+
+    // Read every record header of the log file in order (from the start kept by the last checkpoint)
+    vector<log_header_t> ReadLogHeaders(const string& path)
+    {
+        vector<log_header_t> headers;
+        log_header_t header;
+        off_t offset = ReadMaster(path).start_lsn, size;
+        int fd = open(path.c_str(), O_RDONLY);
+
+        size = lseek(fd, 0, SEEK_END);
+        while (offset < size) {
+            if (pread(fd, &header, sizeof(log_header_t), offset) != sizeof(log_header_t)) break;
+            if (header.log_size == 0) break;
+            headers.push_back(header);
+            offset += header.log_size;
+        }
+        close(fd);
+        return headers;
+    }
+
+    // Read the body of the record after its header (table_id, page_num, offset, length and the images for UPDATE and COMPENSATE)
+    string ReadLogBody(const string& path, const log_header_t& header)
+    {
+        string body(header.log_size - sizeof(log_header_t), '\0');
+        int fd = open(path.c_str(), O_RDONLY);
+
+        EXPECT_EQ(pread(fd, &body[0], body.size(), header.lsn + sizeof(log_header_t)), (ssize_t)body.size());
+        close(fd);
+        return body;
+    }
+
+    // Check the records are contiguous and linked by prev_lsn within each transaction
+    // (a transaction may continue from the log truncated by a checkpoint)
+    void CheckLogChain(const vector<log_header_t>& headers)
+    {
+        unordered_map<int, int64_t> last_lsn;
+        int64_t offset;
+
+        if (headers.empty()) return;
+        offset = headers[0].lsn;
+        for (const log_header_t& header : headers) {
+            EXPECT_EQ(header.lsn, offset);
+            offset += header.log_size;
+            if (header.log_type == LOG::BEGIN_CHECKPOINT || header.log_type == LOG::END_CHECKPOINT) continue;
+
+            if (header.log_type == LOG::BEGIN) EXPECT_EQ(header.prev_lsn, -1);
+            else if (last_lsn.count(header.trx_id) == 0) EXPECT_LT(header.prev_lsn, headers[0].lsn);
+            else EXPECT_EQ(header.prev_lsn, last_lsn[header.trx_id]);
+            last_lsn[header.trx_id] = header.lsn;
+        }
+    }
+
+    const string RECOVERY_TABLE_PATH = "DATA1";
+    const int NUM_RECOVERY_KEYS = 200, NUM_LOSER_KEYS = 10;
+
+    // Count the records of the type in the log file
+    int CountLogRecords(const string& path, int log_type)
+    {
+        int count = 0;
+        for (const log_header_t& header : ReadLogHeaders(path)) {
+            if (header.log_type == log_type) count++;
+        }
+        return count;
+    }
+
+    // Update every key of [begin, end] to a value filled with ch
+    bool UpdateKeys(int64_t table_id, int trx_id, int64_t begin, int64_t end, char ch)
+    {
+        string value(VALUE_MIN_SIZE, ch);
+        uint16_t old_val_size;
+
+        for (int64_t key = begin; key <= end; key++) {
+            if (db_update(table_id, key, const_cast<char*>(value.c_str()), value.size(), &old_val_size, trx_id)) return false;
+        }
+        return true;
+    }
+
+    // Run transactions in a child process which crashes without flushing the buffer
+    /*
+     * Winner updates every key of the first half to 'b' and commits,
+     * losers update the second half to 'c' and the first NUM_LOSER_KEYS keys to 'd' without commit
+     */
+    void RunCrashedWorkload()
+    {
+        remove(LOG_FILE_PATH.c_str());
+        remove(RECOVERY_TABLE_PATH.c_str());
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            string value(VALUE_MIN_SIZE, 'a');
+            int64_t table_id;
+            int winner, loser, loser_on_winner;
+
+            // Load the table without logging
+            if (init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str()))) _exit(1);
+            table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+            if (table_id != 1) _exit(1);
+            for (int64_t key = 1; key <= NUM_RECOVERY_KEYS; key++) {
+                if (db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size())) _exit(1);
+            }
+            shutdown_db();
+
+            // Run the transactions
+            if (init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str()))) _exit(1);
+            table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+            winner = trx_begin();
+            loser = trx_begin();
+            if (!UpdateKeys(table_id, winner, 1, NUM_RECOVERY_KEYS / 2, 'b')) _exit(1);
+            if (!UpdateKeys(table_id, loser, NUM_RECOVERY_KEYS / 2 + 1, NUM_RECOVERY_KEYS, 'c')) _exit(1);
+            if (trx_commit(winner) != winner) _exit(1);
+            loser_on_winner = trx_begin();
+            if (!UpdateKeys(table_id, loser_on_winner, 1, NUM_LOSER_KEYS, 'd')) _exit(1);
+
+            // Crash after the log is durable
+            LOG::force();
+            _exit(0);
+        }
+
+        int status;
+        ASSERT_GT(pid, 0);
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        ASSERT_TRUE(WIFEXITED(status));
+        ASSERT_EQ(WEXITSTATUS(status), 0);
+    }
+
+    // Check the table holds only the updates of the winner
+    void CheckRecoveredTable(int64_t table_id)
+    {
+        char ret_val[VALUE_MAX_SIZE + 1];
+        uint16_t val_size;
+
+        for (int64_t key = 1; key <= NUM_RECOVERY_KEYS; key++) {
+            ASSERT_EQ(db_find(table_id, key, ret_val, &val_size), 0);
+            EXPECT_EQ(string(ret_val, val_size), string(VALUE_MIN_SIZE, key <= NUM_RECOVERY_KEYS / 2 ? 'b' : 'a')) << "key: " << key;
+        }
+    }
+}
+
+
+/// Tests
+
+// 1. Group commit
+/*
+ * Commits of many threads are durable when flush returns, and the log is one contiguous chain
+ */
+TEST(LogTest, GroupCommit)
+{
+    const int NUM_THREADS = 8, NUM_TRX = 200;
+    vector<thread> threads;
+
+    remove(LOG_FILE_PATH.c_str());
+    LOG::init(LOG_FILE_PATH.c_str(), LOGMSG_FILE_PATH.c_str());
+
+    for (int t = 0; t < NUM_THREADS; t++) {
+        threads.emplace_back([t]() {
+            string old_img(VALUE_MIN_SIZE, 'a'), new_img(VALUE_MIN_SIZE, 'b');
+            int64_t lsn;
+
+            for (int i = 0; i < NUM_TRX; i++) {
+                int trx_id = t * NUM_TRX + i + 1;
+                lsn = LOG::log(LOG::BEGIN, trx_id, -1);
+                lsn = LOG::log(LOG::UPDATE, trx_id, lsn, 0, 1, 128, old_img.size(), old_img.c_str(), new_img.c_str());
+                lsn = LOG::log(LOG::COMMIT, trx_id, lsn);
+
+                // The commit record is durable once flush returns
+                EXPECT_GT(LOG::flush(lsn), lsn);
+            }
+        });
+    }
+    for (thread& worker : threads) worker.join();
+    LOG::shutdown();
+
+    vector<log_header_t> headers = ReadLogHeaders(LOG_FILE_PATH);
+    EXPECT_EQ(headers.size(), NUM_THREADS * NUM_TRX * 3);
+    CheckLogChain(headers);
+}
+
+// 2. Ring buffer
+/*
+ * Records over the size of the ring are written in order without waiting for commits
+ */
+TEST(LogTest, WrapAroundRing)
+{
+    const int NUM_RECORDS = 3 * LOG_BUFFER_SIZE / 256;
+    string old_img(VALUE_MAX_SIZE, 'a'), new_img(VALUE_MAX_SIZE, 'b');
+
+    remove(LOG_FILE_PATH.c_str());
+    LOG::init(LOG_FILE_PATH.c_str(), LOGMSG_FILE_PATH.c_str());
+
+    int64_t lsn = LOG::log(LOG::BEGIN, 1, -1);
+    for (int i = 0; i < NUM_RECORDS; i++) {
+        lsn = LOG::log(LOG::UPDATE, 1, lsn, 0, i, 128, old_img.size(), old_img.c_str(), new_img.c_str());
+    }
+    LOG::log(LOG::COMMIT, 1, lsn);
+    LOG::shutdown();
+
+    vector<log_header_t> headers = ReadLogHeaders(LOG_FILE_PATH);
+    EXPECT_EQ(headers.size(), NUM_RECORDS + 2);
+    CheckLogChain(headers);
+    EXPECT_EQ(headers.back().log_type, LOG::COMMIT);
+}
+
+// 3. Transactions
+/*
+ * Transaction APIs write BEGIN, UPDATE and COMMIT records
+ */
+TEST(LogTest, TransactionRecords)
+{
+    int64_t table_id;
+    int trx_id;
+    uint16_t old_val_size;
+    string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'b');
+
+    remove(LOG_FILE_PATH.c_str());
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    remove(RECOVERY_TABLE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    trx_id = trx_begin();
+    ASSERT_GT(trx_id, 0);
+    EXPECT_EQ(db_update(table_id, 1, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // The commit makes the records durable
+    vector<log_header_t> headers = ReadLogHeaders(LOG_FILE_PATH);
+    ASSERT_EQ(headers.size(), 3);
+    CheckLogChain(headers);
+    EXPECT_EQ(headers[0].log_type, LOG::BEGIN);
+    EXPECT_EQ(headers[1].log_type, LOG::UPDATE);
+    EXPECT_EQ(headers[2].log_type, LOG::COMMIT);
+    EXPECT_EQ(headers[1].log_size, sizeof(log_header_t) + 21 + 2 * (SLOT_SIZE + VALUE_MIN_SIZE));
+
+    // Shutdown checkpoints the clean state, and the log before it is not needed anymore
+    EXPECT_EQ(shutdown_db(), 0);
+    headers = ReadLogHeaders(LOG_FILE_PATH);
+    ASSERT_EQ(headers.size(), 2);
+    EXPECT_EQ(headers[0].log_type, LOG::BEGIN_CHECKPOINT);
+    EXPECT_EQ(headers[1].log_type, LOG::END_CHECKPOINT);
+    EXPECT_EQ(ReadMaster(LOG_FILE_PATH).checkpoint_lsn, headers[0].lsn);
+}
+
+// 4. Recovery
+/*
+ * Restart after a crash redoes the winner and rolls the losers back with compensation records
+ */
+TEST(LogTest, RecoverAfterCrash)
+{
+    int64_t table_id;
+
+    RunCrashedWorkload();
+
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    ASSERT_EQ(table_id, 1);
+    CheckRecoveredTable(table_id);
+
+    // New transactions never reuse the ids in the log
+    EXPECT_GT(trx_begin(), 3);
+
+    // Every update of the losers is compensated once, and both losers end with a rollback
+    CheckLogChain(ReadLogHeaders(LOG_FILE_PATH));
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::COMPENSATE), NUM_RECOVERY_KEYS / 2 + NUM_LOSER_KEYS);
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::ROLLBACK), 2);
+    EXPECT_EQ(shutdown_db(), 0);
+
+    // Recovery of a clean log changes nothing
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    ASSERT_EQ(open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str())), 1);
+    CheckRecoveredTable(1);
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::COMPENSATE), 0);
+    EXPECT_EQ(shutdown_db(), 0);
+
+    remove(RECOVERY_TABLE_PATH.c_str());
+}
+
+// 5. Crash during recovery
+/*
+ * Recovery stopped in the middle of redo or undo is completed by the next one without undoing twice
+ */
+TEST(LogTest, CrashDuringRecovery)
+{
+    const int NUM_UNDONE = 30;
+
+    RunCrashedWorkload();
+
+    // Crash in the middle of undo (the loser updating the first keys is rolled back to its BEGIN first)
+    // (the log stays whole, since a stopped recovery never checkpoints)
+    ASSERT_EQ(init_db(16, LOG::PHASE_UNDO, NUM_UNDONE, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    EXPECT_EQ(shutdown_db(), 0);
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::COMPENSATE), NUM_UNDONE - 1);
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::ROLLBACK), 1);
+
+    // Crash in the middle of redo
+    ASSERT_EQ(init_db(16, LOG::PHASE_REDO, NUM_UNDONE, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    EXPECT_EQ(shutdown_db(), 0);
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::COMPENSATE), NUM_UNDONE - 1);
+
+    // Complete the recovery
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    ASSERT_EQ(open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str())), 1);
+    CheckRecoveredTable(1);
+
+    CheckLogChain(ReadLogHeaders(LOG_FILE_PATH));
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::COMPENSATE), NUM_RECOVERY_KEYS / 2 + NUM_LOSER_KEYS);
+    EXPECT_EQ(CountLogRecords(LOG_FILE_PATH, LOG::ROLLBACK), 2);
+    EXPECT_EQ(shutdown_db(), 0);
+
+    remove(RECOVERY_TABLE_PATH.c_str());
+}
+
+// 6. Checkpoint
+/*
+ * Periodic checkpoints during a workload give back the log of the finished transactions,
+ * but keep every record of a loser active over them, so that a crash is still recovered
+ */
+TEST(LogTest, CheckpointTruncatesLog)
+{
+    const int NUM_ROUNDS = 20;
+    int64_t table_id;
+
+    remove(LOG_FILE_PATH.c_str());
+    remove(RECOVERY_TABLE_PATH.c_str());
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        string value(VALUE_MIN_SIZE, 'a');
+        int loser = 0, winner;
+
+        // Load the table
+        if (init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str()))) _exit(1);
+        table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+        for (int64_t key = 1; key <= NUM_RECOVERY_KEYS; key++) {
+            if (db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size())) _exit(1);
+        }
+        shutdown_db();
+
+        // Winners update the first half repeatedly, and a loser updates the second half in the middle
+        // (a short recovery time makes the checkpointer run every interval)
+        if (init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str()),
+                    REPLACEMENT::CLOCK, DIRTY_HIGH_WATER_PERCENT, 1)) _exit(1);
+        table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+        for (int round = 0; round < NUM_ROUNDS; round++) {
+            if (round == NUM_ROUNDS / 2) {
+                loser = trx_begin();
+                if (!UpdateKeys(table_id, loser, NUM_RECOVERY_KEYS / 2 + 1, NUM_RECOVERY_KEYS, 'c')) _exit(1);
+            }
+            winner = trx_begin();
+            if (!UpdateKeys(table_id, winner, 1, NUM_RECOVERY_KEYS / 2, round == NUM_ROUNDS - 1 ? 'b' : 'x')) _exit(1);
+            if (trx_commit(winner) != winner) _exit(1);
+            usleep(CHECKPOINT_INTERVAL_MS * 1000 / 4);
+        }
+
+        // Crash after the log is durable
+        LOG::force();
+        _exit(loser > 0 ? 0 : 1);
+    }
+
+    int status;
+    ASSERT_GT(pid, 0);
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    // The log starts after the first winners, and still holds the whole loser
+    log_file_header_t master = ReadMaster(LOG_FILE_PATH);
+    vector<log_header_t> headers = ReadLogHeaders(LOG_FILE_PATH);
+    map<int, bool> begun, ended;
+    EXPECT_GE(master.checkpoint_lsn, master.start_lsn);
+    CheckLogChain(headers);
+    for (const log_header_t& header : headers) {
+        if (header.trx_id == 0) continue;
+        begun[header.trx_id] |= header.log_type == LOG::BEGIN;
+        ended[header.trx_id] |= header.log_type == LOG::COMMIT || header.log_type == LOG::ROLLBACK;
+    }
+    EXPECT_LT(begun.size(), NUM_ROUNDS);
+    int num_losers = 0;
+    for (auto& trx : ended) {
+        if (trx.second) continue;
+        EXPECT_TRUE(begun[trx.first]);
+        num_losers++;
+    }
+    EXPECT_EQ(num_losers, 1);
+
+    // Recovery from the checkpoint keeps only the last winner
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    ASSERT_EQ(table_id, 1);
+    CheckRecoveredTable(table_id);
+    EXPECT_EQ(shutdown_db(), 0);
+
+    remove(RECOVERY_TABLE_PATH.c_str());
+}
+
+/*
+ * A clean shutdown truncates the log to its checkpoint, and the master record keeps the transaction ids from being reused
+ * (the leaf slots still carry the ids of the writers)
+ */
+TEST(LogTest, RestartKeepsTransactionIds)
+{
+    int64_t table_id;
+    int trx_id, writer;
+    uint16_t old_val_size, val_size;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'b');
+
+    remove(LOG_FILE_PATH.c_str());
+    remove(RECOVERY_TABLE_PATH.c_str());
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    writer = trx_begin();
+    ASSERT_GT(writer, 0);
+    ASSERT_EQ(db_update(table_id, 1, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, writer), 0);
+    ASSERT_EQ(trx_commit(writer), writer);
+    EXPECT_EQ(shutdown_db(), 0);
+
+    // Only the checkpoint is left in the log, and the master record has the ids after the writer
+    vector<log_header_t> headers = ReadLogHeaders(LOG_FILE_PATH);
+    for (const log_header_t& header : headers) EXPECT_EQ(header.trx_id, 0);
+    EXPECT_GT(ReadMaster(LOG_FILE_PATH).next_trx_id, writer);
+
+    // Restart allocates the ids after the writer, and reads the record it wrote
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    EXPECT_GE(LOG::get_last_trx_id(), writer);
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    trx_id = trx_begin();
+    EXPECT_GT(trx_id, writer);
+    ASSERT_EQ(db_find(table_id, 1, ret_val, &val_size, trx_id), 0);
+    EXPECT_EQ(string(ret_val, val_size), new_value);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    EXPECT_EQ(shutdown_db(), 0);
+
+    remove(RECOVERY_TABLE_PATH.c_str());
+}
+
+// 7. Write-ahead logging at page flush
+/*
+ * A page written with an uncommitted update reaches the disk only after the log record stamped on it
+ */
+TEST(LogTest, WriteAheadAtPageFlush)
+{
+    string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'b');
+    uint16_t old_val_size;
+    int64_t table_id, lsn;
+    pagenum_t leaf;
+    page_t page;
+    int trx_id;
+
+    // The page cleaner writes every dirty frame each interval
+    remove(LOG_FILE_PATH.c_str());
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str()), REPLACEMENT::CLOCK, 0), 0);
+    remove(RECOVERY_TABLE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    // Update the leaf without commit, so that nobody waits for its record
+    trx_id = trx_begin();
+    ASSERT_EQ(db_update(table_id, 1, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, trx_id), 0);
+    lsn = TRX::get_last_lsn(trx_id);
+    leaf = BPT::find_leaf(table_id, BPT::get_root_page(table_id), 1);
+
+    // Wait until the page cleaner writes the leaf
+    for (int round = 0; round < 100; round++) {
+        file_read_page(table_id, leaf, &page);
+        if (NodeView(&page).page_lsn() == lsn) break;
+        usleep(CLEANER_INTERVAL_MS * 1000);
+    }
+
+    // The leaf on disk has the update, and the log holds its record
+    ASSERT_EQ(NodeView(&page).page_lsn(), lsn);
+    vector<log_header_t> headers = ReadLogHeaders(LOG_FILE_PATH);
+    ASSERT_FALSE(headers.empty());
+    EXPECT_GE(headers.back().lsn, lsn);
+
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    EXPECT_EQ(shutdown_db(), 0);
+}
+
+// 8. Rollback
+/*
+ * Rollback writes the undo image back to the record and logs the same image as the redo image of the compensation
+ * (the images are of the slot followed by the value, so the compensation follows the slot the record moved to)
+ */
+TEST(LogTest, RollbackCompensatesWithUndoImage)
+{
+    int64_t table_id;
+    int trx_id;
+    uint16_t old_val_size, val_size, offset, length;
+    int64_t key;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    string value(VALUE_MIN_SIZE, 'a'), new_value(VALUE_MIN_SIZE, 'b'), other(VALUE_MIN_SIZE, 'c');
+    string update_body, compensate_body;
+
+    remove(LOG_FILE_PATH.c_str());
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    remove(RECOVERY_TABLE_PATH.c_str());
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    ASSERT_EQ(db_insert(table_id, 1, const_cast<char*>(value.c_str()), value.size()), 0);
+    ASSERT_EQ(db_insert(table_id, 3, const_cast<char*>(value.c_str()), value.size()), 0);
+
+    // Update a record, and move its slot by inserting a smaller key before the rollback
+    trx_id = trx_begin();
+    ASSERT_EQ(db_update(table_id, 3, const_cast<char*>(new_value.c_str()), new_value.size(), &old_val_size, trx_id), 0);
+    ASSERT_EQ(db_insert(table_id, 2, const_cast<char*>(other.c_str()), other.size()), 0);
+    EXPECT_EQ(trx_abort(trx_id), 0);
+
+    // The records hold their values (the commit flushes the log too)
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find(table_id, 3, ret_val, &val_size, trx_id), 0);
+    EXPECT_EQ(string(ret_val, val_size), value);
+    ASSERT_EQ(db_find(table_id, 2, ret_val, &val_size, trx_id), 0);
+    EXPECT_EQ(string(ret_val, val_size), other);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // The compensation is on the page of the update at the slot the record moved to, and redoes its old image
+    vector<log_header_t> headers = ReadLogHeaders(LOG_FILE_PATH);
+    CheckLogChain(headers);
+    for (const log_header_t& header : headers) {
+        if (header.log_type == LOG::UPDATE) update_body = ReadLogBody(LOG_FILE_PATH, header);
+        if (header.log_type == LOG::COMPENSATE) compensate_body = ReadLogBody(LOG_FILE_PATH, header);
+    }
+    length = SLOT_SIZE + VALUE_MIN_SIZE;
+    ASSERT_EQ(update_body.size(), 21 + 2 * length);
+    ASSERT_EQ(compensate_body.size(), 21 + 2 * length + sizeof(int64_t));
+    EXPECT_EQ(compensate_body.substr(0, 16), update_body.substr(0, 16));
+    memcpy(&offset, compensate_body.data() + 16, sizeof(uint16_t));
+    EXPECT_EQ(offset, HEADER_SIZE + 2 * SLOT_SIZE);
+    memcpy(&length, compensate_body.data() + 18, sizeof(uint16_t));
+    EXPECT_EQ(length, SLOT_SIZE + VALUE_MIN_SIZE);
+    EXPECT_EQ((uint8_t)update_body[20], IMAGE::RECORD);
+    EXPECT_EQ((uint8_t)compensate_body[20], IMAGE::RECORD);
+    memcpy(&key, compensate_body.data() + 21 + length, sizeof(int64_t));
+    EXPECT_EQ(key, 3);
+    EXPECT_EQ(compensate_body.substr(21 + SLOT_SIZE, VALUE_MIN_SIZE), new_value);
+    EXPECT_EQ(compensate_body.substr(21 + length + SLOT_SIZE, VALUE_MIN_SIZE), update_body.substr(21 + SLOT_SIZE, VALUE_MIN_SIZE));
+    EXPECT_EQ(update_body.substr(21 + SLOT_SIZE, VALUE_MIN_SIZE), value);
+
+    EXPECT_EQ(shutdown_db(), 0);
+}
+
+// 9. Variable-length update
+/*
+ * Updates changing the size of values are redone and undone through the record images,
+ * with the compaction of a full leaf logged as a compensation never undone
+ */
+TEST(LogTest, RecoverVariableLengthUpdates)
+{
+    const int NUM_KEYS = 50, NUM_WINNER_KEYS = 10, NUM_LOSER_KEYS = 4;
+    int64_t table_id;
+    int trx_id;
+    uint16_t old_val_size, val_size;
+    char ret_val[VALUE_MAX_SIZE + 1];
+    string large(VALUE_MAX_SIZE, 'e');
+
+    remove(LOG_FILE_PATH.c_str());
+    remove(RECOVERY_TABLE_PATH.c_str());
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        string value(VALUE_MIN_SIZE, 'a'), winner_value(VALUE_MAX_SIZE, 'b'), loser_value(VALUE_MAX_SIZE, 'c'), shrunk(VALUE_MIN_SIZE, 'd');
+        int winner, loser, shrinker;
+
+        // Load a leaf with little contiguous space left
+        if (init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str()))) _exit(1);
+        table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+        for (int64_t key = 1; key <= NUM_KEYS; key++) {
+            if (db_insert(table_id, key, const_cast<char*>(value.c_str()), value.size())) _exit(1);
+        }
+        shutdown_db();
+
+        // Grow the values until the leaf is full, and shrink some of the committed ones
+        if (init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str()))) _exit(1);
+        table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+        winner = trx_begin();
+        for (int64_t key = 1; key <= NUM_WINNER_KEYS; key++) {
+            if (db_update(table_id, key, const_cast<char*>(winner_value.c_str()), winner_value.size(), &old_val_size, winner)) _exit(1);
+        }
+        if (trx_commit(winner) != winner) _exit(1);
+        loser = trx_begin();
+        for (int64_t key = NUM_WINNER_KEYS + 1; key <= NUM_WINNER_KEYS + NUM_LOSER_KEYS; key++) {
+            if (db_update(table_id, key, const_cast<char*>(loser_value.c_str()), loser_value.size(), &old_val_size, loser)) _exit(1);
+        }
+        shrinker = trx_begin();
+        for (int64_t key = 1; key <= 3; key++) {
+            if (db_update(table_id, key, const_cast<char*>(shrunk.c_str()), shrunk.size(), &old_val_size, shrinker)) _exit(1);
+        }
+
+        // Crash after the log is durable
+        LOG::force();
+        _exit(0);
+    }
+
+    int status;
+    ASSERT_GT(pid, 0);
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+    EXPECT_GT(CountLogRecords(LOG_FILE_PATH, LOG::COMPENSATE), 0);
+
+    // The compaction is logged as a raw image of the whole body, and the updates as record images
+    for (const log_header_t& header : ReadLogHeaders(LOG_FILE_PATH)) {
+        if (header.log_type != LOG::UPDATE && header.log_type != LOG::COMPENSATE) continue;
+        string body = ReadLogBody(LOG_FILE_PATH, header);
+        uint16_t length;
+        memcpy(&length, body.data() + 18, sizeof(uint16_t));
+        EXPECT_EQ((uint8_t)body[20], length == BODY_SIZE ? IMAGE::RAW : IMAGE::RECORD) << "lsn: " << header.lsn;
+    }
+
+    // Only the values of the winner are grown
+    ASSERT_EQ(init_db(16, 0, 0, const_cast<char*>(LOG_FILE_PATH.c_str()), const_cast<char*>(LOGMSG_FILE_PATH.c_str())), 0);
+    table_id = open_table(const_cast<char*>(RECOVERY_TABLE_PATH.c_str()));
+    ASSERT_EQ(table_id, 1);
+    for (int64_t key = 1; key <= NUM_KEYS; key++) {
+        ASSERT_EQ(db_find(table_id, key, ret_val, &val_size), 0);
+        EXPECT_EQ(string(ret_val, val_size), key <= NUM_WINNER_KEYS ? string(VALUE_MAX_SIZE, 'b') : string(VALUE_MIN_SIZE, 'a')) << "key: " << key;
+    }
+
+    // A value grown in the recovered leaf is rolled back to its old size
+    trx_id = trx_begin();
+    ASSERT_EQ(db_update(table_id, NUM_KEYS, const_cast<char*>(large.c_str()), large.size(), &old_val_size, trx_id), 0);
+    EXPECT_EQ(old_val_size, VALUE_MIN_SIZE);
+    EXPECT_EQ(trx_abort(trx_id), 0);
+    ASSERT_EQ(db_find(table_id, NUM_KEYS, ret_val, &val_size), 0);
+    EXPECT_EQ(string(ret_val, val_size), string(VALUE_MIN_SIZE, 'a'));
+    {
+        PageHandle page = BUF::fix_page(table_id, BPT::find_leaf(table_id, BPT::get_root_page(table_id), 1), true, true);
+        EXPECT_TRUE(BPT::is_valid_node_page(*page.read()));
+        EXPECT_EQ(NodeView(page.read()).amount_of_free_space(), BODY_SIZE - NUM_KEYS * (SLOT_SIZE + VALUE_MIN_SIZE) - NUM_WINNER_KEYS * (VALUE_MAX_SIZE - VALUE_MIN_SIZE));
+    }
+
+    EXPECT_EQ(shutdown_db(), 0);
+}
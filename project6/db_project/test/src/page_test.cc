@@ -1,5 +1,6 @@
 #include "page.h"
 #include "file.h"
+#include "bpt.h"
 #include "debug_util.h"
 #include "test_util.h"
 #include <gtest/gtest.h>
@@ -298,4 +299,119 @@ TEST_F(PageTest, LeafPageOtherTable)
 
     EXPECT_TRUE(pageSrc == pageDest);
     EXPECT_TRUE(pageSrc == pageMid);
-}
\ No newline at end of file
+}
+// Page View
+TEST_F(PageTest, InternalPageView)
+{
+    NodePage pageSrc;
+    page_t pageBuf;
+
+    TestUtil::FillInternalPage(pageSrc);
+    pageBuf = pageSrc;
+
+    InternalView view(&pageBuf);
+    EXPECT_FALSE(view.is_leaf());
+    EXPECT_EQ(view.number_of_keys(), pageSrc.header.number_of_keys);
+    EXPECT_EQ(view.parent_page_number(), pageSrc.header.parent_page_number);
+    EXPECT_EQ(view.first_child_page_number(), pageSrc.header.first_child_page_number);
+    EXPECT_EQ(view.child(-1), pageSrc.header.first_child_page_number);
+    for (int idx = 0; idx < (int)pageSrc.edges.size(); idx++) {
+        EXPECT_EQ(view.key(idx), pageSrc.edges[idx].key);
+        EXPECT_EQ(view.child(idx), pageSrc.edges[idx].page_number);
+        EXPECT_EQ(view.find_index(pageSrc.edges[idx].key), idx);
+        EXPECT_EQ(view.find_child(pageSrc.edges[idx].key), pageSrc.edges[idx].page_number);
+    }
+    if (!pageSrc.edges.empty()) {
+        EXPECT_EQ(view.find_index(pageSrc.edges.front().key - 1), -1);
+    }
+
+    view.set_parent_page_number(pageSrc.header.parent_page_number + 1);
+    EXPECT_EQ(NodePage(pageBuf).header.parent_page_number, pageSrc.header.parent_page_number + 1);
+}
+
+TEST_F(PageTest, LeafPageView)
+{
+    NodePage pageSrc;
+    page_t pageBuf;
+    std::string value;
+
+    TestUtil::FillLeafPage(pageSrc);
+    pageBuf = pageSrc;
+
+    LeafView view(&pageBuf);
+    EXPECT_TRUE(view.is_leaf());
+    EXPECT_EQ(view.number_of_keys(), pageSrc.header.number_of_keys);
+    EXPECT_EQ(view.amount_of_free_space(), pageSrc.header.amount_of_free_space);
+    EXPECT_EQ(view.right_sibling_page_number(), pageSrc.header.right_sibling_page_number);
+    for (int idx = 0; idx < (int)pageSrc.slots.size(); idx++) {
+        EXPECT_EQ(view.key(idx), pageSrc.slots[idx].key);
+        EXPECT_EQ(view.size(idx), pageSrc.slots[idx].size);
+        EXPECT_EQ(view.offset(idx), pageSrc.slots[idx].offset);
+        EXPECT_EQ(view.trx_id(idx), pageSrc.slots[idx].trx_id);
+        EXPECT_EQ(view.find_record(pageSrc.slots[idx].key), idx);
+        value.assign(view.value(idx), view.size(idx));
+        EXPECT_EQ(value, pageSrc.slots[idx].value);
+    }
+    if (!pageSrc.slots.empty()) {
+        EXPECT_EQ(view.find_record(pageSrc.slots.front().key - 1), -1);
+
+        // update the first record in place
+        value = std::string(view.size(0), TEST_VALUE);
+        view.set_value(0, value.c_str(), value.size());
+        view.set_trx_id(0, 7);
+        EXPECT_EQ(NodePage(pageBuf).slots[0].value, value);
+        EXPECT_EQ(NodePage(pageBuf).slots[0].trx_id, 7);
+    }
+}
+
+TEST_F(PageTest, LeafPageFreeSpace)
+{
+    NodePage pageSrc;
+    page_t pageBuf;
+    std::string small(VALUE_MIN_SIZE, TEST_VALUE), large(VALUE_MAX_SIZE, TEST_VALUE + 1);
+    uint16_t top, offset;
+    uint64_t free_space;
+    int64_t key;
+
+    pageBuf = pageSrc;
+    LeafView view(&pageBuf);
+
+    // fill the leaf in descending key order (every insertion shifts the slots)
+    for (key = 100; view.amount_of_free_space() >= SLOT_SIZE + VALUE_MIN_SIZE; key--) {
+        ASSERT_TRUE(view.insert(0, key, small.c_str(), small.size()));
+    }
+    EXPECT_FALSE(view.insert(0, key, small.c_str(), small.size()));
+    EXPECT_EQ(view.contiguous_free_space(), view.amount_of_free_space());
+    EXPECT_TRUE(BPT::is_valid_node_page(pageBuf));
+
+    // a removed record leaves its value as a hole counted in the free space
+    top = view.heap_top();
+    free_space = view.amount_of_free_space();
+    view.remove(1);
+    EXPECT_EQ(view.heap_top(), top);
+    EXPECT_EQ(view.amount_of_free_space(), free_space + SLOT_SIZE + VALUE_MIN_SIZE);
+    EXPECT_LT(view.contiguous_free_space(), view.amount_of_free_space());
+    EXPECT_TRUE(BPT::is_valid_node_page(pageBuf));
+
+    // a larger value fits only in the hole, so the values are compacted with it at the heap top
+    ASSERT_TRUE(view.needs_compaction(2, large.size()));
+    EXPECT_TRUE(view.resize(2, large.c_str(), large.size()));
+    EXPECT_EQ(view.offset(2), view.heap_top());
+    EXPECT_EQ(view.amount_of_free_space(), free_space + SLOT_SIZE + VALUE_MIN_SIZE - (VALUE_MAX_SIZE - VALUE_MIN_SIZE));
+    EXPECT_TRUE(BPT::is_valid_node_page(pageBuf));
+
+    // a smaller value stays in place
+    offset = view.offset(2);
+    EXPECT_TRUE(view.resize(2, small.c_str(), small.size()));
+    EXPECT_EQ(view.offset(2), offset);
+    EXPECT_EQ(view.amount_of_free_space(), free_space + SLOT_SIZE + VALUE_MIN_SIZE);
+
+    // the removed key is inserted again in the holes left
+    EXPECT_TRUE(view.insert(1, key + 2, small.c_str(), small.size()));
+    EXPECT_EQ(view.amount_of_free_space(), free_space);
+    EXPECT_TRUE(BPT::is_valid_node_page(pageBuf));
+    for (int idx = 0; idx < (int)view.number_of_keys(); idx++) {
+        EXPECT_EQ(view.key(idx), key + 1 + idx);
+        EXPECT_EQ(std::string(view.value(idx), view.size(idx)), small);
+    }
+}
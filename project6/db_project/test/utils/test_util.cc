@@ -115,20 +115,14 @@ namespace TestUtil
     {
         if (page_num <= 0) return false;
 
-        bool flag = false;
-        HeaderPage page_buffer;
+        HeaderPage header;
+        page_t allocation_page;
         int table_file = opened_tables.getFileDesc(table_id);
 
-        pread(table_file, &page_buffer, PAGE_SIZE, 0);
-        for (int current_page = page_buffer.next_free_page_number; current_page > 0; current_page = page_buffer.next_free_page_number) {
-            if (current_page == page_num) {
-                flag = true;
-                break;
-            }
-            pread(table_file, &page_buffer, PAGE_SIZE, PAGE_SIZE * current_page);
-        }
-
-        return flag;
+        pread(table_file, &header, PAGE_SIZE, 0);
+        if (page_num >= header.num_of_pages) return false;
+        pread(table_file, &allocation_page, PAGE_SIZE, PAGE_SIZE * AllocationView::allocation_page_number(AllocationView::group_of(page_num)));
+        return !AllocationView(&allocation_page).is_allocated(page_num % PAGES_PER_GROUP);
     }
 
     bool IsValidOpenedFile(int64_t table_id)